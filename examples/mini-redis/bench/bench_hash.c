@@ -0,0 +1,96 @@
+/* Compare the table hash against the FNV-1a it replaced, on key shapes
+   the server sees: short prefixed IDs plus one longer key class.
+
+   make bench_hash && ./build/bench_hash [iterations] */
+#include "hash.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define NKEYS 4096
+#define BUCKET_BITS 12
+
+static uint32_t fnv1a_hash(const char *data, size_t len) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= (uint8_t)data[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static uint64_t fnv1a_wrap(const void *data, size_t len, uint64_t seed) {
+    (void)seed;
+    return fnv1a_hash(data, len);
+}
+
+typedef uint64_t (*hash_fn)(const void *, size_t, uint64_t);
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static char keys[NKEYS][64];
+static size_t key_lens[NKEYS];
+
+static void make_keys(const char *fmt, long base) {
+    for (int i = 0; i < NKEYS; i++) {
+        key_lens[i] = (size_t)snprintf(keys[i], sizeof(keys[i]), fmt,
+                                       base + i);
+    }
+}
+
+/* Fullest bucket when NKEYS keys are spread over 2^BUCKET_BITS buckets
+   by the bits the table uses for group selection (hash >> 7). */
+static int worst_bucket(hash_fn fn) {
+    static int buckets[1 << BUCKET_BITS];
+    int worst = 0;
+    memset(buckets, 0, sizeof(buckets));
+    for (int i = 0; i < NKEYS; i++) {
+        uint64_t h = fn(keys[i], key_lens[i], 42) >> 7;
+        int b = ++buckets[h & ((1 << BUCKET_BITS) - 1)];
+        if (b > worst) {
+            worst = b;
+        }
+    }
+    return worst;
+}
+
+static void run(const char *name, hash_fn fn, long iters) {
+    volatile uint64_t sink = 0;
+    double start = now_sec();
+    for (long n = 0; n < iters; n++) {
+        for (int i = 0; i < NKEYS; i++) {
+            sink += fn(keys[i], key_lens[i], 42);
+        }
+    }
+    double elapsed = now_sec() - start;
+    printf("  %-8s %6.2f ns/key   worst bucket %d\n", name,
+           elapsed * 1e9 / ((double)iters * NKEYS), worst_bucket(fn));
+    (void)sink;
+}
+
+int main(int argc, char **argv) {
+    long iters = argc > 1 ? atol(argv[1]) : 2000;
+    static const struct {
+        const char *fmt;
+        long base;
+    } shapes[] = {
+        {"key:%ld", 0},
+        {"user:%ld", 1000000},
+        {"session:%08lx", 0x1f000000},
+        {"tenant:42:order:%ld:line-items", 7000000},
+    };
+
+    for (size_t s = 0; s < sizeof(shapes) / sizeof(shapes[0]); s++) {
+        make_keys(shapes[s].fmt, shapes[s].base);
+        printf("%s (e.g. \"%s\", %zu bytes)\n", shapes[s].fmt, keys[0],
+               key_lens[0]);
+        run("fnv1a", fnv1a_wrap, iters);
+        run("hash", hash_bytes, iters);
+    }
+    return 0;
+}
@@ -0,0 +1,273 @@
+/* Micro-benchmarks of the server's hot paths: the hash table, the RESP
+   parser and writers, and glob matching. One CSV line per benchmark,
+   so runs can be diffed between releases.
+
+   make bench && ./build/bench_micro [scale] [filter]
+
+   scale multiplies every iteration count (default 1); filter runs only
+   the benchmarks whose name contains it. */
+#include "client.h"
+#include "glob.h"
+#include "hashtable.h"
+#include "resp.h"
+#include "rstr.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define NKEYS 100000
+
+static char keys[NKEYS][24];
+static size_t key_lens[NKEYS];
+static char misses[NKEYS][24];
+static size_t miss_lens[NKEYS];
+static volatile uint64_t sink;
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static rstr_t key(int i) {
+    rstr_t r = {keys[i], key_lens[i]};
+    return r;
+}
+
+static rstr_t miss(int i) {
+    rstr_t r = {misses[i], miss_lens[i]};
+    return r;
+}
+
+static void report(const char *name, long ops, double elapsed) {
+    printf("%s,%ld,%.2f,%.0f\n", name, ops, elapsed * 1e9 / (double)ops,
+           (double)ops / elapsed);
+}
+
+/* ---- hash table ---- */
+
+static long bench_ht_set(long scale) {
+    long ops = 0;
+    for (long r = 0; r < 5 * scale; r++) {
+        hashtable_t *ht = ht_create();
+        rstr_t value = {"value", 5};
+        for (int i = 0; i < NKEYS; i++) {
+            ht_set(ht, key(i), value);
+        }
+        ops += NKEYS;
+        ht_destroy(ht);
+    }
+    return ops;
+}
+
+/* Every lookup below runs against the same filled table. */
+static hashtable_t *filled;
+
+static void fill(void) {
+    if (filled) {
+        return;
+    }
+    filled = ht_create();
+    rstr_t value = {"value", 5};
+    for (int i = 0; i < NKEYS; i++) {
+        ht_set(filled, key(i), value);
+    }
+}
+
+static long bench_ht_get_hit(long scale) {
+    fill();
+    rstr_t v;
+    for (long r = 0; r < 20 * scale; r++) {
+        for (int i = 0; i < NKEYS; i++) {
+            sink += ht_get(filled, key(i), &v);
+        }
+    }
+    return 20 * scale * NKEYS;
+}
+
+/* A miss probes until a group with an empty slot: the longest path. */
+static long bench_ht_probe_miss(long scale) {
+    fill();
+    for (long r = 0; r < 20 * scale; r++) {
+        for (int i = 0; i < NKEYS; i++) {
+            sink += ht_find(filled, miss(i)) != NULL;
+        }
+    }
+    return 20 * scale * NKEYS;
+}
+
+/* ---- RESP ---- */
+
+#define PIPELINE 64
+
+static long bench_resp_parse(long scale) {
+    static const char cmd[] =
+        "*3\r\n$3\r\nSET\r\n$10\r\nkey:000042\r\n$16\r\nvalue-0123456789\r\n";
+    long iters = 1000000 * scale;
+    for (long i = 0; i < iters; i++) {
+        resp_value_t v;
+        sink += (uint64_t)resp_parse(cmd, sizeof(cmd) - 1, &v);
+        resp_value_free(&v);
+    }
+    return iters;
+}
+
+/* The server's path: PIPELINE commands parsed in place from read_buf. */
+static long bench_resp_parse_client(long scale) {
+    char buf[PIPELINE * 64];
+    size_t len = 0;
+    for (int i = 0; i < PIPELINE; i++) {
+        len += (size_t)snprintf(buf + len, sizeof(buf) - len,
+                                "*3\r\n$3\r\nSET\r\n$10\r\nkey:%06d\r\n"
+                                "$16\r\nvalue-0123456789\r\n", i);
+    }
+    client_t c;
+    client_init(&c);
+    c.read_buf = malloc(len);
+    if (!c.read_buf) {
+        perror("malloc");
+        exit(1);
+    }
+    memcpy(c.read_buf, buf, len);
+    c.read_cap = len;
+    c.read_len = len;
+
+    long rounds = 20000 * scale;
+    for (long r = 0; r < rounds; r++) {
+        c.read_pos = 0;
+        resp_parser_reset(&c);
+        resp_value_t cmd;
+        while (resp_parse_client(&c, &cmd) == 1) {
+            sink += (uint64_t)cmd.array.count;
+            resp_command_release(&c, &cmd);
+        }
+    }
+    client_close(&c);
+    return rounds * PIPELINE;
+}
+
+typedef void (*write_fn)(client_t *c, int i);
+
+static void write_bulk(client_t *c, int i) {
+    resp_write_bulk_string(c, keys[i], key_lens[i]);
+}
+
+static void write_integer(client_t *c, int i) {
+    resp_write_integer(c, (int64_t)i * 7919);
+}
+
+static void write_array_header(client_t *c, int i) {
+    resp_write_array_header(c, i & 1023);
+}
+
+static void write_shared(client_t *c, int i) {
+    resp_write_shared(c, (resp_shared_t)(i % RESP_SHARED_COUNT));
+}
+
+/* A reply's worth of writes, then the queue is dropped every 1024. */
+static long run_writes(long scale, write_fn fn) {
+    long iters = 2000000 * scale;
+    client_t c;
+    client_init(&c);
+    for (long i = 0; i < iters; i++) {
+        fn(&c, (int)(i % NKEYS));
+        if ((i & 1023) == 1023) {
+            client_close(&c);
+            client_init(&c);
+        }
+    }
+    client_close(&c);
+    return iters;
+}
+
+static long bench_resp_write_bulk(long scale) {
+    return run_writes(scale, write_bulk);
+}
+
+static long bench_resp_write_integer(long scale) {
+    return run_writes(scale, write_integer);
+}
+
+static long bench_resp_write_array_header(long scale) {
+    return run_writes(scale, write_array_header);
+}
+
+static long bench_resp_write_shared(long scale) {
+    return run_writes(scale, write_shared);
+}
+
+/* ---- glob ---- */
+
+static const char glob_pattern[] = "key:*5?";
+
+static long bench_glob_match(long scale) {
+    size_t plen = strlen(glob_pattern);
+    for (long r = 0; r < 10 * scale; r++) {
+        for (int i = 0; i < NKEYS; i++) {
+            sink += glob_match(glob_pattern, plen, keys[i],
+                               key_lens[i]);
+        }
+    }
+    return 10 * scale * NKEYS;
+}
+
+static long bench_glob_compiled(long scale) {
+    arena_t arena;
+    arena_init(&arena);
+    glob_pattern_t g;
+    glob_compile(&g, glob_pattern, strlen(glob_pattern), &arena);
+    for (long r = 0; r < 10 * scale; r++) {
+        for (int i = 0; i < NKEYS; i++) {
+            sink += glob_pattern_match(&g, keys[i], key_lens[i]);
+        }
+    }
+    arena_free(&arena);
+    return 10 * scale * NKEYS;
+}
+
+static const struct {
+    const char *name;
+    long (*fn)(long scale);
+} benches[] = {
+    {"ht_set", bench_ht_set},
+    {"ht_get_hit", bench_ht_get_hit},
+    {"ht_probe_miss", bench_ht_probe_miss},
+    {"resp_parse", bench_resp_parse},
+    {"resp_parse_client", bench_resp_parse_client},
+    {"resp_write_bulk_string", bench_resp_write_bulk},
+    {"resp_write_integer", bench_resp_write_integer},
+    {"resp_write_array_header", bench_resp_write_array_header},
+    {"resp_write_shared", bench_resp_write_shared},
+    {"glob_match", bench_glob_match},
+    {"glob_pattern_match", bench_glob_compiled},
+};
+
+int main(int argc, char **argv) {
+    long scale = argc > 1 ? atol(argv[1]) : 1;
+    const char *filter = argc > 2 ? argv[2] : NULL;
+    if (scale < 1) {
+        fprintf(stderr, "usage: %s [scale] [filter]\n", argv[0]);
+        return 1;
+    }
+    for (int i = 0; i < NKEYS; i++) {
+        key_lens[i] = (size_t)snprintf(keys[i], sizeof(keys[i]),
+                                       "key:%d", i);
+        miss_lens[i] = (size_t)snprintf(misses[i], sizeof(misses[i]),
+                                        "absent:%d", i);
+    }
+
+    printf("benchmark,ops,ns_per_op,ops_per_sec\n");
+    for (size_t b = 0; b < sizeof(benches) / sizeof(benches[0]); b++) {
+        if (filter && !strstr(benches[b].name, filter)) {
+            continue;
+        }
+        double start = now_sec();
+        long ops = benches[b].fn(scale);
+        report(benches[b].name, ops, now_sec() - start);
+    }
+    if (filled) {
+        ht_destroy(filled);
+    }
+    return 0;
+}
@@ -0,0 +1,753 @@
+/* mini-redis-benchmark: a load generator for a running server.
+
+   Connections send pipelines of commands picked from a weighted mix, on
+   keys drawn uniformly or from a Zipf distribution, and wait for every
+   reply before sending the next pipeline. Each command's latency is the
+   time from its pipeline being sent to its reply being read, the way
+   redis-benchmark counts it.
+
+   ./mini-redis-benchmark [--host H] [--port P] [--socket PATH] [--clients N]
+       [--requests N] [--pipeline N] [--threads N] [--mix get:80,set:20]
+       [--keyspace N] [--distribution uniform|zipf] [--zipf-s S]
+       [--value-size N] [--populate] [--seed N] [--csv] */
+#include <errno.h>
+#include <inttypes.h>
+#include <math.h>
+#include <netdb.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#define MAX_THREADS 64
+#define READ_CHUNK (64 * 1024)
+
+/* Latencies go in log-linear nanosecond buckets: one per power of two,
+   split into 16 steps, so a percentile is within 1/16 of the truth. */
+#define HIST_SUB_BITS 4
+#define HIST_BUCKETS (64 << HIST_SUB_BITS)
+
+typedef enum {
+    OP_PING,
+    OP_GET,
+    OP_SET,
+    OP_INCR,
+    OP_DEL,
+    OP_COUNT
+} op_t;
+
+static const char *const op_names[OP_COUNT] = {
+    "ping", "get", "set", "incr", "del"
+};
+
+typedef struct {
+    const char *host;
+    const char *port;
+    const char *socket_path;    /* --socket: a Unix domain socket instead */
+    int clients;
+    long requests;
+    int pipeline;
+    int threads;
+    unsigned weights[OP_COUNT];
+    unsigned weight_total;
+    long keyspace;
+    bool zipf;
+    double zipf_s;
+    size_t value_size;
+    bool populate;
+    uint64_t seed;
+    bool csv;
+} config_t;
+
+static config_t cfg = {
+    .host = "127.0.0.1",
+    .port = "6379",
+    .clients = 50,
+    .requests = 100000,
+    .pipeline = 1,
+    .threads = 1,
+    .weights = {[OP_GET] = 1, [OP_SET] = 1},
+    .weight_total = 2,
+    .keyspace = 100000,
+    .zipf_s = 0.99,
+    .value_size = 3,
+    .seed = 1,
+};
+
+static char *value;
+static double *zipf_cdf;                /* keyspace entries, last is 1 */
+static atomic_long issued;              /* commands handed out so far */
+
+typedef struct {
+    int fd;
+    char *out;
+    size_t out_len, out_sent;
+    char *in;
+    size_t in_len, in_cap;
+    int pending;                        /* replies still expected */
+    uint64_t sent_ns;                   /* when the pipeline went out */
+} conn_t;
+
+typedef struct {
+    int nconns;
+    conn_t *conns;
+    uint64_t rng;
+    uint64_t hist[HIST_BUCKETS];
+    uint64_t done, errors, max_ns, sum_ns;
+    pthread_t thread;
+} worker_t;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+static void *xmalloc(size_t size) {
+    void *p = malloc(size);
+    if (!p) {
+        perror("malloc");
+        exit(1);
+    }
+    return p;
+}
+
+/* xorshift64* */
+static uint64_t next_random(uint64_t *state) {
+    uint64_t x = *state;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *state = x;
+    return x * 0x2545f4914f6cdd1dULL;
+}
+
+static double random_unit(uint64_t *state) {
+    return (double)(next_random(state) >> 11) / (double)(1ULL << 53);
+}
+
+static void zipf_init(void) {
+    zipf_cdf = xmalloc((size_t)cfg.keyspace * sizeof(double));
+    double sum = 0;
+    for (long i = 0; i < cfg.keyspace; i++) {
+        sum += 1.0 / pow((double)(i + 1), cfg.zipf_s);
+        zipf_cdf[i] = sum;
+    }
+    for (long i = 0; i < cfg.keyspace; i++) {
+        zipf_cdf[i] /= sum;
+    }
+}
+
+static long pick_key(uint64_t *rng) {
+    if (!cfg.zipf) {
+        return (long)(next_random(rng) % (uint64_t)cfg.keyspace);
+    }
+    /* the first rank whose cumulative share reaches u */
+    double u = random_unit(rng);
+    long lo = 0, hi = cfg.keyspace - 1;
+    while (lo < hi) {
+        long mid = lo + (hi - lo) / 2;
+        if (zipf_cdf[mid] < u) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+static op_t pick_op(uint64_t *rng) {
+    unsigned r = (unsigned)(next_random(rng) % cfg.weight_total);
+    for (int op = 0; op < OP_COUNT; op++) {
+        if (r < cfg.weights[op]) {
+            return (op_t)op;
+        }
+        r -= cfg.weights[op];
+    }
+    return OP_GET;
+}
+
+/* ---- requests ---- */
+
+static void out_reserve(conn_t *c, size_t more, size_t *cap) {
+    if (c->out_len + more <= *cap) {
+        return;
+    }
+    while (*cap < c->out_len + more) {
+        *cap *= 2;
+    }
+    char *grown = realloc(c->out, *cap);
+    if (!grown) {
+        perror("realloc");
+        exit(1);
+    }
+    c->out = grown;
+}
+
+static void append_command(conn_t *c, size_t *cap, op_t op, long k) {
+    /* INCR gets keys of its own, so that they hold counters */
+    char key[32];
+    int klen = snprintf(key, sizeof(key), "%s:%ld",
+                        op == OP_INCR ? "counter" : "key", k);
+    out_reserve(c, 96 + cfg.value_size, cap);
+    char *p = c->out + c->out_len;
+    switch (op) {
+    case OP_PING:
+        p += sprintf(p, "*1\r\n$4\r\nPING\r\n");
+        break;
+    case OP_SET:
+        p += sprintf(p, "*3\r\n$3\r\nSET\r\n$%d\r\n%s\r\n$%zu\r\n", klen,
+                     key, cfg.value_size);
+        memcpy(p, value, cfg.value_size);
+        p += cfg.value_size;
+        *p++ = '\r';
+        *p++ = '\n';
+        break;
+    default:
+        p += sprintf(p, "*2\r\n$%zu\r\n%s\r\n$%d\r\n%s\r\n",
+                     strlen(op_names[op]), op_names[op], klen, key);
+        break;
+    }
+    c->out_len = (size_t)(p - c->out);
+}
+
+/* Build the next pipeline; false once every request is handed out. */
+static bool refill(worker_t *w, conn_t *c, size_t *cap) {
+    long n = atomic_fetch_add(&issued, cfg.pipeline);
+    if (n >= cfg.requests) {
+        return false;
+    }
+    long count = cfg.requests - n < cfg.pipeline ? cfg.requests - n :
+                 cfg.pipeline;
+    c->out_len = 0;
+    c->out_sent = 0;
+    for (long i = 0; i < count; i++) {
+        append_command(c, cap, pick_op(&w->rng), pick_key(&w->rng));
+    }
+    c->pending = (int)count;
+    c->sent_ns = now_ns();
+    return true;
+}
+
+/* ---- replies ---- */
+
+/* Length of the complete reply at the start of buf, 0 if it isn't all
+   there yet, -1 for bytes that aren't RESP. */
+static long reply_len(const char *buf, size_t len, bool *error) {
+    if (len < 3) {
+        return 0;
+    }
+    const char *nl = memchr(buf, '\n', len);
+    if (!nl) {
+        return 0;
+    }
+    long line = (long)(nl - buf) + 1;
+    switch (buf[0]) {
+    case '-':
+        *error = true;
+        return line;
+    case '+':
+    case ':':
+        return line;
+    case '$': {
+        long n = atol(buf + 1);
+        if (n < 0) {
+            return line;
+        }
+        return (size_t)(line + n + 2) <= len ? line + n + 2 : 0;
+    }
+    case '*': {
+        long n = atol(buf + 1);
+        long at = line;
+        for (long i = 0; i < n; i++) {
+            bool ignored = false;
+            long sub = reply_len(buf + at, len - (size_t)at, &ignored);
+            if (sub <= 0) {
+                return sub;
+            }
+            at += sub;
+        }
+        return at;
+    }
+    default:
+        return -1;
+    }
+}
+
+static void record(worker_t *w, uint64_t ns) {
+    int bucket;
+    if (ns < (1u << HIST_SUB_BITS)) {
+        bucket = (int)ns;
+    } else {
+        int bit = 63 - __builtin_clzll(ns);
+        int step = (int)(ns >> (bit - HIST_SUB_BITS)) &
+                   ((1 << HIST_SUB_BITS) - 1);
+        bucket = ((bit - HIST_SUB_BITS + 1) << HIST_SUB_BITS) + step;
+    }
+    w->hist[bucket]++;
+    w->sum_ns += ns;
+    if (ns > w->max_ns) {
+        w->max_ns = ns;
+    }
+}
+
+static uint64_t bucket_max(int bucket) {
+    if (bucket < (1 << HIST_SUB_BITS)) {
+        return (uint64_t)bucket;
+    }
+    int bit = (bucket >> HIST_SUB_BITS) + HIST_SUB_BITS - 1;
+    uint64_t step = (uint64_t)(bucket & ((1 << HIST_SUB_BITS) - 1));
+    uint64_t width = 1ULL << (bit - HIST_SUB_BITS);
+    return (1ULL << bit) + (step + 1) * width - 1;
+}
+
+/* Consume the replies that have arrived; -1 on a protocol error. */
+static int take_replies(worker_t *w, conn_t *c) {
+    size_t at = 0;
+    uint64_t now = now_ns();
+    while (c->pending > 0) {
+        bool error = false;
+        long n = reply_len(c->in + at, c->in_len - at, &error);
+        if (n < 0) {
+            return -1;
+        }
+        if (n == 0) {
+            break;
+        }
+        at += (size_t)n;
+        c->pending--;
+        w->done++;
+        w->errors += error;
+        record(w, now - c->sent_ns);
+    }
+    memmove(c->in, c->in + at, c->in_len - at);
+    c->in_len -= at;
+    return 0;
+}
+
+/* ---- connections ---- */
+
+static int connect_unix(void) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(cfg.socket_path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "Socket path too long: %s\n", cfg.socket_path);
+        exit(1);
+    }
+    strcpy(addr.sun_path, cfg.socket_path);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        fprintf(stderr, "Can't connect to %s: %s\n", cfg.socket_path,
+                strerror(errno));
+        exit(1);
+    }
+    return fd;
+}
+
+static int connect_server(void) {
+    if (cfg.socket_path) {
+        return connect_unix();
+    }
+    struct addrinfo hints, *res;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    int rc = getaddrinfo(cfg.host, cfg.port, &hints, &res);
+    if (rc != 0) {
+        fprintf(stderr, "%s: %s\n", cfg.host, gai_strerror(rc));
+        exit(1);
+    }
+    int fd = -1;
+    for (struct addrinfo *ai = res; ai; ai = ai->ai_next) {
+        fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (fd < 0) {
+            continue;
+        }
+        if (connect(fd, ai->ai_addr, ai->ai_addrlen) == 0) {
+            break;
+        }
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(res);
+    if (fd < 0) {
+        fprintf(stderr, "Can't connect to %s:%s: %s\n", cfg.host, cfg.port,
+                strerror(errno));
+        exit(1);
+    }
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    return fd;
+}
+
+static void *run_worker(void *arg) {
+    worker_t *w = arg;
+    struct pollfd *pfds = xmalloc((size_t)w->nconns * sizeof(*pfds));
+    size_t *caps = xmalloc((size_t)w->nconns * sizeof(size_t));
+    int active = 0;
+    for (int i = 0; i < w->nconns; i++) {
+        conn_t *c = &w->conns[i];
+        caps[i] = 4096;
+        c->out = xmalloc(caps[i]);
+        c->in_cap = READ_CHUNK;
+        c->in = xmalloc(c->in_cap);
+        active += refill(w, c, &caps[i]);
+    }
+
+    while (active > 0) {
+        for (int i = 0; i < w->nconns; i++) {
+            conn_t *c = &w->conns[i];
+            pfds[i].fd = c->pending > 0 ? c->fd : -1;
+            /* read while still sending: replies to a long pipeline
+               start before all of it is written */
+            pfds[i].events = POLLIN;
+            if (c->out_sent < c->out_len) {
+                pfds[i].events |= POLLOUT;
+            }
+            pfds[i].revents = 0;
+        }
+        if (poll(pfds, (nfds_t)w->nconns, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("poll");
+            exit(1);
+        }
+        for (int i = 0; i < w->nconns; i++) {
+            conn_t *c = &w->conns[i];
+            if (pfds[i].revents & POLLOUT) {
+                ssize_t n = send(c->fd, c->out + c->out_sent,
+                                 c->out_len - c->out_sent, MSG_NOSIGNAL);
+                if (n < 0 && errno != EAGAIN && errno != EINTR) {
+                    perror("send");
+                    exit(1);
+                }
+                c->out_sent += n > 0 ? (size_t)n : 0;
+            }
+            if (!(pfds[i].revents & (POLLIN | POLLHUP | POLLERR))) {
+                continue;
+            }
+            if (c->in_cap - c->in_len < READ_CHUNK / 2) {
+                c->in_cap *= 2;
+                char *grown = realloc(c->in, c->in_cap);
+                if (!grown) {
+                    perror("realloc");
+                    exit(1);
+                }
+                c->in = grown;
+            }
+            ssize_t n = recv(c->fd, c->in + c->in_len, c->in_cap - c->in_len,
+                             0);
+            if (n <= 0) {
+                if (n < 0 && (errno == EAGAIN || errno == EINTR)) {
+                    continue;
+                }
+                fprintf(stderr, "Connection lost\n");
+                exit(1);
+            }
+            c->in_len += (size_t)n;
+            if (take_replies(w, c) < 0) {
+                fprintf(stderr, "Unexpected reply from the server\n");
+                exit(1);
+            }
+            if (c->pending == 0 && !refill(w, c, &caps[i])) {
+                active--;
+            }
+        }
+    }
+    for (int i = 0; i < w->nconns; i++) {
+        free(w->conns[i].out);
+        free(w->conns[i].in);
+    }
+    free(pfds);
+    free(caps);
+    return NULL;
+}
+
+/* ---- setup ---- */
+
+static bool parse_mix(const char *spec) {
+    memset(cfg.weights, 0, sizeof(cfg.weights));
+    cfg.weight_total = 0;
+    char *copy = strdup(spec);
+    if (!copy) {
+        perror("strdup");
+        exit(1);
+    }
+    bool ok = true;
+    for (char *save = NULL, *tok = strtok_r(copy, ",", &save); tok && ok;
+         tok = strtok_r(NULL, ",", &save)) {
+        char *colon = strchr(tok, ':');
+        unsigned weight = 1;
+        if (colon) {
+            *colon = '\0';
+            weight = (unsigned)atoi(colon + 1);
+        }
+        ok = false;
+        for (int op = 0; op < OP_COUNT; op++) {
+            if (strcasecmp(tok, op_names[op]) == 0 && weight > 0) {
+                cfg.weights[op] += weight;
+                cfg.weight_total += weight;
+                ok = true;
+            }
+        }
+    }
+    free(copy);
+    return ok && cfg.weight_total > 0;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+        "usage: %s [--host H] [--port P] [--socket PATH] [--clients N]\n"
+        "    [--requests N] [--pipeline N] [--threads N]\n"
+        "    [--mix op:weight,...] [--keyspace N]\n"
+        "    [--distribution uniform|zipf] [--zipf-s S] [--value-size N]\n"
+        "    [--populate] [--seed N] [--csv]\n"
+        "ops: ping, get, set, incr, del\n", prog);
+    exit(1);
+}
+
+static void parse_args(int argc, char **argv) {
+    for (int i = 1; i < argc; i++) {
+        const char *opt = argv[i];
+        const char *val = i + 1 < argc ? argv[i + 1] : NULL;
+        if (strcmp(opt, "--populate") == 0) {
+            cfg.populate = true;
+            continue;
+        }
+        if (strcmp(opt, "--csv") == 0) {
+            cfg.csv = true;
+            continue;
+        }
+        if (!val) {
+            usage(argv[0]);
+        }
+        i++;
+        if (strcmp(opt, "--host") == 0) {
+            cfg.host = val;
+        } else if (strcmp(opt, "--port") == 0) {
+            cfg.port = val;
+        } else if (strcmp(opt, "--socket") == 0) {
+            cfg.socket_path = val;
+        } else if (strcmp(opt, "--clients") == 0) {
+            cfg.clients = atoi(val);
+        } else if (strcmp(opt, "--requests") == 0) {
+            cfg.requests = atol(val);
+        } else if (strcmp(opt, "--pipeline") == 0) {
+            cfg.pipeline = atoi(val);
+        } else if (strcmp(opt, "--threads") == 0) {
+            cfg.threads = atoi(val);
+        } else if (strcmp(opt, "--mix") == 0) {
+            if (!parse_mix(val)) {
+                fprintf(stderr, "Bad --mix '%s'\n", val);
+                exit(1);
+            }
+        } else if (strcmp(opt, "--keyspace") == 0) {
+            cfg.keyspace = atol(val);
+        } else if (strcmp(opt, "--distribution") == 0) {
+            if (strcmp(val, "zipf") != 0 && strcmp(val, "uniform") != 0) {
+                usage(argv[0]);
+            }
+            cfg.zipf = strcmp(val, "zipf") == 0;
+        } else if (strcmp(opt, "--zipf-s") == 0) {
+            cfg.zipf_s = atof(val);
+        } else if (strcmp(opt, "--value-size") == 0) {
+            cfg.value_size = (size_t)atol(val);
+        } else if (strcmp(opt, "--seed") == 0) {
+            cfg.seed = strtoull(val, NULL, 10);
+        } else {
+            usage(argv[0]);
+        }
+    }
+    if (cfg.clients < 1 || cfg.requests < 1 || cfg.pipeline < 1 ||
+        cfg.threads < 1 || cfg.threads > MAX_THREADS ||
+        cfg.threads > cfg.clients || cfg.keyspace < 1 ||
+        cfg.zipf_s <= 0 || cfg.value_size > 512 * 1024 * 1024) {
+        usage(argv[0]);
+    }
+}
+
+/* SET every key once, pipelined on one connection, before timing. */
+static void populate(void) {
+    worker_t w;
+    memset(&w, 0, sizeof(w));
+    conn_t c;
+    memset(&c, 0, sizeof(c));
+    c.fd = connect_server();
+    size_t cap = 4096;
+    c.out = xmalloc(cap);
+    c.in_cap = READ_CHUNK;
+    c.in = xmalloc(c.in_cap);
+    for (long k = 0; k < cfg.keyspace;) {
+        c.out_len = 0;
+        long batch = 0;
+        for (; batch < 1000 && k < cfg.keyspace; batch++, k++) {
+            append_command(&c, &cap, OP_SET, k);
+        }
+        for (size_t sent = 0; sent < c.out_len;) {
+            ssize_t n = send(c.fd, c.out + sent, c.out_len - sent,
+                             MSG_NOSIGNAL);
+            if (n <= 0) {
+                perror("send");
+                exit(1);
+            }
+            sent += (size_t)n;
+        }
+        c.pending = (int)batch;
+        while (c.pending > 0) {
+            ssize_t n = recv(c.fd, c.in + c.in_len, c.in_cap - c.in_len, 0);
+            if (n <= 0) {
+                fprintf(stderr, "Connection lost\n");
+                exit(1);
+            }
+            c.in_len += (size_t)n;
+            take_replies(&w, &c);
+        }
+    }
+    close(c.fd);
+    free(c.out);
+    free(c.in);
+}
+
+/* The bound of the bucket holding rank q, but never above the largest
+   latency seen. */
+static double percentile_ms(const uint64_t *hist, uint64_t total,
+                            uint64_t max_ns, double q) {
+    double rank = (double)total * q;
+    uint64_t want = (uint64_t)rank;
+    if ((double)want < rank || want == 0) {
+        want++;
+    }
+    uint64_t seen = 0;
+    for (int b = 0; b < HIST_BUCKETS; b++) {
+        seen += hist[b];
+        if (seen >= want) {
+            uint64_t ns = bucket_max(b);
+            return (double)(ns < max_ns ? ns : max_ns) / 1e6;
+        }
+    }
+    return 0.0;
+}
+
+static void print_mix(void) {
+    const char *sep = "";
+    for (int op = 0; op < OP_COUNT; op++) {
+        if (cfg.weights[op] > 0) {
+            printf("%s%s:%u", sep, op_names[op], cfg.weights[op]);
+            sep = ",";
+        }
+    }
+}
+
+int main(int argc, char **argv) {
+    parse_args(argc, argv);
+    value = xmalloc(cfg.value_size + 1);
+    memset(value, 'x', cfg.value_size);
+    if (cfg.zipf) {
+        zipf_init();
+    }
+    if (cfg.populate) {
+        populate();
+    }
+
+    worker_t *workers = calloc((size_t)cfg.threads, sizeof(worker_t));
+    conn_t *conns = calloc((size_t)cfg.clients, sizeof(conn_t));
+    if (!workers || !conns) {
+        perror("calloc");
+        exit(1);
+    }
+    for (int i = 0; i < cfg.clients; i++) {
+        conns[i].fd = connect_server();
+    }
+    int at = 0;
+    for (int t = 0; t < cfg.threads; t++) {
+        worker_t *w = &workers[t];
+        w->nconns = cfg.clients / cfg.threads +
+                    (t < cfg.clients % cfg.threads);
+        w->conns = &conns[at];
+        at += w->nconns;
+        w->rng = cfg.seed * 0x9e3779b97f4a7c15ULL + (uint64_t)t + 1;
+    }
+
+    uint64_t start = now_ns();
+    for (int t = 0; t < cfg.threads; t++) {
+        int err = pthread_create(&workers[t].thread, NULL, run_worker,
+                                 &workers[t]);
+        if (err != 0) {
+            fprintf(stderr, "pthread_create: error %d\n", err);
+            exit(1);
+        }
+    }
+    static uint64_t hist[HIST_BUCKETS];
+    uint64_t done = 0, errors = 0, max_ns = 0, sum_ns = 0;
+    for (int t = 0; t < cfg.threads; t++) {
+        worker_t *w = &workers[t];
+        pthread_join(w->thread, NULL);
+        for (int b = 0; b < HIST_BUCKETS; b++) {
+            hist[b] += w->hist[b];
+        }
+        done += w->done;
+        errors += w->errors;
+        sum_ns += w->sum_ns;
+        if (w->max_ns > max_ns) {
+            max_ns = w->max_ns;
+        }
+    }
+    double secs = (double)(now_ns() - start) / 1e9;
+    double rps = (double)done / secs;
+    double avg = done ? (double)sum_ns / (double)done / 1e6 : 0.0;
+    double p50 = percentile_ms(hist, done, max_ns, 0.5);
+    double p95 = percentile_ms(hist, done, max_ns, 0.95);
+    double p99 = percentile_ms(hist, done, max_ns, 0.99);
+    double p999 = percentile_ms(hist, done, max_ns, 0.999);
+
+    if (cfg.csv) {
+        printf("mix,clients,pipeline,threads,keyspace,distribution,"
+               "value_size,requests,seconds,requests_per_sec,errors,"
+               "avg_ms,p50_ms,p95_ms,p99_ms,p999_ms,max_ms\n\"");
+        print_mix();
+        printf("\",%d,%d,%d,%ld,%s,%zu,%" PRIu64 ",%.3f,%.2f,%" PRIu64
+               ",%.3f,%.3f,%.3f,%.3f,%.3f,%.3f\n", cfg.clients, cfg.pipeline,
+               cfg.threads, cfg.keyspace, cfg.zipf ? "zipf" : "uniform",
+               cfg.value_size, done, secs, rps, errors, avg, p50, p95, p99,
+               p999, (double)max_ns / 1e6);
+    } else {
+        if (cfg.socket_path) {
+            printf("%s", cfg.socket_path);
+        } else {
+            printf("%s:%s", cfg.host, cfg.port);
+        }
+        printf(", %d clients, pipeline %d, %d thread%s\n", cfg.clients,
+               cfg.pipeline, cfg.threads, cfg.threads == 1 ? "" : "s");
+        printf("mix ");
+        print_mix();
+        printf(", keyspace %ld (%s), %zu byte values\n", cfg.keyspace,
+               cfg.zipf ? "zipf" : "uniform", cfg.value_size);
+        printf("%" PRIu64 " requests in %.2f s: %.2f requests/s, %" PRIu64
+               " errors\n", done, secs, rps, errors);
+        printf("latency ms: avg %.3f  p50 %.3f  p95 %.3f  p99 %.3f  "
+               "p99.9 %.3f  max %.3f\n", avg, p50, p95, p99, p999,
+               (double)max_ns / 1e6);
+    }
+
+    for (int i = 0; i < cfg.clients; i++) {
+        close(conns[i].fd);
+    }
+    free(conns);
+    free(workers);
+    free(zipf_cdf);
+    free(value);
+    return 0;
+}
@@ -0,0 +1,458 @@
+#include "aof.h"
+#include "client.h"
+#include "commands.h"
+#include "util.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#define AOF_REWRITE_CHUNK (64 * 1024)
+
+bool aof_fsync_parse(const char *name, aof_fsync_t *policy) {
+    if (strcmp(name, "always") == 0) {
+        *policy = AOF_FSYNC_ALWAYS;
+    } else if (strcmp(name, "everysec") == 0) {
+        *policy = AOF_FSYNC_EVERYSEC;
+    } else if (strcmp(name, "no") == 0) {
+        *policy = AOF_FSYNC_NO;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+/* ---- buffers ---- */
+
+typedef struct {
+    char *data;
+    size_t len;
+    size_t cap;
+} buf_t;
+
+static void buf_reserve(buf_t *b, size_t extra) {
+    if (b->cap - b->len >= extra) {
+        return;
+    }
+    size_t cap = b->cap ? b->cap : 4096;
+    while (cap - b->len < extra) {
+        cap *= 2;
+    }
+    char *data = realloc(b->data, cap);
+    if (!data) {
+        perror("realloc");
+        exit(1);
+    }
+    b->data = data;
+    b->cap = cap;
+}
+
+static void buf_put(buf_t *b, const void *data, size_t len) {
+    buf_reserve(b, len);
+    memcpy(b->data + b->len, data, len);
+    b->len += len;
+}
+
+static void buf_free(buf_t *b) {
+    free(b->data);
+    b->data = NULL;
+    b->len = 0;
+    b->cap = 0;
+}
+
+/* argv as the RESP array a client would have sent */
+static void put_command(buf_t *b, const resp_value_t *argv, int argc) {
+    char header[32];
+    buf_put(b, header, (size_t)snprintf(header, sizeof(header), "*%d\r\n",
+                                        argc));
+    for (int i = 0; i < argc; i++) {
+        rstr_t s = argv[i].str;
+        buf_put(b, header, (size_t)snprintf(header, sizeof(header),
+                                            "$%zu\r\n", s.len));
+        buf_put(b, s.data, s.len);
+        buf_put(b, "\r\n", 2);
+    }
+}
+
+static int write_all(int fd, const char *data, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, data, len);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        data += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+/* ---- loading ---- */
+
+static bool loading;
+
+bool aof_loading(void) {
+    return loading;
+}
+
+int aof_load(hashtable_t *ht, const char *path, aof_load_stats_t *stats) {
+    memset(stats, 0, sizeof(*stats));
+    int fd = open(path, O_RDWR | O_CLOEXEC);
+    if (fd < 0) {
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        int err = errno;
+        close(fd);
+        errno = err;
+        return -1;
+    }
+    size_t size = (size_t)st.st_size;
+    if (size == 0) {
+        close(fd);
+        return 0;
+    }
+    const char *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED) {
+        int err = errno;
+        close(fd);
+        errno = err;
+        return -1;
+    }
+    posix_madvise((void *)map, size, POSIX_MADV_SEQUENTIAL);
+
+    /* replies go to a client nobody reads */
+    client_t replay;
+    client_init(&replay);
+    loading = true;
+    int rc = 0;
+    size_t off = 0;
+    while (off < size) {
+        resp_value_t cmd;
+        int n = resp_parse(map + off, size - off, &cmd);
+        if (n == 0) {
+            /* a write cut short by a crash: everything before it stands */
+            stats->truncated = size - off;
+            if (ftruncate(fd, (off_t)off) < 0) {
+                rc = -1;
+            }
+            break;
+        }
+        if (n < 0 || cmd.type != RESP_ARRAY) {
+            if (n > 0) {
+                resp_value_free(&cmd);
+            }
+            rc = -2;
+            break;
+        }
+        dispatch_command(&replay, ht, &cmd);
+        resp_value_free(&cmd);
+        arena_reset(&replay.req_arena);
+        size_t out_len;
+        free(client_take_output(&replay, &out_len));
+        stats->commands++;
+        off += (size_t)n;
+    }
+
+    loading = false;
+    int err = errno;
+    client_close(&replay);
+    munmap((void *)map, size);
+    close(fd);
+    errno = err;
+    return rc;
+}
+
+/* ---- appending ---- */
+
+static const char *aof_path;
+static int aof_fd = -1;
+static aof_fsync_t aof_policy;
+static buf_t pending;           /* this iteration's commands */
+static off_t aof_size;          /* bytes known to be whole commands */
+static bool unsynced;
+static int64_t last_fsync;
+
+static pid_t rewrite_pid;       /* rewrite child, 0 if none */
+static buf_t rewrite_diff;      /* commands run since it forked */
+
+static void rewrite_path(char *dst, size_t size, pid_t pid) {
+    snprintf(dst, size, "%s.rewrite-%ld", aof_path, (long)pid);
+}
+
+/* The shortest command list that rebuilds ht, written to path and
+   synced. 0, or -1 with errno set. */
+static int write_rewrite(hashtable_t *ht, const char *path) {
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        return -1;
+    }
+    buf_t out = {NULL, 0, 0};
+    char num[2][24];
+    int rc = 0;
+    ht_iter_t iter;
+    ht_iter_init(ht, &iter);
+    ht_entry_t *e;
+    while ((e = ht_iter_next_entry(&iter)) != NULL && rc == 0) {
+        resp_value_t argv[3];
+        for (int i = 0; i < 3; i++) {
+            argv[i].type = RESP_BULK_STRING;
+        }
+        int64_t n;
+        argv[0].str = (rstr_t){"SET", 3};
+        argv[1].str = ht_entry_key(e);
+        if (ht_entry_int(e, &n)) {
+            argv[2].str = (rstr_t){num[0], (size_t)snprintf(
+                num[0], sizeof(num[0]), "%" PRId64, n)};
+        } else {
+            argv[2].str = ht_entry_value(ht, e);
+        }
+        put_command(&out, argv, 3);
+        int64_t expire_at = ht_entry_expire(e);
+        if (expire_at >= 0) {
+            argv[0].str = (rstr_t){"PEXPIREAT", 9};
+            argv[2].str = (rstr_t){num[1], (size_t)snprintf(
+                num[1], sizeof(num[1]), "%" PRId64, expire_at)};
+            put_command(&out, argv, 3);
+        }
+        if (out.len >= AOF_REWRITE_CHUNK) {
+            rc = write_all(fd, out.data, out.len);
+            out.len = 0;
+        }
+    }
+    ht_iter_release(&iter);
+
+    if (rc == 0) {
+        rc = write_all(fd, out.data, out.len);
+    }
+    int err = errno;
+    buf_free(&out);
+    if (rc == 0 && fsync(fd) < 0) {
+        rc = -1;
+        err = errno;
+    }
+    if (close(fd) < 0 && rc == 0) {
+        rc = -1;
+        err = errno;
+    }
+    if (rc < 0) {
+        unlink(path);
+        errno = err;
+    }
+    return rc;
+}
+
+int aof_open(const char *path, aof_fsync_t policy, hashtable_t *ht) {
+    char tmp[4096];
+    if (access(path, F_OK) < 0) {
+        if (errno != ENOENT) {
+            return -1;
+        }
+        snprintf(tmp, sizeof(tmp), "%s.rewrite-%ld", path, (long)getpid());
+        if (write_rewrite(ht, tmp) < 0) {
+            return -1;
+        }
+        if (rename(tmp, path) < 0) {
+            int err = errno;
+            unlink(tmp);
+            errno = err;
+            return -1;
+        }
+    }
+    int fd = open(path, O_WRONLY | O_APPEND | O_CLOEXEC);
+    if (fd < 0) {
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        int err = errno;
+        close(fd);
+        errno = err;
+        return -1;
+    }
+    aof_path = path;
+    aof_fd = fd;
+    aof_policy = policy;
+    aof_size = st.st_size;
+    unsynced = false;
+    last_fsync = current_time_ms();
+    return 0;
+}
+
+bool aof_enabled(void) {
+    return aof_fd >= 0;
+}
+
+void aof_append(const resp_value_t *argv, int argc) {
+    if (aof_fd >= 0) {
+        put_command(&pending, argv, argc);
+    }
+}
+
+/* Write the pending batch. A failed write is cut back off the file so
+   the next attempt doesn't follow half a command. */
+static int write_pending(void) {
+    if (pending.len == 0) {
+        return 0;
+    }
+    if (write_all(aof_fd, pending.data, pending.len) < 0) {
+        int err = errno;
+        if (ftruncate(aof_fd, aof_size) < 0) {
+            perror("AOF truncate");
+        }
+        errno = err;
+        return -1;
+    }
+    aof_size += (off_t)pending.len;
+    if (rewrite_pid > 0) {
+        buf_put(&rewrite_diff, pending.data, pending.len);
+    }
+    pending.len = 0;
+    unsynced = true;
+    return 0;
+}
+
+void aof_flush(int64_t now) {
+    if (aof_fd < 0) {
+        return;
+    }
+    if (write_pending() < 0) {
+        perror("AOF write");
+        if (aof_policy == AOF_FSYNC_ALWAYS) {
+            exit(1);
+        }
+        /* kept for the next iteration */
+        return;
+    }
+    if (unsynced && (aof_policy == AOF_FSYNC_ALWAYS ||
+                     (aof_policy == AOF_FSYNC_EVERYSEC &&
+                      now - last_fsync >= 1000))) {
+        if (fdatasync(aof_fd) < 0) {
+            perror("AOF fsync");
+            if (aof_policy == AOF_FSYNC_ALWAYS) {
+                exit(1);
+            }
+        }
+        unsynced = false;
+        last_fsync = now;
+    }
+}
+
+/* ---- BGREWRITEAOF ---- */
+
+int aof_rewrite(hashtable_t *ht) {
+    if (aof_fd < 0) {
+        errno = ENOTSUP;
+        return -1;
+    }
+    if (rewrite_pid > 0) {
+        errno = EBUSY;
+        return -1;
+    }
+    /* Commands already run this iteration are in the child's copy of
+       the store; they must not also land in the diff. */
+    if (write_pending() < 0) {
+        return -1;
+    }
+    pid_t pid = fork();
+    if (pid < 0) {
+        return -1;
+    }
+    if (pid == 0) {
+        char tmp[4096];
+        rewrite_path(tmp, sizeof(tmp), getpid());
+        if (write_rewrite(ht, tmp) < 0) {
+            perror("BGREWRITEAOF");
+            _exit(1);
+        }
+        _exit(0);
+    }
+    rewrite_pid = pid;
+    fprintf(stderr, "Background append only file rewriting started by pid "
+            "%ld\n", (long)pid);
+    return 0;
+}
+
+bool aof_rewrite_running(void) {
+    return rewrite_pid > 0;
+}
+
+/* Append the diff to the child's file and put it in place of the AOF.
+   The new fd replaces the old one only once nothing can fail. */
+static int finish_rewrite(const char *tmp) {
+    int fd = open(tmp, O_WRONLY | O_APPEND | O_CLOEXEC);
+    if (fd < 0) {
+        return -1;
+    }
+    struct stat st;
+    if (write_all(fd, rewrite_diff.data, rewrite_diff.len) < 0 ||
+        fdatasync(fd) < 0 || fstat(fd, &st) < 0 || rename(tmp, aof_path) < 0) {
+        int err = errno;
+        close(fd);
+        errno = err;
+        return -1;
+    }
+    close(aof_fd);
+    aof_fd = fd;
+    aof_size = st.st_size;
+    return 0;
+}
+
+void aof_rewrite_poll(void) {
+    if (rewrite_pid <= 0) {
+        return;
+    }
+    int status;
+    pid_t r = waitpid(rewrite_pid, &status, WNOHANG);
+    if (r == 0 || (r < 0 && errno == EINTR)) {
+        return;
+    }
+    char tmp[4096];
+    rewrite_path(tmp, sizeof(tmp), rewrite_pid);
+    if (r > 0 && WIFEXITED(status) && WEXITSTATUS(status) == 0 &&
+        finish_rewrite(tmp) == 0) {
+        fprintf(stderr, "Background AOF rewrite finished successfully\n");
+    } else {
+        unlink(tmp);
+        fprintf(stderr, "Background AOF rewrite failed\n");
+    }
+    rewrite_pid = 0;
+    buf_free(&rewrite_diff);
+}
+
+void aof_close(void) {
+    if (aof_fd < 0) {
+        return;
+    }
+    if (rewrite_pid > 0) {
+        kill(rewrite_pid, SIGKILL);
+        while (waitpid(rewrite_pid, NULL, 0) < 0 && errno == EINTR) {
+        }
+        char tmp[4096];
+        rewrite_path(tmp, sizeof(tmp), rewrite_pid);
+        unlink(tmp);
+        rewrite_pid = 0;
+        buf_free(&rewrite_diff);
+    }
+    if (write_pending() < 0) {
+        perror("AOF write");
+    }
+    if (aof_policy != AOF_FSYNC_NO && fdatasync(aof_fd) < 0) {
+        perror("AOF fsync");
+    }
+    close(aof_fd);
+    aof_fd = -1;
+    buf_free(&pending);
+}
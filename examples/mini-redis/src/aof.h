@@ -0,0 +1,62 @@
+#ifndef AOF_H
+#define AOF_H
+
+#include "hashtable.h"
+#include "resp.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define AOF_DEFAULT_PATH "appendonly.aof"
+
+/* Append-only file (--appendonly yes). Write commands are queued as
+   RESP during a loop iteration and the whole batch is written with one
+   write() at its end: a group commit. Replies to the batch's commands
+   are only sent after aof_flush(), so no client sees a write acknowledged
+   before it reaches the file (and the disk, with "always"). */
+typedef enum {
+    AOF_FSYNC_ALWAYS,       /* fsync every batch before its replies */
+    AOF_FSYNC_EVERYSEC,     /* fsync at most once a second */
+    AOF_FSYNC_NO            /* leave it to the kernel */
+} aof_fsync_t;
+
+bool aof_fsync_parse(const char *name, aof_fsync_t *policy);
+
+typedef struct {
+    size_t commands;
+    size_t truncated;       /* bytes of a cut-off last command dropped */
+} aof_load_stats_t;
+
+/* Replay the commands in path against ht. A command cut off at the end
+   (a crash mid-write) is dropped, and the file truncated to the last
+   whole one. Returns 0, -1 with errno set (ENOENT: no file), or -2 if
+   the file is not RESP. */
+int aof_load(hashtable_t *ht, const char *path, aof_load_stats_t *stats);
+/* True while aof_load() replays: the file is the data, so commands are
+   not held to --maxmemory and nothing is evicted. */
+bool aof_loading(void);
+
+/* Start appending to path. A missing file is first created holding
+   ht's contents, so that the file alone always rebuilds the store. The
+   calls below are for the main thread only. 0, or -1 with errno set. */
+int aof_open(const char *path, aof_fsync_t policy, hashtable_t *ht);
+bool aof_enabled(void);
+/* Queue a command (argv of bulk strings) for this iteration's batch. */
+void aof_append(const resp_value_t *argv, int argc);
+/* End of an iteration: write the batch and fsync as the policy says.
+   Exits when a write fails under "always", since the replies waiting
+   on it can't be sent. */
+void aof_flush(int64_t now);
+
+/* BGREWRITEAOF: fork a child that writes ht as the shortest command
+   list that rebuilds it. Commands run in the meantime are kept too, and
+   appended to the new file before it replaces the old one. 0 once
+   started, -1 with errno set (EBUSY while one is running). */
+int aof_rewrite(hashtable_t *ht);
+bool aof_rewrite_running(void);
+/* Finish a rewrite whose child has exited; never blocks on it. */
+void aof_rewrite_poll(void);
+/* Write and sync what is queued, kill a running rewrite, close. */
+void aof_close(void);
+
+#endif
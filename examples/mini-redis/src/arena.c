@@ -0,0 +1,119 @@
+#include "arena.h"
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+#define ARENA_ALIGN   16
+/* Blocks double up to this size; larger requests get a block of their
+   own. A first block bigger than this is not kept across resets, so a
+   one-off large request does not pin memory to an idle client. */
+#define ARENA_MAX_GROW (64 * 1024)
+
+struct arena_block {
+    arena_block_t *prev;
+    size_t cap;
+    size_t used;
+    char data[];
+};
+
+/* Arenas belong to clients, which I/O threads parse for concurrently. */
+static atomic_size_t total_reserved;
+
+static void block_free(arena_block_t *b) {
+    atomic_fetch_sub_explicit(&total_reserved, b->cap, memory_order_relaxed);
+    free(b);
+}
+
+void arena_init(arena_t *a) {
+    a->head = NULL;
+}
+
+void *arena_alloc(arena_t *a, size_t size) {
+    arena_block_t *b = a->head;
+    if (b) {
+        uintptr_t p = ((uintptr_t)(b->data + b->used) + ARENA_ALIGN - 1) &
+                      ~(uintptr_t)(ARENA_ALIGN - 1);
+        size_t off = (size_t)(p - (uintptr_t)b->data);
+        if (off <= b->cap && size <= b->cap - off) {
+            b->used = off + size;
+            return (void *)p;
+        }
+    }
+
+    size_t cap = b ? b->cap * 2 : ARENA_BLOCK_SIZE;
+    if (cap > ARENA_MAX_GROW) {
+        cap = ARENA_MAX_GROW;
+    }
+    if (cap < size + ARENA_ALIGN) {
+        cap = size + ARENA_ALIGN;
+    }
+    arena_block_t *nb = malloc(sizeof(arena_block_t) + cap);
+    if (!nb) {
+        perror("malloc");
+        exit(1);
+    }
+    nb->prev = b;
+    nb->cap = cap;
+    nb->used = 0;
+    a->head = nb;
+    atomic_fetch_add_explicit(&total_reserved, cap, memory_order_relaxed);
+    return arena_alloc(a, size);
+}
+
+void arena_reset(arena_t *a) {
+    arena_block_t *b = a->head;
+    if (!b) {
+        return;
+    }
+    while (b->prev) {
+        arena_block_t *prev = b->prev;
+        block_free(b);
+        b = prev;
+    }
+    if (b->cap > ARENA_MAX_GROW) {
+        block_free(b);
+        a->head = NULL;
+        return;
+    }
+    b->used = 0;
+    a->head = b;
+}
+
+void arena_free(arena_t *a) {
+    while (a->head) {
+        arena_block_t *prev = a->head->prev;
+        block_free(a->head);
+        a->head = prev;
+    }
+}
+
+arena_mark_t arena_mark(const arena_t *a) {
+    arena_mark_t m;
+    m.block = a->head;
+    m.used = a->head ? a->head->used : 0;
+    return m;
+}
+
+void arena_rewind(arena_t *a, arena_mark_t mark) {
+    while (a->head && a->head != mark.block) {
+        arena_block_t *prev = a->head->prev;
+        block_free(a->head);
+        a->head = prev;
+    }
+    if (a->head) {
+        a->head->used = mark.used;
+    }
+}
+
+size_t arena_reserved(const arena_t *a) {
+    size_t bytes = 0;
+    for (const arena_block_t *b = a->head; b; b = b->prev) {
+        bytes += b->cap;
+    }
+    return bytes;
+}
+
+size_t arena_total_reserved(void) {
+    return atomic_load_explicit(&total_reserved, memory_order_relaxed);
+}
@@ -0,0 +1,37 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+/* Bump allocator for memory that lives no longer than one request:
+   parsed non-bulk arguments and command scratch space. Allocation is a
+   pointer bump; everything is released at once by arena_reset(), which
+   keeps the first block for the next request. */
+#define ARENA_BLOCK_SIZE 4096
+
+typedef struct arena_block arena_block_t;
+
+typedef struct {
+    arena_block_t *head;    /* block being filled; older blocks behind */
+} arena_t;
+
+/* Position to roll back to, for undoing a partial parse. */
+typedef struct {
+    arena_block_t *block;
+    size_t used;
+} arena_mark_t;
+
+void arena_init(arena_t *a);
+/* 16-byte aligned, never NULL (exits on OOM). */
+void *arena_alloc(arena_t *a, size_t size);
+void arena_reset(arena_t *a);
+void arena_free(arena_t *a);
+arena_mark_t arena_mark(const arena_t *a);
+void arena_rewind(arena_t *a, arena_mark_t mark);
+
+/* Bytes of blocks held by a. */
+size_t arena_reserved(const arena_t *a);
+/* Bytes currently held by all arenas in the process. */
+size_t arena_total_reserved(void);
+
+#endif
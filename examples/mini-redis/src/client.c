@@ -1,28 +1,125 @@
 #include "client.h"
+#include "resp.h"
+#include "stats.h"
+#include <stdatomic.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
 #include <unistd.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
 
-#define MIN_BUF_SIZE 1024
+#define FLUSH_IOV_MAX 64
+#define RECV_BUF_SIZE 4096
+
+static void chunk_free(reply_chunk_t *chunk);
+
+/* Read buffers and reply chunks of every client, for used memory. I/O
+   threads grow read buffers and free sent chunks, so it is atomic;
+   signed because a buffer set up outside this file is still given back
+   through it. */
+static atomic_llong buffer_bytes;
+
+static client_limits_t limits = {
+    CLIENT_OUTPUT_HARD_DEFAULT, CLIENT_OUTPUT_SOFT_DEFAULT,
+    CLIENT_QUERY_HARD_DEFAULT, CLIENT_QUERY_SOFT_DEFAULT
+};
+/* connection ids, across all shards */
+static atomic_uint_least64_t next_id;
+/* the loop's table on this thread */
+static _Thread_local const client_table_t *current_table;
+
+static void buffers_add(long long bytes) {
+    atomic_fetch_add_explicit(&buffer_bytes, bytes, memory_order_relaxed);
+}
+
+size_t client_buffers_total(void) {
+    long long v = atomic_load_explicit(&buffer_bytes, memory_order_relaxed);
+    return v > 0 ? (size_t)v : 0;
+}
 
 void client_init(client_t *c) {
     c->fd = -1;
+    c->slot = -1;
+    c->id = 0;
+    c->last_active_ms = 0;
     c->read_buf = NULL;
     c->read_len = 0;
     c->read_cap = 0;
-    c->write_buf = NULL;
+    c->read_pos = 0;
+    c->req_start = 0;
+    c->reply_head = NULL;
+    c->reply_tail = NULL;
+    c->reply_off = 0;
+    c->sent_refs = NULL;
     c->write_len = 0;
-    c->write_cap = 0;
+    c->ev_mask = 0;
+    c->replica = -1;
+    c->error_replies = 0;
+    c->paused = false;
+    c->req_argc = -1;
+    c->req_argi = 0;
+    c->req_bulk_len = -1;
+    c->req_args = NULL;
+    c->req_args_cap = 0;
+    arena_init(&c->req_arena);
 }
 
 void client_close(client_t *c) {
     if (c->fd >= 0) {
         close(c->fd);
     }
+    resp_parser_reset(c);
+    arena_free(&c->req_arena);
+    free(c->req_args);
     free(c->read_buf);
-    free(c->write_buf);
+    buffers_add(-(long long)c->read_cap);
+    while (c->reply_head) {
+        reply_chunk_t *next = c->reply_head->next;
+        chunk_free(c->reply_head);
+        c->reply_head = next;
+    }
+    client_release_sent(c);
+    int slot = c->slot;
     client_init(c);
+    c->slot = slot;
+}
+
+static reply_chunk_t *chunk_alloc(size_t cap) {
+    reply_chunk_t *chunk = malloc(sizeof(reply_chunk_t) + cap);
+    if (!chunk) {
+        perror("malloc");
+        exit(1);
+    }
+    buffers_add((long long)(sizeof(reply_chunk_t) + cap));
+    chunk->next = NULL;
+    chunk->len = 0;
+    chunk->cap = cap;
+    chunk->ref.data = NULL;
+    chunk->ref.len = 0;
+    return chunk;
+}
+
+static void chunk_free(reply_chunk_t *chunk) {
+    if (chunk->cap == 0) {
+        rstr_free(&chunk->ref);
+    }
+    buffers_add(-(long long)(sizeof(reply_chunk_t) + chunk->cap));
+    free(chunk);
+}
+
+static const char *chunk_data(reply_chunk_t *chunk) {
+    return chunk->cap == 0 ? chunk->ref.data : chunk->data;
+}
+
+static void chunk_push(client_t *c, reply_chunk_t *chunk) {
+    if (c->reply_tail) {
+        c->reply_tail->next = chunk;
+    } else {
+        c->reply_head = chunk;
+    }
+    c->reply_tail = chunk;
 }
 
 void client_write_append(client_t *c, const char *data, size_t len) {
@@ -30,24 +127,377 @@ void client_write_append(client_t *c, const char *data, size_t len) {
         return;
     }
 
-    size_t needed = c->write_len + len;
-    if (needed > c->write_cap) {
-        size_t new_cap = c->write_cap * 2;
-        if (new_cap < needed) {
-            new_cap = needed;
+    reply_chunk_t *tail = c->reply_tail;
+    if (tail && tail->cap > 0) {
+        size_t room = tail->cap - tail->len;
+        size_t n = len < room ? len : room;
+        memcpy(tail->data + tail->len, data, n);
+        tail->len += n;
+        c->write_len += n;
+        data += n;
+        len -= n;
+        if (len == 0) {
+            return;
+        }
+    }
+
+    reply_chunk_t *chunk = chunk_alloc(len > REPLY_CHUNK_SIZE ?
+                                       len : REPLY_CHUNK_SIZE);
+    memcpy(chunk->data, data, len);
+    chunk->len = len;
+    c->write_len += len;
+    chunk_push(c, chunk);
+}
+
+char *client_write_reserve(client_t *c, size_t len) {
+    reply_chunk_t *tail = c->reply_tail;
+    if (!tail || tail->cap == 0 || tail->cap - tail->len < len) {
+        tail = chunk_alloc(len > REPLY_CHUNK_SIZE ? len : REPLY_CHUNK_SIZE);
+        chunk_push(c, tail);
+    }
+    char *p = tail->data + tail->len;
+    tail->len += len;
+    c->write_len += len;
+    return p;
+}
+
+void client_write_value(client_t *c, rstr_t value) {
+    if (value.len < RSTR_SHARED_MIN) {
+        client_write_append(c, value.data, value.len);
+        return;
+    }
+    reply_chunk_t *chunk = chunk_alloc(0);
+    chunk->ref = rstr_retain(value);
+    chunk->len = value.len;
+    c->write_len += value.len;
+    chunk_push(c, chunk);
+}
+
+/* With defer_refs, sent reference chunks go on c->sent_refs instead of
+   dropping their value, so the flush can run off the main thread. */
+static int flush(client_t *c, bool defer_refs) {
+    while (c->write_len > 0) {
+        struct iovec iov[FLUSH_IOV_MAX];
+        int iovcnt = 0;
+        size_t off = c->reply_off;
+        for (reply_chunk_t *ch = c->reply_head;
+             ch && iovcnt < FLUSH_IOV_MAX; ch = ch->next) {
+            iov[iovcnt].iov_base = (void *)(chunk_data(ch) + off);
+            iov[iovcnt].iov_len = ch->len - off;
+            iovcnt++;
+            off = 0;
         }
-        if (new_cap < MIN_BUF_SIZE) {
-            new_cap = MIN_BUF_SIZE;
+
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = (size_t)iovcnt;
+
+        ssize_t n = sendmsg(c->fd, &msg, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return 0;
+            }
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        stats_net_output((size_t)n);
+
+        /* Advance the write offset, releasing fully sent chunks */
+        size_t sent = (size_t)n;
+        c->write_len -= sent;
+        while (sent > 0) {
+            reply_chunk_t *head = c->reply_head;
+            size_t avail = head->len - c->reply_off;
+            if (sent < avail) {
+                c->reply_off += sent;
+                break;
+            }
+            sent -= avail;
+            c->reply_off = 0;
+            if (head == c->reply_tail && head->cap > 0) {
+                /* drained: keep the last buffer chunk for the next reply */
+                head->len = 0;
+                break;
+            }
+            c->reply_head = head->next;
+            if (!c->reply_head) {
+                c->reply_tail = NULL;
+            }
+            if (defer_refs && head->cap == 0) {
+                head->next = c->sent_refs;
+                c->sent_refs = head;
+            } else {
+                chunk_free(head);
+            }
+        }
+    }
+    return 0;
+}
+
+int client_flush(client_t *c) {
+    return flush(c, false);
+}
+
+int client_flush_io(client_t *c) {
+    return flush(c, true);
+}
+
+void client_release_sent(client_t *c) {
+    while (c->sent_refs) {
+        reply_chunk_t *next = c->sent_refs->next;
+        chunk_free(c->sent_refs);
+        c->sent_refs = next;
+    }
+}
+
+char *client_take_output(client_t *c, size_t *len) {
+    char *out = malloc(c->write_len ? c->write_len : 1);
+    if (!out) {
+        perror("malloc");
+        exit(1);
+    }
+    size_t n = 0;
+    while (c->reply_head) {
+        reply_chunk_t *head = c->reply_head;
+        memcpy(out + n, chunk_data(head) + c->reply_off,
+               head->len - c->reply_off);
+        n += head->len - c->reply_off;
+        c->reply_off = 0;
+        if (head == c->reply_tail && head->cap > 0) {
+            /* keep the last buffer chunk for the next reply */
+            head->len = 0;
+            break;
+        }
+        c->reply_head = head->next;
+        chunk_free(head);
+    }
+    if (!c->reply_head) {
+        c->reply_tail = NULL;
+    }
+    c->write_len = 0;
+    *len = n;
+    return out;
+}
+
+int client_read(client_t *c, bool drain) {
+    /* Edge-triggered backends only report new data once, so keep reading
+       until the socket is drained. A short read means it already is. */
+    while (1) {
+        char tmp[RECV_BUF_SIZE];
+        ssize_t n = recv(c->fd, tmp, sizeof(tmp), 0);
+
+        if (n <= 0) {
+            if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) {
+                return -1;
+            }
+            return 0;
+        }
+        stats_net_input((size_t)n);
+
+        /* Append to read buffer */
+        size_t needed = c->read_len + (size_t)n;
+        if (needed > c->read_cap) {
+            size_t new_cap = c->read_cap * 2;
+            if (new_cap < needed) {
+                new_cap = needed;
+            }
+            if (new_cap < MIN_BUF_SIZE) {
+                new_cap = MIN_BUF_SIZE;
+            }
+            char *new_buf = realloc(c->read_buf, new_cap);
+            if (!new_buf) {
+                perror("realloc");
+                exit(1);
+            }
+            buffers_add((long long)(new_cap - c->read_cap));
+            c->read_buf = new_buf;
+            c->read_cap = new_cap;
         }
-        char *new_buf = realloc(c->write_buf, new_cap);
-        if (!new_buf) {
+        memcpy(c->read_buf + c->read_len, tmp, (size_t)n);
+        c->read_len += (size_t)n;
+        if (limits.query_hard > 0 && c->replica < 0 &&
+            client_query_len(c) > limits.query_hard) {
+            return CLIENT_READ_LIMIT;
+        }
+
+        if (!drain || (size_t)n < sizeof(tmp)) {
+            return 0;
+        }
+    }
+}
+
+void client_set_limits(const client_limits_t *l) {
+    limits = *l;
+}
+
+const client_limits_t *client_limits(void) {
+    return &limits;
+}
+
+size_t client_query_len(const client_t *c) {
+    size_t from = c->req_argc >= 0 ? c->req_start : c->read_pos;
+    return c->read_len - from;
+}
+
+bool client_output_over_soft(const client_t *c) {
+    return limits.output_soft > 0 && c->replica < 0 &&
+           c->write_len > limits.output_soft;
+}
+
+bool client_output_over_hard(const client_t *c) {
+    return limits.output_hard > 0 && c->replica < 0 &&
+           c->write_len > limits.output_hard;
+}
+
+bool client_query_over_soft(const client_t *c) {
+    return limits.query_soft > 0 && c->replica < 0 &&
+           client_query_len(c) > limits.query_soft;
+}
+
+size_t client_reply_chunks(const client_t *c) {
+    size_t n = 0;
+    for (const reply_chunk_t *ch = c->reply_head; ch; ch = ch->next) {
+        n++;
+    }
+    return n;
+}
+
+size_t client_memory(const client_t *c) {
+    size_t bytes = c->read_cap + arena_reserved(&c->req_arena);
+    for (const reply_chunk_t *ch = c->reply_head; ch; ch = ch->next) {
+        bytes += sizeof(reply_chunk_t) + ch->cap;
+    }
+    return bytes;
+}
+
+/* Drop consumed input. A partially parsed command is kept from its start
+   because its arguments are still referenced by offset. */
+void client_compact_read_buf(client_t *c) {
+    size_t keep_from = (c->req_argc >= 0) ? c->req_start : c->read_pos;
+
+    if (keep_from == c->read_len) {
+        c->read_len = 0;
+        c->read_pos = 0;
+        c->req_start = 0;
+        return;
+    }
+    if (keep_from == 0) {
+        return;
+    }
+
+    size_t remaining = c->read_len - keep_from;
+    memmove(c->read_buf, c->read_buf + keep_from, remaining);
+    c->read_len = remaining;
+    c->read_pos -= keep_from;
+    c->req_start = 0;
+}
+
+size_t client_reclaim(client_t *c) {
+    if (c->write_len > 0 || c->sent_refs || c->req_argc >= 0 ||
+        c->read_pos != c->read_len) {
+        return 0;
+    }
+    size_t freed = 0;
+    if (c->read_cap > MIN_BUF_SIZE) {
+        char *buf = realloc(c->read_buf, MIN_BUF_SIZE);
+        if (buf) {
+            freed += c->read_cap - MIN_BUF_SIZE;
+            buffers_add(-(long long)(c->read_cap - MIN_BUF_SIZE));
+            c->read_buf = buf;
+            c->read_cap = MIN_BUF_SIZE;
+        }
+    }
+    /* the drained last chunk, kept for the next reply */
+    while (c->reply_head) {
+        reply_chunk_t *next = c->reply_head->next;
+        freed += sizeof(reply_chunk_t) + c->reply_head->cap;
+        chunk_free(c->reply_head);
+        c->reply_head = next;
+    }
+    c->reply_tail = NULL;
+    c->reply_off = 0;
+    freed += arena_reserved(&c->req_arena);
+    arena_free(&c->req_arena);
+    if (c->req_args) {
+        freed += c->req_args_cap * sizeof(resp_value_t);
+        free(c->req_args);
+        c->req_args = NULL;
+        c->req_args_cap = 0;
+    }
+    return freed;
+}
+
+void client_table_init(client_table_t *t) {
+    t->slots = NULL;
+    t->cap = 0;
+    t->used = 0;
+    t->free_slots = NULL;
+    t->nfree = 0;
+}
+
+void client_table_free(client_table_t *t) {
+    for (int i = 0; i < t->used; i++) {
+        client_close(t->slots[i]);
+        free(t->slots[i]);
+    }
+    free(t->slots);
+    free(t->free_slots);
+    client_table_init(t);
+}
+
+client_t *client_table_acquire(client_table_t *t) {
+    uint64_t id = atomic_fetch_add_explicit(&next_id, 1,
+                                            memory_order_relaxed) + 1;
+    if (t->nfree > 0) {
+        client_t *c = t->slots[t->free_slots[--t->nfree]];
+        c->id = id;
+        return c;
+    }
+    if (t->used == t->cap) {
+        int cap = t->cap ? t->cap * 2 : 64;
+        client_t **slots = realloc(t->slots, (size_t)cap * sizeof(*slots));
+        int *free_slots = slots ?
+            realloc(t->free_slots, (size_t)cap * sizeof(int)) : NULL;
+        if (!free_slots) {
             perror("realloc");
             exit(1);
         }
-        c->write_buf = new_buf;
-        c->write_cap = new_cap;
+        t->slots = slots;
+        t->free_slots = free_slots;
+        t->cap = cap;
     }
+    client_t *c = malloc(sizeof(client_t));
+    if (!c) {
+        perror("malloc");
+        exit(1);
+    }
+    client_init(c);
+    c->slot = t->used;
+    c->id = id;
+    t->slots[t->used++] = c;
+    return c;
+}
 
-    memcpy(c->write_buf + c->write_len, data, len);
-    c->write_len += len;
+void client_table_release(client_table_t *t, client_t *c) {
+    client_close(c);
+    t->free_slots[t->nfree++] = c->slot;
+}
+
+client_t *client_table_get(const client_table_t *t, int slot) {
+    return slot >= 0 && slot < t->used ? t->slots[slot] : NULL;
+}
+
+int client_table_open(const client_table_t *t) {
+    return t->used - t->nfree;
+}
+
+void client_table_set_current(const client_table_t *t) {
+    current_table = t;
+}
+
+const client_table_t *client_table_current(void) {
+    return current_table;
 }
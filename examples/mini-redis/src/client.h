@@ -1,22 +1,165 @@
 #ifndef CLIENT_H
 #define CLIENT_H
 
+#include "arena.h"
+#include "rstr.h"
+#include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
 
-#define MAX_CLIENTS 1024
+/* Default for --maxclients. */
+#define MAX_CLIENTS 10000
+/* Smallest read buffer; what idle clients are trimmed back to. */
+#define MIN_BUF_SIZE 1024
+
+/* Per-client buffer limits (--client-output-buffer-limit and
+   --client-query-buffer-limit, each a hard and a soft limit in bytes,
+   0 for none). Past the soft output limit a client's commands wait and
+   its socket is not read until its replies drain; past the soft query
+   limit its socket is not read while its commands wait (a batch on
+   other shards, or replies past the soft limit). Past either hard
+   limit it is disconnected. Replicas are exempt: one is dropped when it
+   falls a backlog behind instead (repl_replica_lagging()). */
+typedef struct {
+    size_t output_hard;
+    size_t output_soft;
+    size_t query_hard;
+    size_t query_soft;
+} client_limits_t;
+
+#define CLIENT_OUTPUT_HARD_DEFAULT 0
+#define CLIENT_OUTPUT_SOFT_DEFAULT (8 * 1024 * 1024)
+#define CLIENT_QUERY_HARD_DEFAULT (1024 * 1024 * 1024)
+#define CLIENT_QUERY_SOFT_DEFAULT (1024 * 1024)
+
+/* client_read() past the hard query limit. */
+#define CLIENT_READ_LIMIT -2
+
+/* Output is queued as a chain of chunks. A buffer chunk holds copied
+   reply bytes in data[]; a reference chunk (cap == 0) holds a shared
+   handle to a large stored value, so it is sent without being copied. */
+#define REPLY_CHUNK_SIZE (16 * 1024)
+
+typedef struct reply_chunk {
+    struct reply_chunk *next;
+    size_t len;             /* bytes used */
+    size_t cap;             /* capacity of data[], 0 for a reference */
+    rstr_t ref;
+    char data[];
+} reply_chunk_t;
+
+struct resp_value;
 
 typedef struct {
     int fd;
+    int slot;               /* index in its client_table_t, -1 if none;
+                               kept by client_close() */
+    uint64_t id;            /* unique per connection, from 1; 0 if none */
+    int64_t last_active_ms; /* clock_ms() of the last read */
     char *read_buf;
     size_t read_len;
     size_t read_cap;
-    char *write_buf;
-    size_t write_len;
-    size_t write_cap;
+    size_t read_pos;        /* bytes of read_buf already consumed */
+    reply_chunk_t *reply_head;
+    reply_chunk_t *reply_tail;
+    size_t reply_off;       /* bytes of reply_head already sent */
+    reply_chunk_t *sent_refs;  /* sent by an I/O thread, to be released */
+    size_t write_len;       /* total bytes queued and not yet sent */
+    int ev_mask;            /* interest currently registered with the loop */
+    int replica;            /* index among the replicas, -1 if not one */
+    uint64_t error_replies; /* resp_write_error() calls, so a failed write
+                               is not propagated */
+    bool paused;            /* commands held back: output past the soft
+                               limit */
+
+    /* Resumable command parser state, see resp_parse_client() */
+    size_t req_start;       /* offset of the pending command in read_buf */
+    int64_t req_argc;       /* elements in the pending command, -1 if none */
+    int64_t req_argi;       /* elements fully parsed so far */
+    int64_t req_bulk_len;   /* declared length of the pending bulk, -1 if
+                               its header has not been read yet */
+    struct resp_value *req_args;   /* reusable argv, owned by the client */
+    size_t req_args_cap;
+    arena_t req_arena;      /* request-scoped memory: owned non-bulk
+                               arguments and command scratch; reset by
+                               resp_command_release() */
 } client_t;
 
 void client_init(client_t *c);
 void client_close(client_t *c);
 void client_write_append(client_t *c, const char *data, size_t len);
+/* Reserve len contiguous output bytes and return them for the caller to
+   fill; they are queued immediately. */
+char *client_write_reserve(client_t *c, size_t len);
+/* Queue an owned string (from rstr_create()) for output. Large values
+   are referenced rather than copied. */
+void client_write_value(client_t *c, rstr_t value);
+/* Send as much queued output as the socket takes. Returns 0 when the
+   queue is empty or the socket would block, -1 on a fatal error. */
+int client_flush(client_t *c);
+/* client_flush() for an I/O thread: dropping a shared value touches the
+   allocator, so sent reference chunks are parked until the main thread
+   calls client_release_sent(). */
+int client_flush_io(client_t *c);
+void client_release_sent(client_t *c);
+/* Move all queued output into one malloc'd buffer of *len bytes, for a
+   reply produced on behalf of a client on another thread. */
+char *client_take_output(client_t *c, size_t *len);
+/* Read what the socket has into read_buf; with drain, until it would
+   block. Returns -1 if the connection is closed or broken, and
+   CLIENT_READ_LIMIT once unprocessed input is past the hard query
+   limit. Touches nothing but the client, so I/O threads run it. */
+int client_read(client_t *c, bool drain);
+void client_compact_read_buf(client_t *c);
+
+/* Before the loops start. */
+void client_set_limits(const client_limits_t *limits);
+const client_limits_t *client_limits(void);
+/* Input read and not yet processed, from the pending command's start. */
+size_t client_query_len(const client_t *c);
+/* Whether queued output is past the soft or the hard output limit. */
+bool client_output_over_soft(const client_t *c);
+bool client_output_over_hard(const client_t *c);
+/* Input is past the soft query limit. */
+bool client_query_over_soft(const client_t *c);
+/* Reply chunks queued, and the bytes held by the read buffer, reply
+   chunks and request arena together (CLIENT LIST). */
+size_t client_reply_chunks(const client_t *c);
+size_t client_memory(const client_t *c);
+/* Give back what an idle client holds beyond its minimum: the read
+   buffer shrinks to MIN_BUF_SIZE and the kept reply chunk, request arena
+   and argv go. Clients with unconsumed input or unsent output are left
+   alone. Returns the bytes released. */
+size_t client_reclaim(client_t *c);
+/* Bytes held by read buffers and reply chunks, all clients together. */
+size_t client_buffers_total(void);
+
+/* Connection slots, numbered for use as event tokens. A client_t is
+   allocated the first time its slot is used and never moves or goes
+   away, so pointers to it stay valid after it closes; closed slots go
+   on a free list and are handed out again, most recent first. */
+typedef struct {
+    client_t **slots;
+    int cap;
+    int used;               /* slots handed out so far */
+    int *free_slots;        /* stack of closed slots */
+    int nfree;
+} client_table_t;
+
+void client_table_init(client_table_t *t);
+/* Closes the clients still open. */
+void client_table_free(client_table_t *t);
+/* A closed client in a free slot (c->slot), growing the table if none. */
+client_t *client_table_acquire(client_table_t *t);
+/* Close c and free its slot. */
+void client_table_release(client_table_t *t, client_t *c);
+/* NULL for a slot never handed out. */
+client_t *client_table_get(const client_table_t *t, int slot);
+int client_table_open(const client_table_t *t);
+/* The table of the loop on this thread, for CLIENT LIST; NULL on a
+   thread without one. */
+void client_table_set_current(const client_table_t *t);
+const client_table_t *client_table_current(void);
 
 #endif
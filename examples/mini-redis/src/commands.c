@@ -1,20 +1,34 @@
 #include "commands.h"
+#include "aof.h"
+#include "evict.h"
 #include "glob.h"
+#include "lazyfree.h"
+#include "repl.h"
+#include "slab.h"
+#include "snapshot.h"
+#include "stats.h"
 #include "util.h"
+#include <errno.h>
 #include <string.h>
+#include <strings.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <ctype.h>
 #include <stdint.h>
 #include <inttypes.h>
 #include <limits.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 
 static bool parse_int64(const char *data, size_t len, int64_t *out) {
     if (len == 0) {
         return false;
     }
 
-    int64_t result = 0;
+    /* accumulate the magnitude unsigned so INT64_MIN is reachable */
+    uint64_t result = 0;
     size_t i = 0;
     bool negative = false;
 
@@ -25,31 +39,20 @@ static bool parse_int64(const char *data, size_t len, int64_t *out) {
             return false;
         }
     }
+    uint64_t limit = negative ? (uint64_t)INT64_MAX + 1 : (uint64_t)INT64_MAX;
 
     for (; i < len; i++) {
         if (data[i] < '0' || data[i] > '9') {
             return false;
         }
-        int digit = data[i] - '0';
-        /* overflow check */
-        if (negative) {
-            if (result > (-(INT64_MIN + digit)) / 10 + 1 ||
-                (result == (-(INT64_MIN / 10)) &&
-                 digit > (int)(-(INT64_MIN % 10)))) {
-                /* more robust check below */
-            }
-        }
-        if (!negative && result > (INT64_MAX - digit) / 10) {
+        unsigned digit = (unsigned)(data[i] - '0');
+        if (result > (limit - digit) / 10) {
             return false;
         }
         result = result * 10 + digit;
     }
 
-    if (negative) {
-        *out = -result;
-    } else {
-        *out = result;
-    }
+    *out = negative ? (int64_t)(0 - result) : (int64_t)result;
     return true;
 }
 
@@ -57,7 +60,7 @@ static void cmd_ping(client_t *client, hashtable_t *store,
                      resp_value_t *args, int argc) {
     (void)store;
     if (argc == 1) {
-        resp_write_simple_string(client, "PONG");
+        resp_write_shared(client, RESP_SHARED_PONG);
     } else {
         resp_write_bulk_string(client, args[1].str.data,
                                args[1].str.len);
@@ -75,9 +78,9 @@ static void cmd_set(client_t *client, hashtable_t *store,
                     resp_value_t *args, int argc) {
     rstr_t key = args[1].str;
     rstr_t value = args[2].str;
+    int64_t expire_at = -1;
 
-    ht_set(store, key, value);
-
+    /* validate options first: a rejected SET leaves the key alone */
     if (argc == 5) {
         /* check for EX */
         char ex_buf[3];
@@ -89,41 +92,171 @@ static void cmd_set(client_t *client, hashtable_t *store,
             ex_buf[0] = '\0';
         }
 
-        if (strcmp(ex_buf, "EX") == 0) {
-            int64_t seconds;
-            if (!parse_int64(args[4].str.data, args[4].str.len,
-                             &seconds) || seconds <= 0) {
-                /* undo the set? No, Redis sets and then fails on EX.
-                   Actually Redis rejects the whole command. Let's
-                   delete and send error. */
-                ht_delete(store, key);
-                resp_write_error(client,
-                    "ERR invalid expire time in 'set' command");
-                return;
-            }
-            int64_t expire_at = current_time_ms() + seconds * 1000;
-            ht_set_expire(store, key, expire_at);
-        } else {
-            ht_delete(store, key);
+        if (strcmp(ex_buf, "EX") != 0) {
             resp_write_error(client, "ERR syntax error");
             return;
         }
+        int64_t seconds;
+        if (!parse_int64(args[4].str.data, args[4].str.len, &seconds) ||
+            seconds <= 0) {
+            resp_write_error(client,
+                "ERR invalid expire time in 'set' command");
+            return;
+        }
+        expire_at = clock_ms() + seconds * 1000;
+    }
+
+    bool inserted;
+    ht_entry_t *e = ht_find_or_insert(store, key, value, &inserted);
+    if (!inserted) {
+        ht_entry_set_value(store, e, value);
     }
+    ht_entry_set_expire(store, e, expire_at);
 
-    resp_write_simple_string(client, "OK");
+    resp_write_shared(client, RESP_SHARED_OK);
+}
+
+static void write_entry_value(client_t *client, hashtable_t *store,
+                              const ht_entry_t *e) {
+    int64_t n;
+    if (!e) {
+        resp_write_null_bulk_string(client);
+    } else if (ht_entry_int(e, &n)) {
+        resp_write_bulk_int(client, n);
+    } else {
+        resp_write_bulk_value(client, ht_entry_value(store, e));
+    }
 }
 
 static void cmd_get(client_t *client, hashtable_t *store,
                     resp_value_t *args, int argc) {
     (void)argc;
-    rstr_t *val = ht_get(store, args[1].str);
-    if (val) {
-        resp_write_bulk_string(client, val->data, val->len);
-    } else {
-        resp_write_null_bulk_string(client);
+    write_entry_value(client, store, ht_find(store, args[1].str));
+}
+
+/* Multi-key commands hash every key up front and prefetch ahead of the
+   probes. Key i's control group is fetched 2 * MULTI_PREFETCH_DISTANCE
+   keys early and its candidate entries MULTI_PREFETCH_DISTANCE keys
+   early, when the group has (usually) arrived. */
+#define MULTI_PREFETCH_DISTANCE 8
+
+typedef struct {
+    hashtable_t *store;
+    resp_value_t *keys;     /* first key argument */
+    size_t stride;          /* 1 for keys only, 2 for key/value pairs */
+    size_t n;
+    uint64_t *hashes;       /* request scratch */
+} key_batch_t;
+
+static void batch_prefetch(const key_batch_t *b, size_t i) {
+    if (i + 2 * MULTI_PREFETCH_DISTANCE < b->n) {
+        ht_prefetch_group(b->store, b->hashes[i + 2 * MULTI_PREFETCH_DISTANCE]);
+    }
+    if (i + MULTI_PREFETCH_DISTANCE < b->n) {
+        ht_prefetch_entries(b->store, b->hashes[i + MULTI_PREFETCH_DISTANCE]);
+    }
+}
+
+/* Hash the keys and fill the prefetch pipeline. The batch can be walked
+   more than once; call batch_start() before each walk. */
+static void batch_start(key_batch_t *b) {
+    for (size_t i = 0; i < b->n && i < 2 * MULTI_PREFETCH_DISTANCE; i++) {
+        ht_prefetch_group(b->store, b->hashes[i]);
+    }
+    for (size_t i = 0; i < b->n && i < MULTI_PREFETCH_DISTANCE; i++) {
+        ht_prefetch_entries(b->store, b->hashes[i]);
+    }
+}
+
+static void batch_init(key_batch_t *b, client_t *client, hashtable_t *store,
+                       resp_value_t *keys, size_t n, size_t stride) {
+    b->store = store;
+    b->keys = keys;
+    b->stride = stride;
+    b->n = n;
+    b->hashes = arena_alloc(&client->req_arena, n * sizeof(uint64_t));
+    for (size_t i = 0; i < n; i++) {
+        b->hashes[i] = ht_hash(store, keys[i * stride].str);
+    }
+    batch_start(b);
+}
+
+static rstr_t batch_key(const key_batch_t *b, size_t i) {
+    return b->keys[i * b->stride].str;
+}
+
+static void cmd_mget(client_t *client, hashtable_t *store,
+                     resp_value_t *args, int argc) {
+    key_batch_t b;
+    batch_init(&b, client, store, &args[1], (size_t)(argc - 1), 1);
+
+    resp_write_array_header(client, argc - 1);
+    for (size_t i = 0; i < b.n; i++) {
+        batch_prefetch(&b, i);
+        write_entry_value(client, store,
+                          ht_find_hashed(store, batch_key(&b, i), b.hashes[i]));
     }
 }
 
+/* Store every pair of the batch like SET without options. A key given
+   twice ends up with its last value. */
+static void batch_set(const key_batch_t *b) {
+    for (size_t i = 0; i < b->n; i++) {
+        batch_prefetch(b, i);
+        rstr_t value = b->keys[i * 2 + 1].str;
+        bool inserted;
+        ht_entry_t *e = ht_find_or_insert_hashed(b->store, batch_key(b, i),
+                                                 value, b->hashes[i],
+                                                 &inserted);
+        if (!inserted) {
+            ht_entry_set_value(b->store, e, value);
+        }
+        ht_entry_set_expire(b->store, e, -1);
+    }
+}
+
+static bool pairs_ok(client_t *client, int argc, const char *name) {
+    if ((argc - 1) % 2 != 0) {
+        char err[128];
+        snprintf(err, sizeof(err),
+            "ERR wrong number of arguments for '%s' command", name);
+        resp_write_error(client, err);
+        return false;
+    }
+    return true;
+}
+
+static void cmd_mset(client_t *client, hashtable_t *store,
+                     resp_value_t *args, int argc) {
+    if (!pairs_ok(client, argc, "MSET")) {
+        return;
+    }
+    key_batch_t b;
+    batch_init(&b, client, store, &args[1], (size_t)(argc - 1) / 2, 2);
+    batch_set(&b);
+    resp_write_shared(client, RESP_SHARED_OK);
+}
+
+/* Sets nothing, and replies 0, if any of the keys exists. */
+static void cmd_msetnx(client_t *client, hashtable_t *store,
+                       resp_value_t *args, int argc) {
+    if (!pairs_ok(client, argc, "MSETNX")) {
+        return;
+    }
+    key_batch_t b;
+    batch_init(&b, client, store, &args[1], (size_t)(argc - 1) / 2, 2);
+    for (size_t i = 0; i < b.n; i++) {
+        batch_prefetch(&b, i);
+        if (ht_find_hashed(store, batch_key(&b, i), b.hashes[i])) {
+            resp_write_integer(client, 0);
+            return;
+        }
+    }
+    batch_start(&b);
+    batch_set(&b);
+    resp_write_integer(client, 1);
+}
+
 static void cmd_del(client_t *client, hashtable_t *store,
                     resp_value_t *args, int argc) {
     int64_t count = 0;
@@ -135,6 +268,19 @@ static void cmd_del(client_t *client, hashtable_t *store,
     resp_write_integer(client, count);
 }
 
+/* DEL, but a large value is freed on the lazy-free thread: the loop
+   only unlinks it. */
+static void cmd_unlink(client_t *client, hashtable_t *store,
+                       resp_value_t *args, int argc) {
+    int64_t count = 0;
+    for (int i = 1; i < argc; i++) {
+        if (ht_unlink(store, args[i].str)) {
+            count++;
+        }
+    }
+    resp_write_integer(client, count);
+}
+
 static void cmd_exists(client_t *client, hashtable_t *store,
                        resp_value_t *args, int argc) {
     int64_t count = 0;
@@ -156,13 +302,39 @@ static void cmd_expire(client_t *client, hashtable_t *store,
         return;
     }
 
-    if (!ht_exists(store, args[1].str)) {
+    ht_entry_t *e = ht_find(store, args[1].str);
+    if (!e) {
         resp_write_integer(client, 0);
         return;
     }
 
-    int64_t expire_at = current_time_ms() + seconds * 1000;
-    ht_set_expire(store, args[1].str, expire_at);
+    ht_entry_set_expire(store, e, clock_ms() + seconds * 1000);
+    resp_write_integer(client, 1);
+}
+
+/* PEXPIREAT key unix-ms: the form the AOF logs every TTL in, since it
+   means the same thing whenever it is replayed. */
+static void cmd_pexpireat(client_t *client, hashtable_t *store,
+                          resp_value_t *args, int argc) {
+    (void)argc;
+    int64_t at;
+    if (!parse_int64(args[2].str.data, args[2].str.len, &at)) {
+        resp_write_error(client,
+            "ERR value is not an integer or out of range");
+        return;
+    }
+
+    ht_entry_t *e = ht_find(store, args[1].str);
+    if (!e) {
+        resp_write_integer(client, 0);
+        return;
+    }
+
+    if (at <= clock_ms()) {
+        ht_entry_delete(store, e);
+    } else {
+        ht_entry_set_expire(store, e, at);
+    }
     resp_write_integer(client, 1);
 }
 
@@ -170,23 +342,24 @@ static void cmd_ttl(client_t *client, hashtable_t *store,
                     resp_value_t *args, int argc) {
     (void)argc;
 
-    if (!ht_exists(store, args[1].str)) {
+    ht_entry_t *e = ht_find(store, args[1].str);
+    if (!e) {
         resp_write_integer(client, -2);
         return;
     }
 
-    int64_t expire_at = ht_get_expire(store, args[1].str);
+    int64_t expire_at = ht_entry_expire(e);
     if (expire_at == -1) {
         resp_write_integer(client, -1);
         return;
     }
 
-    int64_t now = current_time_ms();
+    int64_t now = clock_ms();
     int64_t remaining_ms = expire_at - now;
 
     if (remaining_ms <= 0) {
         /* expired, delete it */
-        ht_delete(store, args[1].str);
+        ht_entry_delete(store, e);
         resp_write_integer(client, -2);
         return;
     }
@@ -198,38 +371,24 @@ static void cmd_ttl(client_t *client, hashtable_t *store,
 static void cmd_keys(client_t *client, hashtable_t *store,
                      resp_value_t *args, int argc) {
     (void)argc;
-    rstr_t pattern = args[1].str;
+    glob_pattern_t pattern;
+    glob_compile(&pattern, args[1].str.data, args[1].str.len,
+                 &client->req_arena);
 
-    /* First pass: count matches */
     ht_iter_t iter;
     rstr_t key;
     int match_count = 0;
 
-    /* Collect matching keys - pre-allocate based on table size */
+    /* Request scratch: no key appears twice, so ht_count() bounds the
+       matches. Keys are views, valid until the next write. */
     size_t matches_cap = ht_count(store);
-    if (matches_cap == 0) {
-        matches_cap = 1;
-    }
-    rstr_t *matches = malloc(matches_cap * sizeof(rstr_t));
-    if (!matches) {
-        perror("malloc");
-        exit(1);
-    }
+    rstr_t *matches = arena_alloc(&client->req_arena,
+                                  (matches_cap ? matches_cap : 1) *
+                                  sizeof(rstr_t));
 
     ht_iter_init(store, &iter);
     while (ht_iter_next(&iter, &key, NULL)) {
-        if (glob_match(pattern.data, pattern.len,
-                       key.data, key.len)) {
-            if ((size_t)match_count >= matches_cap) {
-                matches_cap *= 2;
-                rstr_t *tmp = realloc(matches,
-                                      matches_cap * sizeof(rstr_t));
-                if (!tmp) {
-                    perror("realloc");
-                    exit(1);
-                }
-                matches = tmp;
-            }
+        if (glob_pattern_match(&pattern, key.data, key.len)) {
             matches[match_count] = key;
             match_count++;
         }
@@ -239,96 +398,645 @@ static void cmd_keys(client_t *client, hashtable_t *store,
     for (int i = 0; i < match_count; i++) {
         resp_write_bulk_string(client, matches[i].data, matches[i].len);
     }
+}
 
-    free(matches);
+#define SCAN_DEFAULT_COUNT 10
+/* Home groups visited per requested key before giving up on an
+   (almost) empty stretch of the table and returning early. */
+#define SCAN_MAX_GROUPS_PER_KEY 10
+
+typedef struct {
+    glob_pattern_t match;
+    arena_t *arena;
+    size_t examined;
+    rstr_t *keys;
+    size_t count;
+    size_t cap;
+} scan_ctx_t;
+
+static void scan_collect(void *ctx, rstr_t key) {
+    scan_ctx_t *sc = ctx;
+    sc->examined++;
+    if (!glob_pattern_match(&sc->match, key.data, key.len)) {
+        return;
+    }
+    if (sc->count == sc->cap) {
+        /* request scratch: the old array is dropped with the arena */
+        size_t cap = sc->cap ? sc->cap * 2 : 16;
+        rstr_t *keys = arena_alloc(sc->arena, cap * sizeof(rstr_t));
+        if (sc->count) {
+            memcpy(keys, sc->keys, sc->count * sizeof(rstr_t));
+        }
+        sc->keys = keys;
+        sc->cap = cap;
+    }
+    sc->keys[sc->count++] = key;
+}
+
+static bool parse_cursor(rstr_t s, size_t *out) {
+    if (s.len == 0 || s.len > 20) {
+        return false;
+    }
+    uint64_t v = 0;
+    for (size_t i = 0; i < s.len; i++) {
+        unsigned digit = (unsigned)(s.data[i] - '0');
+        if (digit > 9 || v > (UINT64_MAX - digit) / 10) {
+            return false;
+        }
+        v = v * 10 + digit;
+    }
+    if (v > SIZE_MAX) {
+        return false;
+    }
+    *out = (size_t)v;
+    return true;
+}
+
+static bool arg_is(rstr_t arg, const char *name) {
+    return arg.len == strlen(name) && strncasecmp(arg.data, name, arg.len) == 0;
+}
+
+/* SCAN cursor [MATCH pattern] [COUNT n]: reply [next-cursor, [keys]].
+   Work per call is about COUNT keys examined (capped in groups
+   visited), so a scan never holds the loop for long. */
+static void cmd_scan(client_t *client, hashtable_t *store,
+                     resp_value_t *args, int argc) {
+    size_t cursor;
+    if (!parse_cursor(args[1].str, &cursor)) {
+        resp_write_error(client, "ERR invalid cursor");
+        return;
+    }
+
+    scan_ctx_t sc;
+    memset(&sc, 0, sizeof(sc));
+    sc.arena = &client->req_arena;
+    rstr_t pattern = {"*", 1};
+    int64_t count = SCAN_DEFAULT_COUNT;
+
+    for (int i = 2; i < argc; i += 2) {
+        if (i + 1 >= argc) {
+            resp_write_error(client, "ERR syntax error");
+            return;
+        }
+        if (arg_is(args[i].str, "MATCH")) {
+            pattern = args[i + 1].str;
+        } else if (arg_is(args[i].str, "COUNT")) {
+            if (!parse_int64(args[i + 1].str.data, args[i + 1].str.len,
+                             &count)) {
+                resp_write_error(client,
+                    "ERR value is not an integer or out of range");
+                return;
+            }
+            if (count < 1) {
+                resp_write_error(client, "ERR syntax error");
+                return;
+            }
+        } else {
+            resp_write_error(client, "ERR syntax error");
+            return;
+        }
+    }
+
+    /* compiled once for every group this call visits */
+    glob_compile(&sc.match, pattern.data, pattern.len, sc.arena);
+
+    size_t max_groups = (uint64_t)count > SIZE_MAX / SCAN_MAX_GROUPS_PER_KEY ?
+                        SIZE_MAX : (size_t)count * SCAN_MAX_GROUPS_PER_KEY;
+    size_t groups = 0;
+    do {
+        cursor = ht_scan(store, cursor, scan_collect, &sc);
+        groups++;
+    } while (cursor != 0 && sc.examined < (uint64_t)count &&
+             groups < max_groups);
+
+    char buf[24];
+    resp_write_array_header(client, 2);
+    resp_write_bulk_string(client, buf, u64_to_str(buf, cursor));
+    resp_write_array_header(client, (int)sc.count);
+    for (size_t i = 0; i < sc.count; i++) {
+        resp_write_bulk_string(client, sc.keys[i].data, sc.keys[i].len);
+    }
 }
 
 static void cmd_type(client_t *client, hashtable_t *store,
                      resp_value_t *args, int argc) {
     (void)argc;
     if (ht_exists(store, args[1].str)) {
-        resp_write_simple_string(client, "string");
+        resp_write_shared(client, RESP_SHARED_TYPE_STRING);
     } else {
-        resp_write_simple_string(client, "none");
+        resp_write_shared(client, RESP_SHARED_TYPE_NONE);
     }
 }
 
-static void cmd_incr(client_t *client, hashtable_t *store,
-                     resp_value_t *args, int argc) {
-    (void)argc;
-    rstr_t key = args[1].str;
-    rstr_t *val = ht_get(store, key);
+/* FLUSHALL / FLUSHDB [ASYNC | SYNC]: there is one database, so they are
+   the same. ASYNC swaps in an empty table at once and leaves the old
+   entries to ht_lazyfree_step(). */
+static void cmd_flushall(client_t *client, hashtable_t *store,
+                         resp_value_t *args, int argc) {
+    bool async = false;
+    if (argc == 2) {
+        if (arg_is(args[1].str, "ASYNC")) {
+            async = true;
+        } else if (!arg_is(args[1].str, "SYNC")) {
+            resp_write_error(client, "ERR syntax error");
+            return;
+        }
+    }
+    if (async) {
+        ht_clear_async(store);
+    } else {
+        ht_clear(store);
+    }
+    resp_write_shared(client, RESP_SHARED_OK);
+}
 
-    int64_t current = 0;
-    int64_t expire_at = -1;
+/* INCR/DECR/INCRBY/DECRBY: one probe finds the counter (or creates it
+   as 0), and the result is stored back through the same entry as a
+   native integer, keeping its TTL. A string value is parsed only the
+   first time. */
+static void incr_by(client_t *client, hashtable_t *store, rstr_t key,
+                    int64_t delta) {
+    bool inserted;
+    ht_entry_t *e = ht_find_or_insert_int(store, key, 0, &inserted);
 
-    if (val) {
-        expire_at = ht_get_expire(store, key);
-        if (!parse_int64(val->data, val->len, &current)) {
+    int64_t current;
+    if (!ht_entry_int(e, &current)) {
+        rstr_t val = ht_entry_value(store, e);
+        if (!parse_int64(val.data, val.len, &current)) {
             resp_write_error(client,
                 "ERR value is not an integer or out of range");
             return;
         }
     }
+    if ((delta > 0 && current > INT64_MAX - delta) ||
+        (delta < 0 && current < INT64_MIN - delta)) {
+        resp_write_error(client,
+            "ERR value is not an integer or out of range");
+        return;
+    }
+
+    current += delta;
+    ht_entry_set_int(store, e, current);
+    resp_write_integer(client, current);
+}
+
+static void cmd_incr(client_t *client, hashtable_t *store,
+                     resp_value_t *args, int argc) {
+    (void)argc;
+    incr_by(client, store, args[1].str, 1);
+}
 
-    /* overflow check */
-    if (current == INT64_MAX) {
+static void cmd_decr(client_t *client, hashtable_t *store,
+                     resp_value_t *args, int argc) {
+    (void)argc;
+    incr_by(client, store, args[1].str, -1);
+}
+
+static void cmd_incrby(client_t *client, hashtable_t *store,
+                       resp_value_t *args, int argc) {
+    (void)argc;
+    int64_t delta;
+    if (!parse_int64(args[2].str.data, args[2].str.len, &delta)) {
         resp_write_error(client,
             "ERR value is not an integer or out of range");
         return;
     }
+    incr_by(client, store, args[1].str, delta);
+}
 
-    current++;
+static void cmd_decrby(client_t *client, hashtable_t *store,
+                       resp_value_t *args, int argc) {
+    (void)argc;
+    int64_t delta;
+    if (!parse_int64(args[2].str.data, args[2].str.len, &delta)) {
+        resp_write_error(client,
+            "ERR value is not an integer or out of range");
+        return;
+    }
+    if (delta == INT64_MIN) {
+        resp_write_error(client, "ERR decrement would overflow");
+        return;
+    }
+    incr_by(client, store, args[1].str, -delta);
+}
 
-    char buf[32];
-    int n = snprintf(buf, sizeof(buf), "%" PRId64, current);
-    rstr_t new_val = rstr_create(buf, (size_t)n);
-    ht_set(store, key, new_val);
-    if (expire_at != -1) {
-        ht_set_expire(store, key, expire_at);
+static void write_stat(client_t *client, const char *name, int64_t value) {
+    resp_write_bulk_string(client, name, strlen(name));
+    resp_write_integer(client, value);
+}
+
+/* MEMORY STATS: allocator totals as name/value pairs.
+   MEMORY SLABS: one [size, pages, used, free] entry per class in use. */
+static void cmd_memory(client_t *client, hashtable_t *store,
+                       resp_value_t *args, int argc) {
+    (void)argc;
+    rstr_t sub = args[1].str;
+    slab_stats_t st;
+    slab_get_stats(&st);
+
+    if (sub.len == 5 && strncasecmp(sub.data, "STATS", 5) == 0) {
+        /* slab-backed bytes against the bytes callers asked for */
+        char ratio[32];
+        int n = snprintf(ratio, sizeof(ratio), "%.2f",
+                         st.requested ? (double)st.reserved /
+                                        (double)st.requested : 0.0);
+        resp_write_array_header(client, 20);
+        write_stat(client, "rss.bytes", (int64_t)process_rss_bytes());
+        write_stat(client, "slab.requested", (int64_t)st.requested);
+        write_stat(client, "slab.allocated", (int64_t)st.allocated);
+        write_stat(client, "slab.reserved", (int64_t)st.reserved);
+        write_stat(client, "slab.pages", (int64_t)st.pages);
+        write_stat(client, "large.count", (int64_t)st.large_count);
+        write_stat(client, "large.bytes", (int64_t)st.large_bytes);
+        write_stat(client, "arena.reserved",
+                   (int64_t)arena_total_reserved());
+        write_stat(client, "keys", (int64_t)ht_count(store));
+        resp_write_bulk_string(client, "slab.fragmentation", 18);
+        resp_write_bulk_string(client, ratio, (size_t)n);
+        return;
     }
-    rstr_free(&new_val);
 
-    resp_write_integer(client, current);
+    if (sub.len == 5 && strncasecmp(sub.data, "SLABS", 5) == 0) {
+        int in_use = 0;
+        for (int i = 0; i < SLAB_NUM_CLASSES; i++) {
+            in_use += st.classes[i].pages > 0;
+        }
+        resp_write_array_header(client, in_use);
+        for (int i = 0; i < SLAB_NUM_CLASSES; i++) {
+            const slab_class_stats_t *cs = &st.classes[i];
+            if (cs->pages == 0) {
+                continue;
+            }
+            resp_write_array_header(client, 4);
+            resp_write_integer(client, (int64_t)cs->size);
+            resp_write_integer(client, (int64_t)cs->pages);
+            resp_write_integer(client, (int64_t)cs->used);
+            resp_write_integer(client, (int64_t)cs->free);
+        }
+        return;
+    }
+
+    resp_write_error(client, "ERR unknown subcommand for 'memory'");
 }
 
-static void cmd_decr(client_t *client, hashtable_t *store,
+/* "ip:port" of the client's peer, "?" if it can't be had. A Unix
+   domain peer has no name of its own: it is "path:0", the path being
+   the server's socket. True for a Unix domain socket. */
+static bool peer_name(int fd, char *buf, size_t size) {
+    struct sockaddr_storage ss;
+    socklen_t len = sizeof(ss);
+    char ip[INET_ADDRSTRLEN];
+    if (getsockname(fd, (struct sockaddr *)&ss, &len) == 0 &&
+        ss.ss_family == AF_UNIX) {
+        const struct sockaddr_un *un = (const struct sockaddr_un *)&ss;
+        snprintf(buf, size, "%s:0", un->sun_path);
+        return true;
+    }
+    len = sizeof(ss);
+    const struct sockaddr_in *in = (const struct sockaddr_in *)&ss;
+    if (getpeername(fd, (struct sockaddr *)&ss, &len) < 0 ||
+        ss.ss_family != AF_INET ||
+        !inet_ntop(AF_INET, &in->sin_addr, ip, sizeof(ip))) {
+        snprintf(buf, size, "?");
+        return false;
+    }
+    snprintf(buf, size, "%s:%u", ip, (unsigned)ntohs(in->sin_port));
+    return false;
+}
+
+/* CLIENT LIST: one line per connection of this loop (with --shards, of
+   every shard) with what its buffers hold: qbuf is input not yet
+   processed, omem output not yet sent, tot-mem the bytes it holds. */
+static void cmd_client(client_t *client, hashtable_t *store,
+                       resp_value_t *args, int argc) {
+    (void)store;
+    (void)argc;
+    if (!arg_is(args[1].str, "LIST")) {
+        resp_write_error(client, "ERR unknown subcommand for 'client'");
+        return;
+    }
+    const client_table_t *t = client_table_current();
+    int64_t now = clock_ms();
+    info_buf_t b = {NULL, 0, 0};
+    for (int i = 0; t && i < t->used; i++) {
+        const client_t *c = t->slots[i];
+        if (c->fd < 0) {
+            continue;
+        }
+        char addr[128];
+        bool unix_socket = peer_name(c->fd, addr, sizeof(addr));
+        char flags[4];
+        size_t nflags = 0;
+        if (c->replica >= 0) {
+            flags[nflags++] = 'S';
+        }
+        if (c->paused) {
+            flags[nflags++] = 'p';
+        }
+        if (unix_socket) {
+            flags[nflags++] = 'U';
+        }
+        if (nflags == 0) {
+            flags[nflags++] = 'N';
+        }
+        flags[nflags] = '\0';
+        info_printf(&b, "id=%" PRIu64 " addr=%s fd=%d idle=%lld flags=%s "
+                    "qbuf=%zu qbuf-free=%zu oll=%zu omem=%zu tot-mem=%zu\n",
+                    c->id, addr, c->fd,
+                    (long long)((now - c->last_active_ms) / 1000), flags,
+                    client_query_len(c), c->read_cap - c->read_len,
+                    client_reply_chunks(c), c->write_len, client_memory(c));
+    }
+    resp_write_bulk_string(client, b.data ? b.data : "", b.len);
+    free(b.data);
+}
+
+/* SAVE and BGSAVE failures, from errno. */
+static void write_save_error(client_t *client) {
+    if (errno == EBUSY) {
+        resp_write_error(client, "ERR Background save already in progress");
+        return;
+    }
+    if (errno == ENOTSUP) {
+        resp_write_error(client, "ERR snapshots are not supported with "
+                         "--shards");
+        return;
+    }
+    char err[128];
+    snprintf(err, sizeof(err), "ERR %s", strerror(errno));
+    resp_write_error(client, err);
+}
+
+static void cmd_save(client_t *client, hashtable_t *store,
                      resp_value_t *args, int argc) {
+    (void)args;
     (void)argc;
-    rstr_t key = args[1].str;
-    rstr_t *val = ht_get(store, key);
+    if (snapshot_save(store) < 0) {
+        write_save_error(client);
+        return;
+    }
+    resp_write_shared(client, RESP_SHARED_OK);
+}
 
-    int64_t current = 0;
-    int64_t expire_at = -1;
+static void cmd_bgsave(client_t *client, hashtable_t *store,
+                       resp_value_t *args, int argc) {
+    (void)args;
+    (void)argc;
+    if (snapshot_bgsave(store) < 0) {
+        write_save_error(client);
+        return;
+    }
+    resp_write_simple_string(client, "Background saving started");
+}
 
-    if (val) {
-        expire_at = ht_get_expire(store, key);
-        if (!parse_int64(val->data, val->len, &current)) {
+static void cmd_bgrewriteaof(client_t *client, hashtable_t *store,
+                             resp_value_t *args, int argc) {
+    (void)args;
+    (void)argc;
+    if (!aof_enabled()) {
+        resp_write_error(client, "ERR append only file is not enabled");
+        return;
+    }
+    if (aof_rewrite(store) < 0) {
+        if (errno == EBUSY) {
             resp_write_error(client,
-                "ERR value is not an integer or out of range");
-            return;
+                "ERR Background append only file rewriting already in "
+                "progress");
+        } else {
+            char err[128];
+            snprintf(err, sizeof(err), "ERR %s", strerror(errno));
+            resp_write_error(client, err);
         }
+        return;
     }
+    resp_write_simple_string(client,
+        "Background append only file rewriting started");
+}
 
-    /* underflow check */
-    if (current == INT64_MIN) {
-        resp_write_error(client,
-            "ERR value is not an integer or out of range");
+static void cmd_psync(client_t *client, hashtable_t *store,
+                      resp_value_t *args, int argc) {
+    (void)argc;
+    if (!repl_available()) {
+        resp_write_error(client, "ERR replication is not supported with "
+                         "--shards");
+        return;
+    }
+    if (repl_is_replica()) {
+        resp_write_error(client, "ERR chained replication is not supported");
+        return;
+    }
+    if (client->replica >= 0) {
+        resp_write_error(client, "ERR already a replica");
         return;
     }
+    repl_attach(client, store, args[1].str, args[2].str);
+}
 
-    current--;
+static void cmd_replicaof(client_t *client, hashtable_t *store,
+                          resp_value_t *args, int argc) {
+    (void)store;
+    (void)argc;
+    if (!repl_available()) {
+        resp_write_error(client, "ERR replication is not supported with "
+                         "--shards");
+        return;
+    }
+    rstr_t host = args[1].str;
+    rstr_t port = args[2].str;
+    if (host.len == 2 && strncasecmp(host.data, "no", 2) == 0 &&
+        port.len == 3 && strncasecmp(port.data, "one", 3) == 0) {
+        repl_set_primary(NULL, 0);
+        resp_write_shared(client, RESP_SHARED_OK);
+        return;
+    }
+    int64_t n;
+    char name[256];
+    if (!parse_int64(port.data, port.len, &n) || n < 1 || n > 65535) {
+        resp_write_error(client, "ERR Invalid master port");
+        return;
+    }
+    if (host.len == 0 || host.len >= sizeof(name) ||
+        memchr(host.data, '\0', host.len)) {
+        resp_write_error(client, "ERR Invalid master host");
+        return;
+    }
+    memcpy(name, host.data, host.len);
+    name[host.len] = '\0';
+    if (repl_set_primary(name, (int)n) < 0) {
+        resp_write_error(client, "ERR Can't resolve master host");
+        return;
+    }
+    resp_write_shared(client, RESP_SHARED_OK);
+}
 
-    char buf[32];
-    int n = snprintf(buf, sizeof(buf), "%" PRId64, current);
-    rstr_t new_val = rstr_create(buf, (size_t)n);
-    ht_set(store, key, new_val);
-    if (expire_at != -1) {
-        ht_set_expire(store, key, expire_at);
+static void cmd_role(client_t *client, hashtable_t *store,
+                     resp_value_t *args, int argc) {
+    (void)store;
+    (void)args;
+    (void)argc;
+    repl_write_role(client);
+}
+
+static void cmd_lastsave(client_t *client, hashtable_t *store,
+                         resp_value_t *args, int argc) {
+    (void)store;
+    (void)args;
+    (void)argc;
+    resp_write_integer(client, snapshot_lastsave());
+}
+
+static void info_memory(info_buf_t *b, hashtable_t *store) {
+    slab_stats_t st;
+    slab_get_stats(&st);
+    evict_info(b, store);
+    info_printf(b, "used_memory_rss:%zu\r\n", process_rss_bytes());
+    info_printf(b, "slab_requested:%zu\r\n", st.requested);
+    info_printf(b, "slab_reserved:%zu\r\n", st.reserved);
+    info_printf(b, "large_bytes:%zu\r\n", st.large_bytes);
+    info_printf(b, "arena_reserved:%zu\r\n", arena_total_reserved());
+    info_printf(b, "lazyfree_pending_objects:%zu\r\n", lazyfree_pending());
+}
+
+static void info_persistence(info_buf_t *b) {
+    info_printf(b, "rdb_bgsave_in_progress:%d\r\n",
+                snapshot_bgsave_running());
+    info_printf(b, "rdb_last_save_time:%" PRId64 "\r\n",
+                snapshot_lastsave());
+    info_printf(b, "aof_enabled:%d\r\n", aof_enabled());
+    info_printf(b, "aof_rewrite_in_progress:%d\r\n", aof_rewrite_running());
+}
+
+#define INFO_SERVER       0x001
+#define INFO_CLIENTS      0x002
+#define INFO_MEMORY       0x004
+#define INFO_PERSISTENCE  0x008
+#define INFO_STATS        0x010
+#define INFO_REPLICATION  0x020
+#define INFO_COMMANDSTATS 0x040
+#define INFO_LATENCYSTATS 0x080
+#define INFO_KEYSPACE     0x100
+#define INFO_DEFAULT      (INFO_SERVER | INFO_CLIENTS | INFO_MEMORY | \
+                           INFO_PERSISTENCE | INFO_STATS | \
+                           INFO_REPLICATION | INFO_KEYSPACE)
+#define INFO_ALL          (INFO_DEFAULT | INFO_COMMANDSTATS | \
+                           INFO_LATENCYSTATS)
+
+static const struct {
+    const char *name;
+    int mask;
+} info_sections[] = {
+    {"server", INFO_SERVER},
+    {"clients", INFO_CLIENTS},
+    {"memory", INFO_MEMORY},
+    {"persistence", INFO_PERSISTENCE},
+    {"stats", INFO_STATS},
+    {"replication", INFO_REPLICATION},
+    {"commandstats", INFO_COMMANDSTATS},
+    {"latencystats", INFO_LATENCYSTATS},
+    {"keyspace", INFO_KEYSPACE},
+    {"default", INFO_DEFAULT},
+    {"all", INFO_ALL},
+    {"everything", INFO_ALL},
+};
+
+/* INFO [section ...]: "# Name" headed blocks of name:value lines, as one
+   bulk string. Unknown sections are ignored. */
+static void cmd_info(client_t *client, hashtable_t *store,
+                     resp_value_t *args, int argc) {
+    int mask = argc == 1 ? INFO_DEFAULT : 0;
+    for (int i = 1; i < argc; i++) {
+        rstr_t s = args[i].str;
+        for (size_t j = 0; j < sizeof(info_sections) /
+                               sizeof(info_sections[0]); j++) {
+            if (strlen(info_sections[j].name) == s.len &&
+                strncasecmp(s.data, info_sections[j].name, s.len) == 0) {
+                mask |= info_sections[j].mask;
+            }
+        }
     }
-    rstr_free(&new_val);
 
-    resp_write_integer(client, current);
+    info_buf_t b = {NULL, 0, 0};
+    if (mask & INFO_SERVER) {
+        info_section(&b, "Server");
+        stats_info_server(&b);
+    }
+    if (mask & INFO_CLIENTS) {
+        info_section(&b, "Clients");
+        stats_info_clients(&b);
+    }
+    if (mask & INFO_MEMORY) {
+        info_section(&b, "Memory");
+        info_memory(&b, store);
+    }
+    if (mask & INFO_PERSISTENCE) {
+        info_section(&b, "Persistence");
+        info_persistence(&b);
+    }
+    if (mask & INFO_STATS) {
+        info_section(&b, "Stats");
+        stats_info_stats(&b);
+    }
+    if (mask & INFO_REPLICATION) {
+        info_section(&b, "Replication");
+        repl_info(&b);
+    }
+    if (mask & INFO_COMMANDSTATS) {
+        info_section(&b, "Commandstats");
+        stats_info_commandstats(&b);
+    }
+    if (mask & INFO_LATENCYSTATS) {
+        info_section(&b, "Latencystats");
+        stats_info_latencystats(&b);
+    }
+    if (mask & INFO_KEYSPACE) {
+        info_section(&b, "Keyspace");
+        if (ht_count(store) > 0) {
+            info_printf(&b, "db0:keys=%zu\r\n", ht_count(store));
+        }
+    }
+    resp_write_bulk_string(client, b.data ? b.data : "", b.len);
+    free(b.data);
+}
+
+/* SLOWLOG GET [count] | LEN | RESET */
+static void cmd_slowlog(client_t *client, hashtable_t *store,
+                        resp_value_t *args, int argc) {
+    (void)store;
+    rstr_t sub = args[1].str;
+    if (sub.len == 3 && strncasecmp(sub.data, "GET", 3) == 0) {
+        int64_t count = 10;
+        if (argc == 3 && (!parse_int64(args[2].str.data, args[2].str.len,
+                                       &count) || count < -1)) {
+            resp_write_error(client, "ERR count should be greater than or "
+                             "equal to -1");
+            return;
+        }
+        stats_write_slowlog(client, count);
+        return;
+    }
+    if (argc == 2 && sub.len == 3 && strncasecmp(sub.data, "LEN", 3) == 0) {
+        resp_write_integer(client, (int64_t)stats_slowlog_len());
+        return;
+    }
+    if (argc == 2 && sub.len == 5 && strncasecmp(sub.data, "RESET", 5) == 0) {
+        stats_slowlog_reset();
+        resp_write_shared(client, RESP_SHARED_OK);
+        return;
+    }
+    resp_write_error(client, "ERR unknown subcommand or wrong number of "
+                     "arguments for 'slowlog'");
+}
+
+/* LATENCY HISTOGRAM [command ...] */
+static void cmd_latency(client_t *client, hashtable_t *store,
+                        resp_value_t *args, int argc) {
+    (void)store;
+    rstr_t sub = args[1].str;
+    if (sub.len == 9 && strncasecmp(sub.data, "HISTOGRAM", 9) == 0) {
+        stats_write_latency_histogram(client, args + 2, argc - 2);
+        return;
+    }
+    resp_write_error(client, "ERR unknown subcommand for 'latency'");
 }
 
 typedef struct {
@@ -336,24 +1044,149 @@ typedef struct {
     cmd_handler_t handler;
     int min_args;
     int max_args;
+    int flags;
 } cmd_entry_t;
 
-static const cmd_entry_t command_table[] = {
-    {"PING",    cmd_ping,    1,  2},
-    {"ECHO",    cmd_echo,    2,  2},
-    {"SET",     cmd_set,     3,  5},
-    {"GET",     cmd_get,     2,  2},
-    {"DEL",     cmd_del,     2, -1},
-    {"EXISTS",  cmd_exists,  2, -1},
-    {"EXPIRE",  cmd_expire,  3,  3},
-    {"TTL",     cmd_ttl,     2,  2},
-    {"KEYS",    cmd_keys,    2,  2},
-    {"TYPE",    cmd_type,    2,  2},
-    {"INCR",    cmd_incr,    2,  2},
-    {"DECR",    cmd_decr,    2,  2},
-    {NULL,      NULL,        0,  0}
+/* Indexed by cmd_id_t */
+static const cmd_entry_t command_table[CMD_COUNT] = {
+#define X(id, name, handler, min_args, max_args, flags, ...) \
+    [CMD_##id] = {name, handler, min_args, max_args, flags},
+    COMMAND_LIST(X)
+#undef X
 };
 
+#define CMD_KEY(len, k0, k1, k2, k3) \
+    (((uint64_t)(len) << 32) | ((uint64_t)(k0) << 24) | \
+     ((uint64_t)(k1) << 16) | ((uint64_t)(k2) << 8) | (uint64_t)(k3))
+
+/* ASCII lowercase for letters; other bytes only need to be stable */
+static inline unsigned char fold(char c) {
+    return (unsigned char)c | 0x20;
+}
+
+cmd_id_t command_lookup(const char *name, size_t len) {
+    if (len < 2 || len > UINT32_MAX) {
+        return CMD_UNKNOWN;
+    }
+
+    cmd_id_t id;
+    switch (CMD_KEY(len, fold(name[0]), fold(name[1]),
+                    fold(name[len - 2]), fold(name[len - 1]))) {
+#define X(id_, name_, handler, min_args, max_args, flags, k0, k1, k2, k3) \
+    case CMD_KEY(sizeof(name_) - 1, k0, k1, k2, k3): \
+        id = CMD_##id_; \
+        break;
+    COMMAND_LIST(X)
+#undef X
+    default:
+        return CMD_UNKNOWN;
+    }
+
+    /* confirm the whole name, case-insensitively, without copying */
+    const char *expected = command_table[id].name;
+    for (size_t i = 0; i < len; i++) {
+        if (toupper((unsigned char)name[i]) != expected[i]) {
+            return CMD_UNKNOWN;
+        }
+    }
+    return id;
+}
+
+const char *command_name(cmd_id_t id) {
+    if (id < 0 || id >= CMD_COUNT) {
+        return NULL;
+    }
+    return command_table[id].name;
+}
+
+bool command_arity_ok(cmd_id_t id, int argc) {
+    const cmd_entry_t *entry = &command_table[id];
+    return argc >= entry->min_args &&
+           (entry->max_args == -1 || argc <= entry->max_args);
+}
+
+bool command_is_write(cmd_id_t id) {
+    return (command_table[id].flags & CMD_WRITE) != 0;
+}
+
+static void write_unknown_command(client_t *client, rstr_t name) {
+    char name_buf[64];
+    size_t name_len = name.len;
+    if (name_len >= sizeof(name_buf)) {
+        name_len = sizeof(name_buf) - 1;
+    }
+    for (size_t i = 0; i < name_len; i++) {
+        name_buf[i] = (char)toupper((unsigned char)name.data[i]);
+    }
+    name_buf[name_len] = '\0';
+
+    char err[128];
+    snprintf(err, sizeof(err), "ERR unknown command '%s'", name_buf);
+    resp_write_error(client, err);
+}
+
+static resp_value_t bulk(rstr_t s) {
+    resp_value_t v;
+    v.type = RESP_BULK_STRING;
+    v.str = s;
+    return v;
+}
+
+/* A write goes to every sink that wants it. */
+static void feed(const resp_value_t *argv, int argc) {
+    if (aof_enabled()) {
+        aof_append(argv, argc);
+    }
+    repl_feed(argv, argc);
+}
+
+/* Log key's state as it is now: SET (plus PEXPIREAT for a TTL), or DEL
+   when the command left it missing. */
+static void propagate_key(hashtable_t *store, rstr_t key, bool with_value) {
+    resp_value_t argv[3];
+    char num[24];
+    ht_entry_t *e = ht_find(store, key);
+    argv[1] = bulk(key);
+    if (!e) {
+        argv[0] = bulk((rstr_t){"DEL", 3});
+        feed(argv, 2);
+        return;
+    }
+    if (with_value) {
+        int64_t n;
+        rstr_t value;
+        if (ht_entry_int(e, &n)) {
+            value.data = num;
+            value.len = (size_t)snprintf(num, sizeof(num), "%" PRId64, n);
+        } else {
+            value = ht_entry_value(store, e);
+        }
+        argv[0] = bulk((rstr_t){"SET", 3});
+        argv[2] = bulk(value);
+        feed(argv, 3);
+    }
+    int64_t expire_at = ht_entry_expire(e);
+    if (expire_at >= 0) {
+        argv[0] = bulk((rstr_t){"PEXPIREAT", 9});
+        argv[2] = bulk((rstr_t){num, (size_t)snprintf(num, sizeof(num),
+                                                      "%" PRId64, expire_at)});
+        feed(argv, 3);
+    }
+}
+
+/* Hand a write to the AOF and the replicas. Commands are logged as
+   sent, except those taking a relative TTL, which would restart it on
+   every replay: for SET ... EX and EXPIRE the key's resulting state is
+   logged instead. */
+static void propagate(hashtable_t *store, cmd_id_t id, resp_value_t *args,
+                      int argc) {
+    if ((id == CMD_SET && argc > 3) || id == CMD_EXPIRE) {
+        propagate_key(store, args[1].str, id == CMD_SET);
+        return;
+    }
+    feed(args, argc);
+}
+
 void dispatch_command(client_t *client, hashtable_t *store,
                       resp_value_t *cmd) {
     if (cmd->type != RESP_ARRAY || cmd->array.count == 0) {
@@ -372,43 +1205,42 @@ void dispatch_command(client_t *client, hashtable_t *store,
     resp_value_t *args = cmd->array.elements;
     int argc = cmd->array.count;
 
-    /* Convert command name to uppercase for comparison */
-    char name_buf[64];
-    size_t name_len = args[0].str.len;
-    if (name_len >= sizeof(name_buf)) {
-        name_len = sizeof(name_buf) - 1;
-    }
-    for (size_t i = 0; i < name_len; i++) {
-        name_buf[i] = (char)toupper((unsigned char)args[0].str.data[i]);
+    cmd_id_t id = command_lookup(args[0].str.data, args[0].str.len);
+    if (id == CMD_UNKNOWN) {
+        write_unknown_command(client, args[0].str);
+        return;
     }
-    name_buf[name_len] = '\0';
 
-    for (int i = 0; command_table[i].name != NULL; i++) {
-        if (strcmp(name_buf, command_table[i].name) == 0) {
-            if (argc < command_table[i].min_args) {
-                char err[128];
-                snprintf(err, sizeof(err),
-                    "ERR wrong number of arguments for '%s' command",
-                    command_table[i].name);
-                resp_write_error(client, err);
-                return;
-            }
-            if (command_table[i].max_args != -1 &&
-                argc > command_table[i].max_args) {
-                char err[128];
-                snprintf(err, sizeof(err),
-                    "ERR wrong number of arguments for '%s' command",
-                    command_table[i].name);
-                resp_write_error(client, err);
-                return;
-            }
-            command_table[i].handler(client, store, args, argc);
-            return;
-        }
+    const cmd_entry_t *entry = &command_table[id];
+    if (!command_arity_ok(id, argc)) {
+        char err[128];
+        snprintf(err, sizeof(err),
+            "ERR wrong number of arguments for '%s' command",
+            entry->name);
+        resp_write_error(client, err);
+        return;
     }
-
-    /* Unknown command */
-    char err[128];
-    snprintf(err, sizeof(err), "ERR unknown command '%s'", name_buf);
-    resp_write_error(client, err);
+    if ((entry->flags & CMD_WRITE) && repl_readonly(client)) {
+        resp_write_error(client,
+            "READONLY You can't write against a read only replica.");
+        return;
+    }
+    /* a replica leaves eviction to its primary, which sends the DELs;
+       an AOF being replayed already holds what was allowed in */
+    if ((entry->flags & CMD_DENYOOM) && evict_maxmemory() > 0 &&
+        !repl_is_replica() && !aof_loading() && !evict_make_room(store)) {
+        resp_write_error(client,
+            "OOM command not allowed when used memory > 'maxmemory'.");
+        return;
+    }
+    uint64_t start = stats_ticks();
+    uint64_t errors = client->error_replies;
+    entry->handler(client, store, args, argc);
+    /* a write that was refused changed nothing, and would only fail
+       again on replay */
+    if ((entry->flags & CMD_WRITE) && client->error_replies == errors &&
+        (aof_enabled() || repl_feeding())) {
+        propagate(store, id, args, argc);
+    }
+    stats_record_command(id, stats_ticks() - start, args, argc);
 }
@@ -8,6 +8,72 @@
 typedef void (*cmd_handler_t)(client_t *client, hashtable_t *store,
                               resp_value_t *args, int argc);
 
+/* The command table. Each entry is
+     X(ID, name, handler, min_args, max_args, flags, k0, k1, k2, k3)
+   where flags is 0 or CMD_WRITE (the command can change the store, so
+   it is appended to the AOF, streamed to replicas and refused on a
+   replica), plus CMD_DENYOOM for writes that can add data (under
+   --maxmemory keys are evicted to make room first, and the command is
+   refused if that fails; CMD_GROW is both), and k0..k3 are the
+   lowercase first two and last two characters of the name.
+   dispatch_command() switches on (length, k0..k3), so two commands with
+   the same key fail to compile as duplicate case labels; add another
+   distinguishing character to CMD_KEY if that happens. */
+#define CMD_WRITE 0x1
+#define CMD_DENYOOM 0x2
+#define CMD_GROW (CMD_WRITE | CMD_DENYOOM)
+
+#define COMMAND_LIST(X) \
+    X(PING,     "PING",     cmd_ping,     1,  2, 0,         'p', 'i', 'n', 'g') \
+    X(ECHO,     "ECHO",     cmd_echo,     2,  2, 0,         'e', 'c', 'h', 'o') \
+    X(SET,      "SET",      cmd_set,      3,  5, CMD_GROW,  's', 'e', 'e', 't') \
+    X(GET,      "GET",      cmd_get,      2,  2, 0,         'g', 'e', 'e', 't') \
+    X(MGET,     "MGET",     cmd_mget,     2, -1, 0,         'm', 'g', 'e', 't') \
+    X(MSET,     "MSET",     cmd_mset,     3, -1, CMD_GROW,  'm', 's', 'e', 't') \
+    X(MSETNX,   "MSETNX",   cmd_msetnx,   3, -1, CMD_GROW,  'm', 's', 'n', 'x') \
+    X(DEL,      "DEL",      cmd_del,      2, -1, CMD_WRITE, 'd', 'e', 'e', 'l') \
+    X(UNLINK,   "UNLINK",   cmd_unlink,   2, -1, CMD_WRITE, 'u', 'n', 'n', 'k') \
+    X(EXISTS,   "EXISTS",   cmd_exists,   2, -1, 0,         'e', 'x', 't', 's') \
+    X(EXPIRE,   "EXPIRE",   cmd_expire,   3,  3, CMD_WRITE, 'e', 'x', 'r', 'e') \
+    X(PEXPIREAT, "PEXPIREAT", cmd_pexpireat, 3, 3, CMD_WRITE, 'p', 'e', 'a', 't') \
+    X(TTL,      "TTL",      cmd_ttl,      2,  2, 0,         't', 't', 't', 'l') \
+    X(KEYS,     "KEYS",     cmd_keys,     2,  2, 0,         'k', 'e', 'y', 's') \
+    X(SCAN,     "SCAN",     cmd_scan,     2, -1, 0,         's', 'c', 'a', 'n') \
+    X(TYPE,     "TYPE",     cmd_type,     2,  2, 0,         't', 'y', 'p', 'e') \
+    X(FLUSHALL, "FLUSHALL", cmd_flushall, 1,  2, CMD_WRITE, 'f', 'l', 'l', 'l') \
+    X(FLUSHDB,  "FLUSHDB",  cmd_flushall, 1,  2, CMD_WRITE, 'f', 'l', 'd', 'b') \
+    X(INCR,     "INCR",     cmd_incr,     2,  2, CMD_GROW,  'i', 'n', 'c', 'r') \
+    X(DECR,     "DECR",     cmd_decr,     2,  2, CMD_GROW,  'd', 'e', 'c', 'r') \
+    X(INCRBY,   "INCRBY",   cmd_incrby,   3,  3, CMD_GROW,  'i', 'n', 'b', 'y') \
+    X(DECRBY,   "DECRBY",   cmd_decrby,   3,  3, CMD_GROW,  'd', 'e', 'b', 'y') \
+    X(MEMORY,   "MEMORY",   cmd_memory,   2,  2, 0,         'm', 'e', 'r', 'y') \
+    X(CLIENT,   "CLIENT",   cmd_client,   2,  2, 0,         'c', 'l', 'n', 't') \
+    X(SAVE,     "SAVE",     cmd_save,     1,  1, 0,         's', 'a', 'v', 'e') \
+    X(BGSAVE,   "BGSAVE",   cmd_bgsave,   1,  1, 0,         'b', 'g', 'v', 'e') \
+    X(LASTSAVE, "LASTSAVE", cmd_lastsave, 1,  1, 0,         'l', 'a', 'v', 'e') \
+    X(BGREWRITEAOF, "BGREWRITEAOF", cmd_bgrewriteaof, 1, 1, 0, 'b', 'g', 'o', 'f') \
+    X(PSYNC,    "PSYNC",    cmd_psync,    3,  3, 0,         'p', 's', 'n', 'c') \
+    X(REPLICAOF, "REPLICAOF", cmd_replicaof, 3, 3, 0,       'r', 'e', 'o', 'f') \
+    X(ROLE,     "ROLE",     cmd_role,     1,  1, 0,         'r', 'o', 'l', 'e') \
+    X(INFO,     "INFO",     cmd_info,     1, -1, 0,         'i', 'n', 'f', 'o') \
+    X(SLOWLOG,  "SLOWLOG",  cmd_slowlog,  2,  3, 0,         's', 'l', 'o', 'g') \
+    X(LATENCY,  "LATENCY",  cmd_latency,  2, -1, 0,         'l', 'a', 'c', 'y')
+
+typedef enum {
+    CMD_UNKNOWN = -1,
+#define X(id, ...) CMD_##id,
+    COMMAND_LIST(X)
+#undef X
+    CMD_COUNT
+} cmd_id_t;
+
+/* Case-insensitive lookup of a command name; CMD_UNKNOWN if none. */
+cmd_id_t command_lookup(const char *name, size_t len);
+const char *command_name(cmd_id_t id);
+/* Whether argc (including the name) is within the command's arity. */
+bool command_arity_ok(cmd_id_t id, int argc);
+bool command_is_write(cmd_id_t id);
+
 void dispatch_command(client_t *client, hashtable_t *store,
                       resp_value_t *cmd);
 
@@ -0,0 +1,311 @@
+#include "event.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+
+#ifdef __linux__
+#include <sys/epoll.h>
+#define HAVE_EPOLL 1
+#endif
+
+#define EV_INITIAL_SIZE 64
+
+struct event_loop {
+    ev_backend_t backend;
+
+    /* poll backend: a persistent pollfd array, compacted by swap-remove.
+       fd_index maps fd -> position in fds (or -1). */
+    struct pollfd *fds;
+    int *tokens;
+    int nfds;
+    int cap;
+    int *fd_index;
+    int fd_index_cap;
+
+#ifdef HAVE_EPOLL
+    int epfd;
+    struct epoll_event *events;
+    int events_cap;
+#endif
+};
+
+static void *xrealloc(void *ptr, size_t size) {
+    void *p = realloc(ptr, size);
+    if (!p) {
+        perror("realloc");
+        exit(1);
+    }
+    return p;
+}
+
+/* ---- poll backend ---- */
+
+static void poll_grow_index(event_loop_t *el, int fd) {
+    if (fd < el->fd_index_cap) {
+        return;
+    }
+    int new_cap = el->fd_index_cap ? el->fd_index_cap : EV_INITIAL_SIZE;
+    while (new_cap <= fd) {
+        new_cap *= 2;
+    }
+    el->fd_index = xrealloc(el->fd_index, (size_t)new_cap * sizeof(int));
+    for (int i = el->fd_index_cap; i < new_cap; i++) {
+        el->fd_index[i] = -1;
+    }
+    el->fd_index_cap = new_cap;
+}
+
+static short poll_events(int mask) {
+    short events = 0;
+    if (mask & EV_READABLE) {
+        events |= POLLIN;
+    }
+    if (mask & EV_WRITABLE) {
+        events |= POLLOUT;
+    }
+    return events;
+}
+
+static int poll_add(event_loop_t *el, int fd, int mask, int token) {
+    poll_grow_index(el, fd);
+    if (el->fd_index[fd] != -1) {
+        errno = EEXIST;
+        return -1;
+    }
+    if (el->nfds == el->cap) {
+        el->cap = el->cap ? el->cap * 2 : EV_INITIAL_SIZE;
+        el->fds = xrealloc(el->fds, (size_t)el->cap * sizeof(struct pollfd));
+        el->tokens = xrealloc(el->tokens, (size_t)el->cap * sizeof(int));
+    }
+    int i = el->nfds++;
+    el->fds[i].fd = fd;
+    el->fds[i].events = poll_events(mask);
+    el->fds[i].revents = 0;
+    el->tokens[i] = token;
+    el->fd_index[fd] = i;
+    return 0;
+}
+
+static int poll_modify(event_loop_t *el, int fd, int mask, int token) {
+    if (fd >= el->fd_index_cap || el->fd_index[fd] == -1) {
+        errno = ENOENT;
+        return -1;
+    }
+    int i = el->fd_index[fd];
+    el->fds[i].events = poll_events(mask);
+    el->tokens[i] = token;
+    return 0;
+}
+
+static void poll_del(event_loop_t *el, int fd) {
+    if (fd >= el->fd_index_cap || el->fd_index[fd] == -1) {
+        return;
+    }
+    int i = el->fd_index[fd];
+    int last = el->nfds - 1;
+    if (i != last) {
+        el->fds[i] = el->fds[last];
+        el->tokens[i] = el->tokens[last];
+        el->fd_index[el->fds[i].fd] = i;
+    }
+    el->fd_index[fd] = -1;
+    el->nfds--;
+}
+
+static int poll_wait(event_loop_t *el, ev_fired_t *fired, int max,
+                     int timeout_ms) {
+    int ready = poll(el->fds, (nfds_t)el->nfds, timeout_ms);
+    if (ready <= 0) {
+        return ready;
+    }
+
+    int n = 0;
+    for (int i = 0; i < el->nfds && n < max && ready > 0; i++) {
+        short re = el->fds[i].revents;
+        if (re == 0) {
+            continue;
+        }
+        ready--;
+        int mask = 0;
+        if (re & POLLIN) {
+            mask |= EV_READABLE;
+        }
+        if (re & POLLOUT) {
+            mask |= EV_WRITABLE;
+        }
+        if (re & (POLLERR | POLLHUP | POLLNVAL)) {
+            mask |= EV_ERROR;
+        }
+        fired[n].fd = el->fds[i].fd;
+        fired[n].token = el->tokens[i];
+        fired[n].mask = mask;
+        n++;
+    }
+    return n;
+}
+
+/* ---- epoll backend (edge-triggered) ---- */
+
+#ifdef HAVE_EPOLL
+static uint64_t epoll_pack(int fd, int token) {
+    return ((uint64_t)(uint32_t)token << 32) | (uint32_t)fd;
+}
+
+static int epoll_ctl_mask(event_loop_t *el, int op, int fd, int mask,
+                          int token) {
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLET;
+    if (mask & EV_READABLE) {
+        ev.events |= EPOLLIN;
+    }
+    if (mask & EV_WRITABLE) {
+        ev.events |= EPOLLOUT;
+    }
+    ev.data.u64 = epoll_pack(fd, token);
+    return epoll_ctl(el->epfd, op, fd, &ev);
+}
+
+static int epoll_backend_wait(event_loop_t *el, ev_fired_t *fired, int max,
+                              int timeout_ms) {
+    if (max > el->events_cap) {
+        el->events = xrealloc(el->events,
+                              (size_t)max * sizeof(struct epoll_event));
+        el->events_cap = max;
+    }
+
+    int ready = epoll_wait(el->epfd, el->events, max, timeout_ms);
+    for (int i = 0; i < ready; i++) {
+        uint32_t re = el->events[i].events;
+        uint64_t data = el->events[i].data.u64;
+        int mask = 0;
+        if (re & EPOLLIN) {
+            mask |= EV_READABLE;
+        }
+        if (re & EPOLLOUT) {
+            mask |= EV_WRITABLE;
+        }
+        if (re & (EPOLLERR | EPOLLHUP)) {
+            mask |= EV_ERROR;
+        }
+        fired[i].fd = (int)(uint32_t)(data & 0xffffffffu);
+        fired[i].token = (int)(uint32_t)(data >> 32);
+        fired[i].mask = mask;
+    }
+    return ready;
+}
+#endif
+
+/* ---- public API ---- */
+
+event_loop_t *ev_create(ev_backend_t backend) {
+#ifndef HAVE_EPOLL
+    if (backend == EV_BACKEND_EPOLL) {
+        return NULL;
+    }
+#endif
+
+    event_loop_t *el = calloc(1, sizeof(event_loop_t));
+    if (!el) {
+        perror("calloc");
+        exit(1);
+    }
+    el->backend = backend;
+
+#ifdef HAVE_EPOLL
+    el->epfd = -1;
+    if (backend == EV_BACKEND_EPOLL) {
+        el->epfd = epoll_create1(EPOLL_CLOEXEC);
+        if (el->epfd < 0) {
+            free(el);
+            return NULL;
+        }
+    }
+#endif
+    return el;
+}
+
+void ev_destroy(event_loop_t *el) {
+    if (!el) {
+        return;
+    }
+#ifdef HAVE_EPOLL
+    if (el->epfd >= 0) {
+        close(el->epfd);
+    }
+    free(el->events);
+#endif
+    free(el->fds);
+    free(el->tokens);
+    free(el->fd_index);
+    free(el);
+}
+
+int ev_add(event_loop_t *el, int fd, int mask, int token) {
+#ifdef HAVE_EPOLL
+    if (el->backend == EV_BACKEND_EPOLL) {
+        return epoll_ctl_mask(el, EPOLL_CTL_ADD, fd, mask, token);
+    }
+#endif
+    return poll_add(el, fd, mask, token);
+}
+
+int ev_modify(event_loop_t *el, int fd, int mask, int token) {
+#ifdef HAVE_EPOLL
+    if (el->backend == EV_BACKEND_EPOLL) {
+        return epoll_ctl_mask(el, EPOLL_CTL_MOD, fd, mask, token);
+    }
+#endif
+    return poll_modify(el, fd, mask, token);
+}
+
+void ev_del(event_loop_t *el, int fd) {
+#ifdef HAVE_EPOLL
+    if (el->backend == EV_BACKEND_EPOLL) {
+        epoll_ctl(el->epfd, EPOLL_CTL_DEL, fd, NULL);
+        return;
+    }
+#endif
+    poll_del(el, fd);
+}
+
+int ev_wait(event_loop_t *el, ev_fired_t *fired, int max, int timeout_ms) {
+#ifdef HAVE_EPOLL
+    if (el->backend == EV_BACKEND_EPOLL) {
+        return epoll_backend_wait(el, fired, max, timeout_ms);
+    }
+#endif
+    return poll_wait(el, fired, max, timeout_ms);
+}
+
+bool ev_edge_triggered(const event_loop_t *el) {
+    return el->backend == EV_BACKEND_EPOLL;
+}
+
+const char *ev_backend_name(const event_loop_t *el) {
+    return el->backend == EV_BACKEND_EPOLL ? "epoll" : "poll";
+}
+
+bool ev_backend_parse(const char *name, ev_backend_t *out) {
+    if (strcmp(name, "poll") == 0) {
+        *out = EV_BACKEND_POLL;
+        return true;
+    }
+    if (strcmp(name, "epoll") == 0) {
+        *out = EV_BACKEND_EPOLL;
+        return true;
+    }
+    return false;
+}
+
+ev_backend_t ev_default_backend(void) {
+#ifdef HAVE_EPOLL
+    return EV_BACKEND_EPOLL;
+#else
+    return EV_BACKEND_POLL;
+#endif
+}
@@ -0,0 +1,44 @@
+#ifndef EVENT_H
+#define EVENT_H
+
+#include <stdbool.h>
+
+/* Interest / readiness bits */
+#define EV_READABLE 0x1
+#define EV_WRITABLE 0x2
+#define EV_ERROR    0x4   /* only reported, never requested */
+
+typedef enum {
+    EV_BACKEND_POLL,
+    EV_BACKEND_EPOLL
+} ev_backend_t;
+
+typedef struct {
+    int fd;
+    int token;          /* caller-supplied id passed to ev_add() */
+    int mask;           /* EV_READABLE | EV_WRITABLE | EV_ERROR */
+} ev_fired_t;
+
+typedef struct event_loop event_loop_t;
+
+/* Returns NULL if the backend is unavailable on this platform. */
+event_loop_t *ev_create(ev_backend_t backend);
+void ev_destroy(event_loop_t *el);
+
+/* File descriptors are registered once; only the interest mask changes
+   afterwards. Edge-triggered backends require the caller to drain reads
+   and writes until EAGAIN. */
+int ev_add(event_loop_t *el, int fd, int mask, int token);
+int ev_modify(event_loop_t *el, int fd, int mask, int token);
+void ev_del(event_loop_t *el, int fd);
+
+/* Wait up to timeout_ms. Returns the number of entries written to
+   fired (at most max), 0 on timeout, -1 on error (errno set). */
+int ev_wait(event_loop_t *el, ev_fired_t *fired, int max, int timeout_ms);
+
+bool ev_edge_triggered(const event_loop_t *el);
+const char *ev_backend_name(const event_loop_t *el);
+bool ev_backend_parse(const char *name, ev_backend_t *out);
+ev_backend_t ev_default_backend(void);
+
+#endif
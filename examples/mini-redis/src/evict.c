@@ -0,0 +1,175 @@
+#include "evict.h"
+#include "aof.h"
+#include "arena.h"
+#include "client.h"
+#include "repl.h"
+#include "slab.h"
+#include <string.h>
+
+/* Slots of a flushed table released per check while over the limit */
+#define EVICT_LAZYFREE_SLOTS 1024
+
+/* Set by evict_config() before any thread starts, read-only after. */
+static size_t maxmemory;
+static size_t shard_limit;
+static evict_policy_t policy = EVICT_NOEVICTION;
+static int samples = EVICT_DEFAULT_SAMPLES;
+static int shards = 1;
+
+static const struct {
+    const char *name;
+    evict_policy_t policy;
+} policies[] = {
+    {"noeviction", EVICT_NOEVICTION},
+    {"allkeys-lru", EVICT_ALLKEYS_LRU},
+    {"allkeys-lfu", EVICT_ALLKEYS_LFU},
+    {"volatile-ttl", EVICT_VOLATILE_TTL},
+};
+
+bool evict_policy_parse(const char *name, evict_policy_t *out) {
+    for (size_t i = 0; i < sizeof(policies) / sizeof(policies[0]); i++) {
+        if (strcmp(name, policies[i].name) == 0) {
+            *out = policies[i].policy;
+            return true;
+        }
+    }
+    return false;
+}
+
+const char *evict_policy_name(evict_policy_t p) {
+    for (size_t i = 0; i < sizeof(policies) / sizeof(policies[0]); i++) {
+        if (policies[i].policy == p) {
+            return policies[i].name;
+        }
+    }
+    return "unknown";
+}
+
+void evict_config(size_t limit, evict_policy_t p, int nsamples,
+                  int nshards) {
+    maxmemory = limit;
+    policy = p;
+    samples = nsamples < 1 ? 1 : nsamples > EVICT_MAX_SAMPLES ?
+              EVICT_MAX_SAMPLES : nsamples;
+    shards = nshards < 1 ? 1 : nshards;
+    shard_limit = limit / (size_t)shards;
+
+    /* without a limit nothing is evicted, so lookups needn't record */
+    ht_access_t mode = HT_ACCESS_NONE;
+    if (limit > 0 && p == EVICT_ALLKEYS_LRU) {
+        mode = HT_ACCESS_LRU;
+    } else if (limit > 0 && p == EVICT_ALLKEYS_LFU) {
+        mode = HT_ACCESS_LFU;
+    }
+    ht_set_access_mode(mode);
+}
+
+size_t evict_maxmemory(void) {
+    return maxmemory;
+}
+
+static size_t shared_memory(void) {
+    return client_buffers_total() + arena_total_reserved();
+}
+
+size_t evict_used_memory(hashtable_t *store) {
+    return slab_used_bytes() + ht_memory(store) + shared_memory();
+}
+
+/* What the limit is checked against. Like Redis, output waiting for
+   replicas is left out: evicting for it would stream them DELs and
+   queue more. So is a table being drained by a rehash, which goes once
+   migration finishes; a same-size rehash that clears tombstones holds
+   two tables for that long. */
+static size_t charged_memory(hashtable_t *store) {
+    size_t shared = shared_memory();
+    for (int i = 0; i < repl_replica_count(); i++) {
+        size_t pending = repl_replica(i)->write_len;
+        shared -= pending < shared ? pending : shared;
+    }
+    return slab_used_bytes() + ht_memory(store) -
+           ht_memory_draining(store) + shared / (size_t)shards;
+}
+
+static ht_entry_t *pick_victim(hashtable_t *store) {
+    if (policy == EVICT_VOLATILE_TTL) {
+        return ht_next_expiring(store);
+    }
+    ht_entry_t *sample[EVICT_MAX_SAMPLES];
+    size_t n = ht_sample(store, sample, (size_t)samples);
+    ht_entry_t *best = NULL;
+    uint64_t best_score = 0;
+    for (size_t i = 0; i < n; i++) {
+        /* the longest idle, or the least used */
+        uint64_t score = policy == EVICT_ALLKEYS_LRU ?
+                         ht_entry_idle_ms(sample[i]) :
+                         UINT8_MAX - ht_entry_lfu(sample[i]);
+        if (!best || score > best_score) {
+            best = sample[i];
+            best_score = score;
+        }
+    }
+    return best;
+}
+
+static void evict_entry(hashtable_t *store, ht_entry_t *e) {
+    if (aof_enabled() || repl_feeding()) {
+        resp_value_t argv[2];
+        argv[0].type = RESP_BULK_STRING;
+        argv[0].str = (rstr_t){"DEL", 3};
+        argv[1].type = RESP_BULK_STRING;
+        argv[1].str = ht_entry_key(e);
+        if (aof_enabled()) {
+            aof_append(argv, 2);
+        }
+        repl_feed(argv, 2);
+    }
+    ht_entry_delete(store, e);
+}
+
+/* A table doubling that would not fit is headed off by evicting until
+   the next new key only reuses tombstones, at most down to half the
+   load that doubles the table; with nothing to evict it is refused like
+   any write past the limit. Every key is evicted at most once per
+   insert, so this stays amortized O(samples) per write. */
+bool evict_make_room(hashtable_t *store) {
+    if (maxmemory == 0) {
+        return true;
+    }
+    size_t evicted = 0;
+    bool ok = true;
+    for (;;) {
+        size_t used = charged_memory(store);
+        size_t growth = ht_growth_pending(store);
+        bool over = used > shard_limit;
+        if (!over && (growth == 0 || used + growth <= shard_limit)) {
+            break;
+        }
+        if (over && ht_lazyfree_pending(store)) {
+            /* a flushed table is on its way out: free it, not keys */
+            ht_lazyfree_step(store, EVICT_LAZYFREE_SLOTS);
+            continue;
+        }
+        ht_entry_t *victim = policy == EVICT_NOEVICTION ? NULL :
+                             pick_victim(store);
+        if (!victim) {
+            ok = false;
+            break;
+        }
+        evict_entry(store, victim);
+        evicted++;
+    }
+    if (evicted > 0) {
+        stats_record_evictions(evicted);
+    }
+    return ok;
+}
+
+void evict_info(info_buf_t *b, hashtable_t *store) {
+    info_printf(b, "used_memory:%zu\r\n", evict_used_memory(store));
+    info_printf(b, "used_memory_table:%zu\r\n", ht_memory(store));
+    info_printf(b, "used_memory_clients:%zu\r\n", shared_memory());
+    info_printf(b, "maxmemory:%zu\r\n", maxmemory);
+    info_printf(b, "maxmemory_policy:%s\r\n", evict_policy_name(policy));
+    info_printf(b, "maxmemory_samples:%d\r\n", samples);
+}
@@ -0,0 +1,52 @@
+#ifndef EVICT_H
+#define EVICT_H
+
+#include "hashtable.h"
+#include "stats.h"
+#include <stdbool.h>
+#include <stddef.h>
+
+/* Default for --maxmemory-samples: keys looked at per eviction. */
+#define EVICT_DEFAULT_SAMPLES 5
+#define EVICT_MAX_SAMPLES 64
+
+/* A memory limit (--maxmemory) and what to do when a write would go
+   past it (--maxmemory-policy). The LRU and LFU policies evict the best
+   of a few randomly sampled keys by their access bits (ht_access_t), so
+   an eviction costs O(samples) and nothing keeps keys in order;
+   volatile-ttl takes the key nearest to expiring from the expiry index.
+   noeviction, and any policy that finds nothing to evict, refuses the
+   write instead. */
+typedef enum {
+    EVICT_NOEVICTION,
+    EVICT_ALLKEYS_LRU,
+    EVICT_ALLKEYS_LFU,
+    EVICT_VOLATILE_TTL
+} evict_policy_t;
+
+bool evict_policy_parse(const char *name, evict_policy_t *policy);
+const char *evict_policy_name(evict_policy_t policy);
+
+/* Before the stores are created. maxmemory 0 means no limit. With
+   --shards each shard keeps to its share, nshards-th of the limit. Sets
+   the hash table access mode the policy needs. */
+void evict_config(size_t maxmemory, evict_policy_t policy, int samples,
+                  int nshards);
+size_t evict_maxmemory(void);
+
+/* This thread's figure: its allocator's live bytes (keys and values),
+   its store's tables and the request arenas and buffers of every
+   client. */
+size_t evict_used_memory(hashtable_t *store);
+
+/* Before a command that adds data: evict keys until the thread's share
+   of used memory is within its share of the limit, and until the next
+   new key can double the table within it. Each eviction is sent to the
+   AOF and replicas as a DEL. False when there is nothing left to evict
+   short of that, and the command must be refused. */
+bool evict_make_room(hashtable_t *store);
+
+/* INFO memory: used memory and the limit. */
+void evict_info(info_buf_t *b, hashtable_t *store);
+
+#endif
@@ -1,12 +1,16 @@
 #include "glob.h"
+#include <stdint.h>
+#include <string.h>
 
-static bool match_char_class(const char *pattern, size_t plen,
-                             size_t *pi, char c) {
-    size_t i = *pi;
+/* Parse the class opening at pattern[i] == '[' into a 256-bit member set
+   (negation applied). Returns the index just past ']', or 0 if the class
+   is unterminated; an unterminated '[' is an ordinary character. */
+static size_t parse_class(const char *pattern, size_t plen, size_t i,
+                          uint64_t bits[4]) {
     /* skip past '[' */
     i++;
     if (i >= plen) {
-        return false;
+        return 0;
     }
 
     bool negate = false;
@@ -15,37 +19,43 @@ static bool match_char_class(const char *pattern, size_t plen,
         i++;
     }
 
-    bool matched = false;
+    memset(bits, 0, 4 * sizeof(uint64_t));
     bool first = true;
 
     while (i < plen && (pattern[i] != ']' || first)) {
         first = false;
-        char lo = pattern[i];
-        char hi = lo;
+        unsigned lo = (unsigned char)pattern[i];
+        unsigned hi = lo;
 
         if (i + 2 < plen && pattern[i + 1] == '-' && pattern[i + 2] != ']') {
-            hi = pattern[i + 2];
+            hi = (unsigned char)pattern[i + 2];
             i += 3;
         } else {
             i++;
         }
 
-        if ((unsigned char)c >= (unsigned char)lo &&
-            (unsigned char)c <= (unsigned char)hi) {
-            matched = true;
+        for (unsigned c = lo; c <= hi; c++) {
+            bits[c >> 6] |= (uint64_t)1 << (c & 63);
         }
     }
 
     if (i >= plen) {
         /* no closing ']' found */
-        return false;
+        return 0;
     }
 
+    if (negate) {
+        for (int w = 0; w < 4; w++) {
+            bits[w] = ~bits[w];
+        }
+    }
     /* skip past ']' */
-    i++;
-    *pi = i;
+    return i + 1;
+}
 
-    return negate ? !matched : matched;
+static bool class_has(const uint64_t bits[4], char c) {
+    unsigned char u = (unsigned char)c;
+    return (bits[u >> 6] >> (u & 63)) & 1;
 }
 
 bool glob_match(const char *pattern, size_t plen,
@@ -53,6 +63,7 @@ bool glob_match(const char *pattern, size_t plen,
     size_t pi = 0, si = 0;
     size_t star_pi = (size_t)-1;
     size_t star_si = (size_t)-1;
+    uint64_t bits[4];
 
     while (si < slen) {
         if (pi < plen && pattern[pi] == '*') {
@@ -61,19 +72,21 @@ bool glob_match(const char *pattern, size_t plen,
             pi++;
             continue;
         }
-        if (pi < plen && (pattern[pi] == '?' ||
-                          pattern[pi] == str[si])) {
-            pi++;
-            si++;
-            continue;
-        }
+        size_t class_end = 0;
         if (pi < plen && pattern[pi] == '[') {
-            size_t saved_pi = pi;
-            if (match_char_class(pattern, plen, &pi, str[si])) {
+            class_end = parse_class(pattern, plen, pi, bits);
+        }
+        if (class_end) {
+            if (class_has(bits, str[si])) {
+                pi = class_end;
                 si++;
                 continue;
             }
-            pi = saved_pi;
+        } else if (pi < plen && (pattern[pi] == '?' ||
+                                 pattern[pi] == str[si])) {
+            pi++;
+            si++;
+            continue;
         }
         /* mismatch: backtrack to last '*' */
         if (star_pi != (size_t)-1) {
@@ -91,3 +104,272 @@ bool glob_match(const char *pattern, size_t plen,
     }
     return pi == plen;
 }
+
+/* ---- compiled patterns ---- */
+
+enum { ATOM_LIT, ATOM_ANY, ATOM_CLASS };
+
+typedef struct {
+    int op;
+    size_t len;             /* LIT: bytes; ANY: run of '?' */
+    const char *lit;        /* LIT: points into the pattern */
+    const uint64_t *bits;   /* CLASS: member set */
+} glob_atom_t;
+
+/* A star-free run. Every atom consumes a fixed number of bytes, so a
+   segment matches exactly `len` bytes wherever it is placed. */
+struct glob_seg {
+    glob_atom_t *atoms;
+    size_t natoms;
+    size_t len;
+};
+
+typedef struct {
+    size_t segs;
+    size_t atoms;
+    size_t classes;
+} glob_counts_t;
+
+/* Tokenize the pattern. With segs == NULL this only counts what a second
+   pass will write into segs/atoms/classes. */
+static void glob_build(glob_pattern_t *g, const char *pattern, size_t plen,
+                       glob_seg_t *segs, glob_atom_t *atoms,
+                       uint64_t (*classes)[4], glob_counts_t *n) {
+    uint64_t scratch[4];
+    glob_seg_t *seg = NULL;
+    int prev_op = -1;
+    bool in_seg = false;
+
+    memset(n, 0, sizeof(*n));
+    g->star_start = false;
+    g->star_end = false;
+    g->min_len = 0;
+
+    size_t i = 0;
+    while (i < plen) {
+        if (pattern[i] == '*') {
+            g->star_start |= (i == 0);
+            g->star_end = (i + 1 == plen);
+            in_seg = false;
+            i++;
+            continue;
+        }
+
+        int op = ATOM_LIT;
+        size_t next = i + 1;
+        const uint64_t *bits = NULL;
+        if (pattern[i] == '?') {
+            op = ATOM_ANY;
+        } else if (pattern[i] == '[') {
+            /* only a terminated class was counted, so only one may be
+               stored */
+            size_t end = parse_class(pattern, plen, i, scratch);
+            if (end) {
+                op = ATOM_CLASS;
+                next = end;
+                if (classes) {
+                    memcpy(classes[n->classes], scratch, sizeof(scratch));
+                    bits = classes[n->classes];
+                }
+            }
+        }
+
+        if (!in_seg) {
+            if (segs) {
+                seg = &segs[n->segs];
+                seg->atoms = &atoms[n->atoms];
+                seg->natoms = 0;
+                seg->len = 0;
+            }
+            n->segs++;
+            in_seg = true;
+            prev_op = -1;
+        }
+
+        /* adjacent literals are adjacent in the pattern, so they merge
+           into one memcmp; runs of '?' merge into one skip */
+        bool merge = op != ATOM_CLASS && op == prev_op;
+        if (!merge) {
+            if (segs) {
+                glob_atom_t *a = &seg->atoms[seg->natoms++];
+                a->op = op;
+                a->len = 0;
+                a->lit = &pattern[i];
+                a->bits = bits;
+            }
+            n->atoms++;
+            if (op == ATOM_CLASS) {
+                n->classes++;
+            }
+        }
+        if (segs) {
+            seg->atoms[seg->natoms - 1].len++;
+            seg->len++;
+        }
+        g->min_len++;
+        prev_op = op;
+        i = next;
+    }
+}
+
+void glob_compile(glob_pattern_t *g, const char *pattern, size_t plen,
+                  arena_t *arena) {
+    glob_counts_t n;
+    memset(g, 0, sizeof(*g));
+    glob_build(g, pattern, plen, NULL, NULL, NULL, &n);
+
+    glob_seg_t *segs = arena_alloc(arena, (n.segs ? n.segs : 1) *
+                                   sizeof(glob_seg_t));
+    glob_atom_t *atoms = arena_alloc(arena, (n.atoms ? n.atoms : 1) *
+                                     sizeof(glob_atom_t));
+    uint64_t (*classes)[4] = arena_alloc(arena, (n.classes ? n.classes : 1) *
+                                         sizeof(*classes));
+    glob_build(g, pattern, plen, segs, atoms, classes, &n);
+    g->segs = segs;
+    g->nsegs = n.segs;
+
+    if (n.segs == 0) {
+        g->kind = g->star_start ? GLOB_MATCH_ALL : GLOB_EXACT;
+        g->lit = pattern;
+        return;
+    }
+    if (n.segs > 1 || segs[0].natoms > 1 || segs[0].atoms[0].op != ATOM_LIT) {
+        g->kind = GLOB_GENERAL;
+        return;
+    }
+    g->lit = segs[0].atoms[0].lit;
+    g->lit_len = segs[0].len;
+    if (g->star_start) {
+        g->kind = g->star_end ? GLOB_CONTAINS : GLOB_SUFFIX;
+    } else {
+        g->kind = g->star_end ? GLOB_PREFIX : GLOB_EXACT;
+    }
+}
+
+/* First occurrence of a non-empty needle, or NULL. memchr skips to
+   candidates for the first byte, memcmp confirms. */
+static const char *find_literal(const char *hay, size_t hlen,
+                                const char *needle, size_t nlen) {
+    if (hlen < nlen) {
+        return NULL;
+    }
+    const char *p = hay;
+    const char *last = hay + hlen - nlen;
+    while (p <= last) {
+        p = memchr(p, (unsigned char)needle[0], (size_t)(last - p) + 1);
+        if (!p) {
+            return NULL;
+        }
+        if (memcmp(p + 1, needle + 1, nlen - 1) == 0) {
+            return p;
+        }
+        p++;
+    }
+    return NULL;
+}
+
+static bool seg_match_at(const glob_seg_t *seg, const char *s) {
+    for (size_t i = 0; i < seg->natoms; i++) {
+        const glob_atom_t *a = &seg->atoms[i];
+        switch (a->op) {
+        case ATOM_LIT:
+            if (memcmp(s, a->lit, a->len) != 0) {
+                return false;
+            }
+            break;
+        case ATOM_CLASS:
+            if (!class_has(a->bits, *s)) {
+                return false;
+            }
+            break;
+        default:
+            break;
+        }
+        s += a->len;
+    }
+    return true;
+}
+
+/* Leftmost start in [from, last] where seg matches, or SIZE_MAX. */
+static size_t seg_find(const glob_seg_t *seg, const char *str,
+                       size_t from, size_t last) {
+    const glob_atom_t *first = &seg->atoms[0];
+    for (size_t p = from; p <= last; p++) {
+        if (first->op == ATOM_LIT) {
+            const char *hit = memchr(str + p, (unsigned char)first->lit[0],
+                                     last - p + 1);
+            if (!hit) {
+                return SIZE_MAX;
+            }
+            p = (size_t)(hit - str);
+        }
+        if (seg_match_at(seg, str + p)) {
+            return p;
+        }
+    }
+    return SIZE_MAX;
+}
+
+/* Segments have fixed lengths, so anchored ends are checked in place and
+   each middle segment is placed at its leftmost match: any later
+   placement leaves less room for the rest. */
+static bool general_match(const glob_pattern_t *g, const char *str,
+                          size_t slen) {
+    if (g->nsegs == 1 && !g->star_start && !g->star_end) {
+        /* star-free */
+        return slen == g->min_len && seg_match_at(&g->segs[0], str);
+    }
+
+    size_t first = 0, last = g->nsegs;
+    size_t pos = 0, end = slen;
+    if (!g->star_start) {
+        if (!seg_match_at(&g->segs[0], str)) {
+            return false;
+        }
+        pos = g->segs[0].len;
+        first = 1;
+    }
+    if (!g->star_end) {
+        const glob_seg_t *tail = &g->segs[g->nsegs - 1];
+        end = slen - tail->len;
+        if (!seg_match_at(tail, str + end)) {
+            return false;
+        }
+        last--;
+    }
+
+    for (size_t i = first; i < last; i++) {
+        const glob_seg_t *seg = &g->segs[i];
+        if (end - pos < seg->len) {
+            return false;
+        }
+        size_t at = seg_find(seg, str, pos, end - seg->len);
+        if (at == SIZE_MAX) {
+            return false;
+        }
+        pos = at + seg->len;
+    }
+    return true;
+}
+
+bool glob_pattern_match(const glob_pattern_t *g, const char *str,
+                        size_t slen) {
+    if (slen < g->min_len) {
+        return false;
+    }
+    switch (g->kind) {
+    case GLOB_MATCH_ALL:
+        return true;
+    case GLOB_EXACT:
+        return slen == g->lit_len &&
+               (slen == 0 || memcmp(str, g->lit, slen) == 0);
+    case GLOB_PREFIX:
+        return memcmp(str, g->lit, g->lit_len) == 0;
+    case GLOB_SUFFIX:
+        return memcmp(str + slen - g->lit_len, g->lit, g->lit_len) == 0;
+    case GLOB_CONTAINS:
+        return find_literal(str, slen, g->lit, g->lit_len) != NULL;
+    default:
+        return general_match(g, str, slen);
+    }
+}
@@ -3,8 +3,42 @@
 
 #include <stdbool.h>
 #include <stddef.h>
+#include "arena.h"
 
 bool glob_match(const char *pattern, size_t plen,
                 const char *str, size_t slen);
 
+/* A pattern compiled once and matched against many keys. Star-free runs
+   become segments of literal, '?' and class atoms; a pattern of one
+   literal and optional stars at either end is matched as a plain
+   comparison instead. */
+typedef enum {
+    GLOB_MATCH_ALL,         /* "*" */
+    GLOB_EXACT,             /* "lit" (including the empty pattern) */
+    GLOB_PREFIX,            /* "lit*" */
+    GLOB_SUFFIX,            /* "*lit" */
+    GLOB_CONTAINS,          /* "*lit*" */
+    GLOB_GENERAL            /* anything else */
+} glob_kind_t;
+
+typedef struct glob_seg glob_seg_t;
+
+typedef struct {
+    glob_kind_t kind;
+    const char *lit;        /* EXACT..CONTAINS: the literal */
+    size_t lit_len;
+    glob_seg_t *segs;       /* GENERAL: segments between stars */
+    size_t nsegs;
+    bool star_start;        /* pattern starts / ends with a star */
+    bool star_end;
+    size_t min_len;         /* shortest string that can match */
+} glob_pattern_t;
+
+/* Compile `pattern` into `g`. The program is allocated from `arena` and
+   points into `pattern`, which must outlive it. Matches exactly the
+   strings glob_match() does. */
+void glob_compile(glob_pattern_t *g, const char *pattern, size_t plen,
+                  arena_t *arena);
+bool glob_pattern_match(const glob_pattern_t *g, const char *str, size_t slen);
+
 #endif
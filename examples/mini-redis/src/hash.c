@@ -0,0 +1,120 @@
+#include "hash.h"
+#include <string.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+
+static const uint64_t hash_secret[4] = {
+    0x2d358dccaa6c78a5ULL, 0x8bb84b93962eacc9ULL,
+    0x4b33a62ed433d4a3ULL, 0x4d5a2da51de1aa47ULL
+};
+
+#ifdef __SIZEOF_INT128__
+__extension__ typedef unsigned __int128 hash_u128;
+
+static void mum(uint64_t *a, uint64_t *b) {
+    hash_u128 r = (hash_u128)*a * *b;
+    *a = (uint64_t)r;
+    *b = (uint64_t)(r >> 64);
+}
+#else
+static void mum(uint64_t *a, uint64_t *b) {
+    uint64_t ha = *a >> 32, la = (uint32_t)*a;
+    uint64_t hb = *b >> 32, lb = (uint32_t)*b;
+    uint64_t rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb;
+    uint64_t t = rl + (rm0 << 32);
+    uint64_t c = t < rl;
+    uint64_t lo = t + (rm1 << 32);
+    c += lo < t;
+    *a = lo;
+    *b = rh + (rm0 >> 32) + (rm1 >> 32) + c;
+}
+#endif
+
+static uint64_t mix(uint64_t a, uint64_t b) {
+    mum(&a, &b);
+    return a ^ b;
+}
+
+static uint64_t read8(const uint8_t *p) {
+    uint64_t v;
+    memcpy(&v, p, 8);
+    return v;
+}
+
+static uint64_t read4(const uint8_t *p) {
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return v;
+}
+
+/* 1..3 bytes: first, middle and last byte */
+static uint64_t read3(const uint8_t *p, size_t k) {
+    return ((uint64_t)p[0] << 16) | ((uint64_t)p[k >> 1] << 8) | p[k - 1];
+}
+
+uint64_t hash_bytes(const void *data, size_t len, uint64_t seed) {
+    const uint8_t *p = data;
+    uint64_t a, b;
+
+    seed ^= mix(seed ^ hash_secret[0], hash_secret[1]);
+    if (len <= 16) {
+        /* Keys are usually short: at most four overlapping reads. */
+        if (len >= 4) {
+            size_t mid = (len >> 3) << 2;
+            a = (read4(p) << 32) | read4(p + mid);
+            b = (read4(p + len - 4) << 32) | read4(p + len - 4 - mid);
+        } else if (len > 0) {
+            a = read3(p, len);
+            b = 0;
+        } else {
+            a = b = 0;
+        }
+    } else {
+        size_t i = len;
+        if (i >= 48) {
+            uint64_t s1 = seed, s2 = seed;
+            do {
+                seed = mix(read8(p) ^ hash_secret[1], read8(p + 8) ^ seed);
+                s1 = mix(read8(p + 16) ^ hash_secret[2], read8(p + 24) ^ s1);
+                s2 = mix(read8(p + 32) ^ hash_secret[3], read8(p + 40) ^ s2);
+                p += 48;
+                i -= 48;
+            } while (i >= 48);
+            seed ^= s1 ^ s2;
+        }
+        while (i > 16) {
+            seed = mix(read8(p) ^ hash_secret[1], read8(p + 8) ^ seed);
+            p += 16;
+            i -= 16;
+        }
+        a = read8(p + i - 16);
+        b = read8(p + i - 8);
+    }
+
+    a ^= hash_secret[1];
+    b ^= seed;
+    mum(&a, &b);
+    return mix(a ^ hash_secret[0] ^ len, b ^ hash_secret[1]);
+}
+
+uint64_t hash_seed(void) {
+    static uint64_t seed;
+    static int seeded;
+
+    if (!seeded) {
+        FILE *f = fopen("/dev/urandom", "rb");
+        if (!f || fread(&seed, sizeof(seed), 1, f) != 1) {
+            /* no entropy source: fall back to something per-process */
+            struct timespec ts;
+            clock_gettime(CLOCK_MONOTONIC, &ts);
+            seed = mix((uint64_t)ts.tv_nsec ^ hash_secret[2],
+                       (uint64_t)getpid() ^ (uint64_t)ts.tv_sec);
+        }
+        if (f) {
+            fclose(f);
+        }
+        seeded = 1;
+    }
+    return seed;
+}
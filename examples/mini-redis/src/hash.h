@@ -0,0 +1,15 @@
+#ifndef HASH_H
+#define HASH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* 64-bit keyed hash (wyhash construction: 64x64->128 multiply-mix over
+   8-byte reads). Not cryptographic; the seed only has to be unknown to
+   clients so they cannot precompute colliding keys. */
+uint64_t hash_bytes(const void *data, size_t len, uint64_t seed);
+
+/* Process-wide random seed, drawn from the OS on first use. */
+uint64_t hash_seed(void);
+
+#endif
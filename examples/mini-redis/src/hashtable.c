@@ -1,251 +1,1388 @@
 #include "hashtable.h"
+#include "hash.h"
+#include "lazyfree.h"
+#include "slab.h"
+#include "stats.h"
 #include "util.h"
+#include <limits.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 #define HT_INITIAL_CAPACITY 64
-#define HT_LOAD_FACTOR 0.7
 
-static uint32_t fnv1a_hash(const char *data, size_t len) {
-    uint32_t hash = 2166136261u;
-    for (size_t i = 0; i < len; i++) {
-        hash ^= (uint8_t)data[i];
-        hash *= 16777619u;
+/* Grow once full + deleted slots would exceed 7/8 of capacity. Tag
+   filtering keeps probe sequences cheap at this load. */
+#define HT_MAX_LOAD(cap) ((cap) - (cap) / 8)
+
+#define CTRL_EMPTY   0x80
+#define CTRL_DELETED 0xFE
+
+#define HT_NOT_FOUND ((size_t)-1)
+
+/* Groups migrated by each insert/delete while rehashing. Growth adds
+   a new slot for every insert, so at one group per write the old table
+   is drained long before the new one can fill up. */
+#define HT_REHASH_GROUPS_PER_OP 1
+/* Groups between clock checks in ht_rehash_ms() */
+#define HT_REHASH_BATCH 64
+
+/* Slots of a detached table released between clock checks in
+   ht_lazyfree_ms() */
+#define HT_LAZYFREE_BATCH 1024
+
+/* Index items popped between clock checks in ht_expire_cycle() */
+#define HT_EXPIRE_BATCH 32
+/* Stale index items are swept out by a rebuild once the index outgrows
+   both twice the key count and a quarter of the slots, which keeps the
+   rebuild's O(capacity) scan amortized O(1) per ht_set_expire(). */
+#define HT_EXPIRY_MIN_REBUILD 64
+
+#define HT_HASH_MASK   ((UINT64_C(1) << HT_HASH_BITS) - 1)
+#define HT_ACCESS_MASK ((UINT64_C(1) << HT_ACCESS_BITS) - 1)
+#define HT_LFU_MAX     255
+
+static ht_access_t access_mode = HT_ACCESS_NONE;
+
+static uint64_t key_hash(hashtable_t *ht, rstr_t key) {
+    return hash_bytes(key.data, key.len, ht->seed) & HT_HASH_MASK;
+}
+
+static uint64_t entry_hash(const ht_entry_t *e) {
+    return e->hash & HT_HASH_MASK;
+}
+
+/* The low 7 bits go into the control byte; the rest pick the group. */
+static uint8_t hash_tag(uint64_t hash) {
+    return (uint8_t)(hash & 0x7F);
+}
+
+static size_t hash_group(uint64_t hash) {
+    return (size_t)(hash >> 7);
+}
+
+/* ---- group matching: one bit per slot in a 16-slot group ---- */
+
+#if defined(__SSE2__)
+static uint32_t group_match(const uint8_t *ctrl, uint8_t tag) {
+    __m128i g = _mm_load_si128((const __m128i *)ctrl);
+    return (uint32_t)_mm_movemask_epi8(
+        _mm_cmpeq_epi8(g, _mm_set1_epi8((char)tag)));
+}
+
+static uint32_t group_match_empty(const uint8_t *ctrl) {
+    return group_match(ctrl, CTRL_EMPTY);
+}
+
+/* EMPTY and DELETED are the only bytes with the high bit set. */
+static uint32_t group_match_free(const uint8_t *ctrl) {
+    __m128i g = _mm_load_si128((const __m128i *)ctrl);
+    return (uint32_t)_mm_movemask_epi8(g);
+}
+#else
+static uint32_t group_match(const uint8_t *ctrl, uint8_t tag) {
+    uint32_t mask = 0;
+    for (int i = 0; i < HT_GROUP_WIDTH; i++) {
+        if (ctrl[i] == tag) {
+            mask |= 1u << i;
+        }
     }
-    return hash;
+    return mask;
 }
 
+static uint32_t group_match_empty(const uint8_t *ctrl) {
+    return group_match(ctrl, CTRL_EMPTY);
+}
+
+static uint32_t group_match_free(const uint8_t *ctrl) {
+    uint32_t mask = 0;
+    for (int i = 0; i < HT_GROUP_WIDTH; i++) {
+        if (ctrl[i] & 0x80) {
+            mask |= 1u << i;
+        }
+    }
+    return mask;
+}
+#endif
+
 static bool is_expired(ht_entry_t *entry) {
     if (entry->expire_at == -1) {
         return false;
     }
-    return current_time_ms() >= entry->expire_at;
+    return clock_ms() >= entry->expire_at;
 }
 
-static void entry_free(ht_entry_t *entry) {
-    rstr_free(&entry->key);
-    rstr_free(&entry->value);
-    entry->state = ENTRY_TOMBSTONE;
-    entry->expire_at = -1;
+/* ---- access bits (see ht_access_t) ---- */
+
+/* xorshift64*, for LFU bumps and sampling. */
+static _Thread_local uint64_t rng_state;
+
+static uint64_t rng_next(void) {
+    if (rng_state == 0) {
+        rng_state = (hash_seed() ^ (uint64_t)(uintptr_t)&rng_state) | 1;
+    }
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return rng_state * UINT64_C(0x2545F4914F6CDD1D);
 }
 
-static size_t probe(hashtable_t *ht, rstr_t key, bool *found) {
-    uint32_t hash = fnv1a_hash(key.data, key.len);
-    size_t idx = hash & (ht->capacity - 1);
-    size_t first_tombstone = (size_t)-1;
+static uint64_t lru_clock(void) {
+    return (uint64_t)(clock_ms() / HT_LRU_RESOLUTION_MS) & HT_ACCESS_MASK;
+}
 
-    for (size_t i = 0; i < ht->capacity; i++) {
-        size_t slot = (idx + i) & (ht->capacity - 1);
-        ht_entry_t *e = &ht->entries[slot];
+static uint64_t lfu_minutes(void) {
+    return (uint64_t)(clock_ms() / 60000) & 0xFFFF;
+}
 
-        if (e->state == ENTRY_EMPTY) {
-            *found = false;
-            return (first_tombstone != (size_t)-1) ?
-                   first_tombstone : slot;
-        }
+static unsigned lfu_decayed(uint64_t access, uint64_t minutes) {
+    unsigned counter = (unsigned)(access & 0xFF);
+    uint64_t periods = ((minutes - (access >> 8)) & 0xFFFF) /
+                       HT_LFU_DECAY_MINUTES;
+    return periods >= counter ? 0 : counter - (unsigned)periods;
+}
 
-        if (e->state == ENTRY_TOMBSTONE) {
-            if (first_tombstone == (size_t)-1) {
-                first_tombstone = slot;
+static uint64_t access_initial(void) {
+    switch (access_mode) {
+    case HT_ACCESS_LRU:
+        return lru_clock();
+    case HT_ACCESS_LFU:
+        return lfu_minutes() << 8 | HT_LFU_INIT;
+    default:
+        return 0;
+    }
+}
+
+/* Only stores when the bits change: an LRU entry is written at most
+   once per tick, an LFU one when its counter moves or a minute passes. */
+static void entry_touch(ht_entry_t *e) {
+    if (access_mode == HT_ACCESS_NONE) {
+        return;
+    }
+    uint64_t old = e->hash >> HT_HASH_BITS;
+    uint64_t next;
+    if (access_mode == HT_ACCESS_LRU) {
+        next = lru_clock();
+    } else {
+        uint64_t minutes = lfu_minutes();
+        unsigned counter = lfu_decayed(old, minutes);
+        if (counter < HT_LFU_MAX) {
+            uint64_t base = counter > HT_LFU_INIT ? counter - HT_LFU_INIT : 0;
+            if (rng_next() % (base * HT_LFU_LOG_FACTOR + 1) == 0) {
+                counter++;
             }
-            continue;
         }
+        next = minutes << 8 | counter;
+    }
+    if (next != old) {
+        e->hash = entry_hash(e) | next << HT_HASH_BITS;
+    }
+}
 
-        /* ENTRY_OCCUPIED */
-        if (rstr_eq(e->key, key)) {
-            if (is_expired(e)) {
-                entry_free(e);
-                ht->count--;
-                /* don't decrement used: tombstone replaces occupied */
-                *found = false;
-                return (first_tombstone != (size_t)-1) ?
-                       first_tombstone : slot;
+/* ---- entry encoding (see ht_entry_t) ---- */
+
+static bool entry_is_int(const ht_entry_t *e) {
+    return e->val_len == HT_VAL_INT;
+}
+
+static bool entry_is_inline(const ht_entry_t *e) {
+    return !entry_is_int(e) &&
+           (size_t)e->key_len + e->val_len <= HT_INLINE_MAX;
+}
+
+static rstr_t entry_key(const ht_entry_t *e) {
+    rstr_t k;
+    if (entry_is_int(e)) {
+        k.data = e->key_len <= HT_INT_KEY_MAX ? (char *)e->u.num.key :
+                                                e->u.heap.block;
+    } else {
+        k.data = entry_is_inline(e) ? (char *)e->u.inline_data :
+                                      e->u.heap.block;
+    }
+    k.len = e->key_len;
+    return k;
+}
+
+/* Integers are rendered into ht->num_buf. */
+static rstr_t entry_value(hashtable_t *ht, const ht_entry_t *e) {
+    rstr_t v;
+    if (entry_is_int(e)) {
+        v.data = ht->num_buf;
+        v.len = i64_to_str(ht->num_buf, e->u.num.value);
+        return v;
+    }
+    if (entry_is_inline(e)) {
+        v.data = (char *)e->u.inline_data + e->key_len;
+    } else if (e->val_len >= RSTR_SHARED_MIN) {
+        v.data = e->u.heap.shared_value;
+    } else {
+        v.data = e->u.heap.block + e->key_len;
+    }
+    v.len = e->val_len;
+    return v;
+}
+
+static void entry_init(ht_entry_t *e, rstr_t key, rstr_t value,
+                       uint64_t hash) {
+    e->hash = hash | access_initial() << HT_HASH_BITS;
+    e->expire_at = -1;
+    e->key_len = (uint32_t)key.len;
+    e->val_len = (uint32_t)value.len;
+
+    if (entry_is_inline(e)) {
+        memcpy(e->u.inline_data, key.data, key.len);
+        memcpy(e->u.inline_data + key.len, value.data, value.len);
+        return;
+    }
+
+    bool shared = value.len >= RSTR_SHARED_MIN;
+    /* take the whole size class; the slack is value room for later
+       overwrites */
+    size_t block_size = slab_good_size(shared ? key.len : key.len + value.len);
+    e->u.heap.block = slab_alloc(block_size);
+    memcpy(e->u.heap.block, key.data, key.len);
+    if (shared) {
+        e->u.heap.shared_value = rstr_create(value.data, value.len).data;
+        e->u.heap.val_cap = 0;
+    } else {
+        memcpy(e->u.heap.block + key.len, value.data, value.len);
+        e->u.heap.shared_value = NULL;
+        e->u.heap.val_cap = (uint32_t)(block_size - key.len);
+    }
+}
+
+/* An integer takes the slot when the key fits beside it, or when the
+   string form would need a block anyway. */
+static bool int_encodable(size_t key_len, int64_t v) {
+    return key_len <= HT_INT_KEY_MAX ||
+           key_len + i64_strlen(v) > HT_INLINE_MAX;
+}
+
+static void entry_init_int(ht_entry_t *e, rstr_t key, int64_t v,
+                           uint64_t hash) {
+    if (!int_encodable(key.len, v)) {
+        char buf[32];
+        rstr_t str = { buf, i64_to_str(buf, v) };
+        entry_init(e, key, str, hash);
+        return;
+    }
+    e->hash = hash | access_initial() << HT_HASH_BITS;
+    e->expire_at = -1;
+    e->key_len = (uint32_t)key.len;
+    e->val_len = HT_VAL_INT;
+    if (key.len <= HT_INT_KEY_MAX) {
+        memcpy(e->u.num.key, key.data, key.len);
+    } else {
+        e->u.heap.block = slab_alloc(slab_good_size(key.len));
+        memcpy(e->u.heap.block, key.data, key.len);
+    }
+    e->u.num.value = v;
+}
+
+/* How entry_release() gives storage back. */
+typedef enum {
+    FREE_NOW,       /* slab_free() on the spot */
+    FREE_LAZY,      /* large blocks go to the lazy-free thread */
+    FREE_ABANDON    /* FREE_LAZY, and small blocks are left to
+                       slab_release_thread() (ht_abandon()) */
+} free_mode_t;
+
+static void free_block(void *p, size_t size, free_mode_t how) {
+    if (how == FREE_NOW) {
+        slab_free(p, size);
+    } else if (how == FREE_LAZY || size > SLAB_MAX_SIZE) {
+        slab_free_lazy(p, size);
+    }
+}
+
+static void entry_release(ht_entry_t *e, free_mode_t how) {
+    if (entry_is_int(e)) {
+        if (e->key_len > HT_INT_KEY_MAX) {
+            free_block(e->u.heap.block, slab_good_size(e->key_len), how);
+        }
+        return;
+    }
+    if (entry_is_inline(e)) {
+        return;
+    }
+    size_t block_size = e->key_len + e->u.heap.val_cap;
+    if (e->u.heap.shared_value) {
+        rstr_t v = { e->u.heap.shared_value, e->val_len };
+        if (how == FREE_NOW) {
+            rstr_free(&v);
+        } else {
+            rstr_free_lazy(&v);
+        }
+        block_size = slab_good_size(e->key_len);
+    }
+    free_block(e->u.heap.block, block_size, how);
+}
+
+/* Replace the value, keeping the key. Rewrites in place when the
+   encoding does not change and the old buffer is big enough. */
+static void entry_set_value(ht_entry_t *e, rstr_t value) {
+    size_t klen = e->key_len;
+    bool now_inline = entry_is_inline(e);
+    bool next_inline = klen + value.len <= HT_INLINE_MAX;
+
+    if (now_inline && next_inline) {
+        memcpy(e->u.inline_data + klen, value.data, value.len);
+        e->val_len = (uint32_t)value.len;
+        return;
+    }
+    if (!now_inline && !next_inline && !entry_is_int(e) &&
+        !e->u.heap.shared_value && value.len <= e->u.heap.val_cap) {
+        memcpy(e->u.heap.block + klen, value.data, value.len);
+        e->val_len = (uint32_t)value.len;
+        return;
+    }
+
+    ht_entry_t old = *e;
+    entry_init(e, entry_key(&old), value, entry_hash(&old));
+    e->hash = old.hash;
+    e->expire_at = old.expire_at;
+    entry_release(&old, FREE_NOW);
+}
+
+static void entry_set_int(ht_entry_t *e, int64_t v) {
+    if (entry_is_int(e)) {
+        e->u.num.value = v;
+        return;
+    }
+    if (!int_encodable(e->key_len, v)) {
+        char buf[32];
+        rstr_t str = { buf, i64_to_str(buf, v) };
+        entry_set_value(e, str);
+        return;
+    }
+    ht_entry_t old = *e;
+    entry_init_int(e, entry_key(&old), v, entry_hash(&old));
+    e->hash = old.hash;
+    e->expire_at = old.expire_at;
+    entry_release(&old, FREE_NOW);
+}
+
+static bool entry_key_eq(const ht_entry_t *e, rstr_t key, uint64_t hash) {
+    return entry_hash(e) == hash && e->key_len == key.len &&
+           memcmp(entry_key(e).data, key.data, key.len) == 0;
+}
+
+/* ---- expiry index: binary min-heap on expire_at ---- */
+
+static void expiry_sift_up(ht_expiry_t *heap, size_t i) {
+    ht_expiry_t item = heap[i];
+    while (i > 0) {
+        size_t parent = (i - 1) / 2;
+        if (heap[parent].expire_at <= item.expire_at) {
+            break;
+        }
+        heap[i] = heap[parent];
+        i = parent;
+    }
+    heap[i] = item;
+}
+
+static void expiry_sift_down(ht_expiry_t *heap, size_t len, size_t i) {
+    ht_expiry_t item = heap[i];
+    for (;;) {
+        size_t child = 2 * i + 1;
+        if (child >= len) {
+            break;
+        }
+        if (child + 1 < len &&
+            heap[child + 1].expire_at < heap[child].expire_at) {
+            child++;
+        }
+        if (item.expire_at <= heap[child].expire_at) {
+            break;
+        }
+        heap[i] = heap[child];
+        i = child;
+    }
+    heap[i] = item;
+}
+
+static void expiry_pop(hashtable_t *ht) {
+    ht->expiry[0] = ht->expiry[--ht->expiry_len];
+    if (ht->expiry_len > 0) {
+        expiry_sift_down(ht->expiry, ht->expiry_len, 0);
+    }
+}
+
+/* Replace the index with one item per key that has a TTL. */
+static void expiry_rebuild(hashtable_t *ht) {
+    size_t n = 0;
+    for (int i = 0; i <= (ht->rehashing ? 1 : 0); i++) {
+        ht_table_t *t = &ht->t[i];
+        for (size_t slot = 0; slot < t->capacity; slot++) {
+            if (!(t->ctrl[slot] & 0x80) && t->entries[slot].expire_at != -1) {
+                ht->expiry[n].expire_at = t->entries[slot].expire_at;
+                ht->expiry[n].hash = entry_hash(&t->entries[slot]);
+                n++;
             }
-            *found = true;
-            return slot;
         }
     }
+    ht->expiry_len = n;
+    for (size_t i = n / 2; i-- > 0;) {
+        expiry_sift_down(ht->expiry, n, i);
+    }
+}
 
-    *found = false;
-    return (first_tombstone != (size_t)-1) ? first_tombstone : 0;
+static void expiry_push(hashtable_t *ht, int64_t expire_at, uint64_t hash) {
+    if (ht->expiry_len == ht->expiry_cap) {
+        size_t count = ht->t[0].count + ht->t[1].count;
+        size_t slots = ht->t[0].capacity + ht->t[1].capacity;
+        size_t limit = 2 * count > slots / 4 ? 2 * count : slots / 4;
+        if (ht->expiry_len >= limit + HT_EXPIRY_MIN_REBUILD) {
+            expiry_rebuild(ht);
+        }
+    }
+    if (ht->expiry_len == ht->expiry_cap) {
+        size_t cap = ht->expiry_cap ? ht->expiry_cap * 2 : 64;
+        ht_expiry_t *heap = realloc(ht->expiry, cap * sizeof(ht_expiry_t));
+        if (!heap) {
+            perror("realloc");
+            exit(1);
+        }
+        ht->expiry = heap;
+        ht->expiry_cap = cap;
+    }
+    size_t i = ht->expiry_len++;
+    ht->expiry[i].expire_at = expire_at;
+    ht->expiry[i].hash = hash;
+    expiry_sift_up(ht->expiry, i);
 }
 
-static void ht_resize(hashtable_t *ht) {
-    size_t new_cap = ht->capacity * 2;
-    ht_entry_t *new_entries = calloc(new_cap, sizeof(ht_entry_t));
-    if (!new_entries) {
-        perror("calloc");
+static void table_alloc(ht_table_t *t, size_t capacity) {
+    t->ctrl = aligned_alloc(HT_GROUP_WIDTH, capacity);
+    t->entries = malloc(capacity * sizeof(ht_entry_t));
+    if (!t->ctrl || !t->entries) {
+        perror("malloc");
         exit(1);
     }
+    memset(t->ctrl, CTRL_EMPTY, capacity);
+    t->capacity = capacity;
+    t->count = 0;
+    t->used = 0;
+}
+
+/* The arrays of a table: big ones are an munmap to free. */
+static void table_free_arrays(ht_table_t *t, free_mode_t how) {
+    if (how == FREE_NOW) {
+        free(t->ctrl);
+        free(t->entries);
+    } else {
+        lazyfree_free(t->ctrl);
+        lazyfree_free(t->entries);
+    }
+}
+
+static void table_free(ht_table_t *t, free_mode_t how) {
+    for (size_t i = 0; i < t->capacity && t->count > 0; i++) {
+        if (!(t->ctrl[i] & 0x80)) {
+            entry_release(&t->entries[i], how);
+            t->count--;
+        }
+    }
+    table_free_arrays(t, how);
+}
+
+/* Release a full slot. If its group still has an EMPTY byte no probe
+   sequence continues past this group, so the slot can go straight back
+   to EMPTY instead of becoming a tombstone. */
+static void erase_slot(ht_table_t *t, size_t slot, free_mode_t how) {
+    entry_release(&t->entries[slot], how);
+    size_t group = slot & ~(size_t)(HT_GROUP_WIDTH - 1);
+    if (group_match_empty(&t->ctrl[group])) {
+        t->ctrl[slot] = CTRL_EMPTY;
+        t->used--;
+    } else {
+        t->ctrl[slot] = CTRL_DELETED;
+    }
+    t->count--;
+}
+
+/* Groups are visited in triangular order (g, g+1, g+3, g+6, ...), which
+   covers every group exactly once when the group count is a power of 2.
+   Only slots whose tag matches are looked at, and only those whose
+   cached hash matches as well get a key comparison; the search stops at
+   the first group containing an EMPTY slot. Expired keys are erased on
+   the way and reported as missing. */
+static size_t find_slot(ht_table_t *t, rstr_t key, uint64_t hash) {
+    size_t group_mask = t->capacity / HT_GROUP_WIDTH - 1;
+    size_t g = hash_group(hash) & group_mask;
+    uint8_t tag = hash_tag(hash);
+
+    for (size_t step = 1; step <= group_mask + 1; step++) {
+        const uint8_t *ctrl = &t->ctrl[g * HT_GROUP_WIDTH];
+        uint32_t match = group_match(ctrl, tag);
+        while (match) {
+            size_t slot = g * HT_GROUP_WIDTH + (size_t)__builtin_ctz(match);
+            ht_entry_t *e = &t->entries[slot];
+            if (entry_key_eq(e, key, hash)) {
+                if (is_expired(e)) {
+                    erase_slot(t, slot, FREE_NOW);
+                    return HT_NOT_FOUND;
+                }
+                return slot;
+            }
+            match &= match - 1;
+        }
+        if (group_match_empty(ctrl)) {
+            return HT_NOT_FOUND;
+        }
+        g = (g + step) & group_mask;
+    }
+    return HT_NOT_FOUND;
+}
+
+/* First EMPTY or DELETED slot on the key's probe sequence. The load
+   limit guarantees one exists. */
+static size_t find_free_slot(ht_table_t *t, uint64_t hash) {
+    size_t group_mask = t->capacity / HT_GROUP_WIDTH - 1;
+    size_t g = hash_group(hash) & group_mask;
+
+    for (size_t step = 1;; step++) {
+        uint32_t free_mask = group_match_free(&t->ctrl[g * HT_GROUP_WIDTH]);
+        if (free_mask) {
+            return g * HT_GROUP_WIDTH + (size_t)__builtin_ctz(free_mask);
+        }
+        g = (g + step) & group_mask;
+    }
+}
+
+/* Slot of the entry with this cached hash and expire_at, if any. Used
+   for expiry index items, which carry no key. */
+static size_t find_expiring_slot(ht_table_t *t, uint64_t hash,
+                                 int64_t expire_at) {
+    size_t group_mask = t->capacity / HT_GROUP_WIDTH - 1;
+    size_t g = hash_group(hash) & group_mask;
+    uint8_t tag = hash_tag(hash);
+
+    for (size_t step = 1; step <= group_mask + 1; step++) {
+        const uint8_t *ctrl = &t->ctrl[g * HT_GROUP_WIDTH];
+        uint32_t match = group_match(ctrl, tag);
+        while (match) {
+            size_t slot = g * HT_GROUP_WIDTH + (size_t)__builtin_ctz(match);
+            const ht_entry_t *e = &t->entries[slot];
+            if (entry_hash(e) == hash && e->expire_at == expire_at) {
+                return slot;
+            }
+            match &= match - 1;
+        }
+        if (group_match_empty(ctrl)) {
+            return HT_NOT_FOUND;
+        }
+        g = (g + step) & group_mask;
+    }
+    return HT_NOT_FOUND;
+}
 
-    for (size_t i = 0; i < new_cap; i++) {
-        new_entries[i].expire_at = -1;
+/* Find key in whichever table holds it. The old table is checked even
+   past rehash_group: a key migrated later may sit in a group after its
+   home group. */
+static ht_entry_t *lookup(hashtable_t *ht, rstr_t key, uint64_t hash,
+                          ht_table_t **table, size_t *slot_out) {
+    int last = ht->rehashing ? 1 : 0;
+    for (int i = 0; i <= last; i++) {
+        ht_table_t *t = &ht->t[i];
+        if (t->count == 0) {
+            continue;
+        }
+        size_t slot = find_slot(t, key, hash);
+        if (slot != HT_NOT_FOUND) {
+            entry_touch(&t->entries[slot]);
+            if (table) {
+                *table = t;
+                *slot_out = slot;
+            }
+            return &t->entries[slot];
+        }
     }
+    return NULL;
+}
+
+/* Move entries into t[1] by their cached hash (keys are never rehashed).
+   Migrated slots become DELETED, not EMPTY, so probe chains through the
+   group still reach keys that have not moved yet. */
+static void migrate_group(hashtable_t *ht, size_t g) {
+    ht_table_t *from = &ht->t[0];
+    ht_table_t *to = &ht->t[1];
+    uint8_t *ctrl = &from->ctrl[g * HT_GROUP_WIDTH];
 
-    for (size_t i = 0; i < ht->capacity; i++) {
-        ht_entry_t *e = &ht->entries[i];
-        if (e->state != ENTRY_OCCUPIED) {
+    for (size_t i = 0; i < HT_GROUP_WIDTH; i++) {
+        if (ctrl[i] & 0x80) {
             continue;
         }
+        ht_entry_t *e = &from->entries[g * HT_GROUP_WIDTH + i];
+        size_t slot = find_free_slot(to, entry_hash(e));
+        if (to->ctrl[slot] == CTRL_EMPTY) {
+            to->used++;
+        }
+        to->ctrl[slot] = hash_tag(entry_hash(e));
+        to->entries[slot] = *e;
+        to->count++;
+        ctrl[i] = CTRL_DELETED;
+        from->count--;
+    }
+}
+
+static void rehash_finish_if_drained(hashtable_t *ht) {
+    if (ht->t[0].count > 0 &&
+        ht->rehash_group < ht->t[0].capacity / HT_GROUP_WIDTH) {
+        return;
+    }
+    table_free_arrays(&ht->t[0], FREE_LAZY);
+    ht->t[0] = ht->t[1];
+    memset(&ht->t[1], 0, sizeof(ht->t[1]));
+    ht->rehashing = false;
+}
+
+static void rehash_groups(hashtable_t *ht, size_t groups) {
+    size_t ngroups = ht->t[0].capacity / HT_GROUP_WIDTH;
+    while (groups-- > 0 && ht->rehash_group < ngroups &&
+           ht->t[0].count > 0) {
+        migrate_group(ht, ht->rehash_group++);
+    }
+    rehash_finish_if_drained(ht);
+}
+
+/* Start migrating into a table of new_cap slots. Called with the current
+   capacity when most used slots are tombstones, which drops them. */
+static void rehash_start(hashtable_t *ht, size_t new_cap) {
+    /* the allocation is the only pause; migration is incremental */
+    uint64_t start = stats_ticks();
+    table_alloc(&ht->t[1], new_cap);
+    stats_record_resize(stats_ticks() - start);
+    ht->rehashing = true;
+    ht->rehash_group = 0;
+}
 
-        uint32_t hash = fnv1a_hash(e->key.data, e->key.len);
-        size_t idx = hash & (new_cap - 1);
+/* Double t[1] in place, moving its entries by their cached hash; t[0]
+   and the migration position are left alone. */
+static void grow_target(hashtable_t *ht) {
+    ht_table_t old = ht->t[1];
+    uint64_t start = stats_ticks();
+    table_alloc(&ht->t[1], old.capacity * 2);
+    stats_record_resize(stats_ticks() - start);
+
+    ht_table_t *to = &ht->t[1];
+    for (size_t i = 0; i < old.capacity; i++) {
+        if (old.ctrl[i] & 0x80) {
+            continue;
+        }
+        ht_entry_t *e = &old.entries[i];
+        size_t slot = find_free_slot(to, entry_hash(e));
+        to->ctrl[slot] = hash_tag(entry_hash(e));
+        to->entries[slot] = *e;
+        to->count++;
+        to->used++;
+    }
+    table_free_arrays(&old, FREE_LAZY);
+}
 
-        while (new_entries[idx].state == ENTRY_OCCUPIED) {
-            idx = (idx + 1) & (new_cap - 1);
+/* Make room for one more key in the table inserts go to. */
+static void reserve_one(hashtable_t *ht) {
+    if (ht->rehashing) {
+        ht_table_t *to = &ht->t[1];
+        if (to->used + 1 <= HT_MAX_LOAD(to->capacity)) {
+            return;
+        }
+        /* Only reachable when an iterator held migration back for a
+           long run of inserts. Finishing the move would swap a new
+           layout under the walk, so grow t[1] instead; a walk already
+           in t[1] pins that too, and inserts run past the load limit
+           (probes stay correct while one slot is free). */
+        if (ht->iterators > 0) {
+            if (ht->target_iterators == 0 || to->used + 1 >= to->capacity) {
+                grow_target(ht);
+            }
+            return;
         }
+        rehash_groups(ht, SIZE_MAX);
+    }
 
-        new_entries[idx] = *e;
+    ht_table_t *t = &ht->t[0];
+    if (t->used + 1 > HT_MAX_LOAD(t->capacity)) {
+        /* mostly tombstones: clean up in place rather than doubling */
+        size_t new_cap = t->count + 1 > HT_MAX_LOAD(t->capacity) / 2 ?
+                         t->capacity * 2 : t->capacity;
+        rehash_start(ht, new_cap);
     }
+}
 
-    free(ht->entries);
-    ht->entries = new_entries;
-    ht->capacity = new_cap;
-    ht->used = ht->count; /* tombstones are gone */
+/* The table an entry pointer belongs to. */
+static ht_table_t *entry_table(hashtable_t *ht, const ht_entry_t *e) {
+    ht_table_t *t = &ht->t[0];
+    uintptr_t p = (uintptr_t)e;
+    uintptr_t base = (uintptr_t)t->entries;
+    if (p < base || p >= base + t->capacity * sizeof(ht_entry_t)) {
+        t = &ht->t[1];
+    }
+    return t;
 }
 
 hashtable_t *ht_create(void) {
-    hashtable_t *ht = malloc(sizeof(hashtable_t));
+    return ht_create_seeded(hash_seed());
+}
+
+hashtable_t *ht_create_seeded(uint64_t seed) {
+    hashtable_t *ht = calloc(1, sizeof(hashtable_t));
     if (!ht) {
-        perror("malloc");
-        exit(1);
-    }
-    ht->capacity = HT_INITIAL_CAPACITY;
-    ht->count = 0;
-    ht->used = 0;
-    ht->entries = calloc(ht->capacity, sizeof(ht_entry_t));
-    if (!ht->entries) {
         perror("calloc");
         exit(1);
     }
-    for (size_t i = 0; i < ht->capacity; i++) {
-        ht->entries[i].expire_at = -1;
-    }
+    table_alloc(&ht->t[0], HT_INITIAL_CAPACITY);
+    ht->seed = seed;
     return ht;
 }
 
+static void free_all(hashtable_t *ht, free_mode_t how) {
+    table_free(&ht->t[0], how);
+    if (ht->rehashing) {
+        table_free(&ht->t[1], how);
+    }
+    while (ht->detached_len > 0) {
+        table_free(&ht->detached[--ht->detached_len], how);
+    }
+    free(ht->detached);
+    free(ht->expiry);
+    free(ht);
+}
+
 void ht_destroy(hashtable_t *ht) {
-    if (!ht) {
+    if (ht) {
+        free_all(ht, FREE_NOW);
+    }
+}
+
+void ht_abandon(hashtable_t *ht) {
+    if (ht) {
+        free_all(ht, FREE_ABANDON);
+    }
+}
+
+/* Back to one empty table of the initial size. */
+static void reset_tables(hashtable_t *ht) {
+    ht->rehashing = false;
+    memset(&ht->t[1], 0, sizeof(ht->t[1]));
+    ht->rehash_group = 0;
+    ht->expiry_len = 0;
+    table_alloc(&ht->t[0], HT_INITIAL_CAPACITY);
+}
+
+void ht_clear(hashtable_t *ht) {
+    table_free(&ht->t[0], FREE_NOW);
+    if (ht->rehashing) {
+        table_free(&ht->t[1], FREE_NOW);
+    }
+    reset_tables(ht);
+}
+
+/* Queue a table for ht_lazyfree_step(); an empty one is done already. */
+static void detach_table(hashtable_t *ht, ht_table_t *t) {
+    if (t->count == 0) {
+        table_free_arrays(t, FREE_LAZY);
         return;
     }
-    for (size_t i = 0; i < ht->capacity; i++) {
-        if (ht->entries[i].state == ENTRY_OCCUPIED) {
-            rstr_free(&ht->entries[i].key);
-            rstr_free(&ht->entries[i].value);
+    if (ht->detached_len == ht->detached_cap) {
+        size_t cap = ht->detached_cap ? ht->detached_cap * 2 : 2;
+        ht_table_t *d = realloc(ht->detached, cap * sizeof(*d));
+        if (!d) {
+            perror("realloc");
+            exit(1);
         }
+        ht->detached = d;
+        ht->detached_cap = cap;
     }
-    free(ht->entries);
-    free(ht);
+    /* a new table is walked from its first slot */
+    if (ht->detached_len == 0) {
+        ht->detached_slot = 0;
+    }
+    ht->detached[ht->detached_len++] = *t;
+}
+
+void ht_clear_async(hashtable_t *ht) {
+    /* the one in progress stays last, so its walk resumes */
+    ht_table_t last;
+    size_t slot = ht->detached_slot;
+    bool resume = ht->detached_len > 0;
+    if (resume) {
+        last = ht->detached[--ht->detached_len];
+    }
+    detach_table(ht, &ht->t[0]);
+    if (ht->rehashing) {
+        detach_table(ht, &ht->t[1]);
+    }
+    if (resume) {
+        detach_table(ht, &last);
+        ht->detached_slot = slot;
+    }
+    reset_tables(ht);
+}
+
+bool ht_lazyfree_pending(hashtable_t *ht) {
+    return ht->detached_len > 0;
+}
+
+bool ht_lazyfree_step(hashtable_t *ht, size_t slots) {
+    while (slots > 0 && ht->detached_len > 0) {
+        ht_table_t *t = &ht->detached[ht->detached_len - 1];
+        size_t end = ht->detached_slot + slots;
+        if (end > t->capacity) {
+            end = t->capacity;
+        }
+        slots -= end - ht->detached_slot;
+        for (size_t i = ht->detached_slot; i < end && t->count > 0; i++) {
+            if (!(t->ctrl[i] & 0x80)) {
+                entry_release(&t->entries[i], FREE_LAZY);
+                t->count--;
+            }
+        }
+        ht->detached_slot = end;
+        if (t->count == 0 || end == t->capacity) {
+            table_free_arrays(t, FREE_LAZY);
+            ht->detached_len--;
+            ht->detached_slot = 0;
+        }
+    }
+    return ht->detached_len > 0;
+}
+
+bool ht_lazyfree_ms(hashtable_t *ht, int64_t ms) {
+    int64_t deadline = current_time_ms() + ms;
+    while (ht_lazyfree_step(ht, HT_LAZYFREE_BATCH)) {
+        if (current_time_ms() >= deadline) {
+            break;
+        }
+    }
+    return ht->detached_len > 0;
+}
+
+/* Shared front half of the find-or-insert calls: the existing entry,
+   or a claimed slot (counted, tag written) for the caller to init. */
+static ht_entry_t *find_or_claim(hashtable_t *ht, rstr_t key, uint64_t hash,
+                                 bool *inserted) {
+    ht_rehash_step(ht, HT_REHASH_GROUPS_PER_OP);
+
+    ht_entry_t *e = lookup(ht, key, hash, NULL, NULL);
+    if (e) {
+        *inserted = false;
+        return e;
+    }
+
+    reserve_one(ht);
+    ht_table_t *t = &ht->t[ht->rehashing ? 1 : 0];
+    size_t slot = find_free_slot(t, hash);
+    if (t->ctrl[slot] == CTRL_EMPTY) {
+        t->used++;
+    }
+    t->ctrl[slot] = hash_tag(hash);
+    t->count++;
+    *inserted = true;
+    return &t->entries[slot];
+}
+
+ht_entry_t *ht_find_or_insert_hashed(hashtable_t *ht, rstr_t key,
+                                     rstr_t value, uint64_t hash,
+                                     bool *inserted) {
+    ht_entry_t *e = find_or_claim(ht, key, hash, inserted);
+    if (*inserted) {
+        entry_init(e, key, value, hash);
+    }
+    return e;
+}
+
+ht_entry_t *ht_find_or_insert(hashtable_t *ht, rstr_t key, rstr_t value,
+                              bool *inserted) {
+    return ht_find_or_insert_hashed(ht, key, value, key_hash(ht, key),
+                                    inserted);
+}
+
+ht_entry_t *ht_find_or_insert_int(hashtable_t *ht, rstr_t key, int64_t value,
+                                  bool *inserted) {
+    uint64_t hash = key_hash(ht, key);
+    ht_entry_t *e = find_or_claim(ht, key, hash, inserted);
+    if (*inserted) {
+        entry_init_int(e, key, value, hash);
+    }
+    return e;
 }
 
 bool ht_set(hashtable_t *ht, rstr_t key, rstr_t value) {
-    if ((double)ht->used >= (double)ht->capacity * HT_LOAD_FACTOR) {
-        ht_resize(ht);
+    bool inserted;
+    ht_entry_t *e = ht_find_or_insert(ht, key, value, &inserted);
+    if (!inserted) {
+        /* overwrite existing: the key stays, the value buffer is
+           reused when it fits */
+        entry_set_value(e, value);
+        e->expire_at = -1;
     }
+    return inserted;
+}
 
-    bool found;
-    size_t slot = probe(ht, key, &found);
+ht_entry_t *ht_find(hashtable_t *ht, rstr_t key) {
+    return lookup(ht, key, key_hash(ht, key), NULL, NULL);
+}
 
-    if (found) {
-        /* overwrite existing */
-        rstr_free(&ht->entries[slot].key);
-        rstr_free(&ht->entries[slot].value);
-        ht->entries[slot].key = rstr_dup(key);
-        ht->entries[slot].value = rstr_dup(value);
-        ht->entries[slot].expire_at = -1;
-        return false; /* not a new key */
+ht_entry_t *ht_find_hashed(hashtable_t *ht, rstr_t key, uint64_t hash) {
+    return lookup(ht, key, hash, NULL, NULL);
+}
+
+uint64_t ht_hash(hashtable_t *ht, rstr_t key) {
+    return key_hash(ht, key);
+}
+
+void ht_prefetch_group(hashtable_t *ht, uint64_t hash) {
+    int last = ht->rehashing ? 1 : 0;
+    for (int i = 0; i <= last; i++) {
+        const ht_table_t *t = &ht->t[i];
+        size_t g = hash_group(hash) & (t->capacity / HT_GROUP_WIDTH - 1);
+        __builtin_prefetch(&t->ctrl[g * HT_GROUP_WIDTH]);
     }
+}
 
-    /* inserting into empty or tombstone slot */
-    bool was_empty = (ht->entries[slot].state == ENTRY_EMPTY);
-    ht->entries[slot].state = ENTRY_OCCUPIED;
-    ht->entries[slot].key = rstr_dup(key);
-    ht->entries[slot].value = rstr_dup(value);
-    ht->entries[slot].expire_at = -1;
-    ht->count++;
-    if (was_empty) {
-        ht->used++;
+void ht_prefetch_entries(hashtable_t *ht, uint64_t hash) {
+    int last = ht->rehashing ? 1 : 0;
+    for (int i = 0; i <= last; i++) {
+        const ht_table_t *t = &ht->t[i];
+        size_t g = hash_group(hash) & (t->capacity / HT_GROUP_WIDTH - 1);
+        uint32_t match = group_match(&t->ctrl[g * HT_GROUP_WIDTH],
+                                     hash_tag(hash));
+        while (match) {
+            size_t slot = g * HT_GROUP_WIDTH + (size_t)__builtin_ctz(match);
+            /* 48-byte entries can straddle two cache lines */
+            const ht_entry_t *e = &t->entries[slot];
+            __builtin_prefetch(e);
+            __builtin_prefetch((const char *)(e + 1) - 1);
+            match &= match - 1;
+        }
     }
-    return true; /* new key */
 }
 
-rstr_t *ht_get(hashtable_t *ht, rstr_t key) {
-    bool found;
-    size_t slot = probe(ht, key, &found);
-    if (!found) {
-        return NULL;
+rstr_t ht_entry_key(const ht_entry_t *e) {
+    return entry_key(e);
+}
+
+rstr_t ht_entry_value(hashtable_t *ht, const ht_entry_t *e) {
+    return entry_value(ht, e);
+}
+
+void ht_entry_set_value(hashtable_t *ht, ht_entry_t *e, rstr_t value) {
+    (void)ht;
+    entry_set_value(e, value);
+}
+
+bool ht_entry_int(const ht_entry_t *e, int64_t *out) {
+    if (!entry_is_int(e)) {
+        return false;
     }
-    return &ht->entries[slot].value;
+    *out = e->u.num.value;
+    return true;
 }
 
-bool ht_delete(hashtable_t *ht, rstr_t key) {
-    bool found;
-    size_t slot = probe(ht, key, &found);
-    if (!found) {
+void ht_entry_set_int(hashtable_t *ht, ht_entry_t *e, int64_t v) {
+    (void)ht;
+    entry_set_int(e, v);
+}
+
+int64_t ht_entry_expire(const ht_entry_t *e) {
+    return e->expire_at;
+}
+
+void ht_entry_set_expire(hashtable_t *ht, ht_entry_t *e,
+                         int64_t expire_at_ms) {
+    e->expire_at = expire_at_ms;
+    if (expire_at_ms != -1) {
+        expiry_push(ht, expire_at_ms, entry_hash(e));
+    }
+}
+
+void ht_entry_delete(hashtable_t *ht, ht_entry_t *e) {
+    ht_table_t *t = entry_table(ht, e);
+    erase_slot(t, (size_t)(e - t->entries), FREE_NOW);
+}
+
+bool ht_get(hashtable_t *ht, rstr_t key, rstr_t *value) {
+    ht_entry_t *e = ht_find(ht, key);
+    if (!e) {
         return false;
     }
-    entry_free(&ht->entries[slot]);
-    ht->count--;
-    /* used stays the same: tombstone replaces occupied */
+    if (value) {
+        *value = entry_value(ht, e);
+    }
+    return true;
+}
+
+static bool delete_key(hashtable_t *ht, rstr_t key, free_mode_t how) {
+    ht_rehash_step(ht, HT_REHASH_GROUPS_PER_OP);
+
+    ht_table_t *t;
+    size_t slot;
+    if (!lookup(ht, key, key_hash(ht, key), &t, &slot)) {
+        return false;
+    }
+    erase_slot(t, slot, how);
     return true;
 }
 
+bool ht_delete(hashtable_t *ht, rstr_t key) {
+    return delete_key(ht, key, FREE_NOW);
+}
+
+bool ht_unlink(hashtable_t *ht, rstr_t key) {
+    return delete_key(ht, key, FREE_LAZY);
+}
+
 bool ht_exists(hashtable_t *ht, rstr_t key) {
-    bool found;
-    probe(ht, key, &found);
-    return found;
+    return ht_find(ht, key) != NULL;
 }
 
 void ht_set_expire(hashtable_t *ht, rstr_t key, int64_t expire_at_ms) {
-    bool found;
-    size_t slot = probe(ht, key, &found);
-    if (found) {
-        ht->entries[slot].expire_at = expire_at_ms;
+    ht_entry_t *e = ht_find(ht, key);
+    if (e) {
+        ht_entry_set_expire(ht, e, expire_at_ms);
     }
 }
 
 int64_t ht_get_expire(hashtable_t *ht, rstr_t key) {
-    bool found;
-    size_t slot = probe(ht, key, &found);
-    if (!found) {
-        return -1;
-    }
-    return ht->entries[slot].expire_at;
+    ht_entry_t *e = ht_find(ht, key);
+    return e ? e->expire_at : -1;
 }
 
 size_t ht_count(hashtable_t *ht) {
-    return ht->count;
+    return ht->t[0].count + ht->t[1].count;
+}
+
+size_t ht_capacity(hashtable_t *ht) {
+    return ht->t[ht->rehashing ? 1 : 0].capacity;
+}
+
+void ht_reserve(hashtable_t *ht, size_t n) {
+    if (ht->iterators > 0) {
+        return;
+    }
+    if (ht->rehashing) {
+        rehash_groups(ht, SIZE_MAX);
+    }
+    size_t cap = ht->t[0].capacity;
+    while (HT_MAX_LOAD(cap) < n) {
+        cap *= 2;
+    }
+    if (cap > ht->t[0].capacity) {
+        rehash_start(ht, cap);
+        rehash_groups(ht, SIZE_MAX);
+    }
+}
+
+bool ht_is_rehashing(hashtable_t *ht) {
+    return ht->rehashing;
+}
+
+bool ht_rehash_step(hashtable_t *ht, size_t groups) {
+    if (ht->rehashing && ht->iterators == 0) {
+        rehash_groups(ht, groups);
+    }
+    return ht->rehashing;
+}
+
+bool ht_rehash_ms(hashtable_t *ht, int64_t ms) {
+    int64_t deadline = current_time_ms() + ms;
+    while (ht_rehash_step(ht, HT_REHASH_BATCH) && ht->iterators == 0) {
+        if (current_time_ms() >= deadline) {
+            break;
+        }
+    }
+    return ht->rehashing;
+}
+
+size_t ht_expire_cycle(hashtable_t *ht, int64_t budget_us) {
+    int64_t now = clock_ms();
+    int64_t deadline = monotonic_us() + budget_us;
+    size_t expired = 0;
+    size_t popped = 0;
+
+    while (ht->expiry_len > 0 && ht->expiry[0].expire_at <= now) {
+        ht_expiry_t item = ht->expiry[0];
+        expiry_pop(ht);
+        for (int i = 0; i <= (ht->rehashing ? 1 : 0); i++) {
+            ht_table_t *t = &ht->t[i];
+            if (t->count == 0) {
+                continue;
+            }
+            size_t slot = find_expiring_slot(t, item.hash, item.expire_at);
+            if (slot != HT_NOT_FOUND) {
+                erase_slot(t, slot, FREE_NOW);
+                expired++;
+                break;
+            }
+        }
+        if (++popped % HT_EXPIRE_BATCH == 0 && monotonic_us() >= deadline) {
+            break;
+        }
+    }
+    return expired;
+}
+
+int64_t ht_next_expire(hashtable_t *ht) {
+    return ht->expiry_len > 0 ? ht->expiry[0].expire_at : -1;
+}
+
+void ht_set_access_mode(ht_access_t mode) {
+    access_mode = mode;
+}
+
+ht_access_t ht_access_mode(void) {
+    return access_mode;
+}
+
+uint64_t ht_entry_idle_ms(const ht_entry_t *e) {
+    uint64_t ticks = (lru_clock() - (e->hash >> HT_HASH_BITS)) &
+                     HT_ACCESS_MASK;
+    return ticks * HT_LRU_RESOLUTION_MS;
+}
+
+unsigned ht_entry_lfu(const ht_entry_t *e) {
+    return lfu_decayed(e->hash >> HT_HASH_BITS, lfu_minutes());
+}
+
+/* Each pick tries up to HT_SAMPLE_PROBES random slots and takes the
+   first full one, which keeps every key equally likely; only if all of
+   them are empty (a mostly empty table) does it walk forward from the
+   last to the next full slot, which favours keys just after a gap.
+   Taking a run of neighbours instead would be cheaper, but keys
+   inserted together land side by side and tend to share an age, so the
+   sample would be worth about one key. */
+#define HT_SAMPLE_PROBES 16
+
+size_t ht_sample(hashtable_t *ht, ht_entry_t **out, size_t n) {
+    size_t total = ht->t[0].count + ht->t[1].count;
+    size_t found = 0;
+    for (size_t tries = 0; found < n && tries < 2 * n && total > 0;
+         tries++) {
+        uint64_t r = rng_next();
+        /* a table in proportion to the keys it holds */
+        ht_table_t *t = &ht->t[0];
+        if (ht->rehashing && (size_t)(r >> 32) % total >= t->count) {
+            t = &ht->t[1];
+        }
+        size_t mask = t->capacity - 1;
+        size_t slot = (size_t)r & mask;
+        for (int probe = 1; probe < HT_SAMPLE_PROBES &&
+                            (t->ctrl[slot] & 0x80); probe++) {
+            slot = (size_t)rng_next() & mask;
+        }
+        while (t->ctrl[slot] & 0x80) {
+            slot = (slot + 1) & mask;
+        }
+        ht_entry_t *e = &t->entries[slot];
+        bool seen = false;
+        for (size_t i = 0; i < found && !seen; i++) {
+            seen = out[i] == e;
+        }
+        if (!seen) {
+            out[found++] = e;
+        }
+    }
+    return found;
+}
+
+ht_entry_t *ht_next_expiring(hashtable_t *ht) {
+    while (ht->expiry_len > 0) {
+        ht_expiry_t item = ht->expiry[0];
+        for (int i = 0; i <= (ht->rehashing ? 1 : 0); i++) {
+            ht_table_t *t = &ht->t[i];
+            if (t->count == 0) {
+                continue;
+            }
+            size_t slot = find_expiring_slot(t, item.hash, item.expire_at);
+            if (slot != HT_NOT_FOUND) {
+                return &t->entries[slot];
+            }
+        }
+        expiry_pop(ht);
+    }
+    return NULL;
+}
+
+static size_t table_bytes(size_t capacity) {
+    return capacity * (1 + sizeof(ht_entry_t));
+}
+
+size_t ht_memory(hashtable_t *ht) {
+    size_t bytes = sizeof(*ht) + table_bytes(ht->t[0].capacity) +
+                   ht->expiry_cap * sizeof(ht_expiry_t);
+    if (ht->rehashing) {
+        bytes += table_bytes(ht->t[1].capacity);
+    }
+    for (size_t i = 0; i < ht->detached_len; i++) {
+        bytes += table_bytes(ht->detached[i].capacity);
+    }
+    return bytes;
+}
+
+size_t ht_memory_draining(hashtable_t *ht) {
+    size_t bytes = ht->rehashing ? table_bytes(ht->t[0].capacity) : 0;
+    for (size_t i = 0; i < ht->detached_len; i++) {
+        bytes += table_bytes(ht->detached[i].capacity);
+    }
+    return bytes;
+}
+
+/* Mirrors reserve_one(). */
+size_t ht_growth_pending(hashtable_t *ht) {
+    const ht_table_t *t = &ht->t[0];
+    if (ht->rehashing || t->used + 1 <= HT_MAX_LOAD(t->capacity) ||
+        t->count + 1 <= HT_MAX_LOAD(t->capacity) / 2) {
+        return 0;
+    }
+    return table_bytes(t->capacity * 2);
+}
+
+/* Report every live key whose home group is `home`. Those keys sit on
+   home's probe sequence no further than the first group with an EMPTY
+   slot (a lookup for them stops there too). */
+static void scan_home_group(ht_table_t *t, size_t home, ht_scan_fn fn,
+                            void *ctx) {
+    if (t->count == 0) {
+        return;
+    }
+    size_t group_mask = t->capacity / HT_GROUP_WIDTH - 1;
+    size_t g = home;
+
+    for (size_t step = 1; step <= group_mask + 1; step++) {
+        const uint8_t *ctrl = &t->ctrl[g * HT_GROUP_WIDTH];
+        uint32_t full = ~group_match_free(ctrl) & ((1u << HT_GROUP_WIDTH) - 1);
+        while (full) {
+            ht_entry_t *e =
+                &t->entries[g * HT_GROUP_WIDTH + (size_t)__builtin_ctz(full)];
+            if ((hash_group(entry_hash(e)) & group_mask) == home &&
+                !is_expired(e)) {
+                fn(ctx, entry_key(e));
+            }
+            full &= full - 1;
+        }
+        if (group_match_empty(ctrl)) {
+            return;
+        }
+        g = (g + step) & group_mask;
+    }
+}
+
+static size_t rev_bits(size_t v) {
+    size_t s = sizeof(v) * CHAR_BIT;
+    size_t mask = ~(size_t)0;
+    while ((s >>= 1) > 0) {
+        mask ^= mask << s;
+        v = ((v >> s) & mask) | ((v << s) & ~mask);
+    }
+    return v;
+}
+
+/* Increment the bits under mask starting from the most significant, so
+   the cursor sequence for a table is a prefix-closed walk: after growth
+   every group that splits from an unvisited group is itself unvisited. */
+static size_t cursor_next(size_t v, size_t mask) {
+    v |= ~mask;
+    v = rev_bits(v);
+    v++;
+    return rev_bits(v);
+}
+
+size_t ht_scan(hashtable_t *ht, size_t cursor, ht_scan_fn fn, void *ctx) {
+    if (!ht->rehashing) {
+        ht_table_t *t = &ht->t[0];
+        size_t mask = t->capacity / HT_GROUP_WIDTH - 1;
+        scan_home_group(t, cursor & mask, fn, ctx);
+        return cursor_next(cursor, mask);
+    }
+
+    /* Visit the cursor in the smaller table, then every group of the
+       larger table that it expands to. */
+    ht_table_t *small = &ht->t[0];
+    ht_table_t *large = &ht->t[1];
+    if (small->capacity > large->capacity) {
+        small = &ht->t[1];
+        large = &ht->t[0];
+    }
+    size_t small_mask = small->capacity / HT_GROUP_WIDTH - 1;
+    size_t large_mask = large->capacity / HT_GROUP_WIDTH - 1;
+
+    scan_home_group(small, cursor & small_mask, fn, ctx);
+    do {
+        scan_home_group(large, cursor & large_mask, fn, ctx);
+        cursor = cursor_next(cursor, large_mask);
+    } while (cursor & (small_mask ^ large_mask));
+    return cursor;
 }
 
 void ht_iter_init(hashtable_t *ht, ht_iter_t *iter) {
     iter->ht = ht;
+    iter->table = 0;
     iter->index = 0;
+    iter->active = true;
+    iter->in_target = false;
+    ht->iterators++;
 }
 
-bool ht_iter_next(ht_iter_t *iter, rstr_t *key, rstr_t *value) {
-    while (iter->index < iter->ht->capacity) {
-        ht_entry_t *e = &iter->ht->entries[iter->index];
-        iter->index++;
+ht_entry_t *ht_iter_next_entry(ht_iter_t *iter) {
+    hashtable_t *ht = iter->ht;
+    if (!iter->active) {
+        return NULL;
+    }
 
-        if (e->state != ENTRY_OCCUPIED) {
-            continue;
-        }
+    while (iter->table <= (ht->rehashing ? 1 : 0)) {
+        ht_table_t *t = &ht->t[iter->table];
+        while (iter->index < t->capacity) {
+            size_t slot = iter->index++;
+            if (t->ctrl[slot] & 0x80) {
+                continue;
+            }
 
-        /* Check expiration during iteration */
-        if (is_expired(e)) {
-            entry_free(e);
-            iter->ht->count--;
-            continue;
+            ht_entry_t *e = &t->entries[slot];
+            /* Check expiration during iteration */
+            if (is_expired(e)) {
+                erase_slot(t, slot, FREE_NOW);
+                continue;
+            }
+            return e;
         }
-
-        if (key) {
-            *key = e->key;
+        iter->table++;
+        iter->index = 0;
+        if (iter->table == 1 && ht->rehashing) {
+            iter->in_target = true;
+            ht->target_iterators++;
         }
-        if (value) {
-            *value = e->value;
+    }
+
+    ht_iter_release(iter);
+    return NULL;
+}
+
+bool ht_iter_next(ht_iter_t *iter, rstr_t *key, rstr_t *value) {
+    ht_entry_t *e = ht_iter_next_entry(iter);
+    if (!e) {
+        return false;
+    }
+    if (key) {
+        *key = entry_key(e);
+    }
+    if (value) {
+        *value = entry_value(iter->ht, e);
+    }
+    return true;
+}
+
+void ht_iter_release(ht_iter_t *iter) {
+    if (iter->active) {
+        iter->active = false;
+        iter->ht->iterators--;
+        if (iter->in_target) {
+            iter->ht->target_iterators--;
         }
-        return true;
     }
-    return false;
 }
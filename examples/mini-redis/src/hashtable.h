@@ -6,42 +6,274 @@
 #include <stddef.h>
 #include <stdint.h>
 
-typedef enum {
-    ENTRY_EMPTY,
-    ENTRY_OCCUPIED,
-    ENTRY_TOMBSTONE
-} entry_state_t;
+/* Slots are probed a group at a time; capacity is always a power of two
+   and a multiple of the group width. */
+#define HT_GROUP_WIDTH 16
+
+/* Key and value together up to this size are stored in the slot itself;
+   it is the room the heap fields leave, so inline costs no space. */
+#define HT_INLINE_MAX 24
+
+/* val_len marking an integer-encoded value, and the longest key stored
+   beside the integer in the slot. */
+#define HT_VAL_INT UINT32_MAX
+#define HT_INT_KEY_MAX 16
+
+/* An entry's hash word holds hash_bytes(key) cut to its low HT_HASH_BITS
+   bits, which is far more than tags and group indexes use, and above
+   them HT_ACCESS_BITS of access history for eviction (ht_access_t). */
+#define HT_HASH_BITS 40
+#define HT_ACCESS_BITS 24
+
+/* One HT_ACCESS_LRU clock tick; 24 bits of them wrap after 194 days. */
+#define HT_LRU_RESOLUTION_MS 1000
+/* HT_ACCESS_LFU: the counter new keys start at (so they are not the
+   first to go), how fast it saturates, and the minutes per decrement
+   of an idle key's counter. */
+#define HT_LFU_INIT 5
+#define HT_LFU_LOG_FACTOR 10
+#define HT_LFU_DECAY_MINUTES 1
 
+/* One key/value pair. Encoding depends only on the lengths:
+   - key_len + val_len <= HT_INLINE_MAX: key then value in inline_data;
+   - otherwise one heap block holds the key followed by the value, with
+     val_cap bytes of room for the value so overwrites can reuse it;
+   - values of RSTR_SHARED_MIN bytes or more stay separate rstr_t data
+     (shared_value) so replies can reference them without copying. The
+     block then holds only the key;
+   - val_len == HT_VAL_INT: the value is the int64 num.value, written by
+     ht_entry_set_int() (INCR and friends). Keys up to HT_INT_KEY_MAX
+     bytes sit in num.key; longer ones get a block of their own, whose
+     pointer is heap.block. */
 typedef struct {
-    entry_state_t state;
-    rstr_t key;
-    rstr_t value;
+    uint64_t hash;      /* hash of the key, kept for resize and compares,
+                           and access bits (see HT_HASH_BITS) */
     int64_t expire_at;  /* ms since epoch, -1 = no expiration */
+    uint32_t key_len;
+    uint32_t val_len;
+    union {
+        char inline_data[HT_INLINE_MAX];
+        struct {
+            char *block;
+            char *shared_value;
+            uint32_t val_cap;
+        } heap;
+        struct {
+            char key[HT_INT_KEY_MAX];
+            int64_t value;
+        } num;
+    } u;
 } ht_entry_t;
 
+/* ctrl[i] describes entries[i]: 0x80 empty, 0xFE deleted, otherwise the
+   low 7 bits of the key's hash (high bit clear = full). */
 typedef struct {
+    uint8_t *ctrl;
     ht_entry_t *entries;
     size_t capacity;
-    size_t count;       /* OCCUPIED entries */
-    size_t used;        /* OCCUPIED + TOMBSTONE */
+    size_t count;       /* full slots */
+    size_t used;        /* full + deleted slots */
+} ht_table_t;
+
+/* Expiry index item: a key is named by its cached hash, so entries can
+   move (rehash) without the index being told. Items are never updated
+   in place; one whose entry was deleted or given another TTL is found
+   stale when popped and dropped. */
+typedef struct {
+    int64_t expire_at;
+    uint64_t hash;
+} ht_expiry_t;
+
+/* Growth is incremental: while rehashing, t[0] is drained into t[1] a
+   group at a time (on each insert/delete and from ht_rehash_step()),
+   lookups consult both, and new keys land in t[1]. */
+typedef struct {
+    ht_table_t t[2];
+    bool rehashing;
+    size_t rehash_group;    /* next t[0] group to migrate */
+    int iterators;          /* live iterators; migration waits for them */
+    int target_iterators;   /* of those, walking t[1]: it keeps its layout */
+    uint64_t seed;
+    ht_expiry_t *expiry;    /* min-heap on expire_at */
+    size_t expiry_len;
+    size_t expiry_cap;
+    ht_table_t *detached;   /* dropped by ht_clear_async(), released */
+    size_t detached_len;    /* last first by ht_lazyfree_step() */
+    size_t detached_cap;
+    size_t detached_slot;   /* where the last one's walk resumes */
+    char num_buf[24];       /* decimal form of the last integer viewed */
 } hashtable_t;
 
+/* What the access bits of an entry record, process-wide:
+   - HT_ACCESS_NONE: nothing; lookups leave entries alone;
+   - HT_ACCESS_LRU: the HT_LRU_RESOLUTION_MS tick of the last access;
+   - HT_ACCESS_LFU: as in Redis, the minute of the last decay (16 bits)
+     and a logarithmic access counter (8 bits): an access bumps it with
+     probability 1 / ((counter - HT_LFU_INIT) * HT_LFU_LOG_FACTOR + 1),
+     each idle HT_LFU_DECAY_MINUTES takes one off. */
+typedef enum {
+    HT_ACCESS_NONE,
+    HT_ACCESS_LRU,
+    HT_ACCESS_LFU
+} ht_access_t;
+
+/* An iterator pauses migration until it is exhausted or released, so it
+   sees every key present throughout the walk exactly once. Inserts that
+   fill t[1] meanwhile grow t[1] instead; once the walk has reached t[1]
+   they run it past the load limit, and only a t[1] with no free slot
+   left is grown under it (keys may then be seen again or missed). */
 typedef struct {
     hashtable_t *ht;
+    int table;
     size_t index;
+    bool active;
+    bool in_target;         /* counted in ht->target_iterators */
 } ht_iter_t;
 
+/* Seeded from hash_seed(); ht_create_seeded() is for reproducible
+   layouts in tests and benchmarks. */
 hashtable_t *ht_create(void);
+hashtable_t *ht_create_seeded(uint64_t seed);
 void ht_destroy(hashtable_t *ht);
+/* ht_destroy() for a thread that then calls slab_release_thread(): the
+   small keys and values go with the slab pages, so only the memory from
+   malloc is freed (one pass over the slots), and that on the lazy-free
+   thread. */
+void ht_abandon(hashtable_t *ht);
+/* Delete every key and shrink back to the initial table. Not while an
+   iterator is live. */
+void ht_clear(hashtable_t *ht);
+/* ht_clear() in O(1): the tables are set aside and their entries freed
+   a slice at a time by ht_lazyfree_step(), large values and the arrays
+   on the lazy-free thread. Their memory stays counted (slab, and
+   ht_memory_draining()) until then. */
+void ht_clear_async(hashtable_t *ht);
+bool ht_lazyfree_pending(hashtable_t *ht);
+/* Release up to `slots` slots of set-aside tables. Returns true while
+   any remain. */
+bool ht_lazyfree_step(hashtable_t *ht, size_t slots);
+/* Release for roughly `ms` milliseconds. Same return as above. */
+bool ht_lazyfree_ms(hashtable_t *ht, int64_t ms);
 bool ht_set(hashtable_t *ht, rstr_t key, rstr_t value);
-rstr_t *ht_get(hashtable_t *ht, rstr_t key);
+/* Stored data is copied in; ht_get() and iterators return views. An
+   integer-encoded value is viewed through num_buf, so that view only
+   lasts until the next value is viewed. */
+bool ht_get(hashtable_t *ht, rstr_t key, rstr_t *value);
 bool ht_delete(hashtable_t *ht, rstr_t key);
+/* ht_delete(), leaving the free() of a large value to the lazy-free
+   thread, so that deleting it costs no more than a small one. */
+bool ht_unlink(hashtable_t *ht, rstr_t key);
 bool ht_exists(hashtable_t *ht, rstr_t key);
 void ht_set_expire(hashtable_t *ht, rstr_t key, int64_t expire_at_ms);
 int64_t ht_get_expire(hashtable_t *ht, rstr_t key);
 size_t ht_count(hashtable_t *ht);
+/* Slots in the table new keys go to (the target table while rehashing). */
+size_t ht_capacity(hashtable_t *ht);
+/* Grow at once to a table that holds n keys without resizing (bulk
+   loads). A table that already has the room is left alone, as is one
+   with live iterators. */
+void ht_reserve(hashtable_t *ht, size_t n);
+
+/* Views returned by ht_get() stay valid until the next ht_set(),
+   ht_delete() or rehash step. */
+bool ht_is_rehashing(hashtable_t *ht);
+/* Migrate up to `groups` groups. Returns true while rehashing remains. */
+bool ht_rehash_step(hashtable_t *ht, size_t groups);
+/* Migrate for roughly `ms` milliseconds. Same return as above. */
+bool ht_rehash_ms(hashtable_t *ht, int64_t ms);
+
+/* Entry handles: one probe for a whole read-modify-write. A handle
+   stays valid until the next call that inserts, deletes or migrates
+   (ht_set(), ht_delete(), ht_find_or_insert(), ht_entry_delete(),
+   ht_expire_cycle(), a rehash step); the ht_entry_* setters keep it
+   valid. */
+ht_entry_t *ht_find(hashtable_t *ht, rstr_t key);
+/* Returns the entry for key, inserting key -> value (no TTL) if it is
+   missing. An existing entry is returned unchanged. */
+ht_entry_t *ht_find_or_insert(hashtable_t *ht, rstr_t key, rstr_t value,
+                              bool *inserted);
+rstr_t ht_entry_key(const ht_entry_t *e);
+rstr_t ht_entry_value(hashtable_t *ht, const ht_entry_t *e);
+/* Replace the value; the TTL is kept. */
+void ht_entry_set_value(hashtable_t *ht, ht_entry_t *e, rstr_t value);
+/* Like ht_find_or_insert(), inserting the integer value. */
+ht_entry_t *ht_find_or_insert_int(hashtable_t *ht, rstr_t key, int64_t value,
+                                  bool *inserted);
+/* False if the value is stored as a string (which may still parse). */
+bool ht_entry_int(const ht_entry_t *e, int64_t *out);
+/* Store v, as an integer unless the decimal string fits in the slot
+   and the integer would not. The TTL is kept. */
+void ht_entry_set_int(hashtable_t *ht, ht_entry_t *e, int64_t v);
+int64_t ht_entry_expire(const ht_entry_t *e);
+void ht_entry_set_expire(hashtable_t *ht, ht_entry_t *e, int64_t expire_at_ms);
+void ht_entry_delete(hashtable_t *ht, ht_entry_t *e);
+
+/* Batched lookups (MGET, MSET): hash every key first, then prefetch a few
+   keys ahead of the probes so their cache misses overlap. Stage one
+   fetches a key's home control group; stage two, issued a few keys
+   later, reads that group and fetches the entries whose tag matches.
+   Both are only hints, so the table may change in between. The _hashed
+   calls take a hash from ht_hash() and otherwise behave like ht_find()
+   and ht_find_or_insert(). */
+uint64_t ht_hash(hashtable_t *ht, rstr_t key);
+void ht_prefetch_group(hashtable_t *ht, uint64_t hash);
+void ht_prefetch_entries(hashtable_t *ht, uint64_t hash);
+ht_entry_t *ht_find_hashed(hashtable_t *ht, rstr_t key, uint64_t hash);
+ht_entry_t *ht_find_or_insert_hashed(hashtable_t *ht, rstr_t key,
+                                     rstr_t value, uint64_t hash,
+                                     bool *inserted);
+
+/* Active expiration: erase keys whose expire_at has passed (by
+   clock_ms()), stopping after roughly budget_us microseconds. Returns
+   the number of keys removed. */
+size_t ht_expire_cycle(hashtable_t *ht, int64_t budget_us);
+/* Earliest expire_at in the index, -1 if empty. It may belong to a key
+   that has since been deleted or given a new TTL. */
+int64_t ht_next_expire(hashtable_t *ht);
+
+/* Eviction support. Lookups (ht_find(), ht_get(), finding an existing
+   key to update) count as accesses; iterators and scans do not. Set the
+   mode before the tables are used, and from one thread. */
+void ht_set_access_mode(ht_access_t mode);
+ht_access_t ht_access_mode(void);
+/* HT_ACCESS_LRU: ms since the entry was last accessed, to the tick. */
+uint64_t ht_entry_idle_ms(const ht_entry_t *e);
+/* HT_ACCESS_LFU: the access counter after any decay that is due. */
+unsigned ht_entry_lfu(const ht_entry_t *e);
+/* Up to n distinct entries picked at random, expired ones included;
+   returns how many (fewer only when the table has few keys). Handles
+   last as ht_find()'s do. */
+size_t ht_sample(hashtable_t *ht, ht_entry_t **out, size_t n);
+/* The entry with the earliest TTL, NULL if no key has one. Stale items
+   at the front of the expiry index are dropped on the way. */
+ht_entry_t *ht_next_expiring(hashtable_t *ht);
+/* Bytes of table (control bytes and slots) and expiry index, both
+   tables while rehashing; keys and values in their own blocks are the
+   allocator's. */
+size_t ht_memory(hashtable_t *ht);
+/* The part of ht_memory() in a table being drained by a rehash, which
+   goes away as the migration finishes, and in tables set aside by
+   ht_clear_async(). */
+size_t ht_memory_draining(hashtable_t *ht);
+/* The bytes a bigger table would take if the next new key made the
+   table double, else 0. */
+size_t ht_growth_pending(hashtable_t *ht);
+
+/* Cursor scan. Each call visits one home group (plus the groups it
+   splits into in a bigger table while rehashing), passes each live key
+   to fn and returns the next cursor; 0 starts and ends a scan. Cursors
+   advance in reverse-binary order over the group index, so every key
+   present for the whole scan is reported at least once even if the
+   table grows in between calls. Keys may be reported more than once. */
+typedef void (*ht_scan_fn)(void *ctx, rstr_t key);
+size_t ht_scan(hashtable_t *ht, size_t cursor, ht_scan_fn fn, void *ctx);
 
 void ht_iter_init(hashtable_t *ht, ht_iter_t *iter);
 bool ht_iter_next(ht_iter_t *iter, rstr_t *key, rstr_t *value);
+/* Like ht_iter_next(), for callers that need the encoding or TTL; the
+   handle lasts until the next call. NULL at the end. */
+ht_entry_t *ht_iter_next_entry(ht_iter_t *iter);
+/* Only needed when stopping before ht_iter_next() returns false. */
+void ht_iter_release(ht_iter_t *iter);
 
 #endif
@@ -0,0 +1,172 @@
+#include "io_threads.h"
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <sched.h>
+
+/* Polls of the batch counter before a worker goes to sleep on the
+   condition variable. Under load the next batch arrives within the spin
+   and costs no wakeup; an idle server parks its workers quickly. Spinners
+   yield now and then so that, with fewer cores than threads, they do not
+   starve the thread they are waiting for. */
+#define IO_SPIN_LIMIT 20000
+
+typedef struct {
+    io_threads_t *io;
+    int index;
+    pthread_t tid;
+} io_worker_t;
+
+struct io_threads {
+    int nthreads;
+    io_worker_t *workers;       /* nthreads - 1 of them */
+
+    /* Current batch; written by the main thread before the generation
+       is bumped, read by workers after they observe the bump. */
+    io_job_fn fn;
+    void **jobs;
+    size_t njobs;
+    bool stop;
+
+    atomic_ulong generation;    /* batches started */
+    atomic_int pending;         /* workers still running the batch */
+    pthread_mutex_t lock;       /* guards sleeping on start */
+    pthread_cond_t start;
+};
+
+static void run_share(io_threads_t *io, int index) {
+    for (size_t i = (size_t)index; i < io->njobs; i += (size_t)io->nthreads) {
+        io->fn(io->jobs[i]);
+    }
+}
+
+/* Wait for a generation other than `seen`. */
+static unsigned long wait_batch(io_threads_t *io, unsigned long seen) {
+    for (int spin = 0; spin < IO_SPIN_LIMIT; spin++) {
+        unsigned long gen = atomic_load_explicit(&io->generation,
+                                                 memory_order_acquire);
+        if (gen != seen) {
+            return gen;
+        }
+        if ((spin & 255) == 255) {
+            sched_yield();
+        }
+    }
+    pthread_mutex_lock(&io->lock);
+    unsigned long gen;
+    while ((gen = atomic_load_explicit(&io->generation,
+                                       memory_order_acquire)) == seen) {
+        pthread_cond_wait(&io->start, &io->lock);
+    }
+    pthread_mutex_unlock(&io->lock);
+    return gen;
+}
+
+static void *worker_main(void *arg) {
+    io_worker_t *w = arg;
+    io_threads_t *io = w->io;
+    unsigned long seen = 0;
+
+    while (1) {
+        seen = wait_batch(io, seen);
+        if (io->stop) {
+            return NULL;
+        }
+        run_share(io, w->index);
+        atomic_fetch_sub_explicit(&io->pending, 1, memory_order_release);
+    }
+}
+
+/* Publish the batch fields and wake every worker. */
+static void start_batch(io_threads_t *io) {
+    pthread_mutex_lock(&io->lock);
+    atomic_fetch_add_explicit(&io->generation, 1, memory_order_release);
+    pthread_cond_broadcast(&io->start);
+    pthread_mutex_unlock(&io->lock);
+}
+
+io_threads_t *io_threads_create(int nthreads) {
+    if (nthreads < 1) {
+        nthreads = 1;
+    }
+    if (nthreads > IO_THREADS_MAX) {
+        nthreads = IO_THREADS_MAX;
+    }
+    io_threads_t *io = calloc(1, sizeof(io_threads_t));
+    if (!io) {
+        perror("calloc");
+        exit(1);
+    }
+    io->nthreads = nthreads;
+    atomic_init(&io->generation, 0);
+    atomic_init(&io->pending, 0);
+    pthread_mutex_init(&io->lock, NULL);
+    pthread_cond_init(&io->start, NULL);
+    if (nthreads == 1) {
+        return io;
+    }
+
+    io->workers = calloc((size_t)nthreads - 1, sizeof(io_worker_t));
+    if (!io->workers) {
+        perror("calloc");
+        exit(1);
+    }
+    for (int i = 0; i < nthreads - 1; i++) {
+        io_worker_t *w = &io->workers[i];
+        w->io = io;
+        w->index = i + 1;
+        int err = pthread_create(&w->tid, NULL, worker_main, w);
+        if (err != 0) {
+            fprintf(stderr, "pthread_create: error %d\n", err);
+            exit(1);
+        }
+    }
+    return io;
+}
+
+void io_threads_destroy(io_threads_t *io) {
+    if (!io) {
+        return;
+    }
+    if (io->nthreads > 1) {
+        io->stop = true;
+        start_batch(io);
+        for (int i = 0; i < io->nthreads - 1; i++) {
+            pthread_join(io->workers[i].tid, NULL);
+        }
+    }
+    pthread_mutex_destroy(&io->lock);
+    pthread_cond_destroy(&io->start);
+    free(io->workers);
+    free(io);
+}
+
+int io_threads_count(const io_threads_t *io) {
+    return io->nthreads;
+}
+
+void io_threads_run(io_threads_t *io, io_job_fn fn, void **jobs, size_t n) {
+    io->fn = fn;
+    io->jobs = jobs;
+    io->njobs = n;
+    if (io->nthreads == 1 || n <= 1) {
+        run_share(io, 0);
+        return;
+    }
+
+    atomic_store_explicit(&io->pending, io->nthreads - 1,
+                          memory_order_relaxed);
+    start_batch(io);
+    run_share(io, 0);
+    /* the workers' shares are about as long as ours; yield once the
+       wait gets long in case they are waiting for this CPU */
+    for (int spin = 0;
+         atomic_load_explicit(&io->pending, memory_order_acquire) > 0;
+         spin++) {
+        if (spin >= IO_SPIN_LIMIT) {
+            sched_yield();
+        }
+    }
+}
@@ -0,0 +1,25 @@
+#ifndef IO_THREADS_H
+#define IO_THREADS_H
+
+#include <stddef.h>
+
+#define IO_THREADS_MAX 64
+
+/* A fixed set of threads for the server's socket I/O. The main thread
+   hands out a batch of independent jobs (one per client) and takes a
+   share of it itself; io_threads_run() returns once every job is done.
+   Jobs must not touch the store, the event loop or the slab allocator,
+   which stay owned by the main thread. */
+typedef struct io_threads io_threads_t;
+typedef void (*io_job_fn)(void *job);
+
+/* nthreads counts the main thread, so nthreads - 1 workers are started;
+   1 runs every batch inline. */
+io_threads_t *io_threads_create(int nthreads);
+void io_threads_destroy(io_threads_t *io);
+int io_threads_count(const io_threads_t *io);
+
+/* Call fn on each of jobs[0..n). Job i runs on thread i % nthreads. */
+void io_threads_run(io_threads_t *io, io_job_fn fn, void **jobs, size_t n);
+
+#endif
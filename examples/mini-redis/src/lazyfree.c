@@ -0,0 +1,110 @@
+#include "lazyfree.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+/* A queued block's first word links it to the next one. */
+typedef struct lazy_block {
+    struct lazy_block *next;
+} lazy_block_t;
+
+static _Atomic(lazy_block_t *) head;
+static atomic_size_t pending;
+static atomic_size_t freed;
+static atomic_bool running;
+
+/* The thread sleeps on `wake` when the stack is empty. Pushers only
+   take the lock when it says it is asleep: it sets `sleeping` before
+   its last look at the stack, and a pusher reads it after its push, so
+   one of them always sees the other (both are sequentially consistent). */
+static pthread_t thread;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t wake = PTHREAD_COND_INITIALIZER;
+static atomic_bool sleeping;
+static bool stopping;
+
+static void *lazyfree_main(void *arg) {
+    (void)arg;
+    for (;;) {
+        lazy_block_t *b = atomic_exchange(&head, NULL);
+        if (!b) {
+            pthread_mutex_lock(&lock);
+            atomic_store(&sleeping, true);
+            while (!atomic_load(&head) && !stopping) {
+                pthread_cond_wait(&wake, &lock);
+            }
+            atomic_store(&sleeping, false);
+            bool done = stopping && !atomic_load(&head);
+            pthread_mutex_unlock(&lock);
+            if (done) {
+                return NULL;
+            }
+            continue;
+        }
+        size_t n = 0;
+        while (b) {
+            lazy_block_t *next = b->next;
+            free(b);
+            b = next;
+            n++;
+        }
+        atomic_fetch_sub_explicit(&pending, n, memory_order_relaxed);
+        atomic_fetch_add_explicit(&freed, n, memory_order_relaxed);
+    }
+}
+
+void lazyfree_start(void) {
+    if (atomic_load(&running)) {
+        return;
+    }
+    stopping = false;
+    int err = pthread_create(&thread, NULL, lazyfree_main, NULL);
+    if (err != 0) {
+        fprintf(stderr, "pthread_create: error %d\n", err);
+        exit(1);
+    }
+    atomic_store(&running, true);
+}
+
+void lazyfree_stop(void) {
+    if (!atomic_load(&running)) {
+        return;
+    }
+    pthread_mutex_lock(&lock);
+    stopping = true;
+    pthread_cond_signal(&wake);
+    pthread_mutex_unlock(&lock);
+    pthread_join(thread, NULL);
+    atomic_store(&running, false);
+}
+
+void lazyfree_free(void *ptr) {
+    if (!ptr) {
+        return;
+    }
+    if (!atomic_load_explicit(&running, memory_order_relaxed)) {
+        free(ptr);
+        return;
+    }
+    /* counted first, so the thread never takes pending below zero */
+    atomic_fetch_add_explicit(&pending, 1, memory_order_relaxed);
+    lazy_block_t *b = ptr;
+    b->next = atomic_load_explicit(&head, memory_order_relaxed);
+    while (!atomic_compare_exchange_weak(&head, &b->next, b)) {
+    }
+    if (atomic_load(&sleeping)) {
+        pthread_mutex_lock(&lock);
+        pthread_cond_signal(&wake);
+        pthread_mutex_unlock(&lock);
+    }
+}
+
+size_t lazyfree_pending(void) {
+    return atomic_load_explicit(&pending, memory_order_relaxed);
+}
+
+size_t lazyfree_freed(void) {
+    return atomic_load_explicit(&freed, memory_order_relaxed);
+}
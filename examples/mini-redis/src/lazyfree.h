@@ -0,0 +1,30 @@
+#ifndef LAZYFREE_H
+#define LAZYFREE_H
+
+#include <stddef.h>
+
+/* A background thread that hands memory back to malloc, so the event
+   loop never waits on free() of a big block: a multi-megabyte value or
+   a table's arrays, whose free is an munmap. Blocks are pushed onto a
+   lock-free stack linked through their own first word, so giving one
+   away is a compare-and-swap with no allocation and no lock; the thread
+   takes the whole stack at once. Only malloc'd memory can go this way.
+   Slab objects belong to the thread that allocated them, so
+   slab_free_lazy() sends only the large blocks that slab passes through
+   to malloc. */
+
+/* Before the threads that free lazily start. Until then, and after
+   lazyfree_stop(), lazyfree_free() frees inline. */
+void lazyfree_start(void);
+/* Free whatever is queued, then stop the thread. */
+void lazyfree_stop(void);
+
+/* free(ptr), on the lazy-free thread. ptr comes from malloc and is at
+   least pointer-sized; it must not be touched again. Any thread. */
+void lazyfree_free(void *ptr);
+
+/* Blocks queued and not yet freed, and freed so far (INFO). */
+size_t lazyfree_pending(void);
+size_t lazyfree_freed(void);
+
+#endif
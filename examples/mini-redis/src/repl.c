@@ -0,0 +1,805 @@
+#include "repl.h"
+#include "aof.h"
+#include "commands.h"
+#include "hash.h"
+#include "snapshot.h"
+#include "util.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <netdb.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#define REPL_RETRY_MS 1000
+#define REPL_MAX_LINE 256           /* handshake lines */
+
+static bool available;
+static event_loop_t *loop;
+static int link_token;
+static char replid[REPL_ID_LEN + 1];
+static client_t link_client;           /* a replica's link, as a client */
+
+static void new_replid(void) {
+    uint8_t raw[REPL_ID_LEN / 2];
+    FILE *f = fopen("/dev/urandom", "rb");
+    if (!f || fread(raw, sizeof(raw), 1, f) != 1) {
+        /* no entropy source: different per process and per call */
+        uint64_t seed = (uint64_t)current_time_ms() ^ (uint64_t)getpid();
+        for (size_t i = 0; i < sizeof(raw); i++) {
+            seed = hash_bytes(&seed, sizeof(seed), hash_seed() + i);
+            raw[i] = (uint8_t)seed;
+        }
+    }
+    if (f) {
+        fclose(f);
+    }
+    for (size_t i = 0; i < sizeof(raw); i++) {
+        snprintf(replid + 2 * i, 3, "%02x", raw[i]);
+    }
+}
+
+static bool parse_offset(rstr_t s, int64_t *out) {
+    char buf[24];
+    if (s.len == 0 || s.len >= sizeof(buf)) {
+        return false;
+    }
+    memcpy(buf, s.data, s.len);
+    buf[s.len] = '\0';
+    char *end;
+    errno = 0;
+    long long v = strtoll(buf, &end, 10);
+    if (errno != 0 || *end != '\0') {
+        return false;
+    }
+    *out = v;
+    return true;
+}
+
+/* Where snapshot files for a full resync are staged, next to the
+   server's own. */
+static void stage_path(char *dst, size_t size, const char *what, pid_t pid) {
+    const char *base = snapshot_path() ? snapshot_path() :
+                                         SNAPSHOT_DEFAULT_PATH;
+    snprintf(dst, size, "%s.%s-%ld", base, what, (long)pid);
+}
+
+/* ---- primary: backlog ---- */
+
+static char *backlog;               /* NULL until the first replica */
+static size_t backlog_size;
+static int64_t backlog_start;       /* offset the backlog was created at */
+static int64_t master_offset;       /* bytes recorded */
+static int64_t flushed_offset;      /* bytes queued on online replicas */
+
+typedef enum {
+    REPLICA_WAIT_BGSAVE,            /* needs a snapshot not started yet */
+    REPLICA_WAIT_SNAPSHOT,          /* the running child's is for it */
+    REPLICA_ONLINE
+} replica_state_t;
+
+typedef struct {
+    client_t *c;
+    replica_state_t state;
+    size_t payload;                 /* queued snapshot bytes, not lag */
+    bool drop;
+} replica_t;
+
+static replica_t *replicas;
+static int nreplicas;
+static int replicas_cap;
+
+static pid_t sync_pid;              /* snapshot child, 0 if none */
+static int64_t sync_offset;         /* stream offset it was forked at */
+
+void repl_init(event_loop_t *el, int token, size_t size) {
+    available = true;
+    loop = el;
+    link_token = token;
+    backlog_size = size;
+    client_init(&link_client);
+    new_replid();
+}
+
+bool repl_available(void) {
+    return available;
+}
+
+const char *repl_id(void) {
+    return replid;
+}
+
+bool repl_feeding(void) {
+    return backlog != NULL;
+}
+
+/* Oldest offset the backlog still holds. */
+static int64_t backlog_low(void) {
+    int64_t low = master_offset - (int64_t)backlog_size;
+    return low > backlog_start ? low : backlog_start;
+}
+
+static void stream_put(const char *data, size_t len) {
+    while (len > 0) {
+        size_t pending = (size_t)(master_offset - flushed_offset);
+        if (pending == backlog_size) {
+            /* more in one iteration than the ring holds: hand over what
+               it has before overwriting it */
+            repl_flush();
+            continue;
+        }
+        size_t pos = (size_t)(master_offset % (int64_t)backlog_size);
+        size_t n = backlog_size - pos;
+        if (n > backlog_size - pending) {
+            n = backlog_size - pending;
+        }
+        if (n > len) {
+            n = len;
+        }
+        memcpy(backlog + pos, data, n);
+        master_offset += (int64_t)n;
+        data += n;
+        len -= n;
+    }
+}
+
+void repl_feed(const resp_value_t *argv, int argc) {
+    if (!backlog) {
+        return;
+    }
+    char header[32];
+    stream_put(header, (size_t)snprintf(header, sizeof(header), "*%d\r\n",
+                                        argc));
+    for (int i = 0; i < argc; i++) {
+        rstr_t s = argv[i].str;
+        stream_put(header, (size_t)snprintf(header, sizeof(header),
+                                            "$%zu\r\n", s.len));
+        stream_put(s.data, s.len);
+        stream_put("\r\n", 2);
+    }
+}
+
+/* Queue the stream in [from, to) on one replica, or with r NULL on every
+   online one. Large runs are one shared string for all of them. */
+static void queue_stream(replica_t *r, int64_t from, int64_t to) {
+    while (from < to) {
+        size_t pos = (size_t)(from % (int64_t)backlog_size);
+        size_t len = backlog_size - pos;
+        if ((int64_t)len > to - from) {
+            len = (size_t)(to - from);
+        }
+        rstr_t shared = {NULL, 0};
+        if (len >= RSTR_SHARED_MIN) {
+            shared = rstr_create(backlog + pos, len);
+        }
+        for (int i = 0; i < nreplicas; i++) {
+            replica_t *q = &replicas[i];
+            if (r ? q != r : q->state != REPLICA_ONLINE || q->drop) {
+                continue;
+            }
+            if (shared.data) {
+                client_write_value(q->c, shared);
+            } else {
+                client_write_append(q->c, backlog + pos, len);
+            }
+        }
+        rstr_free(&shared);
+        from += (int64_t)len;
+    }
+}
+
+void repl_flush(void) {
+    if (!backlog || master_offset == flushed_offset) {
+        return;
+    }
+    int64_t to = master_offset;
+    queue_stream(NULL, flushed_offset, to);
+    flushed_offset = to;
+}
+
+/* ---- primary: replicas ---- */
+
+static replica_t *add_replica(client_t *c) {
+    if (nreplicas == replicas_cap) {
+        int cap = replicas_cap ? replicas_cap * 2 : 4;
+        replica_t *grown = realloc(replicas, (size_t)cap * sizeof(*grown));
+        if (!grown) {
+            perror("realloc");
+            exit(1);
+        }
+        replicas = grown;
+        replicas_cap = cap;
+    }
+    replica_t *r = &replicas[nreplicas];
+    memset(r, 0, sizeof(*r));
+    r->c = c;
+    c->replica = nreplicas++;
+    return r;
+}
+
+void repl_detach(client_t *c) {
+    int i = c->replica;
+    replicas[i] = replicas[--nreplicas];
+    if (i < nreplicas) {
+        replicas[i].c->replica = i;
+    }
+    c->replica = -1;
+}
+
+static void start_sync(hashtable_t *ht) {
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        for (int i = 0; i < nreplicas; i++) {
+            if (replicas[i].state == REPLICA_WAIT_BGSAVE) {
+                replicas[i].drop = true;
+            }
+        }
+        return;
+    }
+    if (pid == 0) {
+        /* as for BGSAVE: only this thread exists, no handlers run */
+        char path[4096];
+        stage_path(path, sizeof(path), "sync", getpid());
+        if (snapshot_write(ht, path) < 0) {
+            perror("replica sync");
+            _exit(1);
+        }
+        _exit(0);
+    }
+    sync_pid = pid;
+    sync_offset = master_offset;
+    int n = 0;
+    char line[64 + REPL_ID_LEN];
+    size_t len = (size_t)snprintf(line, sizeof(line), "+FULLRESYNC %s %"
+                                  PRId64 "\r\n", replid, sync_offset);
+    for (int i = 0; i < nreplicas; i++) {
+        replica_t *r = &replicas[i];
+        if (r->state == REPLICA_WAIT_BGSAVE) {
+            client_write_append(r->c, line, len);
+            r->state = REPLICA_WAIT_SNAPSHOT;
+            n++;
+        }
+    }
+    fprintf(stderr, "Full resync of %d replica%s at offset %" PRId64
+            ", snapshot by pid %ld\n", n, n == 1 ? "" : "s", sync_offset,
+            (long)pid);
+}
+
+void repl_attach(client_t *c, hashtable_t *ht, rstr_t id, rstr_t offset) {
+    if (!backlog) {
+        backlog = malloc(backlog_size);
+        if (!backlog) {
+            perror("malloc");
+            exit(1);
+        }
+        backlog_start = master_offset;
+        flushed_offset = master_offset;
+    }
+    replica_t *r = add_replica(c);
+
+    int64_t from;
+    if (id.len == REPL_ID_LEN && memcmp(id.data, replid, REPL_ID_LEN) == 0 &&
+        parse_offset(offset, &from) && from >= backlog_low() &&
+        from <= master_offset) {
+        client_write_append(c, "+CONTINUE\r\n", 11);
+        queue_stream(r, from, flushed_offset);
+        r->state = REPLICA_ONLINE;
+        fprintf(stderr, "Partial resync of a replica from offset %" PRId64
+                "\n", from);
+        return;
+    }
+    r->state = REPLICA_WAIT_BGSAVE;
+    if (sync_pid == 0) {
+        start_sync(ht);
+    }
+}
+
+/* The snapshot child has exited: send its file, then the stream since
+   the fork, to the replicas it was for. */
+static void finish_sync(bool ok) {
+    char path[4096];
+    stage_path(path, sizeof(path), "sync", sync_pid);
+    sync_pid = 0;
+
+    rstr_t payload = {NULL, 0};
+    int fd = ok ? open(path, O_RDONLY | O_CLOEXEC) : -1;
+    struct stat st;
+    if (fd >= 0 && fstat(fd, &st) == 0 && st.st_size > 0) {
+        void *map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE,
+                         fd, 0);
+        if (map != MAP_FAILED) {
+            payload = rstr_create(map, (size_t)st.st_size);
+            munmap(map, (size_t)st.st_size);
+        }
+    }
+    if (fd >= 0) {
+        close(fd);
+    }
+    unlink(path);
+    if (!payload.data) {
+        fprintf(stderr, "Replica sync snapshot failed\n");
+    }
+
+    bool in_backlog = sync_offset >= backlog_low();
+    char header[32];
+    size_t header_len = (size_t)snprintf(header, sizeof(header), "$%zu\r\n",
+                                         payload.len);
+    for (int i = 0; i < nreplicas; i++) {
+        replica_t *r = &replicas[i];
+        if (r->state != REPLICA_WAIT_SNAPSHOT) {
+            continue;
+        }
+        if (!payload.data || !in_backlog) {
+            r->drop = true;
+            continue;
+        }
+        client_write_append(r->c, header, header_len);
+        client_write_value(r->c, payload);
+        r->payload = header_len + payload.len;
+        queue_stream(r, sync_offset, flushed_offset);
+        r->state = REPLICA_ONLINE;
+    }
+    rstr_free(&payload);
+}
+
+int repl_replica_count(void) {
+    return nreplicas;
+}
+
+client_t *repl_replica(int i) {
+    return replicas[i].c;
+}
+
+bool repl_replica_lagging(int i) {
+    replica_t *r = &replicas[i];
+    /* the snapshot goes out first, so at most write_len of it is left */
+    if (r->payload > r->c->write_len) {
+        r->payload = r->c->write_len;
+    }
+    return r->drop || r->c->write_len > r->payload + backlog_size;
+}
+
+/* Replicas are left to be dropped and the backlog goes: the stream they
+   were following has ended. */
+static void end_stream(void) {
+    for (int i = 0; i < nreplicas; i++) {
+        replicas[i].drop = true;
+    }
+    free(backlog);
+    backlog = NULL;
+    flushed_offset = master_offset;
+}
+
+/* ---- replica: the link to the primary ---- */
+
+typedef enum {
+    LINK_NONE,                      /* a primary */
+    LINK_CONNECT,                   /* waiting to (re)connect */
+    LINK_CONNECTING,
+    LINK_HANDSHAKE,                 /* PSYNC sent */
+    LINK_SNAPSHOT_HEADER,           /* +FULLRESYNC read, $<len> next */
+    LINK_SNAPSHOT,
+    LINK_CONNECTED                  /* applying the stream */
+} link_state_t;
+
+static link_state_t link_state;
+static char primary_host[256];
+static char primary_port[8];
+static int64_t retry_at;
+static char primary_id[REPL_ID_LEN + 1];   /* "" until the first sync */
+static int64_t applied_offset;
+static size_t cmd_start;            /* read_buf offset of the next command */
+static char pending_id[REPL_ID_LEN + 1];   /* from +FULLRESYNC */
+static int64_t pending_offset;
+static int transfer_fd = -1;
+static uint64_t transfer_left;
+static char transfer_path[4096];
+
+int64_t repl_offset(void) {
+    return link_state == LINK_NONE ? master_offset : applied_offset;
+}
+
+bool repl_is_replica(void) {
+    return link_state != LINK_NONE;
+}
+
+bool repl_readonly(const client_t *c) {
+    return link_state != LINK_NONE && c != &link_client;
+}
+
+static void link_close(void) {
+    if (link_client.fd >= 0) {
+        ev_del(loop, link_client.fd);
+    }
+    client_close(&link_client);
+    if (transfer_fd >= 0) {
+        close(transfer_fd);
+        transfer_fd = -1;
+        unlink(transfer_path);
+    }
+}
+
+static void link_fail(const char *why) {
+    fprintf(stderr, "Link to primary %s:%s lost: %s\n", primary_host,
+            primary_port, why);
+    link_close();
+    link_state = LINK_CONNECT;
+    retry_at = current_time_ms() + REPL_RETRY_MS;
+}
+
+int repl_set_primary(const char *host, int port) {
+    if (!host) {
+        if (link_state != LINK_NONE) {
+            link_close();
+            link_state = LINK_NONE;
+            /* the data now diverges from the old primary's stream */
+            new_replid();
+            master_offset = applied_offset;
+            fprintf(stderr, "Replication: now a primary\n");
+        }
+        return 0;
+    }
+
+    char port_str[8];
+    snprintf(port_str, sizeof(port_str), "%d", port);
+    struct addrinfo hints, *res;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_socktype = SOCK_STREAM;
+    if (strlen(host) >= sizeof(primary_host) ||
+        getaddrinfo(host, port_str, &hints, &res) != 0) {
+        return -1;
+    }
+    freeaddrinfo(res);
+
+    if (link_state != LINK_NONE) {
+        link_close();
+    }
+    end_stream();
+    bool same = link_state != LINK_NONE &&
+                strcmp(primary_host, host) == 0 &&
+                strcmp(primary_port, port_str) == 0;
+    if (!same) {
+        primary_id[0] = '\0';
+    }
+    snprintf(primary_host, sizeof(primary_host), "%s", host);
+    memcpy(primary_port, port_str, sizeof(port_str));
+    link_state = LINK_CONNECT;
+    retry_at = 0;
+    fprintf(stderr, "Replicating from %s:%s\n", primary_host, primary_port);
+    return 0;
+}
+
+static void link_connect(void) {
+    struct addrinfo hints, *res;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(primary_host, primary_port, &hints, &res) != 0) {
+        link_fail("can't resolve the address");
+        return;
+    }
+    int fd = socket(res->ai_family, SOCK_STREAM, 0);
+    if (fd >= 0) {
+        int flags = fcntl(fd, F_GETFL, 0);
+        if (flags >= 0) {
+            fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+        }
+        if (connect(fd, res->ai_addr, res->ai_addrlen) < 0 &&
+            errno != EINPROGRESS) {
+            close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(res);
+    if (fd < 0 || ev_add(loop, fd, EV_WRITABLE, link_token) < 0) {
+        if (fd >= 0) {
+            close(fd);
+        }
+        link_fail(strerror(errno));
+        return;
+    }
+    link_client.fd = fd;
+    link_state = LINK_CONNECTING;
+}
+
+static int send_psync(void) {
+    const char *id = primary_id[0] ? primary_id : "?";
+    char offset[24];
+    snprintf(offset, sizeof(offset), "%" PRId64,
+             primary_id[0] ? applied_offset : (int64_t)-1);
+    char cmd[128];
+    int len = snprintf(cmd, sizeof(cmd),
+                       "*3\r\n$5\r\nPSYNC\r\n$%zu\r\n%s\r\n$%zu\r\n%s\r\n",
+                       strlen(id), id, strlen(offset), offset);
+    /* a fresh socket takes a line this short whole */
+    return send(link_client.fd, cmd, (size_t)len, MSG_NOSIGNAL) == len ? 0 : -1;
+}
+
+/* The next CRLF-terminated line of input, without the CRLF. */
+static int take_line(char **line, size_t *len) {
+    char *start = link_client.read_buf + link_client.read_pos;
+    size_t avail = link_client.read_len - link_client.read_pos;
+    for (size_t i = 0; i + 1 < avail; i++) {
+        if (start[i] == '\r' && start[i + 1] == '\n') {
+            *line = start;
+            *len = i;
+            link_client.read_pos += i + 2;
+            return 1;
+        }
+    }
+    return avail > REPL_MAX_LINE ? -1 : 0;
+}
+
+static bool handshake_line(char *line, size_t len) {
+    static const char full[] = "+FULLRESYNC ";
+    if (len == 9 && memcmp(line, "+CONTINUE", 9) == 0) {
+        fprintf(stderr, "Partial resync from offset %" PRId64 "\n",
+                applied_offset);
+        link_state = LINK_CONNECTED;
+        cmd_start = link_client.read_pos;
+        return true;
+    }
+    size_t prefix = sizeof(full) - 1;
+    if (len < prefix + REPL_ID_LEN + 2 || memcmp(line, full, prefix) != 0 ||
+        line[prefix + REPL_ID_LEN] != ' ') {
+        return false;
+    }
+    rstr_t offset = {line + prefix + REPL_ID_LEN + 1,
+                     len - prefix - REPL_ID_LEN - 1};
+    if (!parse_offset(offset, &pending_offset)) {
+        return false;
+    }
+    memcpy(pending_id, line + prefix, REPL_ID_LEN);
+    pending_id[REPL_ID_LEN] = '\0';
+    link_state = LINK_SNAPSHOT_HEADER;
+    return true;
+}
+
+static bool snapshot_header(char *line, size_t len) {
+    rstr_t size = {line + 1, len - 1};
+    int64_t n;
+    if (len < 2 || line[0] != '$' || !parse_offset(size, &n) || n < 0) {
+        return false;
+    }
+    stage_path(transfer_path, sizeof(transfer_path), "replica", getpid());
+    transfer_fd = open(transfer_path, O_WRONLY | O_CREAT | O_TRUNC |
+                       O_CLOEXEC, 0644);
+    if (transfer_fd < 0) {
+        perror("open");
+        return false;
+    }
+    transfer_left = (uint64_t)n;
+    link_state = LINK_SNAPSHOT;
+    return true;
+}
+
+/* The whole snapshot is in: it replaces the store. */
+static bool load_transfer(hashtable_t *ht) {
+    int rc = close(transfer_fd);
+    transfer_fd = -1;
+    int64_t start = current_time_ms();
+    snapshot_load_stats_t st;
+    if (rc == 0) {
+        ht_clear(ht);
+        rc = snapshot_load(ht, transfer_path, NULL, NULL, 1, &st);
+    }
+    unlink(transfer_path);
+    if (rc != 0) {
+        link_fail("bad snapshot from the primary");
+        return false;
+    }
+    memcpy(primary_id, pending_id, sizeof(primary_id));
+    applied_offset = pending_offset;
+    fprintf(stderr, "Loaded %zu keys from the primary in %lld ms\n",
+            st.loaded, (long long)(current_time_ms() - start));
+    /* the AOF has to start over from the new contents */
+    if (aof_enabled() && aof_rewrite(ht) < 0) {
+        perror("BGREWRITEAOF after resync");
+    }
+    link_state = LINK_CONNECTED;
+    cmd_start = link_client.read_pos;
+    return true;
+}
+
+static bool apply_stream(hashtable_t *ht) {
+    resp_value_t cmd;
+    int parsed;
+    bool applied = false;
+    while ((parsed = resp_parse_client(&link_client, &cmd)) > 0) {
+        dispatch_command(&link_client, ht, &cmd);
+        resp_command_release(&link_client, &cmd);
+        applied_offset += (int64_t)(link_client.read_pos - cmd_start);
+        cmd_start = link_client.read_pos;
+        applied = true;
+    }
+    if (applied) {
+        /* replies to the primary's commands go nowhere */
+        size_t len;
+        free(client_take_output(&link_client, &len));
+    }
+    if (parsed < 0) {
+        link_fail("protocol error in the stream");
+        return false;
+    }
+    return true;
+}
+
+/* Work through what has been read. false once the link is gone. */
+static bool link_process(hashtable_t *ht) {
+    while (link_client.fd >= 0) {
+        if (link_state == LINK_HANDSHAKE ||
+            link_state == LINK_SNAPSHOT_HEADER) {
+            char *line;
+            size_t len;
+            int r = take_line(&line, &len);
+            if (r == 0) {
+                break;
+            }
+            bool ok = r > 0 && (link_state == LINK_HANDSHAKE ?
+                                handshake_line(line, len) :
+                                snapshot_header(line, len));
+            if (!ok) {
+                link_fail("unexpected reply to PSYNC");
+                return false;
+            }
+        } else if (link_state == LINK_SNAPSHOT) {
+            size_t avail = link_client.read_len - link_client.read_pos;
+            size_t n = avail < transfer_left ? avail : (size_t)transfer_left;
+            const char *p = link_client.read_buf + link_client.read_pos;
+            size_t left = n;
+            while (left > 0) {
+                ssize_t w = write(transfer_fd, p, left);
+                if (w < 0 && errno != EINTR) {
+                    link_fail(strerror(errno));
+                    return false;
+                }
+                if (w > 0) {
+                    p += w;
+                    left -= (size_t)w;
+                }
+            }
+            link_client.read_pos += n;
+            transfer_left -= n;
+            if (transfer_left > 0) {
+                break;
+            }
+            if (!load_transfer(ht)) {
+                return false;
+            }
+        } else {
+            if (!apply_stream(ht)) {
+                return false;
+            }
+            break;
+        }
+    }
+    /* keeps a partial command from cmd_start, so that becomes 0 */
+    client_compact_read_buf(&link_client);
+    cmd_start = 0;
+    return true;
+}
+
+void repl_handle(hashtable_t *ht, int mask) {
+    if (link_state == LINK_CONNECTING) {
+        int err = 0;
+        socklen_t len = sizeof(err);
+        if (getsockopt(link_client.fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0) {
+            err = errno;
+        }
+        if (err == 0 && (mask & EV_ERROR)) {
+            err = ECONNREFUSED;
+        }
+        if (err != 0) {
+            link_fail(strerror(err));
+            return;
+        }
+        if (send_psync() < 0 ||
+            ev_modify(loop, link_client.fd, EV_READABLE, link_token) < 0) {
+            link_fail(strerror(errno));
+            return;
+        }
+        link_state = LINK_HANDSHAKE;
+        return;
+    }
+    if (link_client.fd < 0) {
+        return;
+    }
+    /* apply what arrived before the primary went away */
+    int rc = client_read(&link_client, ev_edge_triggered(loop));
+    if (!link_process(ht)) {
+        return;
+    }
+    if (rc < 0) {
+        link_fail("connection closed");
+    }
+}
+
+void repl_cron(hashtable_t *ht, int64_t now) {
+    if (sync_pid > 0) {
+        int status;
+        pid_t r = waitpid(sync_pid, &status, WNOHANG);
+        if (r > 0 || (r < 0 && errno != EINTR)) {
+            finish_sync(r > 0 && WIFEXITED(status) &&
+                        WEXITSTATUS(status) == 0);
+        }
+    }
+    if (sync_pid == 0) {
+        for (int i = 0; i < nreplicas; i++) {
+            if (replicas[i].state == REPLICA_WAIT_BGSAVE &&
+                !replicas[i].drop) {
+                start_sync(ht);
+                break;
+            }
+        }
+    }
+    if (link_state == LINK_CONNECT && now >= retry_at) {
+        link_connect();
+    }
+}
+
+void repl_write_role(client_t *c) {
+    if (link_state == LINK_NONE) {
+        resp_write_array_header(c, 3);
+        resp_write_bulk_string(c, "master", 6);
+        resp_write_integer(c, master_offset);
+        resp_write_integer(c, nreplicas);
+        return;
+    }
+    static const char *const names[] = {
+        [LINK_CONNECT] = "connect",
+        [LINK_CONNECTING] = "connecting",
+        [LINK_HANDSHAKE] = "handshake",
+        [LINK_SNAPSHOT_HEADER] = "sync",
+        [LINK_SNAPSHOT] = "sync",
+        [LINK_CONNECTED] = "connected",
+    };
+    const char *state = names[link_state];
+    resp_write_array_header(c, 5);
+    resp_write_bulk_string(c, "slave", 5);
+    resp_write_bulk_string(c, primary_host, strlen(primary_host));
+    resp_write_integer(c, atoi(primary_port));
+    resp_write_bulk_string(c, state, strlen(state));
+    resp_write_integer(c, applied_offset);
+}
+
+void repl_info(info_buf_t *b) {
+    if (link_state == LINK_NONE) {
+        info_printf(b, "role:master\r\n");
+        info_printf(b, "connected_slaves:%d\r\n", nreplicas);
+        info_printf(b, "master_replid:%s\r\n", replid);
+        info_printf(b, "master_repl_offset:%" PRId64 "\r\n", master_offset);
+        return;
+    }
+    info_printf(b, "role:slave\r\n");
+    info_printf(b, "master_host:%s\r\n", primary_host);
+    info_printf(b, "master_port:%s\r\n", primary_port);
+    info_printf(b, "master_link_status:%s\r\n",
+                link_state == LINK_CONNECTED ? "up" : "down");
+    info_printf(b, "master_replid:%s\r\n", replid);
+    info_printf(b, "slave_repl_offset:%" PRId64 "\r\n", applied_offset);
+}
+
+void repl_shutdown(void) {
+    if (sync_pid > 0) {
+        kill(sync_pid, SIGKILL);
+        while (waitpid(sync_pid, NULL, 0) < 0 && errno == EINTR) {
+        }
+        char path[4096];
+        stage_path(path, sizeof(path), "sync", sync_pid);
+        unlink(path);
+        sync_pid = 0;
+    }
+    if (link_state != LINK_NONE) {
+        link_close();
+        link_state = LINK_NONE;
+    }
+}
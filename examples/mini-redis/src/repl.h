@@ -0,0 +1,79 @@
+#ifndef REPL_H
+#define REPL_H
+
+#include "client.h"
+#include "event.h"
+#include "hashtable.h"
+#include "resp.h"
+#include "rstr.h"
+#include "stats.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define REPL_DEFAULT_BACKLOG (1024 * 1024)
+#define REPL_MIN_BACKLOG     (16 * 1024)
+#define REPL_ID_LEN 40
+
+/* Asynchronous primary -> replica replication.
+
+   A primary records every write, in the form the AOF logs it, in a
+   fixed-size ring: the backlog. Its stream offset counts the bytes ever
+   recorded. A replica connects and sends PSYNC <id> <offset>; if the id
+   is this primary's and the offset still in the backlog it gets
+   +CONTINUE and the stream from there, otherwise +FULLRESYNC <id>
+   <offset>, a snapshot as $<len> and <len> bytes, then the stream from
+   that offset. Replicas are clients: at the end of each loop iteration
+   the bytes recorded in it are queued on every online replica (shared,
+   not copied, when large), and the normal output path sends them.
+
+   Everything here is for the main thread of an unsharded server. */
+
+/* Enable replication; the link to a primary is registered on el under
+   token. Without this call (--shards) nothing else is available. */
+void repl_init(event_loop_t *el, int token, size_t backlog_size);
+bool repl_available(void);
+const char *repl_id(void);
+/* Stream offset: bytes recorded as a primary, or applied as a replica. */
+int64_t repl_offset(void);
+
+/* ---- primary ---- */
+
+/* Whether writes are recorded: a replica has attached since startup. */
+bool repl_feeding(void);
+/* Record a write (argv of bulk strings). No allocation. */
+void repl_feed(const resp_value_t *argv, int argc);
+/* PSYNC from c: reply, and turn c into a replica. */
+void repl_attach(client_t *c, hashtable_t *ht, rstr_t id, rstr_t offset);
+/* c (a replica) is closing. */
+void repl_detach(client_t *c);
+/* Queue what this iteration recorded on the online replicas. */
+void repl_flush(void);
+int repl_replica_count(void);
+client_t *repl_replica(int i);
+/* A replica whose unsent stream outgrew the backlog: it is dropped, and
+   resyncs when it reconnects. */
+bool repl_replica_lagging(int i);
+
+/* ---- replica ---- */
+
+/* REPLICAOF: follow host:port, or with host NULL become a primary
+   again. 0, or -1 if the address doesn't resolve. */
+int repl_set_primary(const char *host, int port);
+bool repl_is_replica(void);
+/* Whether c may not write: everyone but the primary, on a replica. */
+bool repl_readonly(const client_t *c);
+/* Activity on the link to the primary. */
+void repl_handle(hashtable_t *ht, int mask);
+
+/* Reconnect to the primary, finish a snapshot for replicas. Runs at the
+   top of each loop iteration. */
+void repl_cron(hashtable_t *ht, int64_t now);
+/* ROLE */
+void repl_write_role(client_t *c);
+/* INFO replication */
+void repl_info(info_buf_t *b);
+/* Drop the link and kill a snapshot child (shutdown). */
+void repl_shutdown(void);
+
+#endif
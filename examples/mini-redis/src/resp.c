@@ -1,95 +1,218 @@
 #include "resp.h"
+#include "util.h"
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
 #include <inttypes.h>
 
-/* Find \r\n in buf[0..len). Returns offset of \r, or -1 if not found. */
-static int parse_line(const char *buf, size_t len, size_t *line_len) {
-    for (size_t i = 0; i + 1 < len; i++) {
-        if (buf[i] == '\r' && buf[i + 1] == '\n') {
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define RESP_SCAN_WIDTH 32
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define RESP_SCAN_WIDTH 16
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define RESP_SCAN_WIDTH 16
+#endif
+
+/* Offset of the first '\r' in buf[0..len), or len if there is none.
+   The vector path compares a whole block against '\r' at once; the
+   scalar loop handles the tail and builds without SIMD support. */
+static size_t find_cr(const char *buf, size_t len) {
+    size_t i = 0;
+
+#if defined(__AVX2__)
+    const __m256i cr = _mm256_set1_epi8('\r');
+    for (; i + RESP_SCAN_WIDTH <= len; i += RESP_SCAN_WIDTH) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(buf + i));
+        uint32_t mask = (uint32_t)_mm256_movemask_epi8(
+            _mm256_cmpeq_epi8(v, cr));
+        if (mask) {
+            return i + (size_t)__builtin_ctz(mask);
+        }
+    }
+#elif defined(__SSE2__)
+    const __m128i cr = _mm_set1_epi8('\r');
+    for (; i + RESP_SCAN_WIDTH <= len; i += RESP_SCAN_WIDTH) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(buf + i));
+        uint32_t mask = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, cr));
+        if (mask) {
+            return i + (size_t)__builtin_ctz(mask);
+        }
+    }
+#elif defined(__ARM_NEON)
+    const uint8x16_t cr = vdupq_n_u8('\r');
+    for (; i + RESP_SCAN_WIDTH <= len; i += RESP_SCAN_WIDTH) {
+        uint8x16_t eq = vceqq_u8(vld1q_u8((const uint8_t *)(buf + i)), cr);
+        /* narrow each byte to a nibble: 64-bit mask, 4 bits per lane */
+        uint64_t mask = vget_lane_u64(vreinterpret_u64_u8(
+            vshrn_n_u16(vreinterpretq_u16_u8(eq), 4)), 0);
+        if (mask) {
+            return i + (size_t)(__builtin_ctzll(mask) >> 2);
+        }
+    }
+#endif
+
+    for (; i < len; i++) {
+        if (buf[i] == '\r') {
+            return i;
+        }
+    }
+    return len;
+}
+
+/* Find \r\n in buf[0..len), looking at most max bytes before the
+   terminator. Returns 0 and sets *line_len when found, 1 if more data is
+   needed, or -1 if the line already exceeds max. */
+static int parse_line(const char *buf, size_t len, size_t max,
+                      size_t *line_len) {
+    size_t limit = (len < max + 2) ? len : max + 2;
+    size_t i = 0;
+
+    while (i + 1 < limit) {
+        i += find_cr(buf + i, limit - 1 - i);
+        if (i + 1 >= limit) {
+            break;
+        }
+        if (buf[i + 1] == '\n') {
             *line_len = i;
             return 0;
         }
+        i++;
     }
-    return -1; /* not found */
+    return (len >= max + 2) ? -1 : 1;
 }
 
+/* Decimal int64 with overflow checking. No sign other than a leading
+   '-', no whitespace, no leading '+'. */
 static int parse_integer_value(const char *buf, size_t len, int64_t *out) {
-    if (len == 0) {
+    if (len == 0 || len > 20) {
         return -1;
     }
 
-    int64_t result = 0;
-    int sign = 1;
-    size_t i = 0;
+    bool negative = (buf[0] == '-');
+    size_t i = negative ? 1 : 0;
+    if (i == len) {
+        return -1;
+    }
 
-    if (buf[0] == '-') {
-        sign = -1;
-        i = 1;
-        if (len == 1) {
+    /* accumulate as a negative number so INT64_MIN is representable */
+    int64_t result = 0;
+    for (; i < len; i++) {
+        unsigned d = (unsigned)(unsigned char)buf[i] - '0';
+        if (d > 9) {
             return -1;
         }
+        if (result < (INT64_MIN + (int64_t)d) / 10) {
+            return -1;
+        }
+        result = result * 10 - (int64_t)d;
     }
 
-    for (; i < len; i++) {
-        if (buf[i] < '0' || buf[i] > '9') {
+    if (!negative) {
+        if (result == INT64_MIN) {
             return -1;
         }
-        result = result * 10 + (buf[i] - '0');
+        result = -result;
+    }
+    *out = result;
+    return 0;
+}
+
+/* Length prefix of a '$' or '*' header: -1 or 0..max. Bailing out as
+   soon as the value passes max keeps the loop short and overflow-free. */
+static int parse_length(const char *buf, size_t len, int64_t max,
+                        int64_t *out) {
+    if (len == 2 && buf[0] == '-' && buf[1] == '1') {
+        *out = -1;
+        return 0;
+    }
+    if (len == 0 || len >= RESP_MAX_HEADER_LEN) {
+        return -1;
     }
 
-    *out = result * sign;
+    int64_t result = 0;
+    for (size_t i = 0; i < len; i++) {
+        unsigned d = (unsigned)(unsigned char)buf[i] - '0';
+        if (d > 9) {
+            return -1;
+        }
+        result = result * 10 + (int64_t)d;
+        if (result > max) {
+            return -1;
+        }
+    }
+    *out = result;
     return 0;
 }
 
-static int parse_bulk_string(const char *buf, size_t len,
-                             resp_value_t *out) {
-    /* buf starts after '$' */
+/* Parse a "<len>\r\n" header after the type byte. Returns the header
+   length including CRLF, 0 if incomplete, -1 if malformed. */
+static int parse_header(const char *buf, size_t len, int64_t max,
+                        int64_t *out) {
     size_t line_len;
-    if (parse_line(buf, len, &line_len) < 0) {
-        return 0; /* need more data */
+    int r = parse_line(buf, len, RESP_MAX_HEADER_LEN, &line_len);
+    if (r != 0) {
+        return r > 0 ? 0 : -1;
+    }
+    if (parse_length(buf, line_len, max, out) < 0) {
+        return -1;
+    }
+    return (int)(line_len + 2);
+}
+
+/* Values parsed for a client are owned by its request arena; the public
+   resp_parse() (arena == NULL) allocates them individually. */
+static rstr_t copy_string(arena_t *arena, const char *data, size_t len) {
+    if (!arena) {
+        return rstr_create(data, len);
     }
+    rstr_t s;
+    s.data = arena_alloc(arena, len + 1);
+    memcpy(s.data, data, len);
+    s.data[len] = '\0';
+    s.len = len;
+    return s;
+}
 
+static int parse_bulk_string(const char *buf, size_t len,
+                             resp_value_t *out, arena_t *arena) {
+    /* buf starts after '$' */
     int64_t slen;
-    if (parse_integer_value(buf, line_len, &slen) < 0) {
-        return -1;
+    int header = parse_header(buf, len, RESP_MAX_BULK_LEN, &slen);
+    if (header <= 0) {
+        return header;
     }
 
     /* null bulk string */
     if (slen == -1) {
         out->type = RESP_NULL_BULK_STRING;
-        return (int)(1 + line_len + 2); /* $-1\r\n */
+        return 1 + header; /* $-1\r\n */
     }
 
-    if (slen < 0) {
-        return -1; /* invalid */
+    /* The payload is never scanned: skip straight to the declared end */
+    size_t h = (size_t)header;
+    if (len - h < (size_t)slen + 2) {
+        return 0; /* need more data */
     }
-
-    /* bytes consumed so far: '$' + line + \r\n */
-    size_t header_len = 1 + line_len + 2;
-    /* total needed: header + slen bytes + \r\n */
-    size_t total = header_len + (size_t)slen + 2;
-
-    if (1 + len < total) {
-        /* we passed buf starting after '$', so check (len+1) vs total */
-        /* Actually let's recompute: original buf starts at '$',
-           len passed is from after '$'. Need line_len+2+slen+2 bytes
-           from position after '$' */
-        if (len < line_len + 2 + (size_t)slen + 2) {
-            return 0; /* need more data */
-        }
+    if (buf[h + (size_t)slen] != '\r' || buf[h + (size_t)slen + 1] != '\n') {
+        return -1;
     }
 
     out->type = RESP_BULK_STRING;
-    out->str = rstr_create(buf + line_len + 2, (size_t)slen);
+    out->str = copy_string(arena, buf + h, (size_t)slen);
 
-    return (int)(1 + line_len + 2 + (size_t)slen + 2);
+    return (int)(1 + h + (size_t)slen + 2);
 }
 
-static int parse_array(const char *buf, size_t len, resp_value_t *out);
+static int parse_array(const char *buf, size_t len, resp_value_t *out,
+                       arena_t *arena, int depth);
 
-int resp_parse(const char *buf, size_t len, resp_value_t *out) {
+/* depth counts the arrays enclosing buf; capping it keeps a run of
+   "*1\r\n" from recursing off the end of the stack. */
+static int parse_value(const char *buf, size_t len, resp_value_t *out,
+                       arena_t *arena, int depth) {
     if (len == 0) {
         return 0;
     }
@@ -98,18 +221,20 @@ int resp_parse(const char *buf, size_t len, resp_value_t *out) {
     case '+':
     case '-': {
         size_t line_len;
-        if (parse_line(buf + 1, len - 1, &line_len) < 0) {
-            return 0; /* need more data */
+        int r = parse_line(buf + 1, len - 1, RESP_MAX_INLINE_LEN, &line_len);
+        if (r != 0) {
+            return r > 0 ? 0 : -1;
         }
         out->type = (buf[0] == '+') ? RESP_SIMPLE_STRING : RESP_ERROR;
-        out->str = rstr_create(buf + 1, line_len);
+        out->str = copy_string(arena, buf + 1, line_len);
         return (int)(1 + line_len + 2);
     }
 
     case ':': {
         size_t line_len;
-        if (parse_line(buf + 1, len - 1, &line_len) < 0) {
-            return 0;
+        int r = parse_line(buf + 1, len - 1, RESP_MAX_HEADER_LEN, &line_len);
+        if (r != 0) {
+            return r > 0 ? 0 : -1;
         }
         int64_t val;
         if (parse_integer_value(buf + 1, line_len, &val) < 0) {
@@ -121,11 +246,14 @@ int resp_parse(const char *buf, size_t len, resp_value_t *out) {
     }
 
     case '$': {
-        return parse_bulk_string(buf + 1, len - 1, out);
+        return parse_bulk_string(buf + 1, len - 1, out, arena);
     }
 
     case '*': {
-        return parse_array(buf, len, out);
+        if (depth >= RESP_MAX_NESTING) {
+            return -1;
+        }
+        return parse_array(buf, len, out, arena, depth + 1);
     }
 
     default:
@@ -133,23 +261,26 @@ int resp_parse(const char *buf, size_t len, resp_value_t *out) {
     }
 }
 
-static int parse_array(const char *buf, size_t len, resp_value_t *out) {
-    /* buf[0] == '*' */
-    size_t line_len;
-    if (parse_line(buf + 1, len - 1, &line_len) < 0) {
-        return 0;
-    }
+int resp_parse(const char *buf, size_t len, resp_value_t *out) {
+    return parse_value(buf, len, out, NULL, 0);
+}
 
+/* With an arena, a failed parse leaves its allocations behind; callers
+   roll the arena back with arena_rewind(). */
+static int parse_array(const char *buf, size_t len, resp_value_t *out,
+                       arena_t *arena, int depth) {
+    /* buf[0] == '*' */
     int64_t count;
-    if (parse_integer_value(buf + 1, line_len, &count) < 0) {
-        return -1;
+    int header = parse_header(buf + 1, len - 1, RESP_MAX_MULTIBULK, &count);
+    if (header <= 0) {
+        return header;
     }
 
     if (count < 0) {
         return -1;
     }
 
-    size_t consumed = 1 + line_len + 2; /* *<count>\r\n */
+    size_t consumed = 1 + (size_t)header; /* *<count>\r\n */
 
     if (count == 0) {
         out->type = RESP_ARRAY;
@@ -158,29 +289,27 @@ static int parse_array(const char *buf, size_t len, resp_value_t *out) {
         return (int)consumed;
     }
 
-    resp_value_t *elements = malloc((size_t)count * sizeof(resp_value_t));
+    size_t size = (size_t)count * sizeof(resp_value_t);
+    resp_value_t *elements = arena ? arena_alloc(arena, size) : malloc(size);
     if (!elements) {
         perror("malloc");
         exit(1);
     }
 
     for (int64_t i = 0; i < count; i++) {
-        if (consumed >= len) {
-            /* need more data */
-            for (int64_t j = 0; j < i; j++) {
-                resp_value_free(&elements[j]);
-            }
-            free(elements);
-            return 0;
+        int r = 0;
+        if (consumed < len) {
+            r = parse_value(buf + consumed, len - consumed, &elements[i],
+                            arena, depth);
         }
-
-        int r = resp_parse(buf + consumed, len - consumed, &elements[i]);
         if (r <= 0) {
             /* incomplete or error */
-            for (int64_t j = 0; j < i; j++) {
-                resp_value_free(&elements[j]);
+            if (!arena) {
+                for (int64_t j = 0; j < i; j++) {
+                    resp_value_free(&elements[j]);
+                }
+                free(elements);
             }
-            free(elements);
             return r;
         }
         consumed += (size_t)r;
@@ -217,38 +346,311 @@ void resp_value_free(resp_value_t *val) {
     }
 }
 
+typedef struct {
+    const char *data;
+    size_t len;
+} resp_encoded_t;
+
+#define ENCODED(s) {s, sizeof(s) - 1}
+
+static const resp_encoded_t shared_replies[RESP_SHARED_COUNT] = {
+    [RESP_SHARED_OK]          = ENCODED("+OK\r\n"),
+    [RESP_SHARED_PONG]        = ENCODED("+PONG\r\n"),
+    [RESP_SHARED_ZERO]        = ENCODED(":0\r\n"),
+    [RESP_SHARED_ONE]         = ENCODED(":1\r\n"),
+    [RESP_SHARED_MINUS_ONE]   = ENCODED(":-1\r\n"),
+    [RESP_SHARED_MINUS_TWO]   = ENCODED(":-2\r\n"),
+    [RESP_SHARED_NULL_BULK]   = ENCODED("$-1\r\n"),
+    [RESP_SHARED_EMPTY_ARRAY] = ENCODED("*0\r\n"),
+    [RESP_SHARED_TYPE_STRING] = ENCODED("+string\r\n"),
+    [RESP_SHARED_TYPE_NONE]   = ENCODED("+none\r\n"),
+};
+
+/* Bulk headers for short values, the bulk of GET replies */
+#define BULK_HDR(n) ENCODED("$" #n "\r\n")
+#define SHARED_BULK_HDRS 32
+static const resp_encoded_t bulk_headers[SHARED_BULK_HDRS] = {
+    BULK_HDR(0),  BULK_HDR(1),  BULK_HDR(2),  BULK_HDR(3),
+    BULK_HDR(4),  BULK_HDR(5),  BULK_HDR(6),  BULK_HDR(7),
+    BULK_HDR(8),  BULK_HDR(9),  BULK_HDR(10), BULK_HDR(11),
+    BULK_HDR(12), BULK_HDR(13), BULK_HDR(14), BULK_HDR(15),
+    BULK_HDR(16), BULK_HDR(17), BULK_HDR(18), BULK_HDR(19),
+    BULK_HDR(20), BULK_HDR(21), BULK_HDR(22), BULK_HDR(23),
+    BULK_HDR(24), BULK_HDR(25), BULK_HDR(26), BULK_HDR(27),
+    BULK_HDR(28), BULK_HDR(29), BULK_HDR(30), BULK_HDR(31),
+};
+
+void resp_write_shared(client_t *c, resp_shared_t reply) {
+    client_write_append(c, shared_replies[reply].data,
+                        shared_replies[reply].len);
+}
+
+/* "<prefix><n>\r\n" into p; returns bytes written. */
+static size_t encode_header(char *p, char prefix, uint64_t n) {
+    p[0] = prefix;
+    size_t len = 1 + u64_to_str(p + 1, n);
+    p[len] = '\r';
+    p[len + 1] = '\n';
+    return len + 2;
+}
+
+static size_t header_len(uint64_t n) {
+    return 1 + u64_digits(n) + 2;
+}
+
+/* Bulk header for len, into p; returns bytes written. */
+static size_t encode_bulk_header(char *p, size_t len) {
+    if (len < SHARED_BULK_HDRS) {
+        memcpy(p, bulk_headers[len].data, bulk_headers[len].len);
+        return bulk_headers[len].len;
+    }
+    return encode_header(p, '$', len);
+}
+
+static void write_line(client_t *c, char prefix, const char *str) {
+    size_t len = strlen(str);
+    char *p = client_write_reserve(c, len + 3);
+    p[0] = prefix;
+    memcpy(p + 1, str, len);
+    p[len + 1] = '\r';
+    p[len + 2] = '\n';
+}
+
 void resp_write_simple_string(client_t *c, const char *str) {
-    client_write_append(c, "+", 1);
-    client_write_append(c, str, strlen(str));
-    client_write_append(c, "\r\n", 2);
+    write_line(c, '+', str);
 }
 
 void resp_write_error(client_t *c, const char *msg) {
-    client_write_append(c, "-", 1);
-    client_write_append(c, msg, strlen(msg));
-    client_write_append(c, "\r\n", 2);
+    c->error_replies++;
+    write_line(c, '-', msg);
 }
 
 void resp_write_integer(client_t *c, int64_t val) {
-    char buf[32];
-    int n = snprintf(buf, sizeof(buf), ":%" PRId64 "\r\n", val);
-    client_write_append(c, buf, (size_t)n);
+    switch (val) {
+    case 0:  resp_write_shared(c, RESP_SHARED_ZERO); return;
+    case 1:  resp_write_shared(c, RESP_SHARED_ONE); return;
+    case -1: resp_write_shared(c, RESP_SHARED_MINUS_ONE); return;
+    case -2: resp_write_shared(c, RESP_SHARED_MINUS_TWO); return;
+    default: break;
+    }
+
+    size_t len = i64_strlen(val);
+    char *p = client_write_reserve(c, len + 3);
+    p[0] = ':';
+    i64_to_str(p + 1, val);
+    p[len + 1] = '\r';
+    p[len + 2] = '\n';
 }
 
 void resp_write_bulk_string(client_t *c, const char *data, size_t len) {
+    char *p = client_write_reserve(c, header_len(len) + len + 2);
+    p += encode_bulk_header(p, len);
+    memcpy(p, data, len);
+    p[len] = '\r';
+    p[len + 1] = '\n';
+}
+
+void resp_write_bulk_value(client_t *c, rstr_t value) {
+    if (value.len < RSTR_SHARED_MIN) {
+        resp_write_bulk_string(c, value.data, value.len);
+        return;
+    }
     char header[32];
-    int n = snprintf(header, sizeof(header), "$%zu\r\n", len);
-    client_write_append(c, header, (size_t)n);
-    client_write_append(c, data, len);
+    client_write_append(c, header, encode_bulk_header(header, value.len));
+    client_write_value(c, value);
     client_write_append(c, "\r\n", 2);
 }
 
+void resp_write_bulk_int(client_t *c, int64_t val) {
+    size_t len = i64_strlen(val);
+    char *p = client_write_reserve(c, header_len(len) + len + 2);
+    p += encode_bulk_header(p, len);
+    i64_to_str(p, val);
+    p[len] = '\r';
+    p[len + 1] = '\n';
+}
+
 void resp_write_null_bulk_string(client_t *c) {
-    client_write_append(c, "$-1\r\n", 5);
+    resp_write_shared(c, RESP_SHARED_NULL_BULK);
 }
 
 void resp_write_array_header(client_t *c, int count) {
-    char buf[32];
-    int n = snprintf(buf, sizeof(buf), "*%d\r\n", count);
-    client_write_append(c, buf, (size_t)n);
+    if (count == 0) {
+        resp_write_shared(c, RESP_SHARED_EMPTY_ARRAY);
+        return;
+    }
+    char *p = client_write_reserve(c, header_len((uint64_t)count));
+    encode_header(p, '*', (uint64_t)count);
+}
+
+#define REQ_ARGS_INITIAL 16
+
+/* Bulk arguments are views into read_buf. While a command is incomplete
+   their data pointer is not stable (the buffer may be reallocated or
+   compacted), so it is recorded as an offset from req_start and turned
+   into a pointer once the whole command is buffered. Any other element
+   type is copied into the client's request arena. */
+
+/* Parse one command element into the request arena, undoing the
+   allocations of an attempt that does not complete. Depth starts at one
+   for the command's own multibulk (top-level values here are never
+   arrays). */
+static int parse_into_arena(client_t *c, const char *buf, size_t len,
+                            resp_value_t *out) {
+    arena_mark_t mark = arena_mark(&c->req_arena);
+    int r = parse_value(buf, len, out, &c->req_arena, 1);
+    if (r <= 0) {
+        arena_rewind(&c->req_arena, mark);
+    }
+    return r;
+}
+
+void resp_parser_reset(client_t *c) {
+    arena_reset(&c->req_arena);
+    c->req_argc = -1;
+    c->req_argi = 0;
+    c->req_bulk_len = -1;
+}
+
+static void reserve_req_args(client_t *c, size_t needed) {
+    if (needed <= c->req_args_cap) {
+        return;
+    }
+    size_t new_cap = c->req_args_cap ? c->req_args_cap * 2 : REQ_ARGS_INITIAL;
+    while (new_cap < needed) {
+        new_cap *= 2;
+    }
+    resp_value_t *tmp = realloc(c->req_args, new_cap * sizeof(resp_value_t));
+    if (!tmp) {
+        perror("realloc");
+        exit(1);
+    }
+    c->req_args = tmp;
+    c->req_args_cap = new_cap;
+}
+
+int resp_parse_client(client_t *c, resp_value_t *out) {
+    const char *buf = c->read_buf;
+    size_t len = c->read_len;
+
+    if (c->req_argc < 0) {
+        size_t pos = c->read_pos;
+        if (pos >= len) {
+            return 0;
+        }
+
+        /* Anything but a multibulk is parsed in one shot; dispatch turns
+           it into an error reply. */
+        if (buf[pos] != '*') {
+            int r = parse_into_arena(c, buf + pos, len - pos, out);
+            if (r > 0) {
+                c->read_pos += (size_t)r;
+                return 1;
+            }
+            return r;
+        }
+
+        int64_t count;
+        int header = parse_header(buf + pos + 1, len - pos - 1,
+                                  RESP_MAX_MULTIBULK, &count);
+        if (header <= 0) {
+            return header;
+        }
+        if (count < 0) {
+            return -1;
+        }
+        c->req_start = pos;
+        c->read_pos += 1 + (size_t)header;
+
+        c->req_argc = count;
+        c->req_argi = 0;
+        c->req_bulk_len = -1;
+        /* grow lazily: the declared count is untrusted */
+        reserve_req_args(c, count < REQ_ARGS_INITIAL ?
+                            (size_t)count : REQ_ARGS_INITIAL);
+    }
+
+    while (c->req_argi < c->req_argc) {
+        size_t pos = c->read_pos;
+        if (pos >= len) {
+            return 0;
+        }
+        reserve_req_args(c, (size_t)c->req_argi + 1);
+        resp_value_t *el = &c->req_args[c->req_argi];
+
+        if (c->req_bulk_len < 0) {
+            if (buf[pos] != '$') {
+                int r = parse_into_arena(c, buf + pos, len - pos, el);
+                if (r <= 0) {
+                    if (r < 0) {
+                        resp_parser_reset(c);
+                    }
+                    return r;
+                }
+                c->read_pos += (size_t)r;
+                c->req_argi++;
+                continue;
+            }
+
+            int64_t slen;
+            int header = parse_header(buf + pos + 1, len - pos - 1,
+                                      RESP_MAX_BULK_LEN, &slen);
+            if (header <= 0) {
+                if (header < 0) {
+                    resp_parser_reset(c);
+                }
+                return header;
+            }
+            c->read_pos += 1 + (size_t)header;
+
+            if (slen == -1) {
+                el->type = RESP_NULL_BULK_STRING;
+                c->req_argi++;
+                continue;
+            }
+            c->req_bulk_len = slen;
+            pos = c->read_pos;
+        }
+
+        /* Payload: wait until the declared length plus CRLF is buffered */
+        size_t blen = (size_t)c->req_bulk_len;
+        if (len - pos < blen + 2) {
+            return 0;
+        }
+        if (buf[pos + blen] != '\r' || buf[pos + blen + 1] != '\n') {
+            resp_parser_reset(c);
+            return -1;
+        }
+        el->type = RESP_BULK_STRING;
+        el->str.data = (char *)(uintptr_t)(pos - c->req_start);
+        el->str.len = blen;
+        c->read_pos += blen + 2;
+        c->req_bulk_len = -1;
+        c->req_argi++;
+    }
+
+    /* Complete: resolve offsets against the (now stable) buffer */
+    char *base = c->read_buf + c->req_start;
+    for (int64_t i = 0; i < c->req_argc; i++) {
+        if (c->req_args[i].type == RESP_BULK_STRING) {
+            c->req_args[i].str.data = base + (uintptr_t)c->req_args[i].str.data;
+        }
+    }
+
+    out->type = RESP_ARRAY;
+    out->array.elements = c->req_args;
+    out->array.count = (int)c->req_argc;
+    c->req_argi = 0;
+    c->req_argc = -1;
+    return 1;
+}
+
+void resp_command_release(client_t *c, resp_value_t *cmd) {
+    /* Everything the command owned, and any scratch its handler took,
+       lives in the request arena. */
+    if (cmd->type == RESP_ARRAY) {
+        cmd->array.elements = NULL;
+        cmd->array.count = 0;
+    }
+    arena_reset(&c->req_arena);
 }
@@ -5,6 +5,13 @@
 #include "client.h"
 #include <stdint.h>
 
+/* Protocol limits; input beyond them is a protocol error */
+#define RESP_MAX_INLINE_LEN (64 * 1024)          /* +simple / -error lines */
+#define RESP_MAX_BULK_LEN   (512LL * 1024 * 1024)
+#define RESP_MAX_MULTIBULK  (1024 * 1024)        /* elements per array */
+#define RESP_MAX_HEADER_LEN 20                   /* digits in a length */
+#define RESP_MAX_NESTING    32                   /* arrays within arrays */
+
 typedef enum {
     RESP_SIMPLE_STRING,
     RESP_ERROR,
@@ -29,10 +36,44 @@ typedef struct resp_value {
 int resp_parse(const char *buf, size_t len, resp_value_t *out);
 void resp_value_free(resp_value_t *val);
 
+/* Parse the next command from c->read_buf starting at c->read_pos.
+   Returns 1 when a complete value was stored in out, 0 if more data is
+   needed (progress is kept in c, so already-parsed elements are never
+   rescanned), or -1 on a protocol error. Advances c->read_pos.
+
+   A multibulk command is returned as a borrowed view: out->array.elements
+   is the client's reusable argv and each bulk argument points into
+   read_buf (not NUL-terminated). It stays valid until the read buffer is
+   next compacted. Any other value is allocated from c->req_arena.
+   Release it with resp_command_release(), which also resets the arena. */
+int resp_parse_client(client_t *c, resp_value_t *out);
+void resp_command_release(client_t *c, resp_value_t *cmd);
+void resp_parser_reset(client_t *c);
+
+/* Pre-encoded replies, written with a single append */
+typedef enum {
+    RESP_SHARED_OK,
+    RESP_SHARED_PONG,
+    RESP_SHARED_ZERO,           /* :0 */
+    RESP_SHARED_ONE,            /* :1 */
+    RESP_SHARED_MINUS_ONE,      /* :-1 */
+    RESP_SHARED_MINUS_TWO,      /* :-2 */
+    RESP_SHARED_NULL_BULK,      /* $-1 */
+    RESP_SHARED_EMPTY_ARRAY,    /* *0 */
+    RESP_SHARED_TYPE_STRING,    /* +string */
+    RESP_SHARED_TYPE_NONE,      /* +none */
+    RESP_SHARED_COUNT
+} resp_shared_t;
+
+void resp_write_shared(client_t *c, resp_shared_t reply);
 void resp_write_simple_string(client_t *c, const char *str);
 void resp_write_error(client_t *c, const char *msg);
 void resp_write_integer(client_t *c, int64_t val);
 void resp_write_bulk_string(client_t *c, const char *data, size_t len);
+/* Bulk reply for a stored value; large values are queued by reference. */
+void resp_write_bulk_value(client_t *c, rstr_t value);
+/* Bulk reply holding the decimal form of val. */
+void resp_write_bulk_int(client_t *c, int64_t val);
 void resp_write_null_bulk_string(client_t *c);
 void resp_write_array_header(client_t *c, int count);
 
@@ -1,15 +1,24 @@
 #include "rstr.h"
-#include <stdlib.h>
+#include "slab.h"
 #include <string.h>
-#include <stdio.h>
+
+typedef struct {
+    size_t refcount;
+} rstr_shared_t;
+
+static rstr_shared_t *shared_hdr(rstr_t s) {
+    return (rstr_shared_t *)(void *)s.data - 1;
+}
 
 rstr_t rstr_create(const char *data, size_t len) {
     rstr_t s;
     s.len = len;
-    s.data = malloc(len + 1);
-    if (!s.data) {
-        perror("malloc");
-        exit(1);
+    if (len >= RSTR_SHARED_MIN) {
+        rstr_shared_t *hdr = slab_alloc(sizeof(rstr_shared_t) + len + 1);
+        hdr->refcount = 1;
+        s.data = (char *)(hdr + 1);
+    } else {
+        s.data = slab_alloc(len + 1);
     }
     if (len > 0 && data) {
         memcpy(s.data, data, len);
@@ -22,12 +31,40 @@ rstr_t rstr_dup(rstr_t s) {
     return rstr_create(s.data, s.len);
 }
 
+rstr_t rstr_retain(rstr_t s) {
+    if (s.len < RSTR_SHARED_MIN) {
+        return rstr_dup(s);
+    }
+    shared_hdr(s)->refcount++;
+    return s;
+}
+
 void rstr_free(rstr_t *s) {
     if (s) {
-        free(s->data);
+        if (s->data && s->len >= RSTR_SHARED_MIN) {
+            rstr_shared_t *hdr = shared_hdr(*s);
+            if (--hdr->refcount == 0) {
+                slab_free(hdr, sizeof(rstr_shared_t) + s->len + 1);
+            }
+        } else {
+            slab_free(s->data, s->len + 1);
+        }
+        s->data = NULL;
+        s->len = 0;
+    }
+}
+
+void rstr_free_lazy(rstr_t *s) {
+    if (s && s->data && s->len >= RSTR_SHARED_MIN) {
+        rstr_shared_t *hdr = shared_hdr(*s);
+        if (--hdr->refcount == 0) {
+            slab_free_lazy(hdr, sizeof(rstr_shared_t) + s->len + 1);
+        }
         s->data = NULL;
         s->len = 0;
+        return;
     }
+    rstr_free(s);
 }
 
 bool rstr_eq(rstr_t a, rstr_t b) {
@@ -4,6 +4,13 @@
 #include <stdbool.h>
 #include <stddef.h>
 
+/* Strings of at least this many bytes carry a hidden reference count in
+   front of their data so they can be shared (e.g. queued for output)
+   without copying. Smaller strings are plain allocations. Storage comes
+   from the slab allocator, which is told the size again on free, so an
+   owned string's len must not be changed. */
+#define RSTR_SHARED_MIN (16 * 1024)
+
 typedef struct {
     char *data;
     size_t len;
@@ -11,7 +18,13 @@ typedef struct {
 
 rstr_t rstr_create(const char *data, size_t len);
 rstr_t rstr_dup(rstr_t s);
+/* Return an owned handle to s, which must come from rstr_create() or
+   rstr_dup(). Shares the data for large strings, copies small ones. */
+rstr_t rstr_retain(rstr_t s);
 void rstr_free(rstr_t *s);
+/* rstr_free(), leaving the free() of a large string's memory to the
+   lazy-free thread (slab_free_lazy()). */
+void rstr_free_lazy(rstr_t *s);
 bool rstr_eq(rstr_t a, rstr_t b);
 
 #endif
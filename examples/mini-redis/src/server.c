@@ -1,32 +1,179 @@
 #include "server.h"
+#include "aof.h"
 #include "client.h"
 #include "resp.h"
 #include "hashtable.h"
 #include "commands.h"
+#include "evict.h"
+#include "event.h"
+#include "io_threads.h"
+#include "lazyfree.h"
+#include "repl.h"
+#include "shard.h"
+#include "slab.h"
+#include "snapshot.h"
+#include "stats.h"
+#include "util.h"
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <errno.h>
+#include <inttypes.h>
 #include <signal.h>
 #include <fcntl.h>
-#include <poll.h>
+#include <pthread.h>
+#include <sys/resource.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <arpa/inet.h>
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
 
-#define RECV_BUF_SIZE 4096
-#define MIN_BUF_SIZE 1024
+#define LISTENER_TOKEN -1
+#define INBOX_TOKEN -2
+#define REPL_TOKEN -3    /* the link to our primary */
+#define UNIX_LISTENER_TOKEN -4
+#define REHASH_IDLE_MS 1   /* migration slice per idle wakeup */
+/* Slots of a flushed table released per busy iteration (entries are
+   freed by the thread that owns their slab; see ht_clear_async()). */
+#define LAZYFREE_BUSY_SLOTS 4096
+/* Active expiration runs at most every EXPIRE_CYCLE_MS while busy, for
+   up to EXPIRE_CYCLE_BUDGET_US each time (10% of the loop); when idle
+   with a backlog it runs back to back. */
+#define EXPIRE_CYCLE_MS 10
+#define EXPIRE_CYCLE_BUDGET_US 1000
+#define MAX_WAIT_MS 1000
+/* With --io-threads, batches of fewer ready clients than this per
+   thread are handled inline: splitting them costs more than it saves. */
+#define IO_MIN_CLIENTS_PER_THREAD 2
+/* Every CLIENTS_CRON_MS a tenth of the clients is checked, so each is
+   seen about once a second; those idle for CLIENT_IDLE_MS give back
+   their buffers (client_reclaim()). */
+#define CLIENTS_CRON_MS 100
+#define CLIENTS_CRON_MIN 16
+#define CLIENT_IDLE_MS 2000
+/* malloc keeps freed buffers mapped; hand them back to the kernel once a
+   cron pass has freed this much. */
+#define CLIENTS_TRIM_BYTES (1024 * 1024)
+/* Descriptors kept for listeners, inbox pipes and the event loop when
+   sizing RLIMIT_NOFILE for --maxclients. */
+#define RESERVED_FDS 32
 
 volatile sig_atomic_t g_shutdown = 0;
 
+/* --maxclients, checked against the connections open in all shards */
+static int max_clients = MAX_CLIENTS;
+/* --slowlog-log-slower-than, --slowlog-max-len */
+static long long slowlog_slower_than = SLOWLOG_DEFAULT_SLOWER_THAN;
+static size_t slowlog_max_len = SLOWLOG_DEFAULT_MAX_LEN;
+/* --maxmemory (bytes, 0 = no limit), --maxmemory-policy,
+   --maxmemory-samples */
+static size_t maxmemory;
+static evict_policy_t maxmemory_policy = EVICT_NOEVICTION;
+static int maxmemory_samples = EVICT_DEFAULT_SAMPLES;
+/* --client-output-buffer-limit, --client-query-buffer-limit */
+static client_limits_t client_limits_conf = {
+    CLIENT_OUTPUT_HARD_DEFAULT, CLIENT_OUTPUT_SOFT_DEFAULT,
+    CLIENT_QUERY_HARD_DEFAULT, CLIENT_QUERY_SOFT_DEFAULT
+};
+/* --dbfilename: loaded at startup, written by SAVE and BGSAVE */
+static const char *db_path = SNAPSHOT_DEFAULT_PATH;
+/* --appendonly, --appendfsync, --appendfilename */
+static bool aof_on;
+static aof_fsync_t aof_fsync = AOF_FSYNC_EVERYSEC;
+static const char *aof_file = AOF_DEFAULT_PATH;
+/* --unixsocket, --unixsocketperm; the listener is shard 0's */
+static const char *unix_path;
+static mode_t unix_perm;
+/* --tcp-backlog, --tcp-nodelay, --socket-rcvbuf, --socket-sndbuf,
+   --busy-poll */
+static listen_opts_t listen_conf = {LISTEN_BACKLOG_DEFAULT, true, 0, 0, 0};
+/* --replicaof, --repl-backlog-size */
+static const char *primary_host;
+static int primary_port;
+static size_t repl_backlog = REPL_DEFAULT_BACKLOG;
+
+/* One client's part of a threaded batch. */
+typedef struct {
+    client_t *c;
+    bool drain;
+    int status;             /* -1: read hit EOF/error, or flush failed */
+    int parsed;             /* resp_parse_client() result for cmd */
+    resp_value_t cmd;
+} io_job_t;
+
+/* An event loop with its listener, clients and store: the whole server,
+   or one shard of it. */
+typedef struct {
+    int index;                  /* shard number, 0 when unsharded */
+    int nshards;
+    event_loop_t *el;
+    int listen_fd;
+    int unix_fd;                /* -1 unless --unixsocket, on shard 0 */
+    hashtable_t *store;
+    client_table_t clients;
+    int cron_slot;              /* where the clients cron resumes */
+    int64_t next_cron;
+    ev_fired_t *fired;
+    int fired_cap;              /* slots in the table, listeners, inbox */
+    shard_t *shard;             /* NULL unless --shards */
+    int *resumed;               /* shard_poll() output */
+    int resumed_cap;
+    io_threads_t *io;           /* NULL unless --io-threads */
+    io_job_t *jobs;             /* fired_cap of each */
+    void **job_ptrs;
+    pthread_t thread;
+} server_t;
+
 static void signal_handler(int sig) {
     (void)sig;
     g_shutdown = 1;
 }
 
-int start_server(int port) {
+/* Only there to interrupt ev_wait() so a finished BGSAVE is reaped
+   promptly. */
+static void sigchld_handler(int sig) {
+    (void)sig;
+}
+
+/* Buffer sizes and busy polling, on a listener or an accepted socket.
+   Failing to set them is not fatal: the defaults still work. */
+static void set_socket_buffers(int fd, const listen_opts_t *opts) {
+    if (opts->rcvbuf > 0 &&
+        setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &opts->rcvbuf,
+                   sizeof(opts->rcvbuf)) < 0) {
+        perror("setsockopt SO_RCVBUF");
+    }
+    if (opts->sndbuf > 0 &&
+        setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &opts->sndbuf,
+                   sizeof(opts->sndbuf)) < 0) {
+        perror("setsockopt SO_SNDBUF");
+    }
+}
+
+/* Make a bound socket a non-blocking listener, or exit. */
+static int listen_on(int fd, const listen_opts_t *opts) {
+    int flags = fcntl(fd, F_GETFL, 0);
+    if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0) {
+        perror("fcntl");
+        close(fd);
+        exit(1);
+    }
+    if (listen(fd, opts->backlog) < 0) {
+        perror("listen");
+        close(fd);
+        exit(1);
+    }
+    return fd;
+}
+
+int start_server(int port, bool reuse_port, const listen_opts_t *opts) {
     int fd = socket(AF_INET, SOCK_STREAM, 0);
     if (fd < 0) {
         perror("socket");
@@ -39,14 +186,27 @@ int start_server(int port) {
         close(fd);
         exit(1);
     }
-
-    /* Set non-blocking */
-    int flags = fcntl(fd, F_GETFL, 0);
-    if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0) {
-        perror("fcntl");
+    /* every shard binds its own listener; the kernel spreads
+       connections over them */
+    if (reuse_port &&
+        setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt)) < 0) {
+        perror("setsockopt");
         close(fd);
         exit(1);
     }
+    /* before listen(), so the window scale offered fits the buffer */
+    set_socket_buffers(fd, opts);
+    if (opts->busy_poll_us > 0) {
+#ifdef SO_BUSY_POLL
+        /* raising it past net.core.busy_read needs CAP_NET_ADMIN */
+        if (setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL, &opts->busy_poll_us,
+                       sizeof(opts->busy_poll_us)) < 0) {
+            perror("setsockopt SO_BUSY_POLL");
+        }
+#else
+        fprintf(stderr, "--busy-poll is not supported on this platform\n");
+#endif
+    }
 
     struct sockaddr_in addr;
     memset(&addr, 0, sizeof(addr));
@@ -59,17 +219,142 @@ int start_server(int port) {
         close(fd);
         exit(1);
     }
+    return listen_on(fd, opts);
+}
+
+int start_unix_server(const char *path, mode_t perm,
+                      const listen_opts_t *opts) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "--unixsocket path is longer than %zu bytes\n",
+                sizeof(addr.sun_path) - 1);
+        exit(1);
+    }
+    strcpy(addr.sun_path, path);
 
-    if (listen(fd, 128) < 0) {
-        perror("listen");
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        perror("socket");
+        exit(1);
+    }
+    /* a socket left by a server that didn't shut down cleanly; anything
+       else at path is left alone, and bind() fails */
+    struct stat st;
+    if (lstat(path, &st) == 0 && S_ISSOCK(st.st_mode)) {
+        unlink(path);
+    }
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        fprintf(stderr, "bind %s: %s\n", path, strerror(errno));
         close(fd);
         exit(1);
     }
+    if (perm != 0 && chmod(path, perm) < 0) {
+        fprintf(stderr, "chmod %s: %s\n", path, strerror(errno));
+        close(fd);
+        exit(1);
+    }
+    return listen_on(fd, opts);
+}
 
-    return fd;
+static void close_client(server_t *srv, client_t *c) {
+    if (c->fd < 0) {
+        return;
+    }
+    ev_del(srv->el, c->fd);
+    if (c->replica >= 0) {
+        repl_detach(c);
+    }
+    if (srv->shard) {
+        shard_client_closed(srv->shard, c->slot);
+    }
+    client_table_release(&srv->clients, c);
+    stats_client_closed();
+}
+
+/* A client past a hard buffer limit is dropped, with a line in the log. */
+static void close_over_limit(server_t *srv, client_t *c, bool output) {
+    const client_limits_t *l = client_limits();
+    if (output) {
+        stats_output_limit_closed();
+        fprintf(stderr, "Closing client %" PRIu64 ": %zu bytes of output "
+                "past the %zu byte limit\n", c->id, c->write_len,
+                l->output_hard);
+    } else {
+        stats_query_limit_closed();
+        fprintf(stderr, "Closing client %" PRIu64 ": %zu bytes of input "
+                "past the %zu byte limit\n", c->id, client_query_len(c),
+                l->query_hard);
+    }
+    close_client(srv, c);
+}
+
+static bool client_waiting(const server_t *srv, const client_t *c) {
+    return srv->shard && shard_client_waiting(srv->shard, c->slot);
+}
+
+/* Commands are held back past the soft output limit, and past the hard
+   one until a flush decides whether the client is dropped. */
+static bool output_full(const client_t *c) {
+    return client_output_over_soft(c) || client_output_over_hard(c);
+}
+
+/* Its socket is not read while the client's commands are held back by
+   replies past the soft output limit, or while they wait on other
+   shards with input past the soft query limit. */
+static bool client_reading(const server_t *srv, const client_t *c) {
+    if (c->paused) {
+        return false;
+    }
+    return !client_waiting(srv, c) || !client_query_over_soft(c);
 }
 
-static void accept_new_client(int listen_fd, client_t *clients) {
+/* Only touch the kernel interest set when write_len moves between zero
+   and non-zero, or reading stops or resumes; the common request/reply
+   case never changes it. */
+static void update_interest(server_t *srv, client_t *c) {
+    int mask = client_reading(srv, c) ? EV_READABLE : 0;
+    if (c->write_len > 0) {
+        mask |= EV_WRITABLE;
+    }
+    if (mask == c->ev_mask) {
+        return;
+    }
+    if (ev_modify(srv->el, c->fd, mask, c->slot) < 0) {
+        perror("ev_modify");
+        close_client(srv, c);
+        return;
+    }
+    c->ev_mask = mask;
+}
+
+static void reject_client(int fd) {
+    static const char msg[] = "-ERR max number of clients reached\r\n";
+    /* best effort: the socket is new, so the line fits its buffer */
+    if (send(fd, msg, sizeof(msg) - 1, MSG_NOSIGNAL | MSG_DONTWAIT) < 0) {
+        /* closing is all that is left to do */
+    }
+    close(fd);
+}
+
+/* TCP connections inherit the listener's buffers and busy polling but,
+   portably, not TCP_NODELAY. Unix domain connections inherit nothing. */
+static void tune_client_socket(int fd, bool tcp) {
+    if (!tcp) {
+        set_socket_buffers(fd, &listen_conf);
+        return;
+    }
+    int opt = 1;
+    if (listen_conf.nodelay &&
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt)) < 0) {
+        /* Nagle stays on; replies still go out */
+    }
+}
+
+/* Accept everything pending on a listener, the TCP one or the Unix
+   domain socket. */
+static void accept_new_client(server_t *srv, int listen_fd, bool tcp) {
     while (1) {
         int client_fd = accept(listen_fd, NULL, NULL);
         if (client_fd < 0) {
@@ -85,206 +370,932 @@ static void accept_new_client(int listen_fd, client_t *clients) {
         if (flags >= 0) {
             fcntl(client_fd, F_SETFL, flags | O_NONBLOCK);
         }
+        tune_client_socket(client_fd, tcp);
 
-        /* Find a free slot */
-        int slot = -1;
-        for (int i = 0; i < MAX_CLIENTS; i++) {
-            if (clients[i].fd == -1) {
-                slot = i;
-                break;
-            }
+        if (stats_client_opened() > max_clients) {
+            stats_client_closed();
+            stats_client_rejected();
+            reject_client(client_fd);
+            continue;
         }
 
-        if (slot == -1) {
-            /* No room */
+        client_t *c = client_table_acquire(&srv->clients);
+        if (ev_add(srv->el, client_fd, EV_READABLE, c->slot) < 0) {
+            perror("ev_add");
             close(client_fd);
+            client_table_release(&srv->clients, c);
+            stats_client_closed();
             continue;
         }
+        c->fd = client_fd;
+        c->ev_mask = EV_READABLE;
+        c->last_active_ms = clock_ms();
+    }
+}
+
+/* Execute cmd and parse/execute the rest of the buffered input.
+   parsed is the result of resp_parse_client() for cmd, 0 if none.
+   Stops early at a command that waits for other shards, and once the
+   replies are past the soft output limit. */
+static void process_input(server_t *srv, client_t *c, resp_value_t *cmd,
+                          int parsed) {
+    int slot = c->slot;
+    c->last_active_ms = clock_ms();
+    /* where cmd starts, to un-parse it; a deferred command is never the
+       first one, which was parsed with no batch open */
+    size_t start = c->read_pos;
+    while (c->fd >= 0) {
+        if (parsed == 0) {
+            break; /* need more data */
+        }
+
+        if (parsed < 0) {
+            resp_write_error(c, "ERR Protocol error");
+            close_client(srv, c);
+            return;
+        }
+
+        shard_route_t route = srv->shard ?
+            shard_route(srv->shard, c, slot, cmd) : SHARD_LOCAL;
+        if (route == SHARD_LOCAL) {
+            dispatch_command(c, srv->store, cmd);
+        }
+        resp_command_release(c, cmd);
+        if (route == SHARD_DEFER) {
+            c->read_pos = start;
+            break;
+        }
+        if (client_waiting(srv, c)) {
+            break;
+        }
+        if (output_full(c)) {
+            /* the rest waits for finish_client() to drain the replies */
+            c->paused = true;
+            break;
+        }
+        start = c->read_pos;
+        parsed = resp_parse_client(c, cmd);
+    }
+
+    if (srv->shard && c->fd >= 0) {
+        shard_flush(srv->shard, c, slot);
+    }
+    /* Compact once per read batch rather than once per command */
+    client_compact_read_buf(c);
+}
 
-        client_init(&clients[slot]);
-        clients[slot].fd = client_fd;
+/* Parse and run whatever is buffered, unless a command is in flight or
+   the client is paused: input is then left for when that ends. */
+static void resume_input(server_t *srv, client_t *c) {
+    resp_value_t cmd;
+    /* a batch's replies come in at once, past the limit */
+    if (output_full(c)) {
+        c->paused = true;
     }
+    int parsed = client_waiting(srv, c) || c->paused ? 0 :
+                 resp_parse_client(c, &cmd);
+    process_input(srv, c, &cmd, parsed);
 }
 
-static void handle_client_read(client_t *c, hashtable_t *store) {
-    char tmp[RECV_BUF_SIZE];
-    ssize_t n = recv(c->fd, tmp, sizeof(tmp), 0);
+static void handle_client_read(server_t *srv, client_t *c) {
+    int rc = client_read(c, ev_edge_triggered(srv->el));
+    if (rc == CLIENT_READ_LIMIT) {
+        close_over_limit(srv, c, false);
+        return;
+    }
+    if (rc < 0) {
+        close_client(srv, c);
+        return;
+    }
+    resume_input(srv, c);
+}
 
-    if (n <= 0) {
-        if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) {
-            client_close(c);
+static void handle_client_write(server_t *srv, client_t *c) {
+    if (client_flush(c) < 0) {
+        close_client(srv, c);
+    }
+}
+
+/* Flush what the client's commands produced and update its interest.
+   A paused client whose replies drained below the soft limit runs the
+   commands held back, until they pause it again or run out; their AOF
+   records are written before their replies go out. */
+static void finish_client(server_t *srv, client_t *c) {
+    for (;;) {
+        /* Replies produced by the read are flushed right away; POLLOUT
+           interest is only armed if the socket could not take them. */
+        if (c->write_len > 0) {
+            handle_client_write(srv, c);
+            if (c->fd < 0) {
+                return;
+            }
+        }
+        if (!c->paused || output_full(c)) {
+            break;
+        }
+        c->paused = false;
+        resume_input(srv, c);
+        if (c->fd < 0) {
+            return;
         }
+        /* the loop's aof_flush() has run already: write what these
+           commands queued before the next pass sends their replies */
+        aof_flush(clock_ms());
+    }
+    if (client_output_over_hard(c)) {
+        close_over_limit(srv, c, true);
         return;
     }
+    update_interest(srv, c);
+}
 
-    /* Append to read buffer */
-    size_t needed = c->read_len + (size_t)n;
-    if (needed > c->read_cap) {
-        size_t new_cap = c->read_cap * 2;
-        if (new_cap < needed) {
-            new_cap = needed;
+/* Hand this iteration's writes to the replicas and send them. One that
+   can't keep up is dropped: it resyncs when it reconnects. */
+static void flush_replicas(server_t *srv) {
+    repl_flush();
+    for (int i = repl_replica_count() - 1; i >= 0; i--) {
+        client_t *c = repl_replica(i);
+        if (c->write_len > 0) {
+            finish_client(srv, c);
         }
-        if (new_cap < MIN_BUF_SIZE) {
-            new_cap = MIN_BUF_SIZE;
+        /* finish_client() may have closed it, which detaches it */
+        if (c->replica == i && repl_replica_lagging(i)) {
+            fprintf(stderr, "Dropping a replica %zu bytes behind\n",
+                    c->write_len);
+            close_client(srv, c);
         }
-        char *new_buf = realloc(c->read_buf, new_cap);
-        if (!new_buf) {
+    }
+}
+
+/* Replies from other shards have come in: run the sub-commands sent
+   here, and carry on with the clients whose commands completed. */
+static void handle_inbox(server_t *srv) {
+    /* at most one resumed client per slot */
+    if (srv->resumed_cap < srv->clients.used) {
+        srv->resumed_cap = srv->clients.cap;
+        srv->resumed = realloc(srv->resumed,
+                               (size_t)srv->resumed_cap * sizeof(int));
+        if (!srv->resumed) {
             perror("realloc");
             exit(1);
         }
-        c->read_buf = new_buf;
-        c->read_cap = new_cap;
     }
-    memcpy(c->read_buf + c->read_len, tmp, (size_t)n);
-    c->read_len += (size_t)n;
+    int n = shard_poll(srv->shard, &srv->clients, srv->resumed);
+    for (int i = 0; i < n; i++) {
+        client_t *c = client_table_get(&srv->clients, srv->resumed[i]);
+        resume_input(srv, c);
+        if (c->fd >= 0) {
+            finish_client(srv, c);
+        }
+    }
+}
 
-    /* Parse and execute loop */
-    while (c->read_len > 0 && c->fd >= 0) {
-        resp_value_t cmd;
-        int consumed = resp_parse(c->read_buf, c->read_len, &cmd);
+static void io_read_job(void *arg) {
+    io_job_t *job = arg;
+    job->parsed = 0;
+    job->status = client_read(job->c, job->drain);
+    if (job->status == 0) {
+        job->parsed = resp_parse_client(job->c, &job->cmd);
+    }
+}
 
-        if (consumed == 0) {
-            break; /* need more data */
+static void io_flush_job(void *arg) {
+    io_job_t *job = arg;
+    job->status = client_flush_io(job->c);
+}
+
+/* The fired client still open, or NULL (closed earlier in the batch). */
+static client_t *fired_client(const client_table_t *clients,
+                              const ev_fired_t *f) {
+    client_t *c = client_table_get(clients, f->token);
+    return c && c->fd == f->fd ? c : NULL;
+}
+
+/* Same as the inline event loop, in three phases: I/O threads read the
+   ready sockets and parse each one's first command; the main thread
+   runs the commands, in event order, against the store; the threads
+   then write the replies. */
+static void handle_events_threaded(server_t *srv, int ready) {
+    const ev_fired_t *fired = srv->fired;
+    const client_table_t *clients = &srv->clients;
+    io_job_t *jobs = srv->jobs;
+    void **job_ptrs = srv->job_ptrs;
+    bool drain = ev_edge_triggered(srv->el);
+    size_t n = 0;
+    for (int i = 0; i < ready; i++) {
+        if (fired[i].token == LISTENER_TOKEN) {
+            accept_new_client(srv, srv->listen_fd, true);
+            continue;
+        }
+        if (fired[i].token == UNIX_LISTENER_TOKEN) {
+            accept_new_client(srv, srv->unix_fd, false);
+            continue;
+        }
+        if (fired[i].token == REPL_TOKEN) {
+            repl_handle(srv->store, fired[i].mask);
+            continue;
+        }
+        client_t *c = fired_client(clients, &fired[i]);
+        if (!c) {
+            continue;
         }
+        if (fired[i].mask & EV_ERROR) {
+            close_client(srv, c);
+            continue;
+        }
+        if (fired[i].mask & EV_READABLE) {
+            jobs[n].c = c;
+            jobs[n].drain = drain;
+            job_ptrs[n] = &jobs[n];
+            n++;
+        }
+    }
+    io_threads_run(srv->io, io_read_job, job_ptrs, n);
 
-        if (consumed < 0) {
-            resp_write_error(c, "ERR Protocol error");
-            client_close(c);
-            return;
+    for (size_t j = 0; j < n; j++) {
+        io_job_t *job = &jobs[j];
+        if (job->status == CLIENT_READ_LIMIT) {
+            close_over_limit(srv, job->c, false);
+        } else if (job->status < 0) {
+            close_client(srv, job->c);
+        } else {
+            process_input(srv, job->c, &job->cmd, job->parsed);
         }
+    }
+    aof_flush(clock_ms());
+    flush_replicas(srv);
 
-        dispatch_command(c, store, &cmd);
-        resp_value_free(&cmd);
+    n = 0;
+    for (int i = 0; i < ready; i++) {
+        if (fired[i].token < 0) {
+            continue;
+        }
+        client_t *c = fired_client(clients, &fired[i]);
+        if (c && c->write_len > 0) {
+            jobs[n].c = c;
+            job_ptrs[n] = &jobs[n];
+            n++;
+        }
+    }
+    io_threads_run(srv->io, io_flush_job, job_ptrs, n);
 
-        /* Remove consumed bytes */
-        size_t remaining = c->read_len - (size_t)consumed;
-        if (remaining > 0) {
-            memmove(c->read_buf, c->read_buf + consumed, remaining);
+    for (size_t j = 0; j < n; j++) {
+        client_release_sent(jobs[j].c);
+        if (jobs[j].status < 0) {
+            close_client(srv, jobs[j].c);
+        }
+    }
+    for (int i = 0; i < ready; i++) {
+        if (fired[i].token == LISTENER_TOKEN) {
+            continue;
+        }
+        client_t *c = fired_client(clients, &fired[i]);
+        if (c && (c->paused || client_output_over_hard(c))) {
+            finish_client(srv, c);
+        } else if (c) {
+            update_interest(srv, c);
         }
-        c->read_len = remaining;
     }
 }
 
-static void handle_client_write(client_t *c) {
-    if (c->write_len == 0) {
-        return;
+/* Create the loop and listener. The store is created by serve(), on
+   the thread that will use it. */
+static void server_open(server_t *srv, int port, ev_backend_t backend,
+                        bool reuse_port) {
+    srv->el = ev_create(backend);
+    if (!srv->el) {
+        fprintf(stderr, "Event backend unavailable, falling back to poll\n");
+        srv->el = ev_create(EV_BACKEND_POLL);
     }
 
-    ssize_t n = send(c->fd, c->write_buf, c->write_len, 0);
-    if (n < 0) {
-        if (errno != EAGAIN && errno != EWOULDBLOCK) {
-            client_close(c);
-        }
-        return;
+    srv->listen_fd = start_server(port, reuse_port, &listen_conf);
+    if (ev_add(srv->el, srv->listen_fd, EV_READABLE, LISTENER_TOKEN) < 0) {
+        perror("ev_add");
+        exit(1);
     }
+    srv->unix_fd = -1;
 
-    size_t remaining = c->write_len - (size_t)n;
-    if (remaining > 0) {
-        memmove(c->write_buf, c->write_buf + n, remaining);
-    }
-    c->write_len = remaining;
+    client_table_init(&srv->clients);
 }
 
-int main(int argc, char *argv[]) {
-    int port = 6379;
+/* Room in fired (and the I/O jobs) for every slot of the table, so a
+   wakeup can report every client: the poll backend would otherwise
+   favour the ones registered first. Grown between wakeups, never while
+   fired is being walked. */
+static void reserve_fired(server_t *srv) {
+    /* clients, listeners, and the inbox or the link to a primary */
+    int need = srv->clients.cap + 3;
+    if (need <= srv->fired_cap) {
+        return;
+    }
+    srv->fired = realloc(srv->fired, (size_t)need * sizeof(ev_fired_t));
+    if (!srv->fired) {
+        perror("realloc");
+        exit(1);
+    }
+    if (srv->io) {
+        srv->jobs = realloc(srv->jobs, (size_t)need * sizeof(io_job_t));
+        srv->job_ptrs = realloc(srv->job_ptrs, (size_t)need * sizeof(void *));
+        if (!srv->jobs || !srv->job_ptrs) {
+            perror("realloc");
+            exit(1);
+        }
+    }
+    srv->fired_cap = need;
+}
 
-    /* Parse --port argument */
-    for (int i = 1; i < argc; i++) {
-        if (strcmp(argv[i], "--port") == 0 && i + 1 < argc) {
-            port = atoi(argv[i + 1]);
-            i++;
+/* Trim the buffers of idle clients, a slice of the table per call. */
+static void clients_cron(server_t *srv, int64_t now) {
+    client_table_t *t = &srv->clients;
+    int budget = t->used / (1000 / CLIENTS_CRON_MS);
+    if (budget < CLIENTS_CRON_MIN) {
+        budget = CLIENTS_CRON_MIN;
+    }
+    size_t freed = 0;
+    for (int i = 0; i < budget && i < t->used; i++) {
+        if (srv->cron_slot >= t->used) {
+            srv->cron_slot = 0;
+        }
+        client_t *c = t->slots[srv->cron_slot++];
+        if (c->fd >= 0 && now - c->last_active_ms >= CLIENT_IDLE_MS) {
+            freed += client_reclaim(c);
         }
     }
+#ifdef __GLIBC__
+    if (freed >= CLIENTS_TRIM_BYTES) {
+        malloc_trim(0);
+    }
+#endif
+}
 
-    /* Install signal handlers */
-    struct sigaction sa;
-    memset(&sa, 0, sizeof(sa));
-    sa.sa_handler = signal_handler;
-    sigemptyset(&sa.sa_mask);
-    sigaction(SIGINT, &sa, NULL);
-    sigaction(SIGTERM, &sa, NULL);
+/* Shard 0 (or the unsharded server) runs on the main thread and stops
+   on a signal; it stops the other shards. */
+static bool server_stopping(server_t *srv) {
+    if (srv->index == 0) {
+        return g_shutdown;
+    }
+    return shard_stopping(srv->shard);
+}
 
-    int listen_fd = start_server(port);
-    fprintf(stderr, "Mini-Redis server listening on port %d\n", port);
+static bool shard_keeps(void *ctx, rstr_t key) {
+    return shard_owns(ctx, key);
+}
 
-    hashtable_t *store = ht_create();
+/* Fill the store from the snapshot, if there is one; each shard loads
+   its own keys, in parallel with the others. A snapshot that can't be
+   read is fatal rather than silently starting empty. */
+static void load_snapshot(server_t *srv) {
+    int64_t start = current_time_ms();
+    snapshot_load_stats_t st;
+    int rc = snapshot_load(srv->store, db_path,
+                           srv->shard ? shard_keeps : NULL, srv->shard,
+                           srv->nshards, &st);
+    if (rc == -1 && errno == ENOENT) {
+        return;
+    }
+    if (rc == -1) {
+        fprintf(stderr, "Can't read %s: %s\n", db_path, strerror(errno));
+        exit(1);
+    }
+    if (rc == -2) {
+        fprintf(stderr, "%s is not a valid snapshot\n", db_path);
+        exit(1);
+    }
+    char shard_name[32] = "";
+    if (srv->shard) {
+        snprintf(shard_name, sizeof(shard_name), "Shard %d: ", srv->index);
+    }
+    fprintf(stderr, "%sLoaded %zu keys from %s in %lld ms (%zu expired)\n",
+            shard_name, st.loaded, db_path,
+            (long long)(current_time_ms() - start), st.expired);
+}
 
-    client_t clients[MAX_CLIENTS];
-    for (int i = 0; i < MAX_CLIENTS; i++) {
-        client_init(&clients[i]);
+/* With --appendonly the AOF, when there is one, holds everything; the
+   snapshot is only read to start it. */
+static void load_data(server_t *srv) {
+    if (!aof_on) {
+        load_snapshot(srv);
+        return;
+    }
+    int64_t start = current_time_ms();
+    aof_load_stats_t st;
+    int rc = aof_load(srv->store, aof_file, &st);
+    if (rc == -1 && errno == ENOENT) {
+        load_snapshot(srv);
+    } else if (rc == -1) {
+        fprintf(stderr, "Can't read %s: %s\n", aof_file, strerror(errno));
+        exit(1);
+    } else if (rc == -2) {
+        fprintf(stderr, "%s is not a valid append only file\n", aof_file);
+        exit(1);
+    } else {
+        if (st.truncated > 0) {
+            fprintf(stderr, "%s ended in a partial command: dropped its "
+                    "last %zu bytes\n", aof_file, st.truncated);
+        }
+        fprintf(stderr, "Replayed %zu commands from %s in %lld ms\n",
+                st.commands, aof_file,
+                (long long)(current_time_ms() - start));
     }
+    if (aof_open(aof_file, aof_fsync, srv->store) < 0) {
+        fprintf(stderr, "Can't open %s: %s\n", aof_file, strerror(errno));
+        exit(1);
+    }
+}
 
-    struct pollfd fds[MAX_CLIENTS + 1];
-    int poll_to_client[MAX_CLIENTS + 1];
+/* Run the event loop until shutdown, then close everything it owns. */
+static void *serve(void *arg) {
+    server_t *srv = arg;
+    srv->store = ht_create();
+    load_data(srv);
+    if (srv->shard) {
+        shard_attach(srv->shard, srv->store);
+        if (ev_add(srv->el, shard_inbox_fd(srv->shard), EV_READABLE,
+                   INBOX_TOKEN) < 0) {
+            perror("ev_add");
+            exit(1);
+        }
+    }
+    hashtable_t *store = srv->store;
+    client_table_set_current(&srv->clients);
+    if (srv->index == 0 && primary_host &&
+        repl_set_primary(primary_host, primary_port) < 0) {
+        fprintf(stderr, "Can't resolve --replicaof host %s\n", primary_host);
+        exit(1);
+    }
+    int io_thread_count = srv->io ? io_threads_count(srv->io) : 1;
+    int64_t next_expire_cycle = 0;
 
-    while (!g_shutdown) {
-        /* Build pollfd array */
-        int nfds = 0;
+    while (!server_stopping(srv)) {
+        int64_t now = clock_refresh();
+        if (srv->index == 0) {
+            snapshot_bgsave_poll();
+            aof_rewrite_poll();
+            repl_cron(store, now);
+        }
 
-        fds[0].fd = listen_fd;
-        fds[0].events = POLLIN;
-        fds[0].revents = 0;
-        poll_to_client[0] = -1;
-        nfds = 1;
+        /* Sleep until the next key is due, but no sooner than the next
+           expire cycle. Don't sleep at all while keys are overdue, the
+           store is migrating to a bigger table or a flushed one is
+           being released: idle wakeups are spent on that work instead. */
+        int timeout = MAX_WAIT_MS;
+        int64_t next_expire = ht_next_expire(store);
+        if (ht_is_rehashing(store) || ht_lazyfree_pending(store) ||
+            (next_expire >= 0 && next_expire <= now)) {
+            timeout = 0;
+        } else if (next_expire >= 0) {
+            int64_t due = next_expire > next_expire_cycle ?
+                          next_expire : next_expire_cycle;
+            int64_t wait = due - now;
+            timeout = wait > MAX_WAIT_MS ? MAX_WAIT_MS : (int)wait;
+        }
 
-        for (int i = 0; i < MAX_CLIENTS; i++) {
-            if (clients[i].fd < 0) {
-                continue;
+        if (client_table_open(&srv->clients) > 0) {
+            int64_t wait = srv->next_cron - now;
+            if (wait < timeout) {
+                timeout = wait > 0 ? (int)wait : 0;
             }
-            fds[nfds].fd = clients[i].fd;
-            fds[nfds].events = POLLIN;
-            if (clients[i].write_len > 0) {
-                fds[nfds].events |= POLLOUT;
-            }
-            fds[nfds].revents = 0;
-            poll_to_client[nfds] = i;
-            nfds++;
         }
 
-        int ready = poll(fds, (nfds_t)nfds, 1000);
+        reserve_fired(srv);
+        ev_fired_t *fired = srv->fired;
+        int ready = ev_wait(srv->el, fired, srv->fired_cap, timeout);
         if (ready < 0) {
             if (errno == EINTR) {
                 continue;
             }
-            perror("poll");
+            perror("ev_wait");
             break;
         }
+        now = clock_refresh();
+        uint64_t busy_start = stats_ticks();
+
+        next_expire = ht_next_expire(store);
+        if (next_expire >= 0 && next_expire <= now &&
+            (ready == 0 || now >= next_expire_cycle)) {
+            ht_expire_cycle(store, EXPIRE_CYCLE_BUDGET_US);
+            next_expire_cycle = now + EXPIRE_CYCLE_MS;
+        }
+        if (ready == 0 && ht_is_rehashing(store)) {
+            ht_rehash_ms(store, REHASH_IDLE_MS);
+        }
+        /* a slice every iteration: nothing else drives it */
+        if (ht_lazyfree_pending(store)) {
+            if (ready == 0) {
+                ht_lazyfree_ms(store, REHASH_IDLE_MS);
+            } else {
+                ht_lazyfree_step(store, LAZYFREE_BUSY_SLOTS);
+            }
+        }
+        if (now >= srv->next_cron) {
+            clients_cron(srv, now);
+            srv->next_cron = now + CLIENTS_CRON_MS;
+            if (srv->index == 0) {
+                stats_calibrate();
+            }
+        }
 
-        /* Check listening socket */
-        if (fds[0].revents & POLLIN) {
-            accept_new_client(listen_fd, clients);
+        if (srv->io && ready >= IO_MIN_CLIENTS_PER_THREAD * io_thread_count) {
+            handle_events_threaded(srv, ready);
+            stats_record_loop(stats_ticks() - busy_start);
+            continue;
         }
 
-        /* Handle client events */
-        for (int i = 1; i < nfds; i++) {
-            int ci = poll_to_client[i];
+        for (int i = 0; i < ready; i++) {
+            if (fired[i].token == LISTENER_TOKEN) {
+                accept_new_client(srv, srv->listen_fd, true);
+                continue;
+            }
+            if (fired[i].token == UNIX_LISTENER_TOKEN) {
+                accept_new_client(srv, srv->unix_fd, false);
+                continue;
+            }
+            if (fired[i].token == INBOX_TOKEN) {
+                handle_inbox(srv);
+                continue;
+            }
+            if (fired[i].token == REPL_TOKEN) {
+                repl_handle(store, fired[i].mask);
+                continue;
+            }
+
+            client_t *c = fired_client(&srv->clients, &fired[i]);
+            if (!c) {
+                continue; /* closed earlier in this batch */
+            }
 
-            if (fds[i].revents & (POLLERR | POLLHUP)) {
-                client_close(&clients[ci]);
+            if (fired[i].mask & EV_ERROR) {
+                close_client(srv, c);
                 continue;
             }
 
-            if (fds[i].revents & POLLIN) {
-                handle_client_read(&clients[ci], store);
-                if (clients[ci].fd < 0) {
-                    continue;
-                }
+            if (fired[i].mask & EV_READABLE) {
+                handle_client_read(srv, c);
+            }
+        }
+
+        /* Replies go out once the commands behind them are in the AOF:
+           one write for the whole batch. */
+        aof_flush(now);
+        flush_replicas(srv);
+        for (int i = 0; i < ready; i++) {
+            if (fired[i].token < 0) {
+                continue;
+            }
+            client_t *c = fired_client(&srv->clients, &fired[i]);
+            if (c) {
+                finish_client(srv, c);
             }
+        }
+        stats_record_loop(stats_ticks() - busy_start);
+    }
+
+    /* Cleanup; the link to a primary is registered on this loop */
+    if (srv->index == 0) {
+        repl_shutdown();
+    }
+    for (int i = 0; i < srv->clients.used; i++) {
+        close_client(srv, srv->clients.slots[i]);
+    }
+    io_threads_destroy(srv->io);
+    free(srv->jobs);
+    free(srv->job_ptrs);
+    free(srv->resumed);
+    client_table_set_current(NULL);
+    client_table_free(&srv->clients);
+    free(srv->fired);
+    /* The store's small keys and values go with this thread's slab
+       pages, at one munmap per page, instead of one free per key; only
+       its malloc'd memory is freed, on the lazy-free thread. */
+    ht_abandon(store);
+    close(srv->listen_fd);
+    if (srv->unix_fd >= 0) {
+        close(srv->unix_fd);
+        unlink(unix_path);
+    }
+    ev_destroy(srv->el);
+    stats_thread_release();
+    slab_release_thread();
+    return NULL;
+}
+
+/* Raise the open files limit to fit max_clients, or lower max_clients
+   to what the hard limit allows. */
+static void reserve_fds(int nshards) {
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) < 0) {
+        return;
+    }
+    /* each shard also has a listener, an event loop and a pipe */
+    rlim_t spare = RESERVED_FDS + 4 * (rlim_t)nshards;
+    rlim_t want = (rlim_t)max_clients + spare;
+    if (rl.rlim_cur >= want) {
+        return;
+    }
+    rl.rlim_cur = rl.rlim_max != RLIM_INFINITY && want > rl.rlim_max ?
+                  rl.rlim_max : want;
+    if (setrlimit(RLIMIT_NOFILE, &rl) < 0 ||
+        getrlimit(RLIMIT_NOFILE, &rl) < 0) {
+        perror("setrlimit");
+    }
+    if (rl.rlim_cur < want) {
+        max_clients = rl.rlim_cur > spare ? (int)(rl.rlim_cur - spare) : 1;
+        fprintf(stderr, "Open files limit is %llu, --maxclients lowered "
+                "to %d\n", (unsigned long long)rl.rlim_cur, max_clients);
+    }
+}
+
+int main(int argc, char *argv[]) {
+    int port = 6379;
+    int io_thread_count = 1;
+    int nshards = 1;
+    ev_backend_t backend = ev_default_backend();
 
-            if (fds[i].revents & POLLOUT) {
-                handle_client_write(&clients[ci]);
+    /* Parse command-line arguments */
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--port") == 0 && i + 1 < argc) {
+            port = atoi(argv[i + 1]);
+            i++;
+        } else if (strcmp(argv[i], "--event-backend") == 0 && i + 1 < argc) {
+            if (!ev_backend_parse(argv[i + 1], &backend)) {
+                fprintf(stderr, "Unknown event backend '%s'\n", argv[i + 1]);
+                return 1;
+            }
+            i++;
+        } else if (strcmp(argv[i], "--io-threads") == 0 && i + 1 < argc) {
+            io_thread_count = atoi(argv[i + 1]);
+            if (io_thread_count < 1 || io_thread_count > IO_THREADS_MAX) {
+                fprintf(stderr, "--io-threads must be 1..%d\n",
+                        IO_THREADS_MAX);
+                return 1;
+            }
+            i++;
+        } else if (strcmp(argv[i], "--shards") == 0 && i + 1 < argc) {
+            nshards = atoi(argv[i + 1]);
+            if (nshards < 1 || nshards > SHARDS_MAX) {
+                fprintf(stderr, "--shards must be 1..%d\n", SHARDS_MAX);
+                return 1;
+            }
+            i++;
+        } else if (strcmp(argv[i], "--dbfilename") == 0 && i + 1 < argc) {
+            db_path = argv[i + 1];
+            i++;
+        } else if (strcmp(argv[i], "--appendonly") == 0 && i + 1 < argc) {
+            if (strcmp(argv[i + 1], "yes") != 0 &&
+                strcmp(argv[i + 1], "no") != 0) {
+                fprintf(stderr, "--appendonly must be yes or no\n");
+                return 1;
+            }
+            aof_on = strcmp(argv[i + 1], "yes") == 0;
+            i++;
+        } else if (strcmp(argv[i], "--appendfsync") == 0 && i + 1 < argc) {
+            if (!aof_fsync_parse(argv[i + 1], &aof_fsync)) {
+                fprintf(stderr, "--appendfsync must be always, everysec or "
+                        "no\n");
+                return 1;
+            }
+            i++;
+        } else if (strcmp(argv[i], "--appendfilename") == 0 && i + 1 < argc) {
+            aof_file = argv[i + 1];
+            i++;
+        } else if (strcmp(argv[i], "--replicaof") == 0 && i + 2 < argc) {
+            primary_host = argv[i + 1];
+            primary_port = atoi(argv[i + 2]);
+            if (primary_port < 1 || primary_port > 65535) {
+                fprintf(stderr, "--replicaof needs a host and a port\n");
+                return 1;
+            }
+            i += 2;
+        } else if (strcmp(argv[i], "--repl-backlog-size") == 0 &&
+                   i + 1 < argc) {
+            long long size = atoll(argv[i + 1]);
+            if (size < REPL_MIN_BACKLOG) {
+                fprintf(stderr, "--repl-backlog-size must be at least %d\n",
+                        REPL_MIN_BACKLOG);
+                return 1;
+            }
+            repl_backlog = (size_t)size;
+            i++;
+        } else if (strcmp(argv[i], "--maxclients") == 0 && i + 1 < argc) {
+            max_clients = atoi(argv[i + 1]);
+            if (max_clients < 1) {
+                fprintf(stderr, "--maxclients must be at least 1\n");
+                return 1;
+            }
+            i++;
+        } else if (strcmp(argv[i], "--slowlog-log-slower-than") == 0 &&
+                   i + 1 < argc) {
+            slowlog_slower_than = atoll(argv[i + 1]);
+            i++;
+        } else if (strcmp(argv[i], "--slowlog-max-len") == 0 &&
+                   i + 1 < argc) {
+            long long len = atoll(argv[i + 1]);
+            if (len < 0) {
+                fprintf(stderr, "--slowlog-max-len must not be negative\n");
+                return 1;
+            }
+            slowlog_max_len = (size_t)len;
+            i++;
+        } else if (strcmp(argv[i], "--maxmemory") == 0 && i + 1 < argc) {
+            long long bytes = atoll(argv[i + 1]);
+            if (bytes < 0) {
+                fprintf(stderr, "--maxmemory must not be negative\n");
+                return 1;
+            }
+            maxmemory = (size_t)bytes;
+            i++;
+        } else if (strcmp(argv[i], "--maxmemory-policy") == 0 &&
+                   i + 1 < argc) {
+            if (!evict_policy_parse(argv[i + 1], &maxmemory_policy)) {
+                fprintf(stderr, "--maxmemory-policy must be noeviction, "
+                        "allkeys-lru, allkeys-lfu or volatile-ttl\n");
+                return 1;
+            }
+            i++;
+        } else if ((strcmp(argv[i], "--client-output-buffer-limit") == 0 ||
+                    strcmp(argv[i], "--client-query-buffer-limit") == 0) &&
+                   i + 2 < argc) {
+            long long hard = atoll(argv[i + 1]);
+            long long soft = atoll(argv[i + 2]);
+            if (hard < 0 || soft < 0) {
+                fprintf(stderr, "%s needs a hard and a soft limit in bytes, "
+                        "0 for none\n", argv[i]);
+                return 1;
+            }
+            if (strcmp(argv[i], "--client-output-buffer-limit") == 0) {
+                client_limits_conf.output_hard = (size_t)hard;
+                client_limits_conf.output_soft = (size_t)soft;
+            } else {
+                client_limits_conf.query_hard = (size_t)hard;
+                client_limits_conf.query_soft = (size_t)soft;
+            }
+            i += 2;
+        } else if (strcmp(argv[i], "--unixsocket") == 0 && i + 1 < argc) {
+            unix_path = argv[i + 1];
+            i++;
+        } else if (strcmp(argv[i], "--unixsocketperm") == 0 &&
+                   i + 1 < argc) {
+            char *end;
+            long perm = strtol(argv[i + 1], &end, 8);
+            if (*end != '\0' || perm <= 0 || perm > 0777) {
+                fprintf(stderr, "--unixsocketperm must be octal, 1..777\n");
+                return 1;
+            }
+            unix_perm = (mode_t)perm;
+            i++;
+        } else if (strcmp(argv[i], "--tcp-backlog") == 0 && i + 1 < argc) {
+            listen_conf.backlog = atoi(argv[i + 1]);
+            if (listen_conf.backlog < 1) {
+                fprintf(stderr, "--tcp-backlog must be at least 1\n");
+                return 1;
+            }
+            i++;
+        } else if (strcmp(argv[i], "--tcp-nodelay") == 0 && i + 1 < argc) {
+            if (strcmp(argv[i + 1], "yes") != 0 &&
+                strcmp(argv[i + 1], "no") != 0) {
+                fprintf(stderr, "--tcp-nodelay must be yes or no\n");
+                return 1;
+            }
+            listen_conf.nodelay = strcmp(argv[i + 1], "yes") == 0;
+            i++;
+        } else if ((strcmp(argv[i], "--socket-rcvbuf") == 0 ||
+                    strcmp(argv[i], "--socket-sndbuf") == 0 ||
+                    strcmp(argv[i], "--busy-poll") == 0) && i + 1 < argc) {
+            int val = atoi(argv[i + 1]);
+            if (val < 0) {
+                fprintf(stderr, "%s must not be negative\n", argv[i]);
+                return 1;
+            }
+            if (strcmp(argv[i], "--socket-rcvbuf") == 0) {
+                listen_conf.rcvbuf = val;
+            } else if (strcmp(argv[i], "--socket-sndbuf") == 0) {
+                listen_conf.sndbuf = val;
+            } else {
+                listen_conf.busy_poll_us = val;
+            }
+            i++;
+        } else if (strcmp(argv[i], "--maxmemory-samples") == 0 &&
+                   i + 1 < argc) {
+            maxmemory_samples = atoi(argv[i + 1]);
+            if (maxmemory_samples < 1 ||
+                maxmemory_samples > EVICT_MAX_SAMPLES) {
+                fprintf(stderr, "--maxmemory-samples must be 1..%d\n",
+                        EVICT_MAX_SAMPLES);
+                return 1;
             }
+            i++;
+        }
+    }
+    if (nshards > 1 && io_thread_count > 1) {
+        fprintf(stderr, "--shards and --io-threads can't be combined\n");
+        return 1;
+    }
+    if (nshards > 1 && aof_on) {
+        fprintf(stderr, "--shards and --appendonly can't be combined\n");
+        return 1;
+    }
+    if (nshards > 1 && primary_host) {
+        fprintf(stderr, "--shards and --replicaof can't be combined\n");
+        return 1;
+    }
+
+    reserve_fds(nshards);
+    stats_slowlog_config(slowlog_slower_than, slowlog_max_len);
+    client_set_limits(&client_limits_conf);
+    evict_config(maxmemory, maxmemory_policy, maxmemory_samples, nshards);
+    stats_calibrate();
+    /* no thread can fork a consistent copy of every shard */
+    snapshot_set_path(nshards > 1 ? NULL : db_path);
+
+    /* Install signal handlers */
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = signal_handler;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    sa.sa_handler = sigchld_handler;
+    sigaction(SIGCHLD, &sa, NULL);
+
+    server_t *servers = calloc((size_t)nshards, sizeof(server_t));
+    if (!servers) {
+        perror("calloc");
+        exit(1);
+    }
+    shard_group_t *group = nshards > 1 ? shard_group_create(nshards) : NULL;
+    for (int i = 0; i < nshards; i++) {
+        server_open(&servers[i], port, backend, group != NULL);
+        servers[i].index = i;
+        servers[i].nshards = nshards;
+        if (group) {
+            servers[i].shard = shard_get(group, i);
+        }
+    }
+    /* local clients all land on shard 0, which routes their commands
+       like any other connection's */
+    if (unix_path) {
+        servers[0].unix_fd = start_unix_server(unix_path, unix_perm,
+                                               &listen_conf);
+        if (ev_add(servers[0].el, servers[0].unix_fd, EV_READABLE,
+                   UNIX_LISTENER_TOKEN) < 0) {
+            perror("ev_add");
+            exit(1);
         }
     }
+    /* a primary's stream is the one thread's writes, in order */
+    if (!group) {
+        repl_init(servers[0].el, REPL_TOKEN, repl_backlog);
+    }
+    stats_server_info_t info = {port, ev_backend_name(servers[0].el),
+                                io_thread_count, nshards, max_clients};
+    stats_set_server_info(&info);
+    if (group) {
+        fprintf(stderr, "Mini-Redis server listening on port %d (%s, %d "
+                "shards)\n", port, ev_backend_name(servers[0].el), nshards);
+    } else {
+        fprintf(stderr, "Mini-Redis server listening on port %d (%s, %d I/O "
+                "thread%s)\n", port, ev_backend_name(servers[0].el),
+                io_thread_count, io_thread_count == 1 ? "" : "s");
+    }
+    if (unix_path) {
+        fprintf(stderr, "Accepting connections at %s\n", unix_path);
+    }
+
+    /* I/O threads and shards 1..N-1 get signals blocked, leaving them
+       to this thread so that a signal interrupts its wait */
+    sigset_t block, saved;
+    sigemptyset(&block);
+    sigaddset(&block, SIGINT);
+    sigaddset(&block, SIGTERM);
+    sigaddset(&block, SIGCHLD);
+    pthread_sigmask(SIG_BLOCK, &block, &saved);
 
-    /* Cleanup */
-    for (int i = 0; i < MAX_CLIENTS; i++) {
-        if (clients[i].fd >= 0) {
-            client_close(&clients[i]);
+    lazyfree_start();
+    /* Threads only do socket I/O and parsing; commands always run here */
+    if (io_thread_count > 1) {
+        server_t *srv = &servers[0];
+        srv->io = io_threads_create(io_thread_count);
+    }
+    for (int i = 1; i < nshards; i++) {
+        int err = pthread_create(&servers[i].thread, NULL, serve, &servers[i]);
+        if (err != 0) {
+            fprintf(stderr, "pthread_create: error %d\n", err);
+            exit(1);
         }
     }
-    ht_destroy(store);
-    close(listen_fd);
+    pthread_sigmask(SIG_SETMASK, &saved, NULL);
+
+    serve(&servers[0]);
+    snapshot_bgsave_abort();
+    aof_close();
+
+    for (int i = 1; i < nshards; i++) {
+        shard_stop(servers[i].shard);
+        pthread_join(servers[i].thread, NULL);
+    }
+    shard_group_destroy(group);
+    free(servers);
+    lazyfree_stop();
 
     return 0;
 }
@@ -2,9 +2,32 @@
 #define SERVER_H
 
 #include <signal.h>
+#include <stdbool.h>
+#include <sys/types.h>
 
 extern volatile sig_atomic_t g_shutdown;
 
-int start_server(int port);
+/* Default for --tcp-backlog; the kernel caps it at net.core.somaxconn. */
+#define LISTEN_BACKLOG_DEFAULT 511
+
+/* How the listeners and the connections they accept are set up:
+   --tcp-backlog, --tcp-nodelay, --socket-rcvbuf, --socket-sndbuf and
+   --busy-poll. A buffer size or busy_poll_us of 0 leaves the kernel's
+   default. */
+typedef struct {
+    int backlog;
+    bool nodelay;
+    int rcvbuf;
+    int sndbuf;
+    int busy_poll_us;
+} listen_opts_t;
+
+/* A non-blocking TCP listener on every address. The buffer sizes and
+   busy polling are set on it, and accepted sockets inherit them. */
+int start_server(int port, bool reuse_port, const listen_opts_t *opts);
+/* A non-blocking listener on a Unix domain socket, replacing a stale
+   socket left at path. perm, when not 0, is chmod()ed onto it. */
+int start_unix_server(const char *path, mode_t perm,
+                      const listen_opts_t *opts);
 
 #endif
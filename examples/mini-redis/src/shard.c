@@ -0,0 +1,848 @@
+#include "shard.h"
+#include "commands.h"
+#include "hash.h"
+#include "util.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/* Commands one pipeline batch holds at most; the rest of the input is
+   parsed once the batch is answered. */
+#define SHARD_BATCH_MAX 1024
+
+/* A sub-command on its way to the owning shard (argc > 0), or its reply
+   on the way back (argc == 0). The arguments live in the same
+   allocation; the reply buffer is malloc'd by the executing shard. */
+typedef struct shard_msg {
+    struct shard_msg *next;
+    int from;               /* shard of the waiting client */
+    int to;                 /* shard executing the sub-command */
+    int slot;
+    int part;               /* index in the wait's parts */
+    uint32_t gen;
+    int argc;
+    resp_value_t *argv;
+    char *reply;
+    size_t reply_len;
+} shard_msg_t;
+
+/* How parts are combined into the client's reply. */
+typedef enum {
+    MERGE_PIPELINE,         /* one part per command, replies in order */
+    MERGE_SUM,              /* DEL, UNLINK, EXISTS: integers added up */
+    MERGE_OK,               /* MSET, FLUSHALL */
+    MERGE_MGET,             /* values put back in key order */
+    MERGE_KEYS,             /* arrays concatenated */
+    MERGE_LINES,            /* CLIENT LIST: bulk strings concatenated */
+    MERGE_SCAN              /* cursor rewritten to name the shard */
+} merge_t;
+
+/* The commands in flight for one client slot: either a pipeline batch
+   of commands that each run on one shard, or a single command split
+   over several (parts indexed by shard). */
+typedef struct {
+    uint32_t gen;           /* bumped when the slot's client closes */
+    int outstanding;        /* parts sent but not answered */
+    bool collecting;        /* batch open, not sent yet */
+    merge_t merge;
+    int scan_shard;
+    int nkeys;
+    uint8_t *key_shard;     /* MGET: owner of each key */
+    shard_msg_t **parts;    /* replied (or unsent) parts, NULL in flight */
+    int nparts;
+    int parts_cap;
+} shard_wait_t;
+
+struct shard {
+    shard_group_t *group;
+    int index;
+    hashtable_t *store;
+    client_t exec;          /* collects replies to sub-commands */
+    shard_wait_t *waits;    /* by client slot, grown as slots route */
+    int nwaits;
+
+    pthread_mutex_t lock;   /* guards inbox */
+    shard_msg_t *inbox_head;
+    shard_msg_t *inbox_tail;
+    int wake_fds[2];        /* a byte is written when the inbox fills */
+    atomic_bool stop;
+};
+
+struct shard_group {
+    int nshards;
+    uint64_t seed;
+    shard_t *shards;
+};
+
+static void set_nonblocking(int fd) {
+    int flags = fcntl(fd, F_GETFL, 0);
+    if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0) {
+        perror("fcntl");
+        exit(1);
+    }
+}
+
+shard_group_t *shard_group_create(int nshards) {
+    shard_group_t *g = calloc(1, sizeof(shard_group_t));
+    if (!g) {
+        perror("calloc");
+        exit(1);
+    }
+    g->nshards = nshards;
+    /* derived from, but independent of, the seed the stores hash with:
+       keys of one shard must still spread over its whole table */
+    g->seed = hash_bytes("shard", 5, hash_seed());
+    g->shards = calloc((size_t)nshards, sizeof(shard_t));
+    if (!g->shards) {
+        perror("calloc");
+        exit(1);
+    }
+
+    for (int i = 0; i < nshards; i++) {
+        shard_t *s = &g->shards[i];
+        s->group = g;
+        s->index = i;
+        client_init(&s->exec);
+        pthread_mutex_init(&s->lock, NULL);
+        if (pipe(s->wake_fds) < 0) {
+            perror("pipe");
+            exit(1);
+        }
+        set_nonblocking(s->wake_fds[0]);
+        set_nonblocking(s->wake_fds[1]);
+        atomic_init(&s->stop, false);
+    }
+    return g;
+}
+
+void shard_group_destroy(shard_group_t *g) {
+    if (!g) {
+        return;
+    }
+    for (int i = 0; i < g->nshards; i++) {
+        shard_t *s = &g->shards[i];
+        for (int slot = 0; slot < s->nwaits; slot++) {
+            shard_client_closed(s, slot);
+            free(s->waits[slot].parts);
+        }
+        free(s->waits);
+        /* messages posted to a shard after it stopped */
+        while (s->inbox_head) {
+            shard_msg_t *next = s->inbox_head->next;
+            free(s->inbox_head->reply);
+            free(s->inbox_head);
+            s->inbox_head = next;
+        }
+        client_close(&s->exec);
+        pthread_mutex_destroy(&s->lock);
+        close(s->wake_fds[0]);
+        close(s->wake_fds[1]);
+    }
+    free(g->shards);
+    free(g);
+}
+
+shard_t *shard_get(shard_group_t *g, int index) {
+    return &g->shards[index];
+}
+
+int shard_of(const shard_group_t *g, rstr_t key) {
+    uint64_t h = hash_bytes(key.data, key.len, g->seed);
+    return (int)(((h >> 32) * (uint64_t)g->nshards) >> 32);
+}
+
+bool shard_owns(const shard_t *s, rstr_t key) {
+    return shard_of(s->group, key) == s->index;
+}
+
+void shard_attach(shard_t *s, hashtable_t *store) {
+    s->store = store;
+}
+
+int shard_inbox_fd(const shard_t *s) {
+    return s->wake_fds[0];
+}
+
+static void wake(shard_t *s) {
+    /* EAGAIN: the pipe is full of wakeups already */
+    char byte = 1;
+    if (write(s->wake_fds[1], &byte, 1) < 0 &&
+        errno != EAGAIN && errno != EWOULDBLOCK) {
+        perror("write");
+    }
+}
+
+void shard_stop(shard_t *s) {
+    atomic_store(&s->stop, true);
+    wake(s);
+}
+
+bool shard_stopping(shard_t *s) {
+    return atomic_load(&s->stop);
+}
+
+/* Append the list head..tail to the inbox of `to`. */
+static void post(shard_t *to, shard_msg_t *head, shard_msg_t *tail) {
+    tail->next = NULL;
+    pthread_mutex_lock(&to->lock);
+    bool was_empty = to->inbox_head == NULL;
+    if (to->inbox_tail) {
+        to->inbox_tail->next = head;
+    } else {
+        to->inbox_head = head;
+    }
+    to->inbox_tail = tail;
+    pthread_mutex_unlock(&to->lock);
+    /* one wakeup per batch: the receiver takes the whole list */
+    if (was_empty) {
+        wake(to);
+    }
+}
+
+/* Messages bound for each shard, posted together. */
+typedef struct {
+    shard_msg_t *head[SHARDS_MAX];
+    shard_msg_t *tail[SHARDS_MAX];
+} outbox_t;
+
+static void outbox_add(outbox_t *out, int to, shard_msg_t *m) {
+    m->next = NULL;
+    if (out->tail[to]) {
+        out->tail[to]->next = m;
+    } else {
+        out->head[to] = m;
+    }
+    out->tail[to] = m;
+}
+
+static void outbox_send(outbox_t *out, shard_group_t *g) {
+    for (int t = 0; t < g->nshards; t++) {
+        if (out->head[t]) {
+            post(&g->shards[t], out->head[t], out->tail[t]);
+        }
+    }
+}
+
+/* Copy argv[0..argc) into a request message. */
+static shard_msg_t *msg_request(const rstr_t *argv, int argc) {
+    size_t bytes = 0;
+    for (int i = 0; i < argc; i++) {
+        bytes += argv[i].len;
+    }
+    shard_msg_t *m = malloc(sizeof(shard_msg_t) +
+                            (size_t)argc * sizeof(resp_value_t) + bytes);
+    if (!m) {
+        perror("malloc");
+        exit(1);
+    }
+    m->argc = argc;
+    m->argv = (resp_value_t *)(m + 1);
+    m->reply = NULL;
+    m->reply_len = 0;
+
+    char *p = (char *)(m->argv + argc);
+    for (int i = 0; i < argc; i++) {
+        m->argv[i].type = RESP_BULK_STRING;
+        m->argv[i].str.data = p;
+        m->argv[i].str.len = argv[i].len;
+        if (argv[i].len) {
+            memcpy(p, argv[i].data, argv[i].len);
+        }
+        p += argv[i].len;
+    }
+    return m;
+}
+
+static void free_msg(shard_msg_t *m) {
+    free(m->reply);
+    free(m);
+}
+
+/* Run a request against this shard's store; it becomes its reply. */
+static void execute(shard_t *s, shard_msg_t *m) {
+    resp_value_t cmd;
+    cmd.type = RESP_ARRAY;
+    cmd.array.elements = m->argv;
+    cmd.array.count = m->argc;
+    dispatch_command(&s->exec, s->store, &cmd);
+    arena_reset(&s->exec.req_arena);
+    m->reply = client_take_output(&s->exec, &m->reply_len);
+    m->argc = 0;
+}
+
+/* Make room for n parts, all NULL beyond the current ones. */
+static void reserve_parts(shard_wait_t *w, int n) {
+    if (n <= w->parts_cap) {
+        return;
+    }
+    int cap = w->parts_cap ? w->parts_cap : 8;
+    while (cap < n) {
+        cap *= 2;
+    }
+    shard_msg_t **parts = realloc(w->parts, (size_t)cap * sizeof(*parts));
+    if (!parts) {
+        perror("realloc");
+        exit(1);
+    }
+    memset(parts + w->parts_cap, 0,
+           (size_t)(cap - w->parts_cap) * sizeof(*parts));
+    w->parts = parts;
+    w->parts_cap = cap;
+}
+
+static shard_msg_t *new_part(shard_t *s, shard_wait_t *w, int slot, int to,
+                             const rstr_t *argv, int argc) {
+    shard_msg_t *m = msg_request(argv, argc);
+    m->from = s->index;
+    m->to = to;
+    m->slot = slot;
+    m->gen = w->gen;
+    return m;
+}
+
+/* Send part `part` of the client's command to shard `to`, or run it
+   right away when that is this shard. */
+static void send_part(shard_t *s, shard_wait_t *w, int slot, int part,
+                      int to, const rstr_t *argv, int argc) {
+    shard_msg_t *m = new_part(s, w, slot, to, argv, argc);
+    m->part = part;
+    if (to == s->index) {
+        execute(s, m);
+        w->parts[part] = m;
+        return;
+    }
+    w->outstanding++;
+    post(&s->group->shards[to], m, m);
+}
+
+/* ---- merging replies ---- */
+
+/* The integer after a reply's type byte; *hdr gets the length of the
+   line including CRLF. Replies come from this server, so they are well
+   formed. */
+static int64_t reply_number(const char *p, size_t *hdr) {
+    size_t i = 1;
+    bool negative = p[i] == '-';
+    if (negative) {
+        i++;
+    }
+    int64_t v = 0;
+    while (p[i] != '\r') {
+        v = v * 10 + (p[i] - '0');
+        i++;
+    }
+    *hdr = i + 2;
+    return negative ? -v : v;
+}
+
+/* Length of the bulk (or null bulk) reply at p. */
+static size_t bulk_reply_len(const char *p) {
+    size_t hdr;
+    int64_t n = reply_number(p, &hdr);
+    return n < 0 ? hdr : hdr + (size_t)n + 2;
+}
+
+/* Combine the parts of a split command. */
+static void merge_split(shard_t *s, shard_wait_t *w, client_t *c) {
+    int n = s->group->nshards;
+    shard_msg_t **parts = w->parts;
+
+    for (int t = 0; t < n; t++) {
+        if (parts[t] && parts[t]->reply_len > 0 && parts[t]->reply[0] == '-') {
+            /* the first error stands for the whole command */
+            client_write_append(c, parts[t]->reply, parts[t]->reply_len);
+            return;
+        }
+    }
+
+    switch (w->merge) {
+    case MERGE_PIPELINE:
+        break;
+    case MERGE_SUM: {
+        int64_t sum = 0;
+        size_t hdr;
+        for (int t = 0; t < n; t++) {
+            if (parts[t]) {
+                sum += reply_number(parts[t]->reply, &hdr);
+            }
+        }
+        resp_write_integer(c, sum);
+        break;
+    }
+    case MERGE_OK:
+        resp_write_shared(c, RESP_SHARED_OK);
+        break;
+    case MERGE_KEYS: {
+        int64_t total = 0;
+        size_t hdr;
+        for (int t = 0; t < n; t++) {
+            if (parts[t]) {
+                total += reply_number(parts[t]->reply, &hdr);
+            }
+        }
+        resp_write_array_header(c, (int)total);
+        for (int t = 0; t < n; t++) {
+            if (parts[t]) {
+                reply_number(parts[t]->reply, &hdr);
+                client_write_append(c, parts[t]->reply + hdr,
+                                    parts[t]->reply_len - hdr);
+            }
+        }
+        break;
+    }
+    case MERGE_LINES: {
+        size_t total = 0;
+        size_t hdr;
+        for (int t = 0; t < n; t++) {
+            if (parts[t]) {
+                total += (size_t)reply_number(parts[t]->reply, &hdr);
+            }
+        }
+        char head[32];
+        client_write_append(c, head, (size_t)snprintf(head, sizeof(head),
+                                                      "$%zu\r\n", total));
+        for (int t = 0; t < n; t++) {
+            if (parts[t]) {
+                reply_number(parts[t]->reply, &hdr);
+                client_write_append(c, parts[t]->reply + hdr,
+                                    parts[t]->reply_len - hdr - 2);
+            }
+        }
+        client_write_append(c, "\r\n", 2);
+        break;
+    }
+    case MERGE_MGET: {
+        /* each part holds its shard's values in key order */
+        size_t pos[SHARDS_MAX];
+        for (int t = 0; t < n; t++) {
+            if (parts[t]) {
+                reply_number(parts[t]->reply, &pos[t]);
+            }
+        }
+        resp_write_array_header(c, w->nkeys);
+        for (int i = 0; i < w->nkeys; i++) {
+            int t = w->key_shard[i];
+            const char *elem = parts[t]->reply + pos[t];
+            size_t len = bulk_reply_len(elem);
+            client_write_append(c, elem, len);
+            pos[t] += len;
+        }
+        break;
+    }
+    case MERGE_SCAN: {
+        /* [cursor, keys] with the shard's own cursor; see route_scan() */
+        int t = w->scan_shard;
+        const char *r = parts[t]->reply;
+        size_t hdr, cur_hdr;
+        reply_number(r, &hdr);
+        int64_t cur_len = reply_number(r + hdr, &cur_hdr);
+        const char *digits = r + hdr + cur_hdr;
+        uint64_t inner = 0;
+        for (int64_t i = 0; i < cur_len; i++) {
+            inner = inner * 10 + (uint64_t)(digits[i] - '0');
+        }
+        uint64_t next;
+        if (inner != 0) {
+            next = inner * (uint64_t)n + (uint64_t)t;
+        } else {
+            next = t + 1 < n ? (uint64_t)t + 1 : 0;
+        }
+        char buf[24];
+        size_t rest = hdr + cur_hdr + (size_t)cur_len + 2;
+        resp_write_array_header(c, 2);
+        resp_write_bulk_string(c, buf, u64_to_str(buf, next));
+        client_write_append(c, r + rest, parts[t]->reply_len - rest);
+        break;
+    }
+    }
+}
+
+static void free_parts(shard_wait_t *w) {
+    for (int i = 0; i < w->nparts; i++) {
+        if (w->parts[i]) {
+            free_msg(w->parts[i]);
+            w->parts[i] = NULL;
+        }
+    }
+    w->nparts = 0;
+    free(w->key_shard);
+    w->key_shard = NULL;
+}
+
+static void merge(shard_t *s, shard_wait_t *w, client_t *c) {
+    if (w->merge == MERGE_PIPELINE) {
+        for (int i = 0; i < w->nparts; i++) {
+            client_write_append(c, w->parts[i]->reply, w->parts[i]->reply_len);
+        }
+    } else {
+        merge_split(s, w, c);
+    }
+    free_parts(w);
+}
+
+/* ---- routing ---- */
+
+/* Whether args[first], args[first + stride], ... are all owned by one
+   shard; *t is set to it. */
+static bool keys_on_one_shard(const shard_t *s, const resp_value_t *args,
+                              int argc, int first, int stride, int *t) {
+    *t = shard_of(s->group, args[first].str);
+    for (int i = first + stride; i < argc; i += stride) {
+        if (shard_of(s->group, args[i].str) != *t) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/* The one shard a valid command runs on, or -1 if it needs several.
+   Commands without keys run where the client is. */
+static int command_shard(const shard_t *s, const resp_value_t *args, int argc,
+                         cmd_id_t id) {
+    int t = s->index;
+    switch (id) {
+    case CMD_SET:
+    case CMD_GET:
+    case CMD_EXPIRE:
+    case CMD_PEXPIREAT:
+    case CMD_TTL:
+    case CMD_TYPE:
+    case CMD_INCR:
+    case CMD_DECR:
+    case CMD_INCRBY:
+    case CMD_DECRBY:
+        return shard_of(s->group, args[1].str);
+    case CMD_DEL:
+    case CMD_UNLINK:
+    case CMD_EXISTS:
+    case CMD_MGET:
+        return keys_on_one_shard(s, args, argc, 1, 1, &t) ? t : -1;
+    case CMD_MSET:
+    case CMD_MSETNX:
+        if ((argc - 1) % 2 != 0) {
+            return s->index; /* dispatch_command() reports it */
+        }
+        return keys_on_one_shard(s, args, argc, 1, 2, &t) ? t : -1;
+    case CMD_KEYS:
+    case CMD_SCAN:
+    case CMD_FLUSHALL:
+    case CMD_FLUSHDB:
+    case CMD_CLIENT:
+        return s->group->nshards == 1 ? s->index : -1;
+    default:
+        return s->index;
+    }
+}
+
+/* Queue cmd, which runs on shard t alone, as the next part of the
+   client's batch. Local parts run right away; their replies wait for
+   the ones before them. */
+static void batch_add(shard_t *s, client_t *c, shard_wait_t *w, int slot,
+                      int t, const resp_value_t *args, int argc) {
+    if (!w->collecting) {
+        w->collecting = true;
+        w->merge = MERGE_PIPELINE;
+        w->nparts = 0;
+    }
+    rstr_t *argv = arena_alloc(&c->req_arena,
+                               (size_t)argc * sizeof(rstr_t));
+    for (int i = 0; i < argc; i++) {
+        argv[i] = args[i].str;
+    }
+    reserve_parts(w, w->nparts + 1);
+    shard_msg_t *m = new_part(s, w, slot, t, argv, argc);
+    m->part = w->nparts;
+    if (t == s->index) {
+        execute(s, m);
+    }
+    w->parts[w->nparts++] = m;
+}
+
+/* Split the keys args[1], args[1 + stride], ... (each followed by
+   stride - 1 values) by owner and send every shard its part. */
+static void route_split(shard_t *s, client_t *c, int slot, resp_value_t *args,
+                        int argc, int stride, merge_t how) {
+    int n = s->group->nshards;
+    int nkeys = (argc - 1) / stride;
+    uint8_t *owner = arena_alloc(&c->req_arena, (size_t)nkeys);
+    int count[SHARDS_MAX] = {0};
+    for (int i = 0; i < nkeys; i++) {
+        owner[i] = (uint8_t)shard_of(s->group, args[1 + i * stride].str);
+        count[owner[i]]++;
+    }
+
+    shard_wait_t *w = &s->waits[slot];
+    w->merge = how;
+    if (how == MERGE_MGET) {
+        w->nkeys = nkeys;
+        w->key_shard = malloc((size_t)nkeys);
+        if (!w->key_shard) {
+            perror("malloc");
+            exit(1);
+        }
+        memcpy(w->key_shard, owner, (size_t)nkeys);
+    }
+
+    rstr_t *argv = arena_alloc(&c->req_arena,
+                               (size_t)argc * sizeof(rstr_t));
+    argv[0] = args[0].str;
+    for (int t = 0; t < n; t++) {
+        if (count[t] == 0) {
+            continue;
+        }
+        int part_argc = 1;
+        for (int i = 0; i < nkeys; i++) {
+            if (owner[i] != t) {
+                continue;
+            }
+            for (int k = 0; k < stride; k++) {
+                argv[part_argc++] = args[1 + i * stride + k].str;
+            }
+        }
+        send_part(s, w, slot, t, t, argv, part_argc);
+    }
+}
+
+/* KEYS, FLUSHALL and CLIENT LIST run on every shard. */
+static void route_all(shard_t *s, client_t *c, int slot, resp_value_t *args,
+                      int argc, merge_t how) {
+    rstr_t *argv = arena_alloc(&c->req_arena,
+                               (size_t)argc * sizeof(rstr_t));
+    for (int i = 0; i < argc; i++) {
+        argv[i] = args[i].str;
+    }
+    shard_wait_t *w = &s->waits[slot];
+    w->merge = how;
+    for (int t = 0; t < s->group->nshards; t++) {
+        send_part(s, w, slot, t, t, argv, argc);
+    }
+}
+
+/* A sharded SCAN cursor is inner * nshards + shard: shards are walked
+   one after the other, each with its own store's cursor, and moving on
+   to the next shard's start gives a cursor that is just its index.
+   Returns false for a malformed cursor. */
+static bool route_scan(shard_t *s, client_t *c, int slot, resp_value_t *args,
+                       int argc) {
+    rstr_t cur = args[1].str;
+    if (cur.len == 0 || cur.len > 19) {
+        return false;
+    }
+    uint64_t v = 0;
+    for (size_t i = 0; i < cur.len; i++) {
+        unsigned digit = (unsigned)(cur.data[i] - '0');
+        if (digit > 9) {
+            return false;
+        }
+        v = v * 10 + digit;
+    }
+    int n = s->group->nshards;
+    int t = (int)(v % (uint64_t)n);
+
+    char *inner = arena_alloc(&c->req_arena, 24);
+    rstr_t *argv = arena_alloc(&c->req_arena,
+                               (size_t)argc * sizeof(rstr_t));
+    for (int i = 0; i < argc; i++) {
+        argv[i] = args[i].str;
+    }
+    argv[1].data = inner;
+    argv[1].len = u64_to_str(inner, v / (uint64_t)n);
+
+    shard_wait_t *w = &s->waits[slot];
+    w->merge = MERGE_SCAN;
+    w->scan_shard = t;
+    send_part(s, w, slot, t, t, argv, argc);
+    return true;
+}
+
+/* The wait of a slot about to route, allocated on first use. */
+static shard_wait_t *wait_for(shard_t *s, int slot) {
+    if (slot >= s->nwaits) {
+        int n = s->nwaits ? s->nwaits : 64;
+        while (n <= slot) {
+            n *= 2;
+        }
+        shard_wait_t *waits = realloc(s->waits, (size_t)n * sizeof(*waits));
+        if (!waits) {
+            perror("realloc");
+            exit(1);
+        }
+        memset(waits + s->nwaits, 0,
+               (size_t)(n - s->nwaits) * sizeof(*waits));
+        s->waits = waits;
+        s->nwaits = n;
+    }
+    return &s->waits[slot];
+}
+
+static bool plain_command(const resp_value_t *cmd) {
+    if (cmd->type != RESP_ARRAY || cmd->array.count == 0) {
+        return false;
+    }
+    for (int i = 0; i < cmd->array.count; i++) {
+        if (cmd->array.elements[i].type != RESP_BULK_STRING) {
+            return false;
+        }
+    }
+    return true;
+}
+
+shard_route_t shard_route(shard_t *s, client_t *c, int slot,
+                          resp_value_t *cmd) {
+    shard_wait_t *w = wait_for(s, slot);
+    if (!plain_command(cmd)) {
+        return w->collecting ? SHARD_DEFER : SHARD_LOCAL;
+    }
+    resp_value_t *args = cmd->array.elements;
+    int argc = cmd->array.count;
+    cmd_id_t id = command_lookup(args[0].str.data, args[0].str.len);
+    /* invalid commands are left to dispatch_command() */
+    int t = s->index;
+    if (id != CMD_UNKNOWN && command_arity_ok(id, argc)) {
+        t = command_shard(s, args, argc, id);
+    }
+
+    if (t >= 0) {
+        if (t == s->index && !w->collecting) {
+            return SHARD_LOCAL;
+        }
+        if (w->nparts == SHARD_BATCH_MAX) {
+            return SHARD_DEFER;
+        }
+        batch_add(s, c, w, slot, t, args, argc);
+        return SHARD_TAKEN;
+    }
+    if (w->collecting) {
+        return SHARD_DEFER;
+    }
+
+    w->nparts = s->group->nshards;
+    reserve_parts(w, w->nparts);
+    switch (id) {
+    case CMD_DEL:
+    case CMD_UNLINK:
+    case CMD_EXISTS:
+        route_split(s, c, slot, args, argc, 1, MERGE_SUM);
+        break;
+    case CMD_MGET:
+        route_split(s, c, slot, args, argc, 1, MERGE_MGET);
+        break;
+    case CMD_MSET:
+        route_split(s, c, slot, args, argc, 2, MERGE_OK);
+        break;
+    case CMD_MSETNX:
+        /* all-or-nothing needs every key on one shard */
+        w->nparts = 0;
+        resp_write_error(c, "CROSSSLOT Keys in request don't hash "
+                         "to the same shard");
+        return SHARD_TAKEN;
+    case CMD_KEYS:
+        route_all(s, c, slot, args, argc, MERGE_KEYS);
+        break;
+    case CMD_FLUSHALL:
+    case CMD_FLUSHDB:
+        route_all(s, c, slot, args, argc, MERGE_OK);
+        break;
+    case CMD_CLIENT:
+        route_all(s, c, slot, args, argc, MERGE_LINES);
+        break;
+    default: /* CMD_SCAN */
+        if (!route_scan(s, c, slot, args, argc)) {
+            w->nparts = 0;
+            resp_write_error(c, "ERR invalid cursor");
+            return SHARD_TAKEN;
+        }
+        break;
+    }
+
+    /* every part was local */
+    if (w->outstanding == 0) {
+        merge(s, w, c);
+    }
+    return SHARD_TAKEN;
+}
+
+void shard_flush(shard_t *s, client_t *c, int slot) {
+    if (slot >= s->nwaits) {
+        return;
+    }
+    shard_wait_t *w = &s->waits[slot];
+    if (!w->collecting) {
+        return;
+    }
+    w->collecting = false;
+    outbox_t out = {{NULL}, {NULL}};
+    for (int i = 0; i < w->nparts; i++) {
+        shard_msg_t *m = w->parts[i];
+        if (m->argc > 0) {
+            /* owned by the inbox from here on */
+            w->parts[i] = NULL;
+            w->outstanding++;
+            outbox_add(&out, m->to, m);
+        }
+    }
+    outbox_send(&out, s->group);
+    if (w->outstanding == 0) {
+        merge(s, w, c);
+    }
+}
+
+bool shard_client_waiting(const shard_t *s, int slot) {
+    return slot < s->nwaits && s->waits[slot].outstanding > 0;
+}
+
+void shard_client_closed(shard_t *s, int slot) {
+    if (slot >= s->nwaits) {
+        return;
+    }
+    shard_wait_t *w = &s->waits[slot];
+    w->gen++;
+    w->outstanding = 0;
+    w->collecting = false;
+    free_parts(w);
+}
+
+int shard_poll(shard_t *s, const client_table_t *clients, int *resumed) {
+    char drain[64];
+    while (read(s->wake_fds[0], drain, sizeof(drain)) > 0) {
+    }
+
+    pthread_mutex_lock(&s->lock);
+    shard_msg_t *m = s->inbox_head;
+    s->inbox_head = NULL;
+    s->inbox_tail = NULL;
+    pthread_mutex_unlock(&s->lock);
+
+    /* replies go back one list per shard */
+    outbox_t out = {{NULL}, {NULL}};
+    int count = 0;
+    while (m) {
+        shard_msg_t *next = m->next;
+        if (m->argc > 0) {
+            execute(s, m);
+            outbox_add(&out, m->from, m);
+        } else {
+            shard_wait_t *w = &s->waits[m->slot];
+            if (m->gen != w->gen || w->outstanding == 0) {
+                /* the client went away meanwhile */
+                free_msg(m);
+            } else {
+                int slot = m->slot;
+                w->parts[m->part] = m;
+                if (--w->outstanding == 0) {
+                    merge(s, w, client_table_get(clients, slot));
+                    resumed[count++] = slot;
+                }
+            }
+        }
+        m = next;
+    }
+    outbox_send(&out, s->group);
+    return count;
+}
@@ -0,0 +1,67 @@
+#ifndef SHARD_H
+#define SHARD_H
+
+#include "client.h"
+#include "hashtable.h"
+#include "resp.h"
+#include <stdbool.h>
+
+#define SHARDS_MAX 64
+
+/* Shared-nothing sharding (--shards N). Each shard is a thread with its
+   own event loop, listener and store, and owns the keys shard_of() maps
+   to it; nothing in a store is touched by another thread. A command on
+   keys owned elsewhere is sent to the owner as a sub-command through its
+   inbox, and the replies are merged on the shard the client is
+   connected to. Pipelined commands that each run on one shard are sent
+   as one batch, so a pipeline costs one round trip rather than one per
+   command. A client with commands in flight is not parsed any further
+   until the replies are in, so its replies stay in order. */
+typedef struct shard_group shard_group_t;
+typedef struct shard shard_t;
+
+shard_group_t *shard_group_create(int nshards);
+/* Once every shard thread has stopped. */
+void shard_group_destroy(shard_group_t *g);
+shard_t *shard_get(shard_group_t *g, int index);
+int shard_of(const shard_group_t *g, rstr_t key);
+/* Whether key is one of this shard's (snapshot loading). */
+bool shard_owns(const shard_t *s, rstr_t key);
+
+/* The store sub-commands sent to this shard run against. Called from
+   the shard's own thread before it polls. */
+void shard_attach(shard_t *s, hashtable_t *store);
+/* Readable when messages are waiting; register it with the shard's
+   event loop. */
+int shard_inbox_fd(const shard_t *s);
+/* Ask the shard's loop to exit, and wake it. */
+void shard_stop(shard_t *s);
+bool shard_stopping(shard_t *s);
+
+typedef enum {
+    SHARD_LOCAL,            /* dispatch cmd here, now */
+    SHARD_TAKEN,            /* answered, or part of the client's batch */
+    SHARD_DEFER             /* un-parse cmd and retry after the batch */
+} shard_route_t;
+
+/* Route cmd for client `slot` of this shard. Commands with keys owned
+   elsewhere, and any command after one of those in the same pipeline,
+   join the client's batch; commands spanning shards are sent at once.
+   SHARD_DEFER is only returned while a batch is open: cmd spans shards
+   and must wait until the batch is answered. shard_client_waiting()
+   holds until shard_poll() hands the client back. */
+shard_route_t shard_route(shard_t *s, client_t *c, int slot,
+                          resp_value_t *cmd);
+/* Send the client's batch; call once its buffered input is routed. */
+void shard_flush(shard_t *s, client_t *c, int slot);
+bool shard_client_waiting(const shard_t *s, int slot);
+/* Forget a closed client's commands in flight; late replies are dropped. */
+void shard_client_closed(shard_t *s, int slot);
+
+/* Drain the inbox: execute sub-commands sent here and merge replies
+   into the output of this shard's clients. The slots whose commands
+   completed are stored in resumed[], which has room for one per slot
+   in use; returns how many. */
+int shard_poll(shard_t *s, const client_table_t *clients, int *resumed);
+
+#endif
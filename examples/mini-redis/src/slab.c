@@ -0,0 +1,266 @@
+#include "slab.h"
+#include "lazyfree.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <sys/mman.h>
+
+/* Page layout: header, padding to SLAB_PAGE_HDR, then objects. Pages are
+   aligned to SLAB_PAGE_SIZE so an object's page is found by masking. */
+#define SLAB_PAGE_HDR 64
+
+/* Fully free pages kept mapped per class, to absorb alloc/free flapping
+   at a page boundary. */
+#define SLAB_KEEP_EMPTY 1
+
+typedef struct slab_page {
+    struct slab_page *next;     /* in the class's partial list */
+    struct slab_page *prev;
+    struct slab_page *all_next; /* in the class's list of every page */
+    struct slab_page *all_prev;
+    void *free_list;            /* freed objects, linked through their
+                                   first word */
+    uint32_t used;
+    uint32_t fresh;             /* objects never handed out start here */
+    uint32_t capacity;
+    uint32_t class_id;
+} slab_page_t;
+
+typedef struct {
+    slab_page_t *partial;       /* pages with at least one free object */
+    slab_page_t *all;           /* every page, for slab_release_thread() */
+    size_t pages;
+    size_t used;
+    size_t empty_pages;
+} slab_class_t;
+
+static const uint32_t class_sizes[SLAB_NUM_CLASSES] = {
+    16, 32, 48, 64, 80, 96, 112, 128,
+    160, 192, 224, 256,
+    320, 384, 448, 512,
+    640, 768, 896, 1024,
+    1280, 1536, 1792, 2048,
+    2560, 3072, 3584, 4096
+};
+
+/* Per thread: each shard allocates and frees its own store's memory. */
+static _Thread_local slab_class_t classes[SLAB_NUM_CLASSES];
+static _Thread_local size_t stat_requested;
+static _Thread_local size_t stat_allocated;
+static _Thread_local size_t stat_large_count;
+static _Thread_local size_t stat_large_bytes;
+
+/* Inverse of class_sizes: 16-byte steps up to 128, then each power of
+   two is split into quarters. */
+static int size_class(size_t size) {
+    if (size <= 128) {
+        return size == 0 ? 0 : (int)((size + 15) / 16) - 1;
+    }
+    unsigned b = 63 - (unsigned)__builtin_clzll((unsigned long long)(size - 1));
+    size_t quarter = ((size - 1) >> (b - 2)) & 3;
+    return 8 + (int)(b - 7) * 4 + (int)quarter;
+}
+
+static slab_page_t *page_of(void *ptr) {
+    return (slab_page_t *)((uintptr_t)ptr & ~(uintptr_t)(SLAB_PAGE_SIZE - 1));
+}
+
+/* mmap keeps page memory out of the malloc heap, so unmapping an empty
+   page really returns it to the OS. Over-map, then trim to alignment. */
+static slab_page_t *page_map(void) {
+    size_t span = 2 * (size_t)SLAB_PAGE_SIZE;
+    char *raw = mmap(NULL, span, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (raw == MAP_FAILED) {
+        perror("mmap");
+        exit(1);
+    }
+    uintptr_t start = ((uintptr_t)raw + SLAB_PAGE_SIZE - 1) &
+                      ~(uintptr_t)(SLAB_PAGE_SIZE - 1);
+    size_t head = start - (uintptr_t)raw;
+    if (head > 0) {
+        munmap(raw, head);
+    }
+    size_t tail = span - head - SLAB_PAGE_SIZE;
+    if (tail > 0) {
+        munmap((char *)start + SLAB_PAGE_SIZE, tail);
+    }
+    return (slab_page_t *)start;
+}
+
+static void partial_push(slab_class_t *cls, slab_page_t *page) {
+    page->prev = NULL;
+    page->next = cls->partial;
+    if (cls->partial) {
+        cls->partial->prev = page;
+    }
+    cls->partial = page;
+}
+
+static void partial_remove(slab_class_t *cls, slab_page_t *page) {
+    if (page->prev) {
+        page->prev->next = page->next;
+    } else {
+        cls->partial = page->next;
+    }
+    if (page->next) {
+        page->next->prev = page->prev;
+    }
+}
+
+static void page_unmap(slab_class_t *cls, slab_page_t *page) {
+    if (page->all_prev) {
+        page->all_prev->all_next = page->all_next;
+    } else {
+        cls->all = page->all_next;
+    }
+    if (page->all_next) {
+        page->all_next->all_prev = page->all_prev;
+    }
+    cls->pages--;
+    munmap(page, SLAB_PAGE_SIZE);
+}
+
+static slab_page_t *page_new(int class_id) {
+    slab_page_t *page = page_map();
+    page->next = page->prev = NULL;
+    page->free_list = NULL;
+    page->used = 0;
+    page->fresh = 0;
+    page->capacity = (SLAB_PAGE_SIZE - SLAB_PAGE_HDR) / class_sizes[class_id];
+    page->class_id = (uint32_t)class_id;
+    page->all_prev = NULL;
+    page->all_next = classes[class_id].all;
+    if (page->all_next) {
+        page->all_next->all_prev = page;
+    }
+    classes[class_id].all = page;
+    classes[class_id].pages++;
+    classes[class_id].empty_pages++;
+    partial_push(&classes[class_id], page);
+    return page;
+}
+
+void *slab_alloc(size_t size) {
+    if (size > SLAB_MAX_SIZE) {
+        void *p = malloc(size);
+        if (!p) {
+            perror("malloc");
+            exit(1);
+        }
+        stat_large_count++;
+        stat_large_bytes += size;
+        return p;
+    }
+
+    int class_id = size_class(size);
+    slab_class_t *cls = &classes[class_id];
+    slab_page_t *page = cls->partial ? cls->partial : page_new(class_id);
+
+    void *obj;
+    if (page->free_list) {
+        obj = page->free_list;
+        memcpy(&page->free_list, obj, sizeof(void *));
+    } else {
+        /* carve lazily so untouched objects never become resident */
+        obj = (char *)page + SLAB_PAGE_HDR +
+              (size_t)page->fresh * class_sizes[class_id];
+        page->fresh++;
+    }
+    if (page->used++ == 0) {
+        cls->empty_pages--;
+    }
+    if (page->used == page->capacity) {
+        partial_remove(cls, page);
+    }
+
+    cls->used++;
+    stat_requested += size;
+    stat_allocated += class_sizes[class_id];
+    return obj;
+}
+
+void slab_free(void *ptr, size_t size) {
+    if (!ptr) {
+        return;
+    }
+    if (size > SLAB_MAX_SIZE) {
+        free(ptr);
+        stat_large_count--;
+        stat_large_bytes -= size;
+        return;
+    }
+
+    slab_page_t *page = page_of(ptr);
+    slab_class_t *cls = &classes[page->class_id];
+
+    memcpy(ptr, &page->free_list, sizeof(void *));
+    page->free_list = ptr;
+    if (page->used-- == page->capacity) {
+        partial_push(cls, page);
+    }
+    cls->used--;
+    stat_requested -= size;
+    stat_allocated -= class_sizes[page->class_id];
+
+    if (page->used == 0) {
+        if (cls->empty_pages >= SLAB_KEEP_EMPTY) {
+            partial_remove(cls, page);
+            page_unmap(cls, page);
+        } else {
+            cls->empty_pages++;
+        }
+    }
+}
+
+void slab_free_lazy(void *ptr, size_t size) {
+    if (!ptr || size <= SLAB_MAX_SIZE) {
+        slab_free(ptr, size);
+        return;
+    }
+    stat_large_count--;
+    stat_large_bytes -= size;
+    lazyfree_free(ptr);
+}
+
+void slab_release_thread(void) {
+    for (int i = 0; i < SLAB_NUM_CLASSES; i++) {
+        slab_class_t *cls = &classes[i];
+        while (cls->all) {
+            page_unmap(cls, cls->all);
+        }
+        memset(cls, 0, sizeof(*cls));
+    }
+    stat_requested = 0;
+    stat_allocated = 0;
+}
+
+size_t slab_good_size(size_t size) {
+    if (size > SLAB_MAX_SIZE) {
+        return size;
+    }
+    return class_sizes[size_class(size)];
+}
+
+void slab_get_stats(slab_stats_t *out) {
+    memset(out, 0, sizeof(*out));
+    for (int i = 0; i < SLAB_NUM_CLASSES; i++) {
+        slab_class_stats_t *cs = &out->classes[i];
+        size_t per_page = (SLAB_PAGE_SIZE - SLAB_PAGE_HDR) / class_sizes[i];
+        cs->size = class_sizes[i];
+        cs->pages = classes[i].pages;
+        cs->used = classes[i].used;
+        cs->free = classes[i].pages * per_page - classes[i].used;
+        out->pages += classes[i].pages;
+    }
+    out->requested = stat_requested;
+    out->allocated = stat_allocated;
+    out->reserved = out->pages * SLAB_PAGE_SIZE;
+    out->large_count = stat_large_count;
+    out->large_bytes = stat_large_bytes;
+}
+
+size_t slab_used_bytes(void) {
+    return stat_allocated + stat_large_bytes;
+}
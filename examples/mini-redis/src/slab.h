@@ -0,0 +1,52 @@
+#ifndef SLAB_H
+#define SLAB_H
+
+#include <stddef.h>
+
+/* Size-class allocator for stored data. Requests up to SLAB_MAX_SIZE are
+   rounded to one of SLAB_NUM_CLASSES sizes (16-byte steps to 128, then
+   four per power of two) and carved out of SLAB_PAGE_SIZE pages that
+   hold a single class, so churn reuses same-sized holes instead of
+   fragmenting the heap. Pages that empty out are unmapped. Larger
+   requests go to malloc. Each thread has its own pages and stats, so
+   memory must be freed by the thread that allocated it. */
+#define SLAB_PAGE_SIZE   (64 * 1024)
+#define SLAB_MAX_SIZE    4096
+#define SLAB_NUM_CLASSES 28
+
+/* size must be passed unchanged to slab_free(). */
+void *slab_alloc(size_t size);
+void slab_free(void *ptr, size_t size);
+/* slab_free(), except that a large block is freed on the lazy-free
+   thread (lazyfree.h) rather than by this one. */
+void slab_free_lazy(void *ptr, size_t size);
+/* Unmap every page of this thread's, and with them every small object
+   it has live, without freeing them one by one: for a thread done with
+   its data (shutdown), which must not touch those objects again. Large
+   blocks are malloc's and still need freeing. */
+void slab_release_thread(void);
+/* The size slab_alloc(size) really provides (its class size). */
+size_t slab_good_size(size_t size);
+
+typedef struct {
+    size_t size;        /* object size of the class */
+    size_t pages;
+    size_t used;        /* live objects */
+    size_t free;        /* free objects in this class's pages */
+} slab_class_stats_t;
+
+typedef struct {
+    size_t requested;   /* live bytes as passed to slab_alloc() */
+    size_t allocated;   /* live bytes after rounding to class sizes */
+    size_t reserved;    /* bytes mapped for slab pages */
+    size_t pages;
+    size_t large_count; /* live allocations passed through to malloc */
+    size_t large_bytes;
+    slab_class_stats_t classes[SLAB_NUM_CLASSES];
+} slab_stats_t;
+
+void slab_get_stats(slab_stats_t *out);
+/* allocated + large_bytes, without the per-class walk. */
+size_t slab_used_bytes(void);
+
+#endif
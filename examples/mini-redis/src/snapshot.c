@@ -0,0 +1,485 @@
+#include "snapshot.h"
+#include "hash.h"
+#include "util.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#define SNAPSHOT_MAGIC "MRSNAP"
+#define SNAPSHOT_MAGIC_LEN 6
+#define SNAPSHOT_VERSION 1
+#define SNAPSHOT_HEADER_LEN (SNAPSHOT_MAGIC_LEN + 2 + 8)
+#define SNAPSHOT_TRAILER_LEN (1 + 8 + 8)
+#define SNAPSHOT_CHECKSUM_SEED 0x6d722d736e6170ULL
+
+/* Entry type byte: the value encoding, plus a flag for a TTL. */
+#define SNAPSHOT_STRING  0x00
+#define SNAPSHOT_INT     0x01
+#define SNAPSHOT_EXPIRES 0x80
+#define SNAPSHOT_END     0xFF
+
+/* ---- writer ---- */
+
+/* Output is buffered a block at a time, which is also the checksum's
+   unit, so the loader can recompute it without knowing the writes. */
+typedef struct {
+    int fd;
+    size_t len;
+    uint64_t checksum;
+    int error;              /* errno of the first failed write, or 0 */
+    uint8_t buf[SNAPSHOT_BLOCK];
+} writer_t;
+
+static void write_all(writer_t *w, const void *data, size_t len) {
+    const uint8_t *p = data;
+    while (len > 0 && w->error == 0) {
+        ssize_t n = write(w->fd, p, len);
+        if (n < 0) {
+            if (errno != EINTR) {
+                w->error = errno;
+            }
+            continue;
+        }
+        p += n;
+        len -= (size_t)n;
+    }
+}
+
+/* An empty block is not hashed: checksum_of() has no empty tail when
+   the data ends on a block boundary. */
+static void flush_block(writer_t *w) {
+    if (w->len == 0) {
+        return;
+    }
+    w->checksum = hash_bytes(w->buf, w->len, w->checksum);
+    write_all(w, w->buf, w->len);
+    w->len = 0;
+}
+
+static void put_bytes(writer_t *w, const void *data, size_t len) {
+    const uint8_t *p = data;
+    while (len > 0) {
+        size_t room = SNAPSHOT_BLOCK - w->len;
+        size_t n = len < room ? len : room;
+        memcpy(w->buf + w->len, p, n);
+        w->len += n;
+        p += n;
+        len -= n;
+        if (w->len == SNAPSHOT_BLOCK) {
+            flush_block(w);
+        }
+    }
+}
+
+static void put_u8(writer_t *w, uint8_t v) {
+    put_bytes(w, &v, 1);
+}
+
+static void put_u64(writer_t *w, uint64_t v) {
+    uint8_t b[8];
+    for (int i = 0; i < 8; i++) {
+        b[i] = (uint8_t)(v >> (8 * i));
+    }
+    put_bytes(w, b, sizeof(b));
+}
+
+/* LEB128: seven bits a byte, high bit set on all but the last. */
+static void put_varint(writer_t *w, uint64_t v) {
+    uint8_t b[10];
+    size_t n = 0;
+    while (v >= 0x80) {
+        b[n++] = (uint8_t)(v | 0x80);
+        v >>= 7;
+    }
+    b[n++] = (uint8_t)v;
+    put_bytes(w, b, n);
+}
+
+/* Small negative numbers stay small: 0, -1, 1, -2 -> 0, 1, 2, 3. */
+static uint64_t zigzag(int64_t v) {
+    return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63);
+}
+
+static int64_t unzigzag(uint64_t v) {
+    return (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+}
+
+static void put_entry(writer_t *w, hashtable_t *ht, const ht_entry_t *e) {
+    int64_t num;
+    bool is_int = ht_entry_int(e, &num);
+    int64_t expire_at = ht_entry_expire(e);
+    uint8_t type = is_int ? SNAPSHOT_INT : SNAPSHOT_STRING;
+    if (expire_at >= 0) {
+        type |= SNAPSHOT_EXPIRES;
+    }
+
+    put_u8(w, type);
+    if (expire_at >= 0) {
+        put_u64(w, (uint64_t)expire_at);
+    }
+    rstr_t key = ht_entry_key(e);
+    put_varint(w, key.len);
+    put_bytes(w, key.data, key.len);
+    if (is_int) {
+        put_varint(w, zigzag(num));
+    } else {
+        rstr_t value = ht_entry_value(ht, e);
+        put_varint(w, value.len);
+        put_bytes(w, value.data, value.len);
+    }
+}
+
+static void temp_path(char *dst, size_t size, const char *path, pid_t pid) {
+    snprintf(dst, size, "%s.tmp-%ld", path, (long)pid);
+}
+
+int snapshot_write(hashtable_t *ht, const char *path) {
+    char tmp[4096];
+    temp_path(tmp, sizeof(tmp), path, getpid());
+    writer_t *w = malloc(sizeof(writer_t));
+    if (!w) {
+        perror("malloc");
+        exit(1);
+    }
+    w->fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (w->fd < 0) {
+        int err = errno;
+        free(w);
+        errno = err;
+        return -1;
+    }
+    w->len = 0;
+    w->checksum = SNAPSHOT_CHECKSUM_SEED;
+    w->error = 0;
+
+    put_bytes(w, SNAPSHOT_MAGIC, SNAPSHOT_MAGIC_LEN);
+    put_u8(w, SNAPSHOT_VERSION & 0xFF);
+    put_u8(w, SNAPSHOT_VERSION >> 8);
+    put_u64(w, (uint64_t)current_time_ms());
+
+    uint64_t count = 0;
+    ht_iter_t iter;
+    ht_iter_init(ht, &iter);
+    ht_entry_t *e;
+    while ((e = ht_iter_next_entry(&iter)) != NULL && w->error == 0) {
+        put_entry(w, ht, e);
+        count++;
+    }
+    ht_iter_release(&iter);
+
+    put_u8(w, SNAPSHOT_END);
+    put_u64(w, count);
+    flush_block(w);
+    uint8_t sum[8];
+    for (int i = 0; i < 8; i++) {
+        sum[i] = (uint8_t)(w->checksum >> (8 * i));
+    }
+    write_all(w, sum, sizeof(sum));
+
+    int err = w->error;
+    if (err == 0 && fsync(w->fd) < 0) {
+        err = errno;
+    }
+    if (close(w->fd) < 0 && err == 0) {
+        err = errno;
+    }
+    free(w);
+    if (err == 0 && rename(tmp, path) < 0) {
+        err = errno;
+    }
+    if (err != 0) {
+        unlink(tmp);
+        errno = err;
+        return -1;
+    }
+    return 0;
+}
+
+/* ---- loader ---- */
+
+typedef struct {
+    const uint8_t *p;
+    const uint8_t *end;
+} reader_t;
+
+static bool get_u64(reader_t *r, uint64_t *out) {
+    if (r->end - r->p < 8) {
+        return false;
+    }
+    uint64_t v = 0;
+    for (int i = 0; i < 8; i++) {
+        v |= (uint64_t)r->p[i] << (8 * i);
+    }
+    r->p += 8;
+    *out = v;
+    return true;
+}
+
+static bool get_varint(reader_t *r, uint64_t *out) {
+    uint64_t v = 0;
+    for (int shift = 0; shift < 64 && r->p < r->end; shift += 7) {
+        uint8_t b = *r->p++;
+        v |= (uint64_t)(b & 0x7F) << shift;
+        if (!(b & 0x80)) {
+            *out = v;
+            return true;
+        }
+    }
+    return false;
+}
+
+/* A length-prefixed string, as a view into the mapping. */
+static bool get_str(reader_t *r, rstr_t *out) {
+    uint64_t len;
+    if (!get_varint(r, &len) || len > UINT32_MAX - 1 ||
+        len > (uint64_t)(r->end - r->p)) {
+        return false;
+    }
+    out->data = (char *)r->p;
+    out->len = (size_t)len;
+    r->p += len;
+    return true;
+}
+
+static uint64_t checksum_of(const uint8_t *data, size_t len) {
+    uint64_t sum = SNAPSHOT_CHECKSUM_SEED;
+    for (size_t off = 0; off < len; off += SNAPSHOT_BLOCK) {
+        size_t n = len - off < SNAPSHOT_BLOCK ? len - off : SNAPSHOT_BLOCK;
+        sum = hash_bytes(data + off, n, sum);
+    }
+    return sum;
+}
+
+static void load_entry(hashtable_t *ht, rstr_t key, bool is_int, int64_t num,
+                       rstr_t value, int64_t expire_at) {
+    bool inserted;
+    ht_entry_t *e = is_int ? ht_find_or_insert_int(ht, key, num, &inserted) :
+                             ht_find_or_insert(ht, key, value, &inserted);
+    if (!inserted) {
+        /* a key saved twice: the later one wins */
+        if (is_int) {
+            ht_entry_set_int(ht, e, num);
+        } else {
+            ht_entry_set_value(ht, e, value);
+        }
+    }
+    if (expire_at >= 0 || !inserted) {
+        ht_entry_set_expire(ht, e, expire_at);
+    }
+}
+
+static int load_entries(hashtable_t *ht, reader_t *r, uint64_t count,
+                        snapshot_keep_fn keep, void *ctx,
+                        snapshot_load_stats_t *stats) {
+    int64_t now = current_time_ms();
+    for (uint64_t i = 0; i < count; i++) {
+        if (r->p >= r->end) {
+            return -2;
+        }
+        uint8_t type = *r->p++;
+        uint8_t encoding = type & (uint8_t)~SNAPSHOT_EXPIRES;
+        if (type == SNAPSHOT_END ||
+            (encoding != SNAPSHOT_STRING && encoding != SNAPSHOT_INT)) {
+            return -2;
+        }
+
+        uint64_t expire_at = (uint64_t)-1;
+        if ((type & SNAPSHOT_EXPIRES) &&
+            (!get_u64(r, &expire_at) || (int64_t)expire_at < 0)) {
+            return -2;
+        }
+        rstr_t key, value = {NULL, 0};
+        uint64_t raw = 0;
+        if (!get_str(r, &key) ||
+            (encoding == SNAPSHOT_INT ? !get_varint(r, &raw) :
+                                        !get_str(r, &value))) {
+            return -2;
+        }
+
+        if ((int64_t)expire_at >= 0 && (int64_t)expire_at <= now) {
+            stats->expired++;
+        } else if (keep && !keep(ctx, key)) {
+            stats->skipped++;
+        } else {
+            load_entry(ht, key, encoding == SNAPSHOT_INT, unzigzag(raw),
+                       value, (int64_t)expire_at);
+            stats->loaded++;
+        }
+    }
+    return 0;
+}
+
+int snapshot_load(hashtable_t *ht, const char *path, snapshot_keep_fn keep,
+                  void *ctx, int parts, snapshot_load_stats_t *stats) {
+    memset(stats, 0, sizeof(*stats));
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        int err = errno;
+        close(fd);
+        errno = err;
+        return -1;
+    }
+    size_t size = (size_t)st.st_size;
+    if (size < SNAPSHOT_HEADER_LEN + SNAPSHOT_TRAILER_LEN) {
+        close(fd);
+        return -2;
+    }
+    const uint8_t *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    int err = errno;
+    close(fd);
+    if (map == MAP_FAILED) {
+        errno = err;
+        return -1;
+    }
+    posix_madvise((void *)map, size, POSIX_MADV_SEQUENTIAL);
+
+    int rc = -2;
+    reader_t trailer = {map + size - SNAPSHOT_TRAILER_LEN + 1, map + size};
+    uint64_t count = 0, checksum = 0;
+    get_u64(&trailer, &count);
+    get_u64(&trailer, &checksum);
+    if (memcmp(map, SNAPSHOT_MAGIC, SNAPSHOT_MAGIC_LEN) != 0 ||
+        (map[SNAPSHOT_MAGIC_LEN] | map[SNAPSHOT_MAGIC_LEN + 1] << 8) !=
+            SNAPSHOT_VERSION ||
+        map[size - SNAPSHOT_TRAILER_LEN] != SNAPSHOT_END ||
+        checksum_of(map, size - 8) != checksum) {
+        goto out;
+    }
+
+    /* one resize for the whole load, with some slack for the share of a
+       store not coming out even */
+    uint64_t share = parts > 1 ? count / (uint64_t)parts : count;
+    if (parts > 1) {
+        share += share / 16;
+    }
+    if (share > SIZE_MAX / 2) {
+        goto out;
+    }
+    ht_reserve(ht, (size_t)share);
+
+    reader_t r = {map + SNAPSHOT_HEADER_LEN,
+                  map + size - SNAPSHOT_TRAILER_LEN};
+    rc = load_entries(ht, &r, count, keep, ctx, stats);
+    if (rc == 0 && r.p != r.end) {
+        rc = -2;
+    }
+
+out:
+    munmap((void *)map, size);
+    return rc;
+}
+
+/* ---- SAVE / BGSAVE ---- */
+
+static const char *save_path;
+static pid_t child_pid;         /* BGSAVE child, 0 if none */
+static int64_t last_save;
+
+void snapshot_set_path(const char *path) {
+    save_path = path;
+    last_save = (int64_t)time(NULL);
+}
+
+const char *snapshot_path(void) {
+    return save_path;
+}
+
+int snapshot_save(hashtable_t *ht) {
+    if (!save_path) {
+        errno = ENOTSUP;
+        return -1;
+    }
+    if (child_pid > 0) {
+        errno = EBUSY;
+        return -1;
+    }
+    if (snapshot_write(ht, save_path) < 0) {
+        return -1;
+    }
+    last_save = (int64_t)time(NULL);
+    return 0;
+}
+
+int snapshot_bgsave(hashtable_t *ht) {
+    if (!save_path) {
+        errno = ENOTSUP;
+        return -1;
+    }
+    if (child_pid > 0) {
+        errno = EBUSY;
+        return -1;
+    }
+    pid_t pid = fork();
+    if (pid < 0) {
+        return -1;
+    }
+    if (pid == 0) {
+        /* Only this thread exists here, and it holds no locks the
+           writer needs. Exit without running the parent's atexit
+           handlers or flushing its stdio buffers. */
+        if (snapshot_write(ht, save_path) < 0) {
+            perror("BGSAVE");
+            _exit(1);
+        }
+        _exit(0);
+    }
+    child_pid = pid;
+    fprintf(stderr, "Background saving started by pid %ld\n", (long)pid);
+    return 0;
+}
+
+bool snapshot_bgsave_running(void) {
+    return child_pid > 0;
+}
+
+void snapshot_bgsave_poll(void) {
+    if (child_pid <= 0) {
+        return;
+    }
+    int status;
+    pid_t r = waitpid(child_pid, &status, WNOHANG);
+    if (r == 0 || (r < 0 && errno == EINTR)) {
+        return;
+    }
+    if (r > 0 && WIFEXITED(status) && WEXITSTATUS(status) == 0) {
+        last_save = (int64_t)time(NULL);
+        fprintf(stderr, "Background saving terminated with success\n");
+    } else {
+        char tmp[4096];
+        temp_path(tmp, sizeof(tmp), save_path, child_pid);
+        unlink(tmp);
+        fprintf(stderr, "Background saving failed\n");
+    }
+    child_pid = 0;
+}
+
+void snapshot_bgsave_abort(void) {
+    if (child_pid <= 0) {
+        return;
+    }
+    kill(child_pid, SIGKILL);
+    while (waitpid(child_pid, NULL, 0) < 0 && errno == EINTR) {
+    }
+    char tmp[4096];
+    temp_path(tmp, sizeof(tmp), save_path, child_pid);
+    unlink(tmp);
+    child_pid = 0;
+}
+
+int64_t snapshot_lastsave(void) {
+    return last_save;
+}
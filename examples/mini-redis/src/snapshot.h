@@ -0,0 +1,69 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include "hashtable.h"
+#include "rstr.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define SNAPSHOT_DEFAULT_PATH "dump.mrdb"
+
+/* Point-in-time snapshots of a store: SAVE, BGSAVE and the load at
+   startup. The file is written front to back, with no seeks:
+
+     header   "MRSNAP", u16 version, i64 created_ms
+     entry    u8 type, [i64 expire_at], varint key length, key, then
+              varint value length and value (string) or a zigzag
+              varint (integer)
+     trailer  u8 SNAPSHOT_END, u64 entry count, u64 checksum
+
+   Fixed-width fields are little-endian. The checksum chains
+   hash_bytes() over SNAPSHOT_BLOCK-byte blocks of everything before it,
+   each block seeded with the result of the one before. The loader maps
+   the file, so parsing is plain pointer arithmetic over the page
+   cache, and reads the count first to size the table once. */
+#define SNAPSHOT_BLOCK (64 * 1024)
+
+typedef struct {
+    size_t loaded;
+    size_t expired;     /* already past their TTL, dropped */
+    size_t skipped;     /* turned away by the keep function */
+} snapshot_load_stats_t;
+
+/* Write every live key of ht to path, through a temporary file that is
+   synced and renamed over it. 0 on success, -1 with errno set. */
+int snapshot_write(hashtable_t *ht, const char *path);
+
+/* Whether a key belongs in the store being loaded (one shard's share). */
+typedef bool (*snapshot_keep_fn)(void *ctx, rstr_t key);
+
+/* Insert the keys saved in path into ht, dropping expired ones and,
+   when keep is given, the ones it rejects. The table is sized up front
+   for the file's key count divided by parts, the number of stores the
+   keys are spread over. Returns 0, -1 with errno set (ENOENT: there is
+   no snapshot), or -2 if the file is not a valid snapshot; ht may then
+   hold part of it. */
+int snapshot_load(hashtable_t *ht, const char *path, snapshot_keep_fn keep,
+                  void *ctx, int parts, snapshot_load_stats_t *stats);
+
+/* Where SAVE and BGSAVE write. NULL turns them off (--shards, where no
+   one thread sees every store). Also marks the LASTSAVE time. The
+   calls below are for the main thread only. */
+void snapshot_set_path(const char *path);
+const char *snapshot_path(void);
+/* SAVE: write from this process, blocking it until done. */
+int snapshot_save(hashtable_t *ht);
+/* BGSAVE: fork a child that writes the store; copy-on-write keeps its
+   view fixed while this process carries on serving. 0 once started,
+   -1 with errno set (EBUSY while a save is running). */
+int snapshot_bgsave(hashtable_t *ht);
+bool snapshot_bgsave_running(void);
+/* Reap a finished child without blocking. */
+void snapshot_bgsave_poll(void);
+/* Kill a running child and remove its temporary file (shutdown). */
+void snapshot_bgsave_abort(void);
+/* Unix time of the last successful save, or of startup. */
+int64_t snapshot_lastsave(void);
+
+#endif
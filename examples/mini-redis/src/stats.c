@@ -0,0 +1,539 @@
+#include "stats.h"
+#include "lazyfree.h"
+#include "util.h"
+
+#include <ctype.h>
+#include <inttypes.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/* ---- clock ---- */
+
+#if defined(__x86_64__) || defined(__i386__)
+#define CLOCK_SOURCE "tsc"
+#elif defined(__aarch64__)
+#define CLOCK_SOURCE "cntvct"
+#else
+#define CLOCK_SOURCE "clock_gettime"
+#endif
+
+static uint64_t monotonic_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+uint64_t stats_ticks(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    return __builtin_ia32_rdtsc();
+#elif defined(__aarch64__)
+    uint64_t v;
+    __asm__ __volatile__("mrs %0, cntvct_el0" : "=r"(v));
+    return v;
+#else
+    return monotonic_ns();
+#endif
+}
+
+const char *stats_clock_source(void) {
+    return CLOCK_SOURCE;
+}
+
+/* Written by the main thread, read by every dispatching one. */
+static _Atomic double ns_per_tick = 1.0;
+static _Atomic uint64_t slow_ticks = UINT64_MAX;
+static long long slower_than_us = SLOWLOG_DEFAULT_SLOWER_THAN;
+static size_t slowlog_max = SLOWLOG_DEFAULT_MAX_LEN;
+
+static uint64_t base_ticks;
+static uint64_t base_ns;
+
+static void update_slow_ticks(void) {
+    uint64_t t = UINT64_MAX;
+    if (slower_than_us >= 0) {
+        double rate = atomic_load_explicit(&ns_per_tick, memory_order_relaxed);
+        t = (uint64_t)((double)slower_than_us * 1000.0 / rate);
+    }
+    atomic_store_explicit(&slow_ticks, t, memory_order_relaxed);
+}
+
+void stats_calibrate(void) {
+    if (strcmp(CLOCK_SOURCE, "clock_gettime") == 0) {
+        update_slow_ticks();
+        return;
+    }
+    if (base_ns == 0) {
+        /* a first estimate; later calls average over the whole uptime */
+        base_ticks = stats_ticks();
+        base_ns = monotonic_ns();
+        struct timespec pause = {0, 2000000};
+        nanosleep(&pause, NULL);
+    }
+    uint64_t ticks = stats_ticks() - base_ticks;
+    uint64_t ns = monotonic_ns() - base_ns;
+    if (ticks > 0 && ns > 0) {
+        atomic_store_explicit(&ns_per_tick, (double)ns / (double)ticks,
+                              memory_order_relaxed);
+    }
+    update_slow_ticks();
+}
+
+double stats_ticks_to_us(uint64_t ticks) {
+    return (double)ticks *
+           atomic_load_explicit(&ns_per_tick, memory_order_relaxed) / 1000.0;
+}
+
+int stats_hist_bucket(uint64_t ticks) {
+    const int sub = 1 << STATS_HIST_SUB_BITS;
+    if (ticks < (uint64_t)sub) {
+        return (int)ticks;
+    }
+    int bit = 63 - __builtin_clzll(ticks);
+    if (bit > STATS_HIST_MAX_BIT) {
+        return STATS_HIST_BUCKETS - 1;
+    }
+    int step = (int)(ticks >> (bit - STATS_HIST_SUB_BITS)) & (sub - 1);
+    return ((bit - STATS_HIST_SUB_BITS + 1) << STATS_HIST_SUB_BITS) + step;
+}
+
+uint64_t stats_hist_bucket_max(int bucket) {
+    const int sub = 1 << STATS_HIST_SUB_BITS;
+    if (bucket < sub) {
+        return (uint64_t)bucket;
+    }
+    int bit = (bucket >> STATS_HIST_SUB_BITS) + STATS_HIST_SUB_BITS - 1;
+    uint64_t step = (uint64_t)(bucket & (sub - 1));
+    uint64_t width = 1ULL << (bit - STATS_HIST_SUB_BITS);
+    return (1ULL << bit) + (step + 1) * width - 1;
+}
+
+/* ---- per thread ---- */
+
+typedef struct {
+    int64_t id;
+    int64_t time;           /* unix seconds */
+    uint64_t us;
+    int nargs;              /* kept, the last maybe a "more" note */
+    rstr_t args[];
+} slowlog_entry_t;
+
+static _Thread_local cmd_stats_t cmd_stats[CMD_COUNT];
+static _Thread_local uint64_t commands_processed;
+static _Thread_local uint64_t loop_cycles, loop_ticks, loop_max;
+static _Thread_local uint64_t resizes, resize_ticks, resize_max;
+static _Thread_local uint64_t evicted_keys;
+/* a ring of slowlog_max entries, newest at slowlog_head - 1 */
+static _Thread_local slowlog_entry_t **slowlog;
+static _Thread_local size_t slowlog_head, slowlog_count;
+static _Thread_local int64_t slowlog_next_id;
+
+/* room for "... (<n> more bytes)" after a cut argument */
+#define SLOWLOG_NOTE_MAX 48
+
+static void slowlog_add(uint64_t ticks, const resp_value_t *argv,
+                        int argc) {
+    if (slowlog_max == 0) {
+        return;
+    }
+    if (!slowlog) {
+        slowlog = calloc(slowlog_max, sizeof(*slowlog));
+        if (!slowlog) {
+            perror("calloc");
+            exit(1);
+        }
+    }
+    /* past SLOWLOG_MAX_ARGS, the last one kept says how many are left */
+    int nargs = argc > SLOWLOG_MAX_ARGS ? SLOWLOG_MAX_ARGS : argc;
+    char more[SLOWLOG_NOTE_MAX];
+    size_t bytes = SLOWLOG_NOTE_MAX;
+    for (int i = 0; i < nargs; i++) {
+        size_t len = argv[i].str.len;
+        bytes += len > SLOWLOG_MAX_ARG_LEN ?
+                 SLOWLOG_MAX_ARG_LEN + SLOWLOG_NOTE_MAX : len;
+    }
+    slowlog_entry_t *e = malloc(sizeof(*e) + (size_t)nargs * sizeof(rstr_t) +
+                                bytes);
+    if (!e) {
+        perror("malloc");
+        exit(1);
+    }
+    e->id = slowlog_next_id++;
+    e->time = clock_ms() / 1000;
+    e->us = (uint64_t)stats_ticks_to_us(ticks);
+    e->nargs = nargs;
+    char *p = (char *)&e->args[nargs];
+    for (int i = 0; i < nargs; i++) {
+        rstr_t s = argv[i].str;
+        if (i == SLOWLOG_MAX_ARGS - 1 && argc > SLOWLOG_MAX_ARGS) {
+            s.data = more;
+            s.len = (size_t)snprintf(more, sizeof(more),
+                                     "... (%d more arguments)",
+                                     argc - nargs + 1);
+        }
+        size_t len = s.len > SLOWLOG_MAX_ARG_LEN ? SLOWLOG_MAX_ARG_LEN : s.len;
+        memcpy(p, s.data, len);
+        if (len < s.len) {
+            len += (size_t)snprintf(p + len, SLOWLOG_NOTE_MAX,
+                                    "... (%zu more bytes)", s.len - len);
+        }
+        e->args[i].data = p;
+        e->args[i].len = len;
+        p += len;
+    }
+
+    if (slowlog_count == slowlog_max) {
+        free(slowlog[slowlog_head]);
+    } else {
+        slowlog_count++;
+    }
+    slowlog[slowlog_head] = e;
+    slowlog_head = (slowlog_head + 1) % slowlog_max;
+}
+
+void stats_record_command(cmd_id_t id, uint64_t ticks,
+                          const resp_value_t *argv, int argc) {
+    cmd_stats_t *st = &cmd_stats[id];
+    st->calls++;
+    st->ticks += ticks;
+    st->hist[stats_hist_bucket(ticks)]++;
+    commands_processed++;
+    if (ticks >= atomic_load_explicit(&slow_ticks, memory_order_relaxed)) {
+        slowlog_add(ticks, argv, argc);
+    }
+}
+
+const cmd_stats_t *stats_command(cmd_id_t id) {
+    return &cmd_stats[id];
+}
+
+uint64_t stats_commands_processed(void) {
+    return commands_processed;
+}
+
+double stats_percentile_us(const cmd_stats_t *st, double q) {
+    if (st->calls == 0) {
+        return 0.0;
+    }
+    /* the rank of the call at q, rounded up */
+    double rank = (double)st->calls * q;
+    uint64_t want = (uint64_t)rank;
+    if ((double)want < rank || want == 0) {
+        want++;
+    }
+    uint64_t seen = 0;
+    for (int b = 0; b < STATS_HIST_BUCKETS; b++) {
+        seen += st->hist[b];
+        if (seen >= want) {
+            return stats_ticks_to_us(stats_hist_bucket_max(b));
+        }
+    }
+    return stats_ticks_to_us(stats_hist_bucket_max(STATS_HIST_BUCKETS - 1));
+}
+
+void stats_record_loop(uint64_t ticks) {
+    loop_cycles++;
+    loop_ticks += ticks;
+    if (ticks > loop_max) {
+        loop_max = ticks;
+    }
+}
+
+void stats_record_resize(uint64_t ticks) {
+    resizes++;
+    resize_ticks += ticks;
+    if (ticks > resize_max) {
+        resize_max = ticks;
+    }
+}
+
+void stats_record_evictions(size_t n) {
+    evicted_keys += n;
+}
+
+size_t stats_slowlog_len(void) {
+    return slowlog_count;
+}
+
+void stats_slowlog_reset(void) {
+    for (size_t i = 0; i < slowlog_count; i++) {
+        size_t at = (slowlog_head + slowlog_max - 1 - i) % slowlog_max;
+        free(slowlog[at]);
+        slowlog[at] = NULL;
+    }
+    slowlog_count = 0;
+    slowlog_head = 0;
+}
+
+void stats_thread_release(void) {
+    stats_slowlog_reset();
+    free(slowlog);
+    slowlog = NULL;
+}
+
+void stats_slowlog_config(long long slower_than, size_t max_len) {
+    /* the ring is sized on first use; drop ours in case it exists */
+    stats_thread_release();
+    slower_than_us = slower_than;
+    slowlog_max = max_len;
+    update_slow_ticks();
+}
+
+void stats_write_slowlog(client_t *c, long long count) {
+    size_t n = count < 0 || (size_t)count > slowlog_count ?
+               slowlog_count : (size_t)count;
+    resp_write_array_header(c, (int)n);
+    for (size_t i = 0; i < n; i++) {
+        const slowlog_entry_t *e =
+            slowlog[(slowlog_head + slowlog_max - 1 - i) % slowlog_max];
+        resp_write_array_header(c, 4);
+        resp_write_integer(c, e->id);
+        resp_write_integer(c, e->time);
+        resp_write_integer(c, (int64_t)e->us);
+        resp_write_array_header(c, e->nargs);
+        for (int j = 0; j < e->nargs; j++) {
+            resp_write_bulk_string(c, e->args[j].data, e->args[j].len);
+        }
+    }
+}
+
+/* ---- process-wide ---- */
+
+static atomic_int clients_open;
+static atomic_uint_least64_t connections_received;
+static atomic_uint_least64_t connections_rejected;
+static atomic_uint_least64_t output_limit_closed;
+static atomic_uint_least64_t query_limit_closed;
+static atomic_uint_least64_t net_input;
+static atomic_uint_least64_t net_output;
+static stats_server_info_t server_info;
+static int64_t start_ms;
+
+int stats_client_opened(void) {
+    atomic_fetch_add_explicit(&connections_received, 1, memory_order_relaxed);
+    return atomic_fetch_add_explicit(&clients_open, 1,
+                                     memory_order_relaxed) + 1;
+}
+
+void stats_client_closed(void) {
+    atomic_fetch_sub_explicit(&clients_open, 1, memory_order_relaxed);
+}
+
+void stats_client_rejected(void) {
+    atomic_fetch_add_explicit(&connections_rejected, 1, memory_order_relaxed);
+}
+
+int stats_clients_open(void) {
+    return atomic_load_explicit(&clients_open, memory_order_relaxed);
+}
+
+void stats_output_limit_closed(void) {
+    atomic_fetch_add_explicit(&output_limit_closed, 1, memory_order_relaxed);
+}
+
+void stats_query_limit_closed(void) {
+    atomic_fetch_add_explicit(&query_limit_closed, 1, memory_order_relaxed);
+}
+
+void stats_net_input(size_t bytes) {
+    atomic_fetch_add_explicit(&net_input, bytes, memory_order_relaxed);
+}
+
+void stats_net_output(size_t bytes) {
+    atomic_fetch_add_explicit(&net_output, bytes, memory_order_relaxed);
+}
+
+void stats_set_server_info(const stats_server_info_t *info) {
+    server_info = *info;
+    start_ms = current_time_ms();
+}
+
+/* ---- reports ---- */
+
+void info_printf(info_buf_t *b, const char *fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(b->data + b->len, b->cap - b->len, fmt, ap);
+    va_end(ap);
+    if (n < 0) {
+        return;
+    }
+    if (b->len + (size_t)n + 1 > b->cap) {
+        size_t cap = b->cap ? b->cap * 2 : 1024;
+        while (cap < b->len + (size_t)n + 1) {
+            cap *= 2;
+        }
+        char *grown = realloc(b->data, cap);
+        if (!grown) {
+            perror("realloc");
+            exit(1);
+        }
+        b->data = grown;
+        b->cap = cap;
+        va_start(ap, fmt);
+        vsnprintf(b->data + b->len, b->cap - b->len, fmt, ap);
+        va_end(ap);
+    }
+    b->len += (size_t)n;
+}
+
+void info_section(info_buf_t *b, const char *name) {
+    info_printf(b, "%s# %s\r\n", b->len ? "\r\n" : "", name);
+}
+
+/* Command names are reported in lowercase, as Redis does. */
+static void lower_name(char *dst, size_t size, cmd_id_t id) {
+    const char *name = command_name(id);
+    size_t i = 0;
+    for (; name[i] && i + 1 < size; i++) {
+        dst[i] = (char)tolower((unsigned char)name[i]);
+    }
+    dst[i] = '\0';
+}
+
+void stats_info_server(info_buf_t *b) {
+    const stats_server_info_t *s = &server_info;
+    info_printf(b, "process_id:%ld\r\n", (long)getpid());
+    info_printf(b, "tcp_port:%d\r\n", s->port);
+    info_printf(b, "uptime_in_seconds:%lld\r\n",
+                (long long)((current_time_ms() - start_ms) / 1000));
+    info_printf(b, "event_backend:%s\r\n",
+                s->event_backend ? s->event_backend : "");
+    info_printf(b, "io_threads:%d\r\n", s->io_threads);
+    info_printf(b, "shards:%d\r\n", s->shards);
+    info_printf(b, "clock_source:%s\r\n", CLOCK_SOURCE);
+    info_printf(b, "ticks_per_us:%.3f\r\n", 1.0 / stats_ticks_to_us(1));
+}
+
+void stats_info_clients(info_buf_t *b) {
+    info_printf(b, "connected_clients:%d\r\n", stats_clients_open());
+    info_printf(b, "maxclients:%d\r\n", server_info.max_clients);
+}
+
+void stats_info_stats(info_buf_t *b) {
+    info_printf(b, "total_connections_received:%" PRIu64 "\r\n",
+                (uint64_t)atomic_load(&connections_received));
+    info_printf(b, "rejected_connections:%" PRIu64 "\r\n",
+                (uint64_t)atomic_load(&connections_rejected));
+    info_printf(b, "client_output_buffer_limit_disconnections:%" PRIu64
+                "\r\n", (uint64_t)atomic_load(&output_limit_closed));
+    info_printf(b, "client_query_buffer_limit_disconnections:%" PRIu64
+                "\r\n", (uint64_t)atomic_load(&query_limit_closed));
+    info_printf(b, "total_commands_processed:%" PRIu64 "\r\n",
+                commands_processed);
+    info_printf(b, "total_net_input_bytes:%" PRIu64 "\r\n",
+                (uint64_t)atomic_load(&net_input));
+    info_printf(b, "total_net_output_bytes:%" PRIu64 "\r\n",
+                (uint64_t)atomic_load(&net_output));
+    info_printf(b, "eventloop_cycles:%" PRIu64 "\r\n", loop_cycles);
+    info_printf(b, "eventloop_duration_sum:%.0f\r\n",
+                stats_ticks_to_us(loop_ticks));
+    info_printf(b, "eventloop_duration_max:%.0f\r\n",
+                stats_ticks_to_us(loop_max));
+    info_printf(b, "ht_resizes:%" PRIu64 "\r\n", resizes);
+    info_printf(b, "ht_resize_usec_sum:%.0f\r\n",
+                stats_ticks_to_us(resize_ticks));
+    info_printf(b, "ht_resize_usec_max:%.0f\r\n",
+                stats_ticks_to_us(resize_max));
+    info_printf(b, "evicted_keys:%" PRIu64 "\r\n", evicted_keys);
+    info_printf(b, "lazyfreed_objects:%zu\r\n", lazyfree_freed());
+    info_printf(b, "slowlog_len:%zu\r\n", slowlog_count);
+}
+
+void stats_info_commandstats(info_buf_t *b) {
+    for (int id = 0; id < CMD_COUNT; id++) {
+        const cmd_stats_t *st = &cmd_stats[id];
+        if (st->calls == 0) {
+            continue;
+        }
+        char name[32];
+        lower_name(name, sizeof(name), (cmd_id_t)id);
+        double us = stats_ticks_to_us(st->ticks);
+        info_printf(b, "cmdstat_%s:calls=%" PRIu64 ",usec=%.0f,"
+                    "usec_per_call=%.2f\r\n", name, st->calls, us,
+                    us / (double)st->calls);
+    }
+}
+
+void stats_info_latencystats(info_buf_t *b) {
+    for (int id = 0; id < CMD_COUNT; id++) {
+        const cmd_stats_t *st = &cmd_stats[id];
+        if (st->calls == 0) {
+            continue;
+        }
+        char name[32];
+        lower_name(name, sizeof(name), (cmd_id_t)id);
+        info_printf(b, "latency_percentiles_usec_%s:p50=%.3f,p99=%.3f,"
+                    "p99.9=%.3f\r\n", name, stats_percentile_us(st, 0.5),
+                    stats_percentile_us(st, 0.99),
+                    stats_percentile_us(st, 0.999));
+    }
+}
+
+static void write_histogram(client_t *c, cmd_id_t id) {
+    const cmd_stats_t *st = &cmd_stats[id];
+    /* fold the tick buckets into power-of-two microsecond ones */
+    uint64_t counts[64] = {0};
+    int top = 0;
+    for (int b = 0; b < STATS_HIST_BUCKETS; b++) {
+        if (st->hist[b] == 0) {
+            continue;
+        }
+        double us = stats_ticks_to_us(stats_hist_bucket_max(b));
+        int k = 0;
+        while (k < 63 && (double)(1ULL << k) < us) {
+            k++;
+        }
+        counts[k] += st->hist[b];
+        if (k > top) {
+            top = k;
+        }
+    }
+    int used = 0;
+    for (int k = 0; k <= top; k++) {
+        used += counts[k] > 0;
+    }
+    char name[32];
+    lower_name(name, sizeof(name), id);
+    resp_write_bulk_string(c, name, strlen(name));
+    resp_write_array_header(c, 4);
+    resp_write_bulk_string(c, "calls", 5);
+    resp_write_integer(c, (int64_t)st->calls);
+    resp_write_bulk_string(c, "histogram_usec", 14);
+    resp_write_array_header(c, 2 * used);
+    uint64_t total = 0;
+    for (int k = 0; k <= top; k++) {
+        if (counts[k] == 0) {
+            continue;
+        }
+        total += counts[k];
+        resp_write_integer(c, (int64_t)(1ULL << k));
+        resp_write_integer(c, (int64_t)total);
+    }
+}
+
+void stats_write_latency_histogram(client_t *c, const resp_value_t *names,
+                                   int count) {
+    bool want[CMD_COUNT];
+    memset(want, count == 0, sizeof(want));
+    for (int i = 0; i < count; i++) {
+        cmd_id_t id = command_lookup(names[i].str.data, names[i].str.len);
+        if (id != CMD_UNKNOWN) {
+            want[id] = true;
+        }
+    }
+    int n = 0;
+    for (int id = 0; id < CMD_COUNT; id++) {
+        n += want[id] && cmd_stats[id].calls > 0;
+    }
+    resp_write_array_header(c, 2 * n);
+    for (int id = 0; id < CMD_COUNT; id++) {
+        if (want[id] && cmd_stats[id].calls > 0) {
+            write_histogram(c, (cmd_id_t)id);
+        }
+    }
+}
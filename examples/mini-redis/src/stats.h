@@ -0,0 +1,130 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include "client.h"
+#include "commands.h"
+#include "resp.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Defaults for --slowlog-log-slower-than (microseconds; negative turns
+   the log off, 0 logs everything) and --slowlog-max-len. */
+#define SLOWLOG_DEFAULT_SLOWER_THAN 10000
+#define SLOWLOG_DEFAULT_MAX_LEN 128
+/* What a slowlog entry keeps of a command. */
+#define SLOWLOG_MAX_ARGS 32
+#define SLOWLOG_MAX_ARG_LEN 128
+
+/* Latency histograms are HDR-style: a bucket per power of two of the
+   tick count, each split into 1 << STATS_HIST_SUB_BITS linear steps, so
+   every bucket is within 25% of the value recorded in it. Counts past
+   2^STATS_HIST_MAX_BIT ticks land in the last bucket. */
+#define STATS_HIST_SUB_BITS 2
+#define STATS_HIST_MAX_BIT 44
+#define STATS_HIST_BUCKETS \
+    ((STATS_HIST_MAX_BIT - STATS_HIST_SUB_BITS + 2) << STATS_HIST_SUB_BITS)
+
+/* Instrumentation cheap enough to leave on. Timings are taken with
+   stats_ticks(): the CPU's cycle counter where there is one (TSC on
+   x86, the virtual counter on arm64), otherwise CLOCK_MONOTONIC in ns.
+   Ticks are only converted to time when reported, at a rate calibrated
+   against the clock by stats_calibrate().
+
+   Command, slowlog, loop and resize figures are per thread, like the
+   slab statistics: with --shards each shard reports its own. Connection
+   and network counters are process-wide. */
+uint64_t stats_ticks(void);
+/* Take the clock's reading next to the counter's and refine the rate
+   from the one before. Main thread; also run at startup. */
+void stats_calibrate(void);
+double stats_ticks_to_us(uint64_t ticks);
+/* "tsc", "cntvct" or "clock_gettime" */
+const char *stats_clock_source(void);
+
+/* Histogram bucket for a tick count, and the largest count in it. */
+int stats_hist_bucket(uint64_t ticks);
+uint64_t stats_hist_bucket_max(int bucket);
+
+/* ---- per thread ---- */
+
+typedef struct {
+    uint64_t calls;
+    uint64_t ticks;
+    uint64_t hist[STATS_HIST_BUCKETS];
+} cmd_stats_t;
+
+/* One dispatched command took ticks. Slow ones go to the slowlog. */
+void stats_record_command(cmd_id_t id, uint64_t ticks,
+                          const resp_value_t *argv, int argc);
+const cmd_stats_t *stats_command(cmd_id_t id);
+uint64_t stats_commands_processed(void);
+/* The value below which a fraction q of the calls fell, in us. */
+double stats_percentile_us(const cmd_stats_t *st, double q);
+
+/* One event loop iteration spent ticks outside the wait. */
+void stats_record_loop(uint64_t ticks);
+/* A hash table started a resize: ticks to allocate the new table. */
+void stats_record_resize(uint64_t ticks);
+/* --maxmemory evicted n keys to make room for a write. */
+void stats_record_evictions(size_t n);
+
+/* Before the loops start: other threads' slowlogs keep their size. */
+void stats_slowlog_config(long long slower_than_us, size_t max_len);
+size_t stats_slowlog_len(void);
+void stats_slowlog_reset(void);
+/* SLOWLOG GET: the newest count entries, -1 for all. */
+void stats_write_slowlog(client_t *c, long long count);
+/* Free this thread's slowlog, before it exits. */
+void stats_thread_release(void);
+
+/* ---- process-wide ---- */
+
+/* A connection was accepted; returns how many are now open. */
+int stats_client_opened(void);
+void stats_client_closed(void);
+void stats_client_rejected(void);
+int stats_clients_open(void);
+/* A client was dropped past a hard output or query buffer limit. */
+void stats_output_limit_closed(void);
+void stats_query_limit_closed(void);
+void stats_net_input(size_t bytes);
+void stats_net_output(size_t bytes);
+
+/* Fixed facts for INFO server, set before the loops start. */
+typedef struct {
+    int port;
+    const char *event_backend;
+    int io_threads;
+    int shards;
+    int max_clients;
+} stats_server_info_t;
+
+void stats_set_server_info(const stats_server_info_t *info);
+
+/* ---- reports ---- */
+
+/* INFO text being built. */
+typedef struct {
+    char *data;
+    size_t len;
+    size_t cap;
+} info_buf_t;
+
+void info_printf(info_buf_t *b, const char *fmt, ...)
+    __attribute__((format(printf, 2, 3)));
+void info_section(info_buf_t *b, const char *name);
+
+/* INFO server, clients, stats, commandstats, latencystats */
+void stats_info_server(info_buf_t *b);
+void stats_info_clients(info_buf_t *b);
+void stats_info_stats(info_buf_t *b);
+void stats_info_commandstats(info_buf_t *b);
+void stats_info_latencystats(info_buf_t *b);
+
+/* LATENCY HISTOGRAM [command ...]: per command its calls and a
+   cumulative histogram over power-of-two microsecond buckets. */
+void stats_write_latency_histogram(client_t *c, const resp_value_t *names,
+                                   int count);
+
+#endif
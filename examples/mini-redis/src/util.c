@@ -1,8 +1,111 @@
 #include "util.h"
+#include <stdio.h>
 #include <time.h>
+#include <unistd.h>
 
 int64_t current_time_ms(void) {
     struct timespec ts;
     clock_gettime(CLOCK_REALTIME, &ts);
     return (int64_t)ts.tv_sec * 1000 + (int64_t)ts.tv_nsec / 1000000;
 }
+
+/* per thread, like the event loop reading it */
+static _Thread_local int64_t cached_ms = -1;
+
+int64_t clock_ms(void) {
+    return cached_ms >= 0 ? cached_ms : current_time_ms();
+}
+
+int64_t clock_refresh(void) {
+    cached_ms = current_time_ms();
+    return cached_ms;
+}
+
+void clock_uncache(void) {
+    cached_ms = -1;
+}
+
+int64_t monotonic_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + (int64_t)ts.tv_nsec / 1000;
+}
+
+static const uint64_t pow10_table[20] = {
+    1ULL, 10ULL, 100ULL, 1000ULL, 10000ULL, 100000ULL, 1000000ULL,
+    10000000ULL, 100000000ULL, 1000000000ULL, 10000000000ULL,
+    100000000000ULL, 1000000000000ULL, 10000000000000ULL,
+    100000000000000ULL, 1000000000000000ULL, 10000000000000000ULL,
+    100000000000000000ULL, 1000000000000000000ULL,
+    10000000000000000000ULL
+};
+
+static const char digit_pairs[201] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+size_t u64_digits(uint64_t v) {
+    /* log10 estimate from the bit length (1233/4096 ~ log10(2)), then one
+       comparison to correct it */
+    v |= 1;
+    unsigned t = ((unsigned)(64 - __builtin_clzll(v)) * 1233) >> 12;
+    return t + 1 - (v < pow10_table[t]);
+}
+
+size_t u64_to_str(char *dst, uint64_t v) {
+    size_t len = u64_digits(v);
+    char *p = dst + len;
+    /* two digits per division */
+    while (v >= 100) {
+        unsigned i = (unsigned)(v % 100) * 2;
+        v /= 100;
+        *--p = digit_pairs[i + 1];
+        *--p = digit_pairs[i];
+    }
+    if (v >= 10) {
+        unsigned i = (unsigned)v * 2;
+        *--p = digit_pairs[i + 1];
+        *--p = digit_pairs[i];
+    } else {
+        *--p = (char)('0' + v);
+    }
+    return len;
+}
+
+size_t i64_to_str(char *dst, int64_t v) {
+    if (v < 0) {
+        *dst = '-';
+        /* negate in unsigned space so INT64_MIN is handled */
+        return 1 + u64_to_str(dst + 1, 0 - (uint64_t)v);
+    }
+    return u64_to_str(dst, (uint64_t)v);
+}
+
+size_t i64_strlen(int64_t v) {
+    if (v < 0) {
+        return 1 + u64_digits(0 - (uint64_t)v);
+    }
+    return u64_digits((uint64_t)v);
+}
+
+size_t process_rss_bytes(void) {
+    FILE *f = fopen("/proc/self/statm", "r");
+    if (!f) {
+        return 0;
+    }
+    unsigned long size, resident;
+    int n = fscanf(f, "%lu %lu", &size, &resident);
+    fclose(f);
+    if (n != 2) {
+        return 0;
+    }
+    return (size_t)resident * (size_t)sysconf(_SC_PAGESIZE);
+}
@@ -1,8 +1,32 @@
 #ifndef UTIL_H
 #define UTIL_H
 
+#include <stddef.h>
 #include <stdint.h>
 
 int64_t current_time_ms(void);
 
+/* Cached wall clock. The event loop calls clock_refresh() once per
+   iteration so expiry checks and TTL arithmetic within it share one
+   reading; until the first refresh (or after clock_uncache())
+   clock_ms() reads the clock each time. */
+int64_t clock_ms(void);
+int64_t clock_refresh(void);
+void clock_uncache(void);
+
+/* Monotonic microseconds, for time budgets. */
+int64_t monotonic_us(void);
+
+/* Number of decimal digits in v (1 for 0). */
+size_t u64_digits(uint64_t v);
+/* Write v in decimal to dst (no NUL); dst needs room for 20 bytes,
+   21 for a negative i64. Returns the number of bytes written. */
+size_t u64_to_str(char *dst, uint64_t v);
+size_t i64_to_str(char *dst, int64_t v);
+/* Length i64_to_str() would produce. */
+size_t i64_strlen(int64_t v);
+
+/* Resident set size of this process in bytes, 0 if unknown. */
+size_t process_rss_bytes(void);
+
 #endif
@@ -0,0 +1,120 @@
+#include "test.h"
+#include "slab.h"
+#include "arena.h"
+#include <stdint.h>
+#include <string.h>
+
+static int test_slab_size_classes(void) {
+    /* every size maps to the smallest class that holds it */
+    size_t prev = 0;
+    for (size_t size = 1; size <= SLAB_MAX_SIZE; size++) {
+        size_t good = slab_good_size(size);
+        ASSERT_TRUE(good >= size);
+        ASSERT_TRUE(good >= prev);
+        /* at most 25% (or 16 bytes) of rounding */
+        ASSERT_TRUE(good - size < 16 || (good - size) * 4 <= size);
+        prev = good;
+    }
+    ASSERT_EQ_INT(slab_good_size(SLAB_MAX_SIZE), SLAB_MAX_SIZE);
+    ASSERT_EQ_INT(slab_good_size(SLAB_MAX_SIZE + 1), SLAB_MAX_SIZE + 1);
+    return 0;
+}
+
+static int test_slab_reuses_freed_objects(void) {
+    char *a = slab_alloc(40);
+    char *b = slab_alloc(40);
+    ASSERT_TRUE(a != b);
+    ASSERT_EQ_INT((uintptr_t)a % 16, 0);
+    memset(a, 'a', 40);
+    memset(b, 'b', 40);
+    slab_free(a, 40);
+    /* same class (48 bytes): the hole is handed out again */
+    char *c = slab_alloc(33);
+    ASSERT_TRUE(c == a);
+    ASSERT_EQ_INT(b[39], 'b');
+    slab_free(b, 40);
+    slab_free(c, 33);
+    return 0;
+}
+
+static int test_slab_stats_and_unmap(void) {
+    slab_stats_t before, during, after;
+    slab_get_stats(&before);
+
+    /* ~4 pages of a class nothing else uses */
+    enum { N = 60 };
+    void *ptrs[N];
+    for (int i = 0; i < N; i++) {
+        ptrs[i] = slab_alloc(3500);
+    }
+    slab_get_stats(&during);
+    ASSERT_EQ_INT(during.requested - before.requested, N * 3500);
+    ASSERT_EQ_INT(during.allocated - before.allocated, N * 3584);
+    ASSERT_TRUE(during.pages >= before.pages + 3);
+
+    for (int i = 0; i < N; i++) {
+        slab_free(ptrs[i], 3500);
+    }
+    slab_get_stats(&after);
+    ASSERT_EQ_INT(after.requested, before.requested);
+    /* empty pages are returned, apart from one kept per class */
+    ASSERT_TRUE(after.pages <= before.pages + 1);
+    ASSERT_TRUE(after.reserved == after.pages * SLAB_PAGE_SIZE);
+
+    void *big = slab_alloc(SLAB_MAX_SIZE + 100);
+    slab_get_stats(&during);
+    ASSERT_EQ_INT(during.large_count, after.large_count + 1);
+    slab_free(big, SLAB_MAX_SIZE + 100);
+    return 0;
+}
+
+static int test_arena_reset_keeps_first_block(void) {
+    arena_t a;
+    arena_init(&a);
+    size_t base = arena_total_reserved();
+
+    char *p = arena_alloc(&a, 10);
+    char *q = arena_alloc(&a, 10);
+    ASSERT_EQ_INT((uintptr_t)q % 16, 0);
+    ASSERT_TRUE(q >= p + 10);
+    ASSERT_EQ_INT(arena_total_reserved() - base, ARENA_BLOCK_SIZE);
+
+    /* spill into further blocks, then reset back to the first */
+    for (int i = 0; i < 10; i++) {
+        memset(arena_alloc(&a, 3000), 'x', 3000);
+    }
+    ASSERT_TRUE(arena_total_reserved() - base > ARENA_BLOCK_SIZE);
+    arena_reset(&a);
+    ASSERT_EQ_INT(arena_total_reserved() - base, ARENA_BLOCK_SIZE);
+    ASSERT_TRUE(arena_alloc(&a, 10) == p);
+
+    arena_free(&a);
+    ASSERT_EQ_INT(arena_total_reserved(), base);
+    return 0;
+}
+
+static int test_arena_rewind(void) {
+    arena_t a;
+    arena_init(&a);
+    size_t base = arena_total_reserved();
+
+    arena_alloc(&a, 100);
+    arena_mark_t m = arena_mark(&a);
+    char *next = arena_alloc(&a, 16);
+    arena_alloc(&a, 100000);     /* oversized: its own block */
+    arena_rewind(&a, m);
+    ASSERT_EQ_INT(arena_total_reserved() - base, ARENA_BLOCK_SIZE);
+    ASSERT_TRUE(arena_alloc(&a, 16) == next);
+
+    arena_free(&a);
+    return 0;
+}
+
+test_case_t alloc_tests[] = {
+    {"test_slab_size_classes",             test_slab_size_classes},
+    {"test_slab_reuses_freed_objects",     test_slab_reuses_freed_objects},
+    {"test_slab_stats_and_unmap",          test_slab_stats_and_unmap},
+    {"test_arena_reset_keeps_first_block", test_arena_reset_keeps_first_block},
+    {"test_arena_rewind",                  test_arena_rewind},
+};
+int alloc_test_count = sizeof(alloc_tests) / sizeof(alloc_tests[0]);
@@ -0,0 +1,292 @@
+#include "test.h"
+#include "aof.h"
+#include "client.h"
+#include "commands.h"
+#include "evict.h"
+#include "hashtable.h"
+#include "util.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+static char aof_file[64];
+
+static const char *test_path(void) {
+    snprintf(aof_file, sizeof(aof_file), "/tmp/mini-redis-aof-%d.aof",
+             (int)getpid());
+    return aof_file;
+}
+
+static rstr_t view(const char *s) {
+    rstr_t r = {(char *)s, strlen(s)};
+    return r;
+}
+
+/* Run a command the way the server does, discarding its reply; true
+   if the reply was an error. */
+static bool run(client_t *c, hashtable_t *ht, int argc, ...) {
+    resp_value_t argv[8];
+    va_list ap;
+    va_start(ap, argc);
+    for (int i = 0; i < argc; i++) {
+        argv[i].type = RESP_BULK_STRING;
+        argv[i].str = view(va_arg(ap, const char *));
+    }
+    va_end(ap);
+    resp_value_t cmd;
+    cmd.type = RESP_ARRAY;
+    cmd.array.elements = argv;
+    cmd.array.count = argc;
+    dispatch_command(c, ht, &cmd);
+    size_t len;
+    char *out = client_take_output(c, &len);
+    bool error = len > 0 && out[0] == '-';
+    free(out);
+    return error;
+}
+
+static off_t file_size(const char *path) {
+    struct stat sb;
+    return stat(path, &sb) == 0 ? sb.st_size : -1;
+}
+
+static int test_aof_replay(void) {
+    const char *path = test_path();
+    unlink(path);
+    hashtable_t *ht = ht_create();
+    client_t c;
+    client_init(&c);
+
+    ASSERT_EQ_INT(aof_open(path, AOF_FSYNC_ALWAYS, ht), 0);
+    ASSERT_TRUE(aof_enabled());
+    run(&c, ht, 3, "SET", "a", "alpha");
+    run(&c, ht, 3, "INCRBY", "n", "41");
+    run(&c, ht, 2, "INCR", "n");
+    run(&c, ht, 2, "GET", "a");
+    /* queued until the end of the iteration, then one write */
+    ASSERT_EQ_INT(file_size(path), 0);
+    aof_flush(current_time_ms());
+    off_t size = file_size(path);
+    ASSERT_TRUE(size > 0);
+    /* reads aren't logged */
+    run(&c, ht, 2, "GET", "a");
+    aof_flush(current_time_ms());
+    ASSERT_EQ_INT(file_size(path), size);
+    run(&c, ht, 2, "DEL", "a");
+    run(&c, ht, 3, "SET", "b", "beta");
+    aof_close();
+    ASSERT_FALSE(aof_enabled());
+    ht_destroy(ht);
+
+    ht = ht_create();
+    aof_load_stats_t st;
+    ASSERT_EQ_INT(aof_load(ht, path, &st), 0);
+    ASSERT_EQ_INT(st.commands, 5);
+    ASSERT_EQ_INT(st.truncated, 0);
+    ASSERT_FALSE(ht_exists(ht, view("a")));
+    int64_t n;
+    ASSERT_TRUE(ht_entry_int(ht_find(ht, view("n")), &n));
+    ASSERT_EQ_INT(n, 42);
+    rstr_t got;
+    ASSERT_TRUE(ht_get(ht, view("b"), &got));
+    ASSERT_EQ_RSTR(got, view("beta"));
+
+    client_close(&c);
+    ht_destroy(ht);
+    unlink(path);
+    return 0;
+}
+
+static int test_aof_absolute_ttls(void) {
+    const char *path = test_path();
+    unlink(path);
+    hashtable_t *ht = ht_create();
+    client_t c;
+    client_init(&c);
+
+    ASSERT_EQ_INT(aof_open(path, AOF_FSYNC_NO, ht), 0);
+    run(&c, ht, 5, "SET", "s", "v", "EX", "100");
+    run(&c, ht, 3, "SET", "e", "v");
+    run(&c, ht, 3, "EXPIRE", "e", "200");
+    run(&c, ht, 3, "SET", "gone", "v");
+    run(&c, ht, 3, "EXPIRE", "gone", "-1");
+    int64_t s_at = ht_get_expire(ht, view("s"));
+    int64_t e_at = ht_get_expire(ht, view("e"));
+    aof_close();
+    ht_destroy(ht);
+
+    /* replayed later, the keys keep their deadlines, not a fresh TTL */
+    usleep(20000);
+    ht = ht_create();
+    aof_load_stats_t st;
+    ASSERT_EQ_INT(aof_load(ht, path, &st), 0);
+    ASSERT_EQ_INT(ht_get_expire(ht, view("s")), s_at);
+    ASSERT_EQ_INT(ht_get_expire(ht, view("e")), e_at);
+    ASSERT_FALSE(ht_exists(ht, view("gone")));
+
+    client_close(&c);
+    ht_destroy(ht);
+    unlink(path);
+    return 0;
+}
+
+static int test_aof_truncated_tail(void) {
+    const char *path = test_path();
+    unlink(path);
+    hashtable_t *ht = ht_create();
+    client_t c;
+    client_init(&c);
+    ASSERT_EQ_INT(aof_open(path, AOF_FSYNC_NO, ht), 0);
+    run(&c, ht, 3, "SET", "x", "1");
+    run(&c, ht, 3, "SET", "y", "2");
+    aof_close();
+    ht_destroy(ht);
+    off_t whole = file_size(path);
+
+    /* a crash in the middle of the last command */
+    ASSERT_EQ_INT(truncate(path, whole - 3), 0);
+    ht = ht_create();
+    aof_load_stats_t st;
+    ASSERT_EQ_INT(aof_load(ht, path, &st), 0);
+    ASSERT_EQ_INT(st.commands, 1);
+    ASSERT_TRUE(st.truncated > 0);
+    ASSERT_TRUE(ht_exists(ht, view("x")));
+    ASSERT_FALSE(ht_exists(ht, view("y")));
+    /* cut back to the whole commands, so appending can resume */
+    ASSERT_EQ_INT(file_size(path), whole - 3 - (off_t)st.truncated);
+    ht_destroy(ht);
+
+    int fd = open(path, O_WRONLY | O_APPEND);
+    ASSERT_TRUE(write(fd, "garbage\r\n", 9) == 9);
+    close(fd);
+    ht = ht_create();
+    ASSERT_EQ_INT(aof_load(ht, path, &st), -2);
+
+    unlink(path);
+    ASSERT_EQ_INT(aof_load(ht, path, &st), -1);
+    ASSERT_EQ_INT(errno, ENOENT);
+    ht_destroy(ht);
+    client_close(&c);
+    return 0;
+}
+
+static int test_aof_open_writes_base(void) {
+    const char *path = test_path();
+    unlink(path);
+    hashtable_t *ht = ht_create();
+    bool inserted;
+    ht_set(ht, view("str"), view("value"));
+    ht_find_or_insert_int(ht, view("num"), -7, &inserted);
+    ht_set_expire(ht, view("num"), current_time_ms() + 60000);
+
+    /* a store loaded from elsewhere goes into a new file first */
+    ASSERT_EQ_INT(aof_open(path, AOF_FSYNC_EVERYSEC, ht), 0);
+    aof_close();
+    int64_t at = ht_get_expire(ht, view("num"));
+    ht_destroy(ht);
+
+    ht = ht_create();
+    aof_load_stats_t st;
+    ASSERT_EQ_INT(aof_load(ht, path, &st), 0);
+    ASSERT_EQ_INT(st.commands, 3);
+    ASSERT_EQ_INT(ht_count(ht), 2);
+    /* integers are written in decimal, as a client would SET them */
+    rstr_t got;
+    ASSERT_TRUE(ht_get(ht, view("num"), &got));
+    ASSERT_EQ_RSTR(got, view("-7"));
+    ASSERT_EQ_INT(ht_get_expire(ht, view("num")), at);
+
+    ht_destroy(ht);
+    unlink(path);
+    return 0;
+}
+
+/* A write that replied with an error is not logged. */
+static int test_aof_skips_failed_writes(void) {
+    const char *path = test_path();
+    unlink(path);
+    hashtable_t *ht = ht_create();
+    client_t c;
+    client_init(&c);
+    ASSERT_EQ_INT(aof_open(path, AOF_FSYNC_NO, ht), 0);
+    ASSERT_FALSE(run(&c, ht, 3, "SET", "s", "text"));
+    aof_flush(current_time_ms());
+    off_t size = file_size(path);
+    ASSERT_TRUE(size > 0);
+
+    ASSERT_TRUE(run(&c, ht, 2, "INCR", "s"));
+    ASSERT_TRUE(run(&c, ht, 3, "PEXPIREAT", "s", "soon"));
+    ASSERT_TRUE(run(&c, ht, 5, "SET", "s", "v", "PX", "10"));
+    aof_flush(current_time_ms());
+    ASSERT_EQ_INT(file_size(path), size);
+
+    ASSERT_FALSE(run(&c, ht, 2, "DEL", "s"));
+    aof_flush(current_time_ms());
+    ASSERT_TRUE(file_size(path) > size);
+    aof_close();
+    ht_destroy(ht);
+    client_close(&c);
+    unlink(path);
+    return 0;
+}
+
+#define LIMIT_TEST_KEYS 2000
+
+/* --maxmemory applies to clients, not to the file being replayed: every
+   key comes back, whatever the policy, and the limit holds after. */
+static int test_aof_load_ignores_maxmemory(void) {
+    const char *path = test_path();
+    unlink(path);
+    hashtable_t *ht = ht_create();
+    client_t c;
+    client_init(&c);
+    char value[101];
+    memset(value, 'v', sizeof(value) - 1);
+    value[sizeof(value) - 1] = '\0';
+    ASSERT_EQ_INT(aof_open(path, AOF_FSYNC_NO, ht), 0);
+    for (int i = 0; i < LIMIT_TEST_KEYS; i++) {
+        char key[32];
+        snprintf(key, sizeof(key), "key:%d", i);
+        run(&c, ht, 3, "SET", key, value);
+    }
+    aof_close();
+    ht_destroy(ht);
+
+    evict_policy_t policies[] = {EVICT_NOEVICTION, EVICT_ALLKEYS_LRU};
+    for (int p = 0; p < 2; p++) {
+        evict_config(1, policies[p], EVICT_DEFAULT_SAMPLES, 1);
+        ht = ht_create();
+        aof_load_stats_t st;
+        ASSERT_EQ_INT(aof_load(ht, path, &st), 0);
+        ASSERT_FALSE(aof_loading());
+        ASSERT_EQ_INT(st.commands, LIMIT_TEST_KEYS);
+        ASSERT_EQ_INT(ht_count(ht), LIMIT_TEST_KEYS);
+        ht_destroy(ht);
+    }
+
+    ht = ht_create();
+    evict_config(1, EVICT_NOEVICTION, EVICT_DEFAULT_SAMPLES, 1);
+    ASSERT_TRUE(run(&c, ht, 3, "SET", "k", "v"));
+    evict_config(0, EVICT_NOEVICTION, EVICT_DEFAULT_SAMPLES, 1);
+
+    ht_destroy(ht);
+    client_close(&c);
+    unlink(path);
+    return 0;
+}
+
+test_case_t aof_tests[] = {
+    {"test_aof_replay",           test_aof_replay},
+    {"test_aof_absolute_ttls",    test_aof_absolute_ttls},
+    {"test_aof_truncated_tail",   test_aof_truncated_tail},
+    {"test_aof_open_writes_base", test_aof_open_writes_base},
+    {"test_aof_skips_failed_writes", test_aof_skips_failed_writes},
+    {"test_aof_load_ignores_maxmemory", test_aof_load_ignores_maxmemory},
+};
+int aof_test_count = sizeof(aof_tests) / sizeof(aof_tests[0]);
@@ -0,0 +1,298 @@
+#include "test.h"
+#include "client.h"
+#include "resp.h"
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+
+static int make_pair(client_t *c, int *peer) {
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0) {
+        return -1;
+    }
+    fcntl(sv[0], F_SETFL, fcntl(sv[0], F_GETFL, 0) | O_NONBLOCK);
+    client_init(c);
+    c->fd = sv[0];
+    *peer = sv[1];
+    return 0;
+}
+
+static size_t read_all(int fd, char *buf, size_t want) {
+    size_t got = 0;
+    while (got < want) {
+        ssize_t n = read(fd, buf + got, want - got);
+        if (n <= 0) {
+            break;
+        }
+        got += (size_t)n;
+    }
+    return got;
+}
+
+static int test_client_append_coalesces(void) {
+    client_t c;
+    int peer;
+    ASSERT_EQ_INT(make_pair(&c, &peer), 0);
+
+    resp_write_simple_string(&c, "OK");
+    resp_write_integer(&c, 42);
+    /* small replies share one buffer chunk */
+    ASSERT_TRUE(c.reply_head == c.reply_tail);
+    ASSERT_EQ_INT(c.write_len, 10);
+
+    ASSERT_EQ_INT(client_flush(&c), 0);
+    ASSERT_EQ_INT(c.write_len, 0);
+    /* the drained chunk is kept for reuse */
+    ASSERT_NOT_NULL(c.reply_head);
+
+    char buf[16];
+    ASSERT_EQ_INT(read_all(peer, buf, 10), 10);
+    ASSERT_TRUE(memcmp(buf, "+OK\r\n:42\r\n", 10) == 0);
+
+    client_close(&c);
+    close(peer);
+    return 0;
+}
+
+static int test_client_large_value_by_reference(void) {
+    client_t c;
+    int peer;
+    ASSERT_EQ_INT(make_pair(&c, &peer), 0);
+
+    size_t n = RSTR_SHARED_MIN * 2;
+    char *src = malloc(n);
+    for (size_t i = 0; i < n; i++) {
+        src[i] = (char)('a' + i % 26);
+    }
+    rstr_t value = rstr_create(src, n);
+
+    resp_write_bulk_value(&c, value);
+    /* header chunk, referenced value, trailer chunk */
+    ASSERT_NOT_NULL(c.reply_head->next);
+    ASSERT_EQ_INT(c.reply_head->next->cap, 0);
+    ASSERT_TRUE(c.reply_head->next->ref.data == value.data);
+
+    /* the queued reply outlives the stored value */
+    rstr_free(&value);
+
+    ASSERT_EQ_INT(client_flush(&c), 0);
+    char *buf = malloc(n + 32);
+    char header[32];
+    int h = snprintf(header, sizeof(header), "$%zu\r\n", n);
+    ASSERT_EQ_INT(read_all(peer, buf, (size_t)h + n + 2), (size_t)h + n + 2);
+    ASSERT_TRUE(memcmp(buf, header, (size_t)h) == 0);
+    ASSERT_TRUE(memcmp(buf + h, src, n) == 0);
+    ASSERT_TRUE(memcmp(buf + h + n, "\r\n", 2) == 0);
+
+    free(buf);
+    free(src);
+    client_close(&c);
+    close(peer);
+    return 0;
+}
+
+static int test_client_flush_io_defers_refs(void) {
+    client_t c;
+    int peer;
+    ASSERT_EQ_INT(make_pair(&c, &peer), 0);
+
+    size_t n = RSTR_SHARED_MIN;
+    rstr_t value = rstr_create(NULL, n);
+    memset(value.data, 'v', n);
+    resp_write_bulk_value(&c, value);
+
+    /* sent in full, but the reference is parked for the main thread */
+    ASSERT_EQ_INT(client_flush_io(&c), 0);
+    ASSERT_EQ_INT(c.write_len, 0);
+    ASSERT_NOT_NULL(c.sent_refs);
+    ASSERT_TRUE(c.sent_refs->ref.data == value.data);
+    ASSERT_NULL(c.sent_refs->next);
+
+    client_release_sent(&c);
+    ASSERT_NULL(c.sent_refs);
+
+    char *buf = malloc(n + 32);
+    ASSERT_TRUE(read_all(peer, buf, n + 10) == n + 10);
+    ASSERT_TRUE(buf[n + 7] == 'v' && buf[n + 8] == '\r');
+    free(buf);
+    rstr_free(&value);
+    client_close(&c);
+    close(peer);
+    return 0;
+}
+
+static int test_client_partial_flush(void) {
+    client_t c;
+    int peer;
+    ASSERT_EQ_INT(make_pair(&c, &peer), 0);
+
+    /* more than a socketpair buffers, so the flush stops at EAGAIN */
+    size_t total = 4 * 1024 * 1024;
+    char block[4096];
+    memset(block, 'x', sizeof(block));
+    for (size_t i = 0; i < total / sizeof(block); i++) {
+        client_write_append(&c, block, sizeof(block));
+    }
+    ASSERT_EQ_INT(c.write_len, total);
+    ASSERT_EQ_INT(client_flush(&c), 0);
+    ASSERT_TRUE(c.write_len > 0);
+    ASSERT_TRUE(c.write_len < total);
+
+    char *buf = malloc(total);
+    size_t got = 0;
+    while (got < total) {
+        ssize_t n = read(peer, buf + got, total - got);
+        ASSERT_TRUE(n > 0);
+        got += (size_t)n;
+        ASSERT_EQ_INT(client_flush(&c), 0);
+    }
+    ASSERT_EQ_INT(c.write_len, 0);
+    ASSERT_EQ_INT(buf[total - 1], 'x');
+
+    free(buf);
+    client_close(&c);
+    close(peer);
+    return 0;
+}
+
+static int test_client_flush_closed_peer(void) {
+    client_t c;
+    int peer;
+    ASSERT_EQ_INT(make_pair(&c, &peer), 0);
+    close(peer);
+
+    /* no SIGPIPE: the error is reported instead */
+    resp_write_simple_string(&c, "OK");
+    ASSERT_EQ_INT(client_flush(&c), -1);
+    client_close(&c);
+    return 0;
+}
+
+static int test_client_table_free_list(void) {
+    client_table_t t;
+    client_table_init(&t);
+    client_t *a = client_table_acquire(&t);
+    client_t *b = client_table_acquire(&t);
+    ASSERT_EQ_INT(a->slot, 0);
+    ASSERT_EQ_INT(b->slot, 1);
+
+    /* growing the table leaves clients where they are */
+    for (int i = 2; i < 200; i++) {
+        ASSERT_EQ_INT(client_table_acquire(&t)->slot, i);
+    }
+    ASSERT_TRUE(client_table_get(&t, 0) == a);
+    ASSERT_TRUE(client_table_get(&t, 1) == b);
+    ASSERT_NULL(client_table_get(&t, 200));
+    ASSERT_EQ_INT(client_table_open(&t), 200);
+
+    /* closed slots come back, the latest first, before any new one */
+    client_table_release(&t, a);
+    client_table_release(&t, b);
+    ASSERT_EQ_INT(b->slot, 1);
+    ASSERT_EQ_INT(client_table_open(&t), 198);
+    ASSERT_TRUE(client_table_acquire(&t) == b);
+    ASSERT_TRUE(client_table_acquire(&t) == a);
+    ASSERT_EQ_INT(client_table_acquire(&t)->slot, 200);
+    client_table_free(&t);
+    return 0;
+}
+
+static int test_client_reclaim(void) {
+    client_t c;
+    int peer;
+    ASSERT_EQ_INT(make_pair(&c, &peer), 0);
+
+    /* a large request and reply leave grown buffers behind */
+    c.read_buf = malloc(64 * 1024);
+    c.read_cap = 64 * 1024;
+    arena_alloc(&c.req_arena, 100);
+    resp_write_simple_string(&c, "OK");
+    ASSERT_TRUE(client_reclaim(&c) == 0);   /* output pending */
+    ASSERT_EQ_INT(client_flush(&c), 0);
+    ASSERT_NOT_NULL(c.reply_head);
+
+    ASSERT_TRUE(client_reclaim(&c) >= 64 * 1024 - MIN_BUF_SIZE +
+                                     REPLY_CHUNK_SIZE + ARENA_BLOCK_SIZE);
+    ASSERT_EQ_INT(c.read_cap, MIN_BUF_SIZE);
+    ASSERT_NULL(c.reply_head);
+    ASSERT_NULL(c.req_arena.head);
+    ASSERT_EQ_INT(client_reclaim(&c), 0);
+
+    /* still usable afterwards */
+    resp_write_simple_string(&c, "OK");
+    ASSERT_EQ_INT(client_flush(&c), 0);
+    char buf[16];
+    ASSERT_EQ_INT(read_all(peer, buf, 10), 10);
+    ASSERT_TRUE(memcmp(buf, "+OK\r\n+OK\r\n", 10) == 0);
+
+    /* unconsumed input is kept as it is */
+    c.read_len = 5;
+    ASSERT_EQ_INT(client_reclaim(&c), 0);
+    c.read_len = 0;
+
+    client_close(&c);
+    close(peer);
+    return 0;
+}
+
+/* Soft and hard limits on queued output and unprocessed input; a
+   replica is exempt. */
+static int test_client_buffer_limits(void) {
+    client_limits_t saved = *client_limits();
+    client_limits_t l = {100, 50, 200, 100};
+    client_set_limits(&l);
+    client_t c;
+    int peer;
+    ASSERT_EQ_INT(make_pair(&c, &peer), 0);
+
+    char data[300];
+    memset(data, 'x', sizeof(data));
+    client_write_append(&c, data, 50);
+    ASSERT_FALSE(client_output_over_soft(&c));
+    client_write_append(&c, data, 1);
+    ASSERT_TRUE(client_output_over_soft(&c));
+    ASSERT_FALSE(client_output_over_hard(&c));
+    client_write_append(&c, data, 50);
+    ASSERT_TRUE(client_output_over_hard(&c));
+    ASSERT_EQ_INT(client_reply_chunks(&c), 1);
+    c.replica = 0;
+    ASSERT_FALSE(client_output_over_soft(&c));
+    ASSERT_FALSE(client_output_over_hard(&c));
+    c.replica = -1;
+
+    /* consumed input does not count; a pending command counts from
+       its start */
+    ASSERT_EQ_INT(write(peer, data, 150), 150);
+    ASSERT_EQ_INT(client_read(&c, true), 0);
+    ASSERT_TRUE(client_query_over_soft(&c));
+    c.read_pos = 100;
+    ASSERT_EQ_INT(client_query_len(&c), 50);
+    ASSERT_FALSE(client_query_over_soft(&c));
+    c.req_argc = 1;
+    c.req_start = 20;
+    ASSERT_EQ_INT(client_query_len(&c), 130);
+    c.req_argc = -1;
+    ASSERT_TRUE(client_memory(&c) >= c.read_cap + 101);
+
+    ASSERT_EQ_INT(write(peer, data, 300), 300);
+    ASSERT_EQ_INT(client_read(&c, true), CLIENT_READ_LIMIT);
+
+    client_close(&c);
+    close(peer);
+    client_set_limits(&saved);
+    return 0;
+}
+
+test_case_t client_tests[] = {
+    {"test_client_append_coalesces",         test_client_append_coalesces},
+    {"test_client_large_value_by_reference", test_client_large_value_by_reference},
+    {"test_client_flush_io_defers_refs",     test_client_flush_io_defers_refs},
+    {"test_client_partial_flush",            test_client_partial_flush},
+    {"test_client_flush_closed_peer",        test_client_flush_closed_peer},
+    {"test_client_table_free_list",          test_client_table_free_list},
+    {"test_client_reclaim",                  test_client_reclaim},
+    {"test_client_buffer_limits",            test_client_buffer_limits},
+};
+int client_test_count = sizeof(client_tests) / sizeof(client_tests[0]);
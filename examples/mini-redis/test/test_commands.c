@@ -0,0 +1,50 @@
+#include "test.h"
+#include "commands.h"
+#include <ctype.h>
+
+static int test_lookup_every_command(void) {
+    for (int id = 0; id < CMD_COUNT; id++) {
+        const char *name = command_name((cmd_id_t)id);
+        ASSERT_NOT_NULL(name);
+        ASSERT_EQ_INT(command_lookup(name, strlen(name)), id);
+
+        /* lowercase variant */
+        char lower[32];
+        size_t len = strlen(name);
+        for (size_t i = 0; i < len; i++) {
+            lower[i] = (char)tolower((unsigned char)name[i]);
+        }
+        ASSERT_EQ_INT(command_lookup(lower, len), id);
+    }
+    return 0;
+}
+
+static int test_lookup_mixed_case(void) {
+    ASSERT_EQ_INT(command_lookup("gEt", 3), CMD_GET);
+    ASSERT_EQ_INT(command_lookup("Exists", 6), CMD_EXISTS);
+    ASSERT_EQ_INT(command_lookup("expIRE", 6), CMD_EXPIRE);
+    return 0;
+}
+
+static int test_lookup_unknown(void) {
+    ASSERT_EQ_INT(command_lookup("FOOBAR", 6), CMD_UNKNOWN);
+    ASSERT_EQ_INT(command_lookup("", 0), CMD_UNKNOWN);
+    ASSERT_EQ_INT(command_lookup("G", 1), CMD_UNKNOWN);
+    /* same length and key characters as a real command */
+    ASSERT_EQ_INT(command_lookup("EXIXTS", 6), CMD_UNKNOWN);
+    ASSERT_EQ_INT(command_lookup("GETT", 4), CMD_UNKNOWN);
+    /* '@' folds onto '`' but must not match */
+    ASSERT_EQ_INT(command_lookup("G@T", 3), CMD_UNKNOWN);
+    /* the name is not NUL-terminated by the parser */
+    ASSERT_EQ_INT(command_lookup("GETX", 3), CMD_GET);
+    ASSERT_NULL(command_name(CMD_UNKNOWN));
+    ASSERT_NULL(command_name(CMD_COUNT));
+    return 0;
+}
+
+test_case_t command_tests[] = {
+    {"test_lookup_every_command", test_lookup_every_command},
+    {"test_lookup_mixed_case",    test_lookup_mixed_case},
+    {"test_lookup_unknown",       test_lookup_unknown},
+};
+int command_test_count = sizeof(command_tests) / sizeof(command_tests[0]);
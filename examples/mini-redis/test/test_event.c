@@ -0,0 +1,97 @@
+#include "test.h"
+#include "event.h"
+#include <unistd.h>
+#include <sys/socket.h>
+
+static int check_backend(ev_backend_t backend) {
+    event_loop_t *el = ev_create(backend);
+    ASSERT_NOT_NULL(el);
+
+    int sv[2];
+    ASSERT_EQ_INT(socketpair(AF_UNIX, SOCK_STREAM, 0, sv), 0);
+    ASSERT_EQ_INT(ev_add(el, sv[0], EV_READABLE, 7), 0);
+
+    ev_fired_t fired[4];
+
+    /* nothing to read yet */
+    ASSERT_EQ_INT(ev_wait(el, fired, 4, 0), 0);
+
+    ASSERT_EQ_INT(write(sv[1], "x", 1), 1);
+    ASSERT_EQ_INT(ev_wait(el, fired, 4, 100), 1);
+    ASSERT_EQ_INT(fired[0].fd, sv[0]);
+    ASSERT_EQ_INT(fired[0].token, 7);
+    ASSERT_TRUE(fired[0].mask & EV_READABLE);
+
+    char c;
+    ASSERT_EQ_INT(read(sv[0], &c, 1), 1);
+
+    /* arming write interest reports writability */
+    ASSERT_EQ_INT(ev_modify(el, sv[0], EV_READABLE | EV_WRITABLE, 7), 0);
+    ASSERT_EQ_INT(ev_wait(el, fired, 4, 100), 1);
+    ASSERT_TRUE(fired[0].mask & EV_WRITABLE);
+    ASSERT_FALSE(fired[0].mask & EV_READABLE);
+
+    /* removed fds no longer fire */
+    ev_del(el, sv[0]);
+    ASSERT_EQ_INT(write(sv[1], "y", 1), 1);
+    ASSERT_EQ_INT(ev_wait(el, fired, 4, 0), 0);
+
+    close(sv[0]);
+    close(sv[1]);
+    ev_destroy(el);
+    return 0;
+}
+
+static int test_event_poll_backend(void) {
+    return check_backend(EV_BACKEND_POLL);
+}
+
+static int test_event_default_backend(void) {
+    return check_backend(ev_default_backend());
+}
+
+static int test_event_poll_swap_remove(void) {
+    event_loop_t *el = ev_create(EV_BACKEND_POLL);
+    ASSERT_NOT_NULL(el);
+
+    int a[2], b[2];
+    ASSERT_EQ_INT(socketpair(AF_UNIX, SOCK_STREAM, 0, a), 0);
+    ASSERT_EQ_INT(socketpair(AF_UNIX, SOCK_STREAM, 0, b), 0);
+    ASSERT_EQ_INT(ev_add(el, a[0], EV_READABLE, 1), 0);
+    ASSERT_EQ_INT(ev_add(el, b[0], EV_READABLE, 2), 0);
+
+    /* removing the first entry must keep the second one registered */
+    ev_del(el, a[0]);
+    ASSERT_EQ_INT(write(b[1], "x", 1), 1);
+
+    ev_fired_t fired[4];
+    ASSERT_EQ_INT(ev_wait(el, fired, 4, 100), 1);
+    ASSERT_EQ_INT(fired[0].token, 2);
+
+    ASSERT_TRUE(ev_add(el, b[0], EV_READABLE, 2) < 0);
+
+    close(a[0]);
+    close(a[1]);
+    close(b[0]);
+    close(b[1]);
+    ev_destroy(el);
+    return 0;
+}
+
+static int test_event_backend_parse(void) {
+    ev_backend_t b;
+    ASSERT_TRUE(ev_backend_parse("poll", &b));
+    ASSERT_EQ_INT(b, EV_BACKEND_POLL);
+    ASSERT_TRUE(ev_backend_parse("epoll", &b));
+    ASSERT_EQ_INT(b, EV_BACKEND_EPOLL);
+    ASSERT_FALSE(ev_backend_parse("kqueue", &b));
+    return 0;
+}
+
+test_case_t event_tests[] = {
+    {"test_event_poll_backend",     test_event_poll_backend},
+    {"test_event_default_backend",  test_event_default_backend},
+    {"test_event_poll_swap_remove", test_event_poll_swap_remove},
+    {"test_event_backend_parse",    test_event_backend_parse},
+};
+int event_test_count = sizeof(event_tests) / sizeof(event_tests[0]);
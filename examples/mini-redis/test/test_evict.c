@@ -0,0 +1,166 @@
+#include "test.h"
+#include "evict.h"
+#include "hashtable.h"
+#include "util.h"
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#define NO_LIMIT ((size_t)1 << 40)
+
+static rstr_t str(const char *s) {
+    rstr_t r = {(char *)s, strlen(s)};
+    return r;
+}
+
+static rstr_t key_n(char *buf, size_t size, int i) {
+    rstr_t k = {buf, (size_t)snprintf(buf, size, "key:%d", i)};
+    return k;
+}
+
+/* Values big enough to need a block, so evicting one frees memory. */
+static void fill(hashtable_t *ht, int n) {
+    char value[100];
+    memset(value, 'v', sizeof(value));
+    for (int i = 0; i < n; i++) {
+        char buf[32];
+        ht_set(ht, key_n(buf, sizeof(buf), i),
+               (rstr_t){value, sizeof(value)});
+    }
+}
+
+static int test_evict_policy_names(void) {
+    const char *names[] = {"noeviction", "allkeys-lru", "allkeys-lfu",
+                           "volatile-ttl"};
+    for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+        evict_policy_t p;
+        ASSERT_TRUE(evict_policy_parse(names[i], &p));
+        ASSERT_EQ_STR(evict_policy_name(p), names[i]);
+    }
+    evict_policy_t p;
+    ASSERT_FALSE(evict_policy_parse("allkeys-random", &p));
+    return 0;
+}
+
+/* Lookups bump the counter logarithmically; the access bits never get
+   in the way of finding the key, before or after a resize. */
+static int test_evict_lfu_counter(void) {
+    evict_config(NO_LIMIT, EVICT_ALLKEYS_LFU, EVICT_DEFAULT_SAMPLES, 1);
+    ASSERT_EQ_INT(ht_access_mode(), HT_ACCESS_LFU);
+    hashtable_t *ht = ht_create();
+    ht_set(ht, str("hot"), str("1"));
+    ht_set(ht, str("cold"), str("2"));
+    /* the lookup is the key's first access */
+    ASSERT_EQ_INT(ht_entry_lfu(ht_find(ht, str("cold"))),
+                  HT_LFU_INIT + 1);
+
+    for (int i = 0; i < 2000; i++) {
+        ASSERT_TRUE(ht_get(ht, str("hot"), NULL));
+    }
+    unsigned hot = ht_entry_lfu(ht_find(ht, str("hot")));
+    ASSERT_TRUE(hot > HT_LFU_INIT + 5);
+    ASSERT_TRUE(hot < 100);
+
+    ht_set_expire(ht, str("hot"), current_time_ms() + 60000);
+    fill(ht, 1000);
+    rstr_t v;
+    ASSERT_TRUE(ht_get(ht, str("hot"), &v));
+    ASSERT_EQ_RSTR(v, str("1"));
+    ht_entry_t *e = ht_next_expiring(ht);
+    ASSERT_NOT_NULL(e);
+    ASSERT_EQ_RSTR(ht_entry_key(e), str("hot"));
+
+    ht_destroy(ht);
+    evict_config(0, EVICT_NOEVICTION, EVICT_DEFAULT_SAMPLES, 1);
+    ASSERT_EQ_INT(ht_access_mode(), HT_ACCESS_NONE);
+    return 0;
+}
+
+static int test_evict_sample(void) {
+    hashtable_t *ht = ht_create();
+    ht_entry_t *out[16];
+    ASSERT_EQ_INT(ht_sample(ht, out, 16), 0);
+    fill(ht, 300);
+    for (int round = 0; round < 20; round++) {
+        ASSERT_EQ_INT(ht_sample(ht, out, 16), 16);
+        for (int i = 0; i < 16; i++) {
+            ASSERT_TRUE(ht_find(ht, ht_entry_key(out[i])) == out[i]);
+            for (int j = 0; j < i; j++) {
+                ASSERT_TRUE(out[i] != out[j]);
+            }
+        }
+    }
+    ht_destroy(ht);
+    return 0;
+}
+
+/* Keys read after the others went idle outlive them. Sampling is
+   approximate: a recent key goes only when every sample is recent,
+   and two going is far past chance. */
+static int test_evict_lru_keeps_recent(void) {
+    evict_config(NO_LIMIT, EVICT_ALLKEYS_LRU, EVICT_DEFAULT_SAMPLES, 1);
+    hashtable_t *ht = ht_create();
+    fill(ht, 200);
+    usleep(HT_LRU_RESOLUTION_MS * 1100);
+    char buf[32];
+    for (int i = 0; i < 20; i++) {
+        ASSERT_TRUE(ht_get(ht, key_n(buf, sizeof(buf), i), NULL));
+    }
+    ASSERT_EQ_INT(ht_entry_idle_ms(ht_find(ht, key_n(buf, sizeof(buf), 0))),
+                  0);
+
+    size_t limit = evict_used_memory(ht) - 60 * 128;
+    evict_config(limit, EVICT_ALLKEYS_LRU, EVICT_DEFAULT_SAMPLES, 1);
+    ASSERT_TRUE(evict_make_room(ht));
+    ASSERT_TRUE(evict_used_memory(ht) <= limit);
+    ASSERT_TRUE(ht_count(ht) < 200);
+    int kept = 0;
+    for (int i = 0; i < 20; i++) {
+        kept += ht_exists(ht, key_n(buf, sizeof(buf), i));
+    }
+    ASSERT_TRUE(kept >= 19);
+
+    ht_destroy(ht);
+    evict_config(0, EVICT_NOEVICTION, EVICT_DEFAULT_SAMPLES, 1);
+    return 0;
+}
+
+/* noeviction refuses; volatile-ttl takes the soonest TTL first and
+   refuses once no key has one. */
+static int test_evict_refusal_and_ttl(void) {
+    hashtable_t *ht = ht_create();
+    fill(ht, 100);
+    char buf[32];
+    int64_t now = current_time_ms();
+    ht_set_expire(ht, key_n(buf, sizeof(buf), 7), now + 30000);
+    ht_set_expire(ht, key_n(buf, sizeof(buf), 3), now + 10000);
+    ht_set_expire(ht, key_n(buf, sizeof(buf), 5), now + 20000);
+
+    size_t used = evict_used_memory(ht);
+    evict_config(used - 1, EVICT_NOEVICTION, EVICT_DEFAULT_SAMPLES, 1);
+    ASSERT_FALSE(evict_make_room(ht));
+    ASSERT_EQ_INT(ht_count(ht), 100);
+
+    evict_config(used - 1, EVICT_VOLATILE_TTL, EVICT_DEFAULT_SAMPLES, 1);
+    ASSERT_TRUE(evict_make_room(ht));
+    ASSERT_EQ_INT(ht_count(ht), 99);
+    ASSERT_FALSE(ht_exists(ht, key_n(buf, sizeof(buf), 3)));
+
+    evict_config(used / 2, EVICT_VOLATILE_TTL, EVICT_DEFAULT_SAMPLES, 1);
+    ASSERT_FALSE(evict_make_room(ht));
+    ASSERT_EQ_INT(ht_count(ht), 97);
+    ASSERT_NULL(ht_next_expiring(ht));
+
+    ht_destroy(ht);
+    evict_config(0, EVICT_NOEVICTION, EVICT_DEFAULT_SAMPLES, 1);
+    return 0;
+}
+
+test_case_t evict_tests[] = {
+    {"test_evict_policy_names",     test_evict_policy_names},
+    {"test_evict_lfu_counter",      test_evict_lfu_counter},
+    {"test_evict_sample",           test_evict_sample},
+    {"test_evict_lru_keeps_recent", test_evict_lru_keeps_recent},
+    {"test_evict_refusal_and_ttl",  test_evict_refusal_and_ttl},
+};
+int evict_test_count = sizeof(evict_tests) / sizeof(evict_tests[0]);
@@ -1,5 +1,6 @@
 #include "test.h"
 #include "glob.h"
+#include <stdlib.h>
 #include <string.h>
 
 static int test_glob_literal(void) {
@@ -75,6 +76,122 @@ static int test_glob_question_star(void) {
     return 0;
 }
 
+static int test_glob_class_forms(void) {
+    /* ']' first is a member, '-' at the end is literal, ranges are
+       inclusive */
+    ASSERT_TRUE(glob_match("[]a]", 4, "]", 1));
+    ASSERT_TRUE(glob_match("[a-]", 4, "-", 1));
+    ASSERT_TRUE(glob_match("[a-c]x", 6, "bx", 2));
+    ASSERT_FALSE(glob_match("[a-c]x", 6, "dx", 2));
+    ASSERT_TRUE(glob_match("[^a-c]", 6, "d", 1));
+    /* a well-formed class never matches its own '[' literally */
+    ASSERT_FALSE(glob_match("[ab]", 4, "[ab]", 4));
+    /* an unterminated '[' is an ordinary character */
+    ASSERT_TRUE(glob_match("a[b", 3, "a[b", 3));
+    ASSERT_FALSE(glob_match("a[b", 3, "ab", 2));
+    return 0;
+}
+
+static bool compiled_match(arena_t *a, const char *pattern, const char *str) {
+    glob_pattern_t g;
+    glob_compile(&g, pattern, strlen(pattern), a);
+    return glob_pattern_match(&g, str, strlen(str));
+}
+
+static int test_glob_compiled_kinds(void) {
+    arena_t a;
+    arena_init(&a);
+    glob_pattern_t g;
+    struct {
+        const char *pattern;
+        glob_kind_t kind;
+    } cases[] = {
+        {"*", GLOB_MATCH_ALL},        {"***", GLOB_MATCH_ALL},
+        {"", GLOB_EXACT},             {"user:1", GLOB_EXACT},
+        {"user:1234:*", GLOB_PREFIX}, {"*:name", GLOB_SUFFIX},
+        {"**mid**", GLOB_CONTAINS},   {"a[b", GLOB_EXACT},
+        {"user:?", GLOB_GENERAL},     {"a*b", GLOB_GENERAL},
+        {"[ab]*", GLOB_GENERAL},
+    };
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        glob_compile(&g, cases[i].pattern, strlen(cases[i].pattern), &a);
+        ASSERT_EQ_INT(g.kind, cases[i].kind);
+    }
+
+    ASSERT_TRUE(compiled_match(&a, "user:1234:*", "user:1234:"));
+    ASSERT_TRUE(compiled_match(&a, "user:1234:*", "user:1234:x"));
+    ASSERT_FALSE(compiled_match(&a, "user:1234:*", "user:123"));
+    ASSERT_TRUE(compiled_match(&a, "*:name", "u:name"));
+    ASSERT_FALSE(compiled_match(&a, "*:name", "name"));
+    ASSERT_TRUE(compiled_match(&a, "*mid*", "amidb"));
+    ASSERT_TRUE(compiled_match(&a, "*mid*", "mimid"));
+    ASSERT_FALSE(compiled_match(&a, "*mid*", "mi"));
+    ASSERT_TRUE(compiled_match(&a, "", ""));
+    ASSERT_FALSE(compiled_match(&a, "", "a"));
+    ASSERT_TRUE(compiled_match(&a, "user:*:name", "user:1:x:name"));
+    ASSERT_FALSE(compiled_match(&a, "a*b*c", "acb"));
+    ASSERT_TRUE(compiled_match(&a, "a??*[0-9]", "abc7"));
+    ASSERT_FALSE(compiled_match(&a, "a??*[0-9]", "ab7"));
+
+    /* an unterminated class after counted ones is a literal '[' and
+       takes no class slot (past the arena's slack, for ASAN) */
+    ASSERT_TRUE(compiled_match(&a, "[a]x[b", "ax[b"));
+    ASSERT_FALSE(compiled_match(&a, "[a]x[b", "axb"));
+    enum { NCLASSES = 2100 };
+    static char many[NCLASSES * 3 + 2], subject[NCLASSES + 2];
+    for (int i = 0; i < NCLASSES; i++) {
+        memcpy(many + i * 3, "[a]", 3);
+        subject[i] = 'a';
+    }
+    memcpy(many + NCLASSES * 3, "[b", 2);
+    memcpy(subject + NCLASSES, "[b", 2);
+    glob_compile(&g, many, sizeof(many), &a);
+    ASSERT_TRUE(glob_pattern_match(&g, subject, sizeof(subject)));
+    ASSERT_FALSE(glob_pattern_match(&g, subject, sizeof(subject) - 1));
+
+    /* binary-safe: classes cover all 256 byte values */
+    glob_compile(&g, "[^a]\0*", 6, &a);
+    ASSERT_TRUE(glob_pattern_match(&g, "\xff\0z", 3));
+    ASSERT_FALSE(glob_pattern_match(&g, "a\0z", 3));
+    arena_free(&a);
+    return 0;
+}
+
+static int test_glob_compiled_agrees(void) {
+    /* Random short patterns over the metacharacters must match exactly
+       the strings the interpreter matches. */
+    static const char pattern_chars[] = "ab[]!^-*?";
+    static const char str_chars[] = "ab[]-!";
+    arena_t a;
+    arena_init(&a);
+    srand(17);
+    char pattern[10], str[10];
+    for (int n = 0; n < 20000; n++) {
+        size_t plen = (size_t)(rand() % 9);
+        for (size_t i = 0; i < plen; i++) {
+            pattern[i] = pattern_chars[rand() % (sizeof(pattern_chars) - 1)];
+        }
+        glob_pattern_t g;
+        glob_compile(&g, pattern, plen, &a);
+        for (int k = 0; k < 16; k++) {
+            size_t slen = (size_t)(rand() % 9);
+            for (size_t i = 0; i < slen; i++) {
+                str[i] = str_chars[rand() % (sizeof(str_chars) - 1)];
+            }
+            bool want = glob_match(pattern, plen, str, slen);
+            if (glob_pattern_match(&g, str, slen) != want) {
+                printf("    pattern \"%.*s\" string \"%.*s\": want %d\n",
+                       (int)plen, pattern, (int)slen, str, want);
+                arena_free(&a);
+                return 1;
+            }
+        }
+        arena_reset(&a);
+    }
+    arena_free(&a);
+    return 0;
+}
+
 test_case_t glob_tests[] = {
     {"test_glob_literal",          test_glob_literal},
     {"test_glob_star",             test_glob_star},
@@ -87,5 +204,8 @@ test_case_t glob_tests[] = {
     {"test_glob_consecutive_stars", test_glob_consecutive_stars},
     {"test_glob_complex",          test_glob_complex},
     {"test_glob_question_star",    test_glob_question_star},
+    {"test_glob_class_forms",      test_glob_class_forms},
+    {"test_glob_compiled_kinds",   test_glob_compiled_kinds},
+    {"test_glob_compiled_agrees",  test_glob_compiled_agrees},
 };
 int glob_test_count = sizeof(glob_tests) / sizeof(glob_tests[0]);
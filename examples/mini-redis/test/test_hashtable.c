@@ -1,6 +1,10 @@
 #include "test.h"
 #include "hashtable.h"
+#include "hash.h"
 #include "rstr.h"
+#include "util.h"
+#include "slab.h"
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -10,9 +14,9 @@ static int test_ht_insert_and_get(void) {
     rstr_t val = rstr_create("world", 5);
 
     ht_set(ht, key, val);
-    rstr_t *got = ht_get(ht, key);
-    ASSERT_NOT_NULL(got);
-    ASSERT_EQ_RSTR(*got, val);
+    rstr_t got;
+    ASSERT_TRUE(ht_get(ht, key, &got));
+    ASSERT_EQ_RSTR(got, val);
 
     rstr_free(&key);
     rstr_free(&val);
@@ -28,9 +32,9 @@ static int test_ht_overwrite(void) {
 
     ht_set(ht, key, val1);
     ht_set(ht, key, val2);
-    rstr_t *got = ht_get(ht, key);
-    ASSERT_NOT_NULL(got);
-    ASSERT_EQ_RSTR(*got, val2);
+    rstr_t got;
+    ASSERT_TRUE(ht_get(ht, key, &got));
+    ASSERT_EQ_RSTR(got, val2);
     ASSERT_EQ_INT(ht_count(ht), 1);
 
     rstr_free(&key);
@@ -47,7 +51,7 @@ static int test_ht_delete(void) {
 
     ht_set(ht, key, val);
     ASSERT_TRUE(ht_delete(ht, key));
-    ASSERT_NULL(ht_get(ht, key));
+    ASSERT_FALSE(ht_get(ht, key, NULL));
     ASSERT_EQ_INT(ht_count(ht), 0);
 
     rstr_free(&key);
@@ -71,7 +75,7 @@ static int test_ht_get_nonexistent(void) {
     hashtable_t *ht = ht_create();
     rstr_t key = rstr_create("nope", 4);
 
-    ASSERT_NULL(ht_get(ht, key));
+    ASSERT_FALSE(ht_get(ht, key, NULL));
 
     rstr_free(&key);
     ht_destroy(ht);
@@ -80,9 +84,9 @@ static int test_ht_get_nonexistent(void) {
 
 static int test_ht_resize(void) {
     hashtable_t *ht = ht_create();
-    /* Initial capacity is 64, load factor 0.7 => resize at >44 */
+    /* Initial capacity is 64, max load 7/8 => resize at >56 */
     char buf[32];
-    for (int i = 0; i < 50; i++) {
+    for (int i = 0; i < 60; i++) {
         int n = snprintf(buf, sizeof(buf), "key%d", i);
         rstr_t key = rstr_create(buf, (size_t)n);
         rstr_t val = rstr_create(buf, (size_t)n);
@@ -91,14 +95,14 @@ static int test_ht_resize(void) {
         rstr_free(&val);
     }
 
-    ASSERT_EQ_INT(ht_count(ht), 50);
-    ASSERT_TRUE(ht->capacity > 64);
+    ASSERT_EQ_INT(ht_count(ht), 60);
+    ASSERT_TRUE(ht_capacity(ht) > 64);
 
     /* Verify all keys still accessible */
-    for (int i = 0; i < 50; i++) {
+    for (int i = 0; i < 60; i++) {
         int n = snprintf(buf, sizeof(buf), "key%d", i);
         rstr_t key = rstr_create(buf, (size_t)n);
-        ASSERT_NOT_NULL(ht_get(ht, key));
+        ASSERT_TRUE(ht_get(ht, key, NULL));
         rstr_free(&key);
     }
 
@@ -106,6 +110,69 @@ static int test_ht_resize(void) {
     return 0;
 }
 
+static int test_ht_reserve(void) {
+    hashtable_t *ht = ht_create();
+    char buf[32];
+    for (int i = 0; i < 10; i++) {
+        int n = snprintf(buf, sizeof(buf), "key%d", i);
+        rstr_t key = {buf, (size_t)n};
+        ht_set(ht, key, key);
+    }
+
+    /* grown at once, keys kept, and no further migration while filling */
+    ht_reserve(ht, 1000);
+    ASSERT_FALSE(ht_is_rehashing(ht));
+    size_t cap = ht_capacity(ht);
+    ASSERT_EQ_INT(cap, 2048);
+    for (int i = 10; i < 1000; i++) {
+        int n = snprintf(buf, sizeof(buf), "key%d", i);
+        rstr_t key = {buf, (size_t)n};
+        ht_set(ht, key, key);
+        ASSERT_FALSE(ht_is_rehashing(ht));
+    }
+    ASSERT_EQ_INT(ht_capacity(ht), cap);
+    ASSERT_EQ_INT(ht_count(ht), 1000);
+    for (int i = 0; i < 1000; i++) {
+        int n = snprintf(buf, sizeof(buf), "key%d", i);
+        rstr_t key = {buf, (size_t)n};
+        ASSERT_TRUE(ht_get(ht, key, NULL));
+    }
+
+    /* never shrinks */
+    ht_reserve(ht, 10);
+    ASSERT_EQ_INT(ht_capacity(ht), cap);
+
+    ht_destroy(ht);
+    return 0;
+}
+
+static int test_ht_clear(void) {
+    hashtable_t *ht = ht_create();
+    char buf[32];
+    for (int i = 0; i < 200; i++) {
+        int n = snprintf(buf, sizeof(buf), "key%d", i);
+        rstr_t key = {buf, (size_t)n};
+        ht_set(ht, key, key);
+        if (i % 2 == 0) {
+            ht_set_expire(ht, key, current_time_ms() + 60000);
+        }
+    }
+
+    ht_clear(ht);
+    ASSERT_EQ_INT(ht_count(ht), 0);
+    ASSERT_FALSE(ht_is_rehashing(ht));
+    ASSERT_EQ_INT(ht_capacity(ht), 64);
+    ASSERT_EQ_INT(ht_next_expire(ht), -1);
+    rstr_t key = {"key7", 4};
+    ASSERT_FALSE(ht_exists(ht, key));
+
+    /* usable again afterwards */
+    ht_set(ht, key, key);
+    ASSERT_TRUE(ht_exists(ht, key));
+    ht_destroy(ht);
+    return 0;
+}
+
 static int test_ht_many_keys(void) {
     hashtable_t *ht = ht_create();
     char buf[32];
@@ -124,12 +191,12 @@ static int test_ht_many_keys(void) {
     for (int i = 0; i < 1000; i++) {
         int n = snprintf(buf, sizeof(buf), "k%d", i);
         rstr_t key = rstr_create(buf, (size_t)n);
-        rstr_t *got = ht_get(ht, key);
-        ASSERT_NOT_NULL(got);
+        rstr_t got;
+        ASSERT_TRUE(ht_get(ht, key, &got));
 
         n = snprintf(buf, sizeof(buf), "v%d", i);
         rstr_t expected = rstr_create(buf, (size_t)n);
-        ASSERT_EQ_RSTR(*got, expected);
+        ASSERT_EQ_RSTR(got, expected);
         rstr_free(&key);
         rstr_free(&expected);
     }
@@ -138,6 +205,68 @@ static int test_ht_many_keys(void) {
     return 0;
 }
 
+static int test_ht_high_load(void) {
+    hashtable_t *ht = ht_create();
+    char buf[32];
+    /* 56 of 64 slots: at the limit, but no resize yet */
+    for (int i = 0; i < 56; i++) {
+        int n = snprintf(buf, sizeof(buf), "load%d", i);
+        rstr_t key = rstr_create(buf, (size_t)n);
+        ht_set(ht, key, key);
+        rstr_free(&key);
+    }
+    ASSERT_EQ_INT(ht_capacity(ht), 64);
+
+    for (int i = 0; i < 56; i++) {
+        int n = snprintf(buf, sizeof(buf), "load%d", i);
+        rstr_t key = rstr_create(buf, (size_t)n);
+        rstr_t got;
+        ASSERT_TRUE(ht_get(ht, key, &got));
+        ASSERT_EQ_RSTR(got, key);
+        rstr_free(&key);
+    }
+    for (int i = 56; i < 200; i++) {
+        int n = snprintf(buf, sizeof(buf), "load%d", i);
+        rstr_t key = rstr_create(buf, (size_t)n);
+        ASSERT_FALSE(ht_get(ht, key, NULL));
+        rstr_free(&key);
+    }
+
+    ht_destroy(ht);
+    return 0;
+}
+
+static int test_ht_delete_churn(void) {
+    hashtable_t *ht = ht_create();
+    char buf[32];
+    /* Insert/delete many distinct keys while only a few are live:
+       tombstones must be reclaimed instead of growing the table. */
+    for (int i = 0; i < 10000; i++) {
+        int n = snprintf(buf, sizeof(buf), "churn%d", i);
+        rstr_t key = rstr_create(buf, (size_t)n);
+        ht_set(ht, key, key);
+        rstr_free(&key);
+        if (i >= 20) {
+            n = snprintf(buf, sizeof(buf), "churn%d", i - 20);
+            key = rstr_create(buf, (size_t)n);
+            ASSERT_TRUE(ht_delete(ht, key));
+            rstr_free(&key);
+        }
+    }
+    ASSERT_EQ_INT(ht_count(ht), 20);
+    ASSERT_EQ_INT(ht_capacity(ht), 64);
+
+    for (int i = 9980; i < 10000; i++) {
+        int n = snprintf(buf, sizeof(buf), "churn%d", i);
+        rstr_t key = rstr_create(buf, (size_t)n);
+        ASSERT_TRUE(ht_exists(ht, key));
+        rstr_free(&key);
+    }
+
+    ht_destroy(ht);
+    return 0;
+}
+
 static int test_ht_iterator(void) {
     hashtable_t *ht = ht_create();
     int n_keys = 20;
@@ -197,6 +326,396 @@ static int test_ht_iterator_with_tombstones(void) {
     return 0;
 }
 
+/* Fill a fresh table until the next insert starts a migration. */
+static hashtable_t *rehashing_table(int n_keys) {
+    hashtable_t *ht = ht_create_seeded(7);
+    char buf[32];
+    for (int i = 0; i < n_keys; i++) {
+        int n = snprintf(buf, sizeof(buf), "rh%d", i);
+        rstr_t key = rstr_create(buf, (size_t)n);
+        ht_set(ht, key, key);
+        rstr_free(&key);
+    }
+    return ht;
+}
+
+static int test_ht_incremental_rehash(void) {
+    /* 57th key crosses 7/8 of 64 slots */
+    hashtable_t *ht = rehashing_table(57);
+    char buf[32];
+    ASSERT_TRUE(ht_is_rehashing(ht));
+    ASSERT_EQ_INT(ht_capacity(ht), 128);
+    ASSERT_EQ_INT(ht_count(ht), 57);
+
+    /* keys are found in either table mid-migration */
+    for (int i = 0; i < 57; i++) {
+        int n = snprintf(buf, sizeof(buf), "rh%d", i);
+        rstr_t key = rstr_create(buf, (size_t)n);
+        rstr_t got;
+        ASSERT_TRUE(ht_get(ht, key, &got));
+        ASSERT_EQ_RSTR(got, key);
+        rstr_free(&key);
+    }
+    rstr_t gone = rstr_create("rh3", 3);
+    ASSERT_TRUE(ht_delete(ht, gone));
+    ASSERT_FALSE(ht_exists(ht, gone));
+
+    /* 4 old groups, one already moved by the delete */
+    int steps = 0;
+    while (ht_rehash_step(ht, 1)) {
+        steps++;
+    }
+    ASSERT_TRUE(steps <= 3);
+    ASSERT_FALSE(ht_is_rehashing(ht));
+    ASSERT_EQ_INT(ht_count(ht), 56);
+    ASSERT_FALSE(ht_exists(ht, gone));
+    for (int i = 0; i < 57; i++) {
+        if (i == 3) {
+            continue;
+        }
+        int n = snprintf(buf, sizeof(buf), "rh%d", i);
+        rstr_t key = rstr_create(buf, (size_t)n);
+        ASSERT_TRUE(ht_exists(ht, key));
+        rstr_free(&key);
+    }
+
+    rstr_free(&gone);
+    ht_destroy(ht);
+    return 0;
+}
+
+static int test_ht_iterator_during_rehash(void) {
+    hashtable_t *ht = rehashing_table(57);
+    int seen[57] = {0};
+    ASSERT_TRUE(ht_is_rehashing(ht));
+
+    ht_iter_t iter;
+    rstr_t key;
+    int count = 0;
+    ht_iter_init(ht, &iter);
+    while (ht_iter_next(&iter, &key, NULL)) {
+        int idx = 0;
+        for (size_t j = 2; j < key.len; j++) {
+            idx = idx * 10 + (key.data[j] - '0');
+        }
+        ASSERT_TRUE(idx >= 0 && idx < 57);
+        seen[idx]++;
+        count++;
+        /* overwrites and explicit steps must not move entries */
+        rstr_t k = rstr_create(key.data, key.len);
+        ht_set(ht, k, k);
+        rstr_free(&k);
+        ASSERT_TRUE(ht_rehash_step(ht, 100));
+    }
+    ASSERT_EQ_INT(count, 57);
+    for (int i = 0; i < 57; i++) {
+        ASSERT_EQ_INT(seen[i], 1);
+    }
+
+    /* exhausted iterator no longer holds migration back */
+    ASSERT_FALSE(ht_rehash_step(ht, 100));
+    ht_destroy(ht);
+    return 0;
+}
+
+/* Walk ht, inserting `inserts` new keys once `after` keys have been
+   seen (or once the walk reaches t[1] when after < 0); every rh key
+   must still come up exactly once. */
+static int walk_while_inserting(hashtable_t *ht, int after, int inserts) {
+    int seen[57] = {0};
+    char buf[32];
+    ht_iter_t iter;
+    rstr_t key;
+    int count = 0;
+    ht_iter_init(ht, &iter);
+    while (ht_iter_next(&iter, &key, NULL)) {
+        if (key.len > 2 && memcmp(key.data, "rh", 2) == 0) {
+            int idx = 0;
+            for (size_t j = 2; j < key.len; j++) {
+                idx = idx * 10 + (key.data[j] - '0');
+            }
+            ASSERT_TRUE(idx >= 0 && idx < 57);
+            seen[idx]++;
+        }
+        count++;
+        bool now = after < 0 ? iter.table == 1 : count == after;
+        for (int i = 0; now && i < inserts; i++) {
+            int n = snprintf(buf, sizeof(buf), "new%d", i);
+            rstr_t k = rstr_create(buf, (size_t)n);
+            ht_set(ht, k, k);
+            rstr_free(&k);
+        }
+        if (now) {
+            after = 0;
+        }
+    }
+    for (int i = 0; i < 57; i++) {
+        ASSERT_EQ_INT(seen[i], 1);
+    }
+    ASSERT_EQ_INT(ht_count(ht), 57 + inserts);
+    return 0;
+}
+
+static int test_ht_iterator_target_full(void) {
+    /* walk in t[0]: 200 inserts take t[1] (128 slots) past its limit */
+    hashtable_t *ht = rehashing_table(57);
+    ASSERT_TRUE(ht_is_rehashing(ht));
+    ASSERT_EQ_INT(walk_while_inserting(ht, 1, 200), 0);
+    ASSERT_TRUE(ht_is_rehashing(ht));
+    ASSERT_EQ_INT(ht_capacity(ht), 256);
+    ht_destroy(ht);
+
+    /* walk in t[1]: it keeps its layout past the load limit */
+    ht = rehashing_table(57);
+    ASSERT_EQ_INT(walk_while_inserting(ht, -1, 60), 0);
+    ASSERT_EQ_INT(ht_capacity(ht), 128);
+    for (int i = 0; i < 60; i++) {
+        char buf[32];
+        int n = snprintf(buf, sizeof(buf), "new%d", i);
+        rstr_t k = rstr_create(buf, (size_t)n);
+        ASSERT_TRUE(ht_exists(ht, k));
+        rstr_free(&k);
+    }
+    ht_destroy(ht);
+    return 0;
+}
+
+static int test_ht_iter_release(void) {
+    hashtable_t *ht = rehashing_table(57);
+    ht_iter_t iter;
+    rstr_t key;
+
+    ht_iter_init(ht, &iter);
+    ASSERT_TRUE(ht_iter_next(&iter, &key, NULL));
+    ASSERT_TRUE(ht_rehash_step(ht, 100));
+    ht_iter_release(&iter);
+    ht_iter_release(&iter);
+    ASSERT_FALSE(ht_iter_next(&iter, &key, NULL));
+    ASSERT_FALSE(ht_rehash_step(ht, 100));
+    ASSERT_EQ_INT(ht_count(ht), 57);
+
+    ht_destroy(ht);
+    return 0;
+}
+
+/* ht_scan callback: count sightings of "rh<N>" keys below limit */
+typedef struct {
+    int *seen;
+    int limit;
+    int calls;
+} scan_seen_t;
+
+static void scan_mark(void *ctx, rstr_t key) {
+    scan_seen_t *ss = ctx;
+    int idx = 0;
+    for (size_t j = 2; j < key.len; j++) {
+        idx = idx * 10 + (key.data[j] - '0');
+    }
+    if (idx < ss->limit) {
+        ss->seen[idx]++;
+    }
+}
+
+static int test_ht_scan_full(void) {
+    hashtable_t *ht = rehashing_table(1000);
+    while (ht_rehash_step(ht, 100)) {
+    }
+    int seen[1000] = {0};
+    scan_seen_t ss = { seen, 1000, 0 };
+
+    size_t cursor = 0;
+    do {
+        cursor = ht_scan(ht, cursor, scan_mark, &ss);
+        ss.calls++;
+    } while (cursor != 0);
+
+    /* one call per group; a stable table reports each key once */
+    ASSERT_EQ_INT(ss.calls, (int)(ht_capacity(ht) / HT_GROUP_WIDTH));
+    for (int i = 0; i < 1000; i++) {
+        ASSERT_EQ_INT(seen[i], 1);
+    }
+    ht_destroy(ht);
+    return 0;
+}
+
+static int test_ht_scan_across_growth(void) {
+    hashtable_t *ht = rehashing_table(200);
+    while (ht_rehash_step(ht, 100)) {
+    }
+    int seen[200] = {0};
+    scan_seen_t ss = { seen, 200, 0 };
+    char buf[32];
+
+    size_t cursor = 0;
+    int calls = 0;
+    bool saw_rehash = false;
+    do {
+        cursor = ht_scan(ht, cursor, scan_mark, &ss);
+        /* grow the table (several times, partly mid-rehash) between
+           calls; the first 200 keys stay put throughout */
+        for (int i = 0; i < 40; i++) {
+            int n = snprintf(buf, sizeof(buf), "rh%d", 200 + calls * 40 + i);
+            rstr_t key = { buf, (size_t)n };
+            ht_set(ht, key, key);
+        }
+        saw_rehash |= ht_is_rehashing(ht);
+        calls++;
+    } while (cursor != 0);
+
+    ASSERT_TRUE(saw_rehash);
+    ASSERT_TRUE(ht_capacity(ht) >= 1024);
+    for (int i = 0; i < 200; i++) {
+        ASSERT_TRUE(seen[i] >= 1);
+    }
+    ht_destroy(ht);
+    return 0;
+}
+
+static int test_ht_scan_during_rehash(void) {
+    hashtable_t *ht = rehashing_table(57);
+    int seen[57] = {0};
+    scan_seen_t ss = { seen, 57, 0 };
+    ASSERT_TRUE(ht_is_rehashing(ht));
+
+    /* migration continues between calls */
+    size_t cursor = 0;
+    do {
+        cursor = ht_scan(ht, cursor, scan_mark, &ss);
+        ht_rehash_step(ht, 1);
+    } while (cursor != 0);
+
+    for (int i = 0; i < 57; i++) {
+        ASSERT_TRUE(seen[i] >= 1);
+    }
+    ht_destroy(ht);
+    return 0;
+}
+
+static int test_ht_value_encodings(void) {
+    hashtable_t *ht = ht_create();
+    static char big[RSTR_SHARED_MIN + 10];
+    memset(big, 'b', sizeof(big));
+    /* inline -> heap -> inline -> shared -> heap, short and long keys */
+    const size_t lens[] = {3, 40, 10, 0, sizeof(big), 30, 21, sizeof(big)};
+    const char *keys[] = {"k", "a-key-that-is-longer-than-the-inline-room"};
+
+    for (int k = 0; k < 2; k++) {
+        rstr_t key = rstr_create(keys[k], strlen(keys[k]));
+        for (size_t i = 0; i < sizeof(lens) / sizeof(lens[0]); i++) {
+            big[0] = (char)('0' + i);
+            rstr_t val = rstr_create(big, lens[i]);
+            ht_set(ht, key, val);
+            rstr_t got;
+            ASSERT_TRUE(ht_get(ht, key, &got));
+            ASSERT_EQ_RSTR(got, val);
+            rstr_free(&val);
+        }
+        rstr_free(&key);
+    }
+    ASSERT_EQ_INT(ht_count(ht), 2);
+
+    ht_iter_t iter;
+    rstr_t key, value;
+    int count = 0;
+    ht_iter_init(ht, &iter);
+    while (ht_iter_next(&iter, &key, &value)) {
+        ASSERT_EQ_INT(value.len, sizeof(big));
+        count++;
+    }
+    ASSERT_EQ_INT(count, 2);
+
+    ht_destroy(ht);
+    return 0;
+}
+
+static int test_ht_overwrite_reuses_buffer(void) {
+    hashtable_t *ht = ht_create();
+    rstr_t key = rstr_create("user:session:0000000001", 23);
+    rstr_t v1 = rstr_create("0123456789012345678901234567890123456789", 40);
+    rstr_t v2 = rstr_create("abcdefghijklmnopqrstuvwxyz", 26);
+
+    ht_set(ht, key, v1);
+    rstr_t got1, got2;
+    ASSERT_TRUE(ht_get(ht, key, &got1));
+    ht_set(ht, key, v2);
+    ASSERT_TRUE(ht_get(ht, key, &got2));
+    ASSERT_TRUE(got1.data == got2.data);
+    ASSERT_EQ_RSTR(got2, v2);
+
+    rstr_free(&key);
+    rstr_free(&v1);
+    rstr_free(&v2);
+    ht_destroy(ht);
+    return 0;
+}
+
+static int test_ht_shared_value_outlives_entry(void) {
+    /* Large values are handed out for zero-copy replies; a reference
+       taken before an overwrite must stay readable. */
+    hashtable_t *ht = ht_create();
+    static char big[RSTR_SHARED_MIN];
+    memset(big, 'x', sizeof(big));
+    rstr_t key = rstr_create("big", 3);
+    rstr_t val = rstr_create(big, sizeof(big));
+    rstr_t small = rstr_create("s", 1);
+
+    ht_set(ht, key, val);
+    rstr_t got;
+    ASSERT_TRUE(ht_get(ht, key, &got));
+    rstr_t ref = rstr_retain(got);
+    ht_set(ht, key, small);
+    ASSERT_EQ_RSTR(ref, val);
+    ht_delete(ht, key);
+    ASSERT_EQ_RSTR(ref, val);
+
+    rstr_free(&ref);
+    rstr_free(&key);
+    rstr_free(&val);
+    rstr_free(&small);
+    ht_destroy(ht);
+    return 0;
+}
+
+static int test_ht_hashed_lookup(void) {
+    /* prefetching an empty table is harmless */
+    hashtable_t *empty = ht_create();
+    rstr_t none = rstr_create("none", 4);
+    uint64_t h = ht_hash(empty, none);
+    ht_prefetch_group(empty, h);
+    ht_prefetch_entries(empty, h);
+    ASSERT_NULL(ht_find_hashed(empty, none, h));
+    ht_destroy(empty);
+
+    /* mid-migration, hashed calls see both tables like the plain ones */
+    hashtable_t *ht = rehashing_table(57);
+    char buf[32];
+    ASSERT_TRUE(ht_is_rehashing(ht));
+    for (int i = 0; i < 57; i++) {
+        int n = snprintf(buf, sizeof(buf), "rh%d", i);
+        rstr_t key = rstr_create(buf, (size_t)n);
+        h = ht_hash(ht, key);
+        ht_prefetch_group(ht, h);
+        ht_prefetch_entries(ht, h);
+        ht_entry_t *e = ht_find_hashed(ht, key, h);
+        ASSERT_NOT_NULL(e);
+        ASSERT_TRUE(e == ht_find(ht, key));
+        rstr_free(&key);
+    }
+
+    bool inserted;
+    h = ht_hash(ht, none);
+    ht_entry_t *e = ht_find_or_insert_hashed(ht, none, none, h, &inserted);
+    ASSERT_TRUE(inserted);
+    ASSERT_TRUE(ht_find_or_insert_hashed(ht, none, none, h, &inserted) == e);
+    ASSERT_FALSE(inserted);
+    ASSERT_EQ_RSTR(ht_entry_value(ht, ht_find(ht, none)), none);
+    ASSERT_EQ_INT(ht_count(ht), 58);
+
+    rstr_free(&none);
+    ht_destroy(ht);
+    return 0;
+}
+
 static int test_ht_binary_keys(void) {
     hashtable_t *ht = ht_create();
     char key_data[] = "ab\0cd";
@@ -204,14 +723,14 @@ static int test_ht_binary_keys(void) {
     rstr_t val = rstr_create("value", 5);
 
     ht_set(ht, key, val);
-    rstr_t *got = ht_get(ht, key);
-    ASSERT_NOT_NULL(got);
-    ASSERT_EQ_RSTR(*got, val);
+    rstr_t got;
+    ASSERT_TRUE(ht_get(ht, key, &got));
+    ASSERT_EQ_RSTR(got, val);
 
     /* Different key with same prefix but different after null */
     char key2_data[] = "ab\0ce";
     rstr_t key2 = rstr_create(key2_data, 5);
-    ASSERT_NULL(ht_get(ht, key2));
+    ASSERT_FALSE(ht_get(ht, key2, NULL));
 
     rstr_free(&key);
     rstr_free(&key2);
@@ -220,6 +739,170 @@ static int test_ht_binary_keys(void) {
     return 0;
 }
 
+static int test_hash_seeded(void) {
+    const char *k = "user:1000";
+    uint64_t a = hash_bytes(k, strlen(k), 1);
+    ASSERT_TRUE(a == hash_bytes(k, strlen(k), 1));
+    ASSERT_TRUE(a != hash_bytes(k, strlen(k), 2));
+    ASSERT_TRUE(a != hash_bytes("user:1001", 9, 1));
+    /* every length class: empty, 1-3, 4-16, 17-47, 48+ */
+    char buf[100];
+    memset(buf, 'x', sizeof(buf));
+    uint64_t prev = hash_bytes(buf, 0, 1);
+    for (size_t len = 1; len <= sizeof(buf); len++) {
+        uint64_t h = hash_bytes(buf, len, 1);
+        ASSERT_TRUE(h != prev);
+        prev = h;
+    }
+    return 0;
+}
+
+static int test_ht_seeds_agree(void) {
+    /* Lookups work the same whatever seed placed the keys. */
+    hashtable_t *a = ht_create_seeded(1);
+    hashtable_t *b = ht_create_seeded(0x9e3779b97f4a7c15ULL);
+    char buf[32];
+    for (int i = 0; i < 500; i++) {
+        int n = snprintf(buf, sizeof(buf), "id:%d", i);
+        rstr_t key = rstr_create(buf, (size_t)n);
+        ht_set(a, key, key);
+        ht_set(b, key, key);
+        rstr_free(&key);
+    }
+    for (int i = 0; i < 500; i++) {
+        int n = snprintf(buf, sizeof(buf), "id:%d", i);
+        rstr_t key = rstr_create(buf, (size_t)n);
+        ASSERT_TRUE(ht_exists(a, key));
+        ASSERT_TRUE(ht_exists(b, key));
+        rstr_free(&key);
+    }
+    ht_destroy(a);
+    ht_destroy(b);
+    return 0;
+}
+
+static int test_ht_entry_handles(void) {
+    hashtable_t *ht = ht_create();
+    rstr_t key = rstr_create("counter", 7);
+    rstr_t v1 = rstr_create("1", 1);
+    rstr_t v2 = rstr_create("a value too long to be stored inline", 36);
+    bool inserted;
+
+    ht_entry_t *e = ht_find_or_insert(ht, key, v1, &inserted);
+    ASSERT_TRUE(inserted);
+    ASSERT_EQ_RSTR(ht_entry_value(ht, e), v1);
+    ASSERT_EQ_INT(ht_entry_expire(e), -1);
+
+    /* an existing entry comes back untouched */
+    ASSERT_TRUE(ht_find_or_insert(ht, key, v2, &inserted) == e);
+    ASSERT_FALSE(inserted);
+    ASSERT_EQ_RSTR(ht_entry_value(ht, e), v1);
+
+    /* setters keep the handle and each other's fields */
+    ht_entry_set_expire(ht, e, current_time_ms() + 10000);
+    ht_entry_set_value(ht, e, v2);
+    ASSERT_TRUE(ht_find(ht, key) == e);
+    ASSERT_EQ_RSTR(ht_entry_value(ht, e), v2);
+    ASSERT_TRUE(ht_get_expire(ht, key) > 0);
+
+    ht_entry_delete(ht, e);
+    ASSERT_NULL(ht_find(ht, key));
+    ASSERT_EQ_INT(ht_count(ht), 0);
+
+    rstr_free(&key);
+    rstr_free(&v1);
+    rstr_free(&v2);
+    ht_destroy(ht);
+    return 0;
+}
+
+static int test_ht_entry_delete_during_rehash(void) {
+    hashtable_t *ht = rehashing_table(57);
+    char buf[32];
+    ASSERT_TRUE(ht_is_rehashing(ht));
+
+    /* handles into either table delete the right slot */
+    for (int i = 0; i < 57; i += 2) {
+        int n = snprintf(buf, sizeof(buf), "rh%d", i);
+        rstr_t key = { buf, (size_t)n };
+        ht_entry_t *e = ht_find(ht, key);
+        ASSERT_NOT_NULL(e);
+        ht_entry_delete(ht, e);
+    }
+    ASSERT_EQ_INT(ht_count(ht), 28);
+    for (int i = 0; i < 57; i++) {
+        int n = snprintf(buf, sizeof(buf), "rh%d", i);
+        rstr_t key = { buf, (size_t)n };
+        ASSERT_EQ_INT(ht_exists(ht, key), i % 2 == 1);
+    }
+
+    ht_destroy(ht);
+    return 0;
+}
+
+static int test_ht_int_encoding(void) {
+    hashtable_t *ht = ht_create();
+    slab_stats_t before, after;
+    slab_get_stats(&before);
+    bool inserted;
+    int64_t n;
+    rstr_t got;
+
+    /* short key: the integer lives in the slot */
+    rstr_t shortk = rstr_create("hits", 4);
+    ht_entry_t *e = ht_find_or_insert_int(ht, shortk, 41, &inserted);
+    ASSERT_TRUE(inserted);
+    ht_entry_set_expire(ht, e, current_time_ms() + 10000);
+    ht_entry_set_int(ht, e, -9223372036854775807LL - 1);
+    ASSERT_TRUE(ht_entry_int(e, &n));
+    ASSERT_TRUE(n == INT64_MIN);
+    ASSERT_TRUE(ht_get(ht, shortk, &got));
+    ASSERT_EQ_INT(got.len, 20);
+    ASSERT_TRUE(memcmp(got.data, "-9223372036854775808", 20) == 0);
+    ASSERT_TRUE(ht_get_expire(ht, shortk) > 0);
+
+    /* a string value turns into an integer, keeping its TTL */
+    rstr_t longk = rstr_create("rate:user:0123456789:window", 27);
+    rstr_t seven = rstr_create("7", 1);
+    ht_set(ht, longk, seven);
+    e = ht_find(ht, longk);
+    ht_entry_set_expire(ht, e, current_time_ms() + 10000);
+    ASSERT_FALSE(ht_entry_int(e, &n));
+    ht_entry_set_int(ht, e, 8);
+    ASSERT_TRUE(ht_entry_int(e, &n));
+    ASSERT_EQ_INT(n, 8);
+    ASSERT_TRUE(ht_get_expire(ht, longk) > 0);
+    ASSERT_TRUE(ht_get(ht, longk, &got));
+    ASSERT_EQ_INT(got.len, 1);
+    ASSERT_EQ_INT(got.data[0], '8');
+
+    /* a mid-length key with a short number is no bigger as a string */
+    rstr_t midk = rstr_create("counter:0123456789", 18);
+    e = ht_find_or_insert_int(ht, midk, 5, &inserted);
+    ASSERT_FALSE(ht_entry_int(e, &n));
+    ASSERT_TRUE(ht_get(ht, midk, &got));
+    ASSERT_EQ_INT(got.data[0], '5');
+
+    /* writing a string replaces the integer */
+    ht_set(ht, shortk, seven);
+    ASSERT_TRUE(ht_get(ht, shortk, &got));
+    ASSERT_EQ_RSTR(got, seven);
+    ASSERT_FALSE(ht_entry_int(ht_find(ht, shortk), &n));
+
+    ASSERT_TRUE(ht_delete(ht, longk));
+    ASSERT_TRUE(ht_delete(ht, midk));
+    ASSERT_TRUE(ht_delete(ht, shortk));
+    rstr_free(&shortk);
+    rstr_free(&longk);
+    rstr_free(&midk);
+    rstr_free(&seven);
+    /* every block went back in the size it was taken */
+    slab_get_stats(&after);
+    ASSERT_EQ_INT(after.requested, before.requested);
+    ht_destroy(ht);
+    return 0;
+}
+
 test_case_t hashtable_tests[] = {
     {"test_ht_insert_and_get",          test_ht_insert_and_get},
     {"test_ht_overwrite",               test_ht_overwrite},
@@ -227,9 +910,29 @@ test_case_t hashtable_tests[] = {
     {"test_ht_delete_nonexistent",      test_ht_delete_nonexistent},
     {"test_ht_get_nonexistent",         test_ht_get_nonexistent},
     {"test_ht_resize",                  test_ht_resize},
+    {"test_ht_reserve",                 test_ht_reserve},
+    {"test_ht_clear",                   test_ht_clear},
     {"test_ht_many_keys",               test_ht_many_keys},
+    {"test_ht_high_load",               test_ht_high_load},
+    {"test_ht_delete_churn",            test_ht_delete_churn},
     {"test_ht_iterator",                test_ht_iterator},
     {"test_ht_iterator_with_tombstones", test_ht_iterator_with_tombstones},
+    {"test_ht_incremental_rehash",      test_ht_incremental_rehash},
+    {"test_ht_iterator_during_rehash",  test_ht_iterator_during_rehash},
+    {"test_ht_iterator_target_full",    test_ht_iterator_target_full},
+    {"test_ht_iter_release",            test_ht_iter_release},
+    {"test_ht_scan_full",               test_ht_scan_full},
+    {"test_ht_scan_across_growth",      test_ht_scan_across_growth},
+    {"test_ht_scan_during_rehash",      test_ht_scan_during_rehash},
+    {"test_ht_value_encodings",         test_ht_value_encodings},
+    {"test_ht_overwrite_reuses_buffer", test_ht_overwrite_reuses_buffer},
+    {"test_ht_shared_value_outlives_entry", test_ht_shared_value_outlives_entry},
+    {"test_ht_entry_handles",           test_ht_entry_handles},
+    {"test_ht_entry_delete_during_rehash", test_ht_entry_delete_during_rehash},
+    {"test_ht_int_encoding",            test_ht_int_encoding},
+    {"test_ht_hashed_lookup",           test_ht_hashed_lookup},
     {"test_ht_binary_keys",             test_ht_binary_keys},
+    {"test_hash_seeded",                test_hash_seeded},
+    {"test_ht_seeds_agree",             test_ht_seeds_agree},
 };
 int hashtable_test_count = sizeof(hashtable_tests) / sizeof(hashtable_tests[0]);
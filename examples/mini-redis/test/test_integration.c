@@ -9,7 +9,9 @@
 #include <signal.h>
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <sys/stat.h>
 #include <sys/socket.h>
+#include <sys/un.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <errno.h>
@@ -18,14 +20,21 @@
 static pid_t server_pid = -1;
 static int test_port = 0;
 
-static void start_test_server(void) {
-    test_port = 30000 + (getpid() % 10000);
-    server_pid = fork();
-    if (server_pid == 0) {
+/* Start ./mini-redis on port with the NULL-terminated options in opts
+   and wait until it accepts connections. */
+static pid_t spawn_server_opts(int port, const char *const *opts) {
+    pid_t pid = fork();
+    if (pid == 0) {
         char port_str[16];
-        snprintf(port_str, sizeof(port_str), "%d", test_port);
-        execl("./mini-redis", "mini-redis", "--port", port_str, NULL);
-        perror("execl");
+        snprintf(port_str, sizeof(port_str), "%d", port);
+        const char *argv[16] = {"mini-redis", "--port", port_str};
+        int argc = 3;
+        for (int i = 0; opts[i] && argc < 15; i++) {
+            argv[argc++] = opts[i];
+        }
+        argv[argc] = NULL;
+        execv("./mini-redis", (char *const *)argv);
+        perror("execv");
         _exit(1);
     }
 
@@ -38,16 +47,33 @@ static void start_test_server(void) {
         struct sockaddr_in addr;
         memset(&addr, 0, sizeof(addr));
         addr.sin_family = AF_INET;
-        addr.sin_port = htons((uint16_t)test_port);
+        addr.sin_port = htons((uint16_t)port);
         inet_pton(AF_INET, "127.0.0.1", &addr.sin_addr);
 
         if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0) {
             close(fd);
-            return;
+            return pid;
         }
         close(fd);
     }
     fprintf(stderr, "Failed to connect to test server\n");
+    return pid;
+}
+
+/* The same with up to two extra options. */
+static pid_t spawn_server2(int port, const char *opt, const char *opt_val,
+                           const char *opt2, const char *opt2_val) {
+    const char *opts[] = {opt, opt_val, opt2, opt2_val, NULL};
+    return spawn_server_opts(port, opts);
+}
+
+static pid_t spawn_server(int port, const char *opt, const char *opt_val) {
+    return spawn_server2(port, opt, opt_val, NULL, NULL);
+}
+
+static void start_test_server(void) {
+    test_port = 30000 + (getpid() % 10000);
+    server_pid = spawn_server(test_port, NULL, NULL);
 }
 
 static void stop_test_server(void) {
@@ -375,6 +401,35 @@ static int test_int_set_ex(void) {
     return 0;
 }
 
+static int test_int_set_ex_invalid(void) {
+    int fd = test_connect();
+    ASSERT_TRUE(fd >= 0);
+
+    resp_value_t val;
+    test_send_command(fd, 3, "SET", "exbad", "old");
+    ASSERT_TRUE(test_read_response(fd, &val) > 0);
+    resp_value_free(&val);
+
+    /* a rejected SET does not touch the existing key */
+    test_send_command(fd, 5, "SET", "exbad", "new", "EX", "0");
+    ASSERT_TRUE(test_read_response(fd, &val) > 0);
+    ASSERT_EQ_INT(val.type, RESP_ERROR);
+    resp_value_free(&val);
+    test_send_command(fd, 5, "SET", "exbad", "new", "PX", "10");
+    ASSERT_TRUE(test_read_response(fd, &val) > 0);
+    ASSERT_EQ_INT(val.type, RESP_ERROR);
+    resp_value_free(&val);
+
+    test_send_command(fd, 2, "GET", "exbad");
+    ASSERT_TRUE(test_read_response(fd, &val) > 0);
+    ASSERT_EQ_INT(val.type, RESP_BULK_STRING);
+    ASSERT_EQ_STR(val.str.data, "old");
+    resp_value_free(&val);
+
+    close(fd);
+    return 0;
+}
+
 static int test_int_ttl_no_expiry(void) {
     int fd = test_connect();
     ASSERT_TRUE(fd >= 0);
@@ -434,73 +489,134 @@ static int test_int_keys_pattern(void) {
     return 0;
 }
 
-static int test_int_type(void) {
+static int test_int_scan(void) {
     int fd = test_connect();
     ASSERT_TRUE(fd >= 0);
 
     resp_value_t val;
-    test_send_command(fd, 3, "SET", "typekey", "v");
+    char key[32];
+    for (int i = 0; i < 50; i++) {
+        snprintf(key, sizeof(key), "scan:%d", i);
+        test_send_command(fd, 3, "SET", key, "v");
+        ASSERT_TRUE(test_read_response(fd, &val) > 0);
+        resp_value_free(&val);
+    }
+
+    int seen[50] = {0};
+    char cursor[32] = "0";
+    int calls = 0;
+    do {
+        test_send_command(fd, 6, "SCAN", cursor, "MATCH", "scan:*",
+                          "COUNT", "5");
+        ASSERT_TRUE(test_read_response(fd, &val) > 0);
+        ASSERT_EQ_INT(val.type, RESP_ARRAY);
+        ASSERT_EQ_INT(val.array.count, 2);
+        resp_value_t *next = &val.array.elements[0];
+        resp_value_t *keys = &val.array.elements[1];
+        ASSERT_EQ_INT(next->type, RESP_BULK_STRING);
+        ASSERT_EQ_INT(keys->type, RESP_ARRAY);
+        snprintf(cursor, sizeof(cursor), "%.*s", (int)next->str.len,
+                 next->str.data);
+        for (int i = 0; i < keys->array.count; i++) {
+            rstr_t k = keys->array.elements[i].str;
+            ASSERT_TRUE(k.len > 5 && memcmp(k.data, "scan:", 5) == 0);
+            int idx = atoi(k.data + 5);
+            ASSERT_TRUE(idx >= 0 && idx < 50);
+            seen[idx]++;
+        }
+        resp_value_free(&val);
+        calls++;
+    } while (strcmp(cursor, "0") != 0);
+
+    /* COUNT bounds each reply, so the scan takes several calls */
+    ASSERT_TRUE(calls > 1);
+    for (int i = 0; i < 50; i++) {
+        ASSERT_TRUE(seen[i] >= 1);
+    }
+
+    test_send_command(fd, 2, "SCAN", "nope");
     ASSERT_TRUE(test_read_response(fd, &val) > 0);
+    ASSERT_EQ_INT(val.type, RESP_ERROR);
     resp_value_free(&val);
 
-    test_send_command(fd, 2, "TYPE", "typekey");
+    test_send_command(fd, 4, "SCAN", "0", "COUNT", "0");
     ASSERT_TRUE(test_read_response(fd, &val) > 0);
-    ASSERT_EQ_INT(val.type, RESP_SIMPLE_STRING);
-    ASSERT_EQ_STR(val.str.data, "string");
+    ASSERT_EQ_INT(val.type, RESP_ERROR);
     resp_value_free(&val);
 
-    test_send_command(fd, 2, "TYPE", "missing_typekey");
+    test_send_command(fd, 3, "SCAN", "0", "MATCH");
     ASSERT_TRUE(test_read_response(fd, &val) > 0);
-    ASSERT_EQ_INT(val.type, RESP_SIMPLE_STRING);
-    ASSERT_EQ_STR(val.str.data, "none");
+    ASSERT_EQ_INT(val.type, RESP_ERROR);
     resp_value_free(&val);
 
     close(fd);
     return 0;
 }
 
-static int test_int_incr_new(void) {
-    int fd = test_connect();
-    ASSERT_TRUE(fd >= 0);
-
-    resp_value_t val;
-    test_send_command(fd, 2, "INCR", "incr_new_key");
-    ASSERT_TRUE(test_read_response(fd, &val) > 0);
-    ASSERT_EQ_INT(val.type, RESP_INTEGER);
-    ASSERT_EQ_INT(val.integer, 1);
-
-    close(fd);
-    return 0;
+/* Send `cmd` followed by n "<prefix><i>" keys, each with a "v<i>" value
+   if with_values. */
+static void send_numbered(int fd, const char *cmd, const char *prefix,
+                          int n, bool with_values) {
+    char buf[8192];
+    int argc = 1 + n * (with_values ? 2 : 1);
+    int off = snprintf(buf, sizeof(buf), "*%d\r\n$%zu\r\n%s\r\n",
+                       argc, strlen(cmd), cmd);
+    for (int i = 0; i < n; i++) {
+        char arg[32];
+        int len = snprintf(arg, sizeof(arg), "%s%d", prefix, i);
+        off += snprintf(buf + off, sizeof(buf) - (size_t)off,
+                        "$%d\r\n%s\r\n", len, arg);
+        if (with_values) {
+            len = snprintf(arg, sizeof(arg), "v%d", i);
+            off += snprintf(buf + off, sizeof(buf) - (size_t)off,
+                            "$%d\r\n%s\r\n", len, arg);
+        }
+    }
+    test_send(fd, buf, (size_t)off);
 }
 
-static int test_int_incr_existing(void) {
+static int test_int_mset_mget(void) {
     int fd = test_connect();
     ASSERT_TRUE(fd >= 0);
 
+    /* more keys than the prefetch pipeline is deep */
     resp_value_t val;
-    test_send_command(fd, 3, "SET", "incr_ex_key", "10");
+    send_numbered(fd, "MSET", "mk:", 40, true);
     ASSERT_TRUE(test_read_response(fd, &val) > 0);
+    ASSERT_EQ_INT(val.type, RESP_SIMPLE_STRING);
     resp_value_free(&val);
 
-    test_send_command(fd, 2, "INCR", "incr_ex_key");
+    test_send_command(fd, 2, "INCR", "mk:40");
     ASSERT_TRUE(test_read_response(fd, &val) > 0);
-    ASSERT_EQ_INT(val.type, RESP_INTEGER);
-    ASSERT_EQ_INT(val.integer, 11);
-
-    close(fd);
-    return 0;
-}
-
-static int test_int_incr_non_integer(void) {
-    int fd = test_connect();
-    ASSERT_TRUE(fd >= 0);
+    send_numbered(fd, "MGET", "mk:", 42, false);
+    ASSERT_TRUE(test_read_response(fd, &val) > 0);
+    ASSERT_EQ_INT(val.type, RESP_ARRAY);
+    ASSERT_EQ_INT(val.array.count, 42);
+    char want[32];
+    for (int i = 0; i < 40; i++) {
+        snprintf(want, sizeof(want), "v%d", i);
+        ASSERT_EQ_INT(val.array.elements[i].type, RESP_BULK_STRING);
+        ASSERT_EQ_STR(val.array.elements[i].str.data, want);
+    }
+    ASSERT_EQ_STR(val.array.elements[40].str.data, "1");
+    ASSERT_EQ_INT(val.array.elements[41].type, RESP_NULL_BULK_STRING);
+    resp_value_free(&val);
 
-    resp_value_t val;
-    test_send_command(fd, 3, "SET", "incr_str_key", "abc");
+    /* MSET overwrites and drops a TTL, like SET */
+    test_send_command(fd, 3, "EXPIRE", "mk:0", "100");
+    ASSERT_TRUE(test_read_response(fd, &val) > 0);
+    test_send_command(fd, 5, "MSET", "mk:0", "new", "mk:0", "newer");
+    ASSERT_TRUE(test_read_response(fd, &val) > 0);
+    resp_value_free(&val);
+    test_send_command(fd, 2, "GET", "mk:0");
     ASSERT_TRUE(test_read_response(fd, &val) > 0);
+    ASSERT_EQ_STR(val.str.data, "newer");
     resp_value_free(&val);
+    test_send_command(fd, 2, "TTL", "mk:0");
+    ASSERT_TRUE(test_read_response(fd, &val) > 0);
+    ASSERT_EQ_INT(val.integer, -1);
 
-    test_send_command(fd, 2, "INCR", "incr_str_key");
+    test_send_command(fd, 4, "MSET", "mk:0", "v", "mk:1");
     ASSERT_TRUE(test_read_response(fd, &val) > 0);
     ASSERT_EQ_INT(val.type, RESP_ERROR);
     resp_value_free(&val);
@@ -509,133 +625,1424 @@ static int test_int_incr_non_integer(void) {
     return 0;
 }
 
-static int test_int_decr(void) {
+static int test_int_msetnx(void) {
     int fd = test_connect();
     ASSERT_TRUE(fd >= 0);
 
     resp_value_t val;
-    test_send_command(fd, 3, "SET", "decr_key", "10");
+    test_send_command(fd, 5, "MSETNX", "nx:a", "1", "nx:b", "2");
+    ASSERT_TRUE(test_read_response(fd, &val) > 0);
+    ASSERT_EQ_INT(val.type, RESP_INTEGER);
+    ASSERT_EQ_INT(val.integer, 1);
+
+    /* one existing key and nothing is set */
+    test_send_command(fd, 5, "MSETNX", "nx:c", "3", "nx:b", "4");
+    ASSERT_TRUE(test_read_response(fd, &val) > 0);
+    ASSERT_EQ_INT(val.integer, 0);
+    test_send_command(fd, 4, "MGET", "nx:a", "nx:b", "nx:c");
     ASSERT_TRUE(test_read_response(fd, &val) > 0);
+    ASSERT_EQ_INT(val.array.count, 3);
+    ASSERT_EQ_STR(val.array.elements[0].str.data, "1");
+    ASSERT_EQ_STR(val.array.elements[1].str.data, "2");
+    ASSERT_EQ_INT(val.array.elements[2].type, RESP_NULL_BULK_STRING);
     resp_value_free(&val);
 
-    test_send_command(fd, 2, "DECR", "decr_key");
+    test_send_command(fd, 4, "MSETNX", "nx:c", "3", "nx:d");
     ASSERT_TRUE(test_read_response(fd, &val) > 0);
-    ASSERT_EQ_INT(val.type, RESP_INTEGER);
-    ASSERT_EQ_INT(val.integer, 9);
+    ASSERT_EQ_INT(val.type, RESP_ERROR);
+    resp_value_free(&val);
 
     close(fd);
     return 0;
 }
 
-static int test_int_pipeline(void) {
-    int fd = test_connect();
-    ASSERT_TRUE(fd >= 0);
+static size_t recv_all(int fd, char *buf, size_t want) {
+    size_t got = 0;
+    while (got < want) {
+        ssize_t n = recv(fd, buf + got, want - got, 0);
+        if (n <= 0) {
+            break;
+        }
+        got += (size_t)n;
+    }
+    return got;
+}
 
-    /* Send 3 commands at once */
-    char buf[512];
-    int off = 0;
-    /* PING */
-    off += snprintf(buf + off, sizeof(buf) - (size_t)off,
-                    "*1\r\n$4\r\nPING\r\n");
-    /* SET pipeline_k v */
-    off += snprintf(buf + off, sizeof(buf) - (size_t)off,
-                    "*3\r\n$3\r\nSET\r\n$10\r\npipeline_k\r\n$1\r\nv\r\n");
-    /* GET pipeline_k */
-    off += snprintf(buf + off, sizeof(buf) - (size_t)off,
-                    "*2\r\n$3\r\nGET\r\n$10\r\npipeline_k\r\n");
-    test_send(fd, buf, (size_t)off);
+#define IO_TEST_CLIENTS 12      /* distinct read_bufs slots */
+#define IO_TEST_INCRS 20
+#define IO_TEST_BIG 20000       /* replied by reference */
 
-    /* Read 3 responses */
-    resp_value_t val;
+static int test_int_io_threads(void) {
+    /* a second server, with I/O threads; commands still run in order */
+    int saved_port = test_port;
+    test_port = saved_port + 1;
+    pid_t pid = spawn_server(test_port, "--io-threads", "4");
 
-    ASSERT_TRUE(test_read_response(fd, &val) > 0);
-    ASSERT_EQ_INT(val.type, RESP_SIMPLE_STRING);
-    ASSERT_EQ_STR(val.str.data, "PONG");
-    resp_value_free(&val);
+    int fds[IO_TEST_CLIENTS];
+    for (int i = 0; i < IO_TEST_CLIENTS; i++) {
+        fds[i] = test_connect();
+        ASSERT_TRUE(fds[i] >= 0);
+    }
 
-    ASSERT_TRUE(test_read_response(fd, &val) > 0);
+    static char big[IO_TEST_BIG + 64];
+    int off = snprintf(big, sizeof(big), "*3\r\n$3\r\nSET\r\n$3\r\nbig\r\n"
+                       "$%d\r\n", IO_TEST_BIG);
+    memset(big + off, 'x', IO_TEST_BIG);
+    memcpy(big + off + IO_TEST_BIG, "\r\n", 2);
+    test_send(fds[0], big, (size_t)off + IO_TEST_BIG + 2);
+    resp_value_t val;
+    ASSERT_TRUE(test_read_response(fds[0], &val) > 0);
     ASSERT_EQ_INT(val.type, RESP_SIMPLE_STRING);
-    ASSERT_EQ_STR(val.str.data, "OK");
     resp_value_free(&val);
 
-    ASSERT_TRUE(test_read_response(fd, &val) > 0);
-    ASSERT_EQ_INT(val.type, RESP_BULK_STRING);
-    ASSERT_EQ_STR(val.str.data, "v");
+    /* everyone reads the shared value at once */
+    for (int i = 0; i < IO_TEST_CLIENTS; i++) {
+        test_send_command(fds[i], 2, "GET", "big");
+    }
+    static char reply[IO_TEST_BIG + 64];
+    for (int i = 0; i < IO_TEST_CLIENTS; i++) {
+        size_t want = 8 + IO_TEST_BIG + 2;     /* "$20000\r\n" ... "\r\n" */
+        ASSERT_TRUE(recv_all(fds[i], reply, want) == want);
+        ASSERT_TRUE(memcmp(reply, "$20000\r\n", 8) == 0);
+        ASSERT_TRUE(reply[8] == 'x' && reply[7 + IO_TEST_BIG] == 'x');
+    }
+
+    /* pipelined increments from every client are all applied */
+    char pipeline[IO_TEST_INCRS * 32];
+    int plen = 0;
+    for (int k = 0; k < IO_TEST_INCRS; k++) {
+        plen += snprintf(pipeline + plen, sizeof(pipeline) - (size_t)plen,
+                         "*2\r\n$4\r\nINCR\r\n$6\r\nshared\r\n");
+    }
+    for (int i = 0; i < IO_TEST_CLIENTS; i++) {
+        test_send(fds[i], pipeline, (size_t)plen);
+    }
+    for (int i = 0; i < IO_TEST_CLIENTS; i++) {
+        int64_t last = 0;
+        for (int k = 0; k < IO_TEST_INCRS; k++) {
+            ASSERT_TRUE(test_read_response(fds[i], &val) > 0);
+            ASSERT_EQ_INT(val.type, RESP_INTEGER);
+            /* a client's own replies come back in order */
+            ASSERT_TRUE(val.integer > last);
+            last = val.integer;
+        }
+    }
+    test_send_command(fds[0], 2, "GET", "shared");
+    ASSERT_TRUE(test_read_response(fds[0], &val) > 0);
+    ASSERT_EQ_STR(val.str.data, "240");
     resp_value_free(&val);
 
-    close(fd);
+    for (int i = 0; i < IO_TEST_CLIENTS; i++) {
+        close(fds[i]);
+    }
+    kill(pid, SIGTERM);
+    int status;
+    waitpid(pid, &status, 0);
+    test_port = saved_port;
+    ASSERT_TRUE(WIFEXITED(status) && WEXITSTATUS(status) == 0);
     return 0;
 }
 
-static int test_int_concurrent(void) {
-    int fd1 = test_connect();
-    int fd2 = test_connect();
-    int fd3 = test_connect();
-    ASSERT_TRUE(fd1 >= 0);
-    ASSERT_TRUE(fd2 >= 0);
-    ASSERT_TRUE(fd3 >= 0);
+#define SHARD_TEST_CLIENTS 8
+#define SHARD_TEST_KEYS 60
 
-    resp_value_t val;
+static int test_int_shards(void) {
+    /* four shards; connections land on any of them */
+    int saved_port = test_port;
+    test_port = saved_port + 2;
+    pid_t pid = spawn_server(test_port, "--shards", "4");
 
-    /* Each client sets its own key */
-    test_send_command(fd1, 3, "SET", "cc1", "v1");
-    test_send_command(fd2, 3, "SET", "cc2", "v2");
-    test_send_command(fd3, 3, "SET", "cc3", "v3");
+    int fds[SHARD_TEST_CLIENTS];
+    for (int i = 0; i < SHARD_TEST_CLIENTS; i++) {
+        fds[i] = test_connect();
+        ASSERT_TRUE(fds[i] >= 0);
+    }
 
-    ASSERT_TRUE(test_read_response(fd1, &val) > 0);
-    resp_value_free(&val);
-    ASSERT_TRUE(test_read_response(fd2, &val) > 0);
+    /* keys written through one connection are seen through every other */
+    resp_value_t val;
+    char key[32], want[32];
+    for (int k = 0; k < SHARD_TEST_KEYS; k++) {
+        snprintf(key, sizeof(key), "sk:%d", k);
+        snprintf(want, sizeof(want), "v%d", k);
+        test_send_command(fds[k % SHARD_TEST_CLIENTS], 3, "SET", key, want);
+        ASSERT_TRUE(test_read_response(fds[k % SHARD_TEST_CLIENTS], &val) > 0);
+        ASSERT_EQ_INT(val.type, RESP_SIMPLE_STRING);
+        resp_value_free(&val);
+    }
+    for (int k = 0; k < SHARD_TEST_KEYS; k++) {
+        snprintf(key, sizeof(key), "sk:%d", k);
+        snprintf(want, sizeof(want), "v%d", k);
+        test_send_command(fds[(k + 3) % SHARD_TEST_CLIENTS], 2, "GET", key);
+        ASSERT_TRUE(test_read_response(fds[(k + 3) % SHARD_TEST_CLIENTS],
+                                       &val) > 0);
+        ASSERT_EQ_STR(val.str.data, want);
+        resp_value_free(&val);
+    }
+
+    /* multi-key commands are split across shards and merged */
+    send_numbered(fds[1], "MGET", "sk:", SHARD_TEST_KEYS + 1, false);
+    ASSERT_TRUE(test_read_response(fds[1], &val) > 0);
+    ASSERT_EQ_INT(val.array.count, SHARD_TEST_KEYS + 1);
+    for (int k = 0; k < SHARD_TEST_KEYS; k++) {
+        snprintf(want, sizeof(want), "v%d", k);
+        ASSERT_EQ_STR(val.array.elements[k].str.data, want);
+    }
+    ASSERT_EQ_INT(val.array.elements[SHARD_TEST_KEYS].type,
+                  RESP_NULL_BULK_STRING);
     resp_value_free(&val);
-    ASSERT_TRUE(test_read_response(fd3, &val) > 0);
+    send_numbered(fds[2], "EXISTS", "sk:", SHARD_TEST_KEYS + 5, false);
+    ASSERT_TRUE(test_read_response(fds[2], &val) > 0);
+    ASSERT_EQ_INT(val.integer, SHARD_TEST_KEYS);
+    test_send_command(fds[3], 2, "KEYS", "sk:*");
+    ASSERT_TRUE(test_read_response(fds[3], &val) > 0);
+    ASSERT_EQ_INT(val.array.count, SHARD_TEST_KEYS);
     resp_value_free(&val);
 
-    /* Each client gets its own key */
-    test_send_command(fd1, 2, "GET", "cc1");
-    test_send_command(fd2, 2, "GET", "cc2");
-    test_send_command(fd3, 2, "GET", "cc3");
-
-    ASSERT_TRUE(test_read_response(fd1, &val) > 0);
-    ASSERT_EQ_STR(val.str.data, "v1");
+    /* SCAN visits every shard before returning cursor 0 */
+    char cursor[32] = "0";
+    int seen = 0;
+    do {
+        test_send_command(fds[4], 4, "SCAN", cursor, "COUNT", "5");
+        ASSERT_TRUE(test_read_response(fds[4], &val) > 0);
+        snprintf(cursor, sizeof(cursor), "%s", val.array.elements[0].str.data);
+        seen += val.array.elements[1].array.count;
+        resp_value_free(&val);
+    } while (strcmp(cursor, "0") != 0);
+    ASSERT_EQ_INT(seen, SHARD_TEST_KEYS);
+
+    /* sixty keys all on one shard is vanishingly unlikely */
+    send_numbered(fds[5], "MSETNX", "nx:", SHARD_TEST_KEYS, true);
+    ASSERT_TRUE(test_read_response(fds[5], &val) > 0);
+    ASSERT_EQ_INT(val.type, RESP_ERROR);
+    ASSERT_TRUE(strncmp(val.str.data, "CROSSSLOT", 9) == 0);
     resp_value_free(&val);
 
-    ASSERT_TRUE(test_read_response(fd2, &val) > 0);
-    ASSERT_EQ_STR(val.str.data, "v2");
+    /* pipelined commands on remote keys still reply in order */
+    char pipeline[IO_TEST_INCRS * 64];
+    int plen = 0;
+    for (int k = 0; k < IO_TEST_INCRS; k++) {
+        plen += snprintf(pipeline + plen, sizeof(pipeline) - (size_t)plen,
+                         "*2\r\n$4\r\nINCR\r\n$4\r\nc:%02d\r\n"
+                         "*2\r\n$4\r\nINCR\r\n$3\r\nall\r\n", k);
+    }
+    for (int i = 0; i < SHARD_TEST_CLIENTS; i++) {
+        test_send(fds[i], pipeline, (size_t)plen);
+    }
+    for (int i = 0; i < SHARD_TEST_CLIENTS; i++) {
+        int64_t last = 0;
+        for (int k = 0; k < IO_TEST_INCRS; k++) {
+            ASSERT_TRUE(test_read_response(fds[i], &val) > 0);
+            ASSERT_EQ_INT(val.type, RESP_INTEGER);
+            ASSERT_TRUE(val.integer >= 1 && val.integer <= SHARD_TEST_CLIENTS);
+            ASSERT_TRUE(test_read_response(fds[i], &val) > 0);
+            ASSERT_TRUE(val.integer > last);
+            last = val.integer;
+        }
+    }
+    test_send_command(fds[0], 2, "GET", "all");
+    ASSERT_TRUE(test_read_response(fds[0], &val) > 0);
+    snprintf(want, sizeof(want), "%d", SHARD_TEST_CLIENTS * IO_TEST_INCRS);
+    ASSERT_EQ_STR(val.str.data, want);
     resp_value_free(&val);
+    send_numbered(fds[6], "DEL", "sk:", SHARD_TEST_KEYS, false);
+    ASSERT_TRUE(test_read_response(fds[6], &val) > 0);
+    ASSERT_EQ_INT(val.integer, SHARD_TEST_KEYS);
 
-    ASSERT_TRUE(test_read_response(fd3, &val) > 0);
-    ASSERT_EQ_STR(val.str.data, "v3");
+    for (int i = 0; i < SHARD_TEST_CLIENTS; i++) {
+        close(fds[i]);
+    }
+    kill(pid, SIGTERM);
+    int status;
+    waitpid(pid, &status, 0);
+    test_port = saved_port;
+    ASSERT_TRUE(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    return 0;
+}
+
+static int test_int_maxclients(void) {
+    int saved_port = test_port;
+    test_port = saved_port + 3;
+    pid_t pid = spawn_server(test_port, "--maxclients", "2");
+    resp_value_t val;
+
+    /* let the server see the readiness probe close first */
+    usleep(50000);
+    int fds[2];
+    for (int i = 0; i < 2; i++) {
+        fds[i] = test_connect();
+        ASSERT_TRUE(fds[i] >= 0);
+        test_send_command(fds[i], 1, "PING");
+        ASSERT_TRUE(test_read_response(fds[i], &val) > 0);
+        ASSERT_EQ_INT(val.type, RESP_SIMPLE_STRING);
+        resp_value_free(&val);
+    }
+
+    /* one too many: told why, then closed */
+    int extra = test_connect();
+    ASSERT_TRUE(extra >= 0);
+    ASSERT_TRUE(test_read_response(extra, &val) > 0);
+    ASSERT_EQ_INT(val.type, RESP_ERROR);
+    ASSERT_EQ_STR(val.str.data, "ERR max number of clients reached");
+    resp_value_free(&val);
+    char byte;
+    ASSERT_EQ_INT(read(extra, &byte, 1), 0);
+    close(extra);
+
+    /* a freed slot is taken by the next connection */
+    close(fds[0]);
+    usleep(50000);
+    fds[0] = test_connect();
+    ASSERT_TRUE(fds[0] >= 0);
+    test_send_command(fds[0], 1, "PING");
+    ASSERT_TRUE(test_read_response(fds[0], &val) > 0);
+    ASSERT_EQ_INT(val.type, RESP_SIMPLE_STRING);
     resp_value_free(&val);
 
-    close(fd1);
-    close(fd2);
-    close(fd3);
+    close(fds[0]);
+    close(fds[1]);
+    kill(pid, SIGTERM);
+    int status;
+    waitpid(pid, &status, 0);
+    test_port = saved_port;
+    ASSERT_TRUE(WIFEXITED(status) && WEXITSTATUS(status) == 0);
     return 0;
 }
 
-static int test_int_unknown_cmd(void) {
+static int stop_server(pid_t pid) {
+    kill(pid, SIGTERM);
+    int status;
+    waitpid(pid, &status, 0);
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+static int test_int_save_restart(void) {
+    int saved_port = test_port;
+    test_port = saved_port + 4;
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/mini-redis-int-%d.mrdb", (int)getpid());
+    unlink(path);
+    pid_t pid = spawn_server(test_port, "--dbfilename", path);
+    resp_value_t val;
+
     int fd = test_connect();
     ASSERT_TRUE(fd >= 0);
+    test_send_command(fd, 3, "SET", "snap:a", "alpha");
+    test_send_command(fd, 3, "INCRBY", "snap:n", "5");
+    test_send_command(fd, 5, "SET", "snap:t", "x", "EX", "100");
+    for (int i = 0; i < 3; i++) {
+        ASSERT_TRUE(test_read_response(fd, &val) > 0);
+        resp_value_free(&val);
+    }
 
-    test_send_command(fd, 1, "FOOBAR");
-    resp_value_t val;
+    /* the child saves the store as of the fork; later writes miss it */
+    test_send_command(fd, 1, "BGSAVE");
     ASSERT_TRUE(test_read_response(fd, &val) > 0);
-    ASSERT_EQ_INT(val.type, RESP_ERROR);
+    ASSERT_EQ_INT(val.type, RESP_SIMPLE_STRING);
+    ASSERT_EQ_STR(val.str.data, "Background saving started");
+    resp_value_free(&val);
+    test_send_command(fd, 3, "SET", "snap:c", "late");
+    ASSERT_TRUE(test_read_response(fd, &val) > 0);
+    resp_value_free(&val);
+    for (int i = 0; i < 100 && access(path, F_OK) < 0; i++) {
+        usleep(20000);
+    }
+    ASSERT_EQ_INT(access(path, F_OK), 0);
+    close(fd);
+    ASSERT_TRUE(stop_server(pid));
+
+    pid = spawn_server(test_port, "--dbfilename", path);
+    fd = test_connect();
+    ASSERT_TRUE(fd >= 0);
+    test_send_command(fd, 2, "GET", "snap:a");
+    ASSERT_TRUE(test_read_response(fd, &val) > 0);
+    ASSERT_EQ_STR(val.str.data, "alpha");
+    resp_value_free(&val);
+    test_send_command(fd, 2, "GET", "snap:n");
+    ASSERT_TRUE(test_read_response(fd, &val) > 0);
+    ASSERT_EQ_STR(val.str.data, "5");
+    resp_value_free(&val);
+    test_send_command(fd, 2, "TTL", "snap:t");
+    ASSERT_TRUE(test_read_response(fd, &val) > 0);
+    ASSERT_TRUE(val.integer > 0 && val.integer <= 100);
+    resp_value_free(&val);
+    test_send_command(fd, 2, "EXISTS", "snap:c");
+    ASSERT_TRUE(test_read_response(fd, &val) > 0);
+    ASSERT_EQ_INT(val.integer, 0);
+    resp_value_free(&val);
+
+    /* SAVE writes in the foreground and replies once it is on disk */
+    test_send_command(fd, 3, "SET", "snap:d", "delta");
+    ASSERT_TRUE(test_read_response(fd, &val) > 0);
+    resp_value_free(&val);
+    test_send_command(fd, 1, "SAVE");
+    ASSERT_TRUE(test_read_response(fd, &val) > 0);
+    ASSERT_EQ_INT(val.type, RESP_SIMPLE_STRING);
+    resp_value_free(&val);
+    test_send_command(fd, 1, "LASTSAVE");
+    ASSERT_TRUE(test_read_response(fd, &val) > 0);
+    ASSERT_EQ_INT(val.type, RESP_INTEGER);
+    ASSERT_TRUE(val.integer > 0);
     resp_value_free(&val);
+    close(fd);
+    ASSERT_TRUE(stop_server(pid));
 
+    pid = spawn_server(test_port, "--dbfilename", path);
+    fd = test_connect();
+    ASSERT_TRUE(fd >= 0);
+    test_send_command(fd, 2, "GET", "snap:d");
+    ASSERT_TRUE(test_read_response(fd, &val) > 0);
+    ASSERT_EQ_STR(val.str.data, "delta");
+    resp_value_free(&val);
     close(fd);
+    ASSERT_TRUE(stop_server(pid));
+
+    unlink(path);
+    test_port = saved_port;
     return 0;
 }
 
-static int test_int_wrong_argc(void) {
+static pid_t spawn_aof_server(int port, const char *path) {
+    return spawn_server2(port, "--appendonly", "yes",
+                         "--appendfilename", path);
+}
+
+static int test_int_aof_restart(void) {
+    int saved_port = test_port;
+    test_port = saved_port + 5;
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/mini-redis-int-%d.aof", (int)getpid());
+    unlink(path);
+    pid_t pid = spawn_aof_server(test_port, path);
+    resp_value_t val;
+
     int fd = test_connect();
     ASSERT_TRUE(fd >= 0);
+    test_send_command(fd, 3, "SET", "aof:a", "alpha");
+    test_send_command(fd, 5, "SET", "aof:t", "x", "EX", "100");
+    test_send_command(fd, 3, "SET", "aof:gone", "x");
+    test_send_command(fd, 2, "DEL", "aof:gone");
+    for (int i = 0; i < 50; i++) {
+        test_send_command(fd, 2, "INCR", "aof:n");
+    }
+    for (int i = 0; i < 54; i++) {
+        ASSERT_TRUE(test_read_response(fd, &val) > 0);
+        resp_value_free(&val);
+    }
+    close(fd);
+    ASSERT_TRUE(stop_server(pid));
+
+    /* everything acknowledged comes back */
+    pid = spawn_aof_server(test_port, path);
+    fd = test_connect();
+    ASSERT_TRUE(fd >= 0);
+    test_send_command(fd, 2, "GET", "aof:n");
+    ASSERT_TRUE(test_read_response(fd, &val) > 0);
+    ASSERT_EQ_STR(val.str.data, "50");
+    resp_value_free(&val);
+    test_send_command(fd, 2, "TTL", "aof:t");
+    ASSERT_TRUE(test_read_response(fd, &val) > 0);
+    ASSERT_TRUE(val.integer > 0 && val.integer <= 100);
+    resp_value_free(&val);
+    test_send_command(fd, 2, "EXISTS", "aof:gone");
+    ASSERT_TRUE(test_read_response(fd, &val) > 0);
+    ASSERT_EQ_INT(val.integer, 0);
+    resp_value_free(&val);
 
-    /* GET with no args */
-    test_send_command(fd, 1, "GET");
-    resp_value_t val;
+    /* the rewrite compacts the log; a write made meanwhile is kept */
+    struct stat before;
+    ASSERT_EQ_INT(stat(path, &before), 0);
+    test_send_command(fd, 1, "BGREWRITEAOF");
     ASSERT_TRUE(test_read_response(fd, &val) > 0);
-    ASSERT_EQ_INT(val.type, RESP_ERROR);
+    ASSERT_EQ_INT(val.type, RESP_SIMPLE_STRING);
     resp_value_free(&val);
+    test_send_command(fd, 3, "SET", "aof:late", "during");
+    ASSERT_TRUE(test_read_response(fd, &val) > 0);
+    resp_value_free(&val);
+    /* a second one is refused until the first is done */
+    bool started = false;
+    for (int i = 0; i < 100 && !started; i++) {
+        test_send_command(fd, 1, "BGREWRITEAOF");
+        ASSERT_TRUE(test_read_response(fd, &val) > 0);
+        started = val.type == RESP_SIMPLE_STRING;
+        if (!started) {
+            ASSERT_EQ_INT(val.type, RESP_ERROR);
+            usleep(20000);
+        }
+        resp_value_free(&val);
+    }
+    ASSERT_TRUE(started);
+    struct stat after;
+    ASSERT_EQ_INT(stat(path, &after), 0);
+    ASSERT_TRUE(after.st_size < before.st_size);
+    close(fd);
+    ASSERT_TRUE(stop_server(pid));
+
+    pid = spawn_aof_server(test_port, path);
+    fd = test_connect();
+    ASSERT_TRUE(fd >= 0);
+    test_send_command(fd, 2, "GET", "aof:late");
+    ASSERT_TRUE(test_read_response(fd, &val) > 0);
+    ASSERT_EQ_STR(val.str.data, "during");
+    resp_value_free(&val);
+    test_send_command(fd, 2, "GET", "aof:n");
+    ASSERT_TRUE(test_read_response(fd, &val) > 0);
+    ASSERT_EQ_STR(val.str.data, "50");
+    resp_value_free(&val);
+    close(fd);
+    ASSERT_TRUE(stop_server(pid));
+
+    unlink(path);
+    test_port = saved_port;
+    return 0;
+}
+
+/* Poll port until GET key returns want, for up to about two seconds. */
+static bool wait_for_value(int port, const char *key, const char *want) {
+    int saved_port = test_port;
+    test_port = port;
+    int fd = test_connect();
+    test_port = saved_port;
+    if (fd < 0) {
+        return false;
+    }
+    bool found = false;
+    for (int i = 0; i < 100 && !found; i++) {
+        resp_value_t val;
+        test_send_command(fd, 2, "GET", key);
+        if (test_read_response(fd, &val) <= 0) {
+            break;
+        }
+        found = val.type == RESP_BULK_STRING && strcmp(val.str.data, want) == 0;
+        resp_value_free(&val);
+        if (!found) {
+            usleep(20000);
+        }
+    }
+    close(fd);
+    return found;
+}
+
+static int test_int_replication(void) {
+    int saved_port = test_port;
+    int primary_port = saved_port + 6, replica_port = saved_port + 7;
+    char primary_db[64], replica_db[64];
+    snprintf(primary_db, sizeof(primary_db), "/tmp/mini-redis-int-%d-p.mrdb",
+             (int)getpid());
+    snprintf(replica_db, sizeof(replica_db), "/tmp/mini-redis-int-%d-r.mrdb",
+             (int)getpid());
+    pid_t primary = spawn_server(primary_port, "--dbfilename", primary_db);
+    pid_t replica = spawn_server(replica_port, "--dbfilename", replica_db);
+    resp_value_t val;
+
+    /* written before the replica attaches: comes over in the snapshot */
+    test_port = primary_port;
+    int pfd = test_connect();
+    ASSERT_TRUE(pfd >= 0);
+    test_send_command(pfd, 3, "SET", "repl:old", "before");
+    ASSERT_TRUE(test_read_response(pfd, &val) > 0);
+    resp_value_free(&val);
+
+    test_port = replica_port;
+    int rfd = test_connect();
+    ASSERT_TRUE(rfd >= 0);
+    char port_str[16];
+    snprintf(port_str, sizeof(port_str), "%d", primary_port);
+    test_send_command(rfd, 3, "REPLICAOF", "127.0.0.1", port_str);
+    ASSERT_TRUE(test_read_response(rfd, &val) > 0);
+    ASSERT_EQ_INT(val.type, RESP_SIMPLE_STRING);
+    resp_value_free(&val);
+    ASSERT_TRUE(wait_for_value(replica_port, "repl:old", "before"));
+
+    /* then the stream */
+    for (int i = 0; i < 20; i++) {
+        test_send_command(pfd, 2, "INCR", "repl:n");
+    }
+    test_send_command(pfd, 3, "SET", "repl:new", "after");
+    for (int i = 0; i < 21; i++) {
+        ASSERT_TRUE(test_read_response(pfd, &val) > 0);
+        resp_value_free(&val);
+    }
+    ASSERT_TRUE(wait_for_value(replica_port, "repl:new", "after"));
+    test_send_command(rfd, 2, "GET", "repl:n");
+    ASSERT_TRUE(test_read_response(rfd, &val) > 0);
+    ASSERT_EQ_STR(val.str.data, "20");
+    resp_value_free(&val);
+
+    test_send_command(rfd, 3, "SET", "repl:new", "mine");
+    ASSERT_TRUE(test_read_response(rfd, &val) > 0);
+    ASSERT_EQ_INT(val.type, RESP_ERROR);
+    ASSERT_TRUE(strncmp(val.str.data, "READONLY", 8) == 0);
+    resp_value_free(&val);
+
+    test_send_command(rfd, 1, "ROLE");
+    ASSERT_TRUE(test_read_response(rfd, &val) > 0);
+    ASSERT_EQ_INT(val.type, RESP_ARRAY);
+    ASSERT_EQ_INT(val.array.count, 5);
+    ASSERT_EQ_STR(val.array.elements[0].str.data, "slave");
+    ASSERT_EQ_STR(val.array.elements[3].str.data, "connected");
+    int64_t offset = val.array.elements[4].integer;
+    resp_value_free(&val);
+    test_send_command(pfd, 1, "ROLE");
+    ASSERT_TRUE(test_read_response(pfd, &val) > 0);
+    ASSERT_EQ_STR(val.array.elements[0].str.data, "master");
+    ASSERT_EQ_INT(val.array.elements[1].integer, offset);
+    ASSERT_EQ_INT(val.array.elements[2].integer, 1);
+    resp_value_free(&val);
+
+    /* promoted, it takes writes again */
+    test_send_command(rfd, 3, "REPLICAOF", "NO", "ONE");
+    ASSERT_TRUE(test_read_response(rfd, &val) > 0);
+    resp_value_free(&val);
+    test_send_command(rfd, 3, "SET", "repl:new", "mine");
+    ASSERT_TRUE(test_read_response(rfd, &val) > 0);
+    ASSERT_EQ_INT(val.type, RESP_SIMPLE_STRING);
+    resp_value_free(&val);
+
+    close(pfd);
+    close(rfd);
+    ASSERT_TRUE(stop_server(replica));
+    ASSERT_TRUE(stop_server(primary));
+    unlink(primary_db);
+    unlink(replica_db);
+    test_port = saved_port;
+    return 0;
+}
+
+static int test_int_type(void) {
+    int fd = test_connect();
+    ASSERT_TRUE(fd >= 0);
+
+    resp_value_t val;
+    test_send_command(fd, 3, "SET", "typekey", "v");
+    ASSERT_TRUE(test_read_response(fd, &val) > 0);
+    resp_value_free(&val);
+
+    test_send_command(fd, 2, "TYPE", "typekey");
+    ASSERT_TRUE(test_read_response(fd, &val) > 0);
+    ASSERT_EQ_INT(val.type, RESP_SIMPLE_STRING);
+    ASSERT_EQ_STR(val.str.data, "string");
+    resp_value_free(&val);
+
+    test_send_command(fd, 2, "TYPE", "missing_typekey");
+    ASSERT_TRUE(test_read_response(fd, &val) > 0);
+    ASSERT_EQ_INT(val.type, RESP_SIMPLE_STRING);
+    ASSERT_EQ_STR(val.str.data, "none");
+    resp_value_free(&val);
+
+    close(fd);
+    return 0;
+}
+
+static int test_int_incr_new(void) {
+    int fd = test_connect();
+    ASSERT_TRUE(fd >= 0);
+
+    resp_value_t val;
+    test_send_command(fd, 2, "INCR", "incr_new_key");
+    ASSERT_TRUE(test_read_response(fd, &val) > 0);
+    ASSERT_EQ_INT(val.type, RESP_INTEGER);
+    ASSERT_EQ_INT(val.integer, 1);
+
+    close(fd);
+    return 0;
+}
+
+static int test_int_incr_existing(void) {
+    int fd = test_connect();
+    ASSERT_TRUE(fd >= 0);
+
+    resp_value_t val;
+    test_send_command(fd, 3, "SET", "incr_ex_key", "10");
+    ASSERT_TRUE(test_read_response(fd, &val) > 0);
+    resp_value_free(&val);
+
+    test_send_command(fd, 2, "INCR", "incr_ex_key");
+    ASSERT_TRUE(test_read_response(fd, &val) > 0);
+    ASSERT_EQ_INT(val.type, RESP_INTEGER);
+    ASSERT_EQ_INT(val.integer, 11);
+
+    close(fd);
+    return 0;
+}
+
+static int test_int_incr_non_integer(void) {
+    int fd = test_connect();
+    ASSERT_TRUE(fd >= 0);
+
+    resp_value_t val;
+    test_send_command(fd, 3, "SET", "incr_str_key", "abc");
+    ASSERT_TRUE(test_read_response(fd, &val) > 0);
+    resp_value_free(&val);
+
+    test_send_command(fd, 2, "INCR", "incr_str_key");
+    ASSERT_TRUE(test_read_response(fd, &val) > 0);
+    ASSERT_EQ_INT(val.type, RESP_ERROR);
+    resp_value_free(&val);
+
+    close(fd);
+    return 0;
+}
+
+static int test_int_decr(void) {
+    int fd = test_connect();
+    ASSERT_TRUE(fd >= 0);
+
+    resp_value_t val;
+    test_send_command(fd, 3, "SET", "decr_key", "10");
+    ASSERT_TRUE(test_read_response(fd, &val) > 0);
+    resp_value_free(&val);
+
+    test_send_command(fd, 2, "DECR", "decr_key");
+    ASSERT_TRUE(test_read_response(fd, &val) > 0);
+    ASSERT_EQ_INT(val.type, RESP_INTEGER);
+    ASSERT_EQ_INT(val.integer, 9);
+
+    close(fd);
+    return 0;
+}
+
+static int test_int_incrby_decrby(void) {
+    int fd = test_connect();
+    ASSERT_TRUE(fd >= 0);
+
+    resp_value_t val;
+    test_send_command(fd, 3, "INCRBY", "by_key", "100");
+    ASSERT_TRUE(test_read_response(fd, &val) > 0);
+    ASSERT_EQ_INT(val.type, RESP_INTEGER);
+    ASSERT_EQ_INT(val.integer, 100);
+
+    test_send_command(fd, 3, "DECRBY", "by_key", "142");
+    ASSERT_TRUE(test_read_response(fd, &val) > 0);
+    ASSERT_EQ_INT(val.integer, -42);
+
+    /* the counter reads back as a string */
+    test_send_command(fd, 2, "GET", "by_key");
+    ASSERT_TRUE(test_read_response(fd, &val) > 0);
+    ASSERT_EQ_INT(val.type, RESP_BULK_STRING);
+    ASSERT_EQ_STR(val.str.data, "-42");
+    resp_value_free(&val);
+
+    test_send_command(fd, 3, "INCRBY", "by_key", "ten");
+    ASSERT_TRUE(test_read_response(fd, &val) > 0);
+    ASSERT_EQ_INT(val.type, RESP_ERROR);
+    resp_value_free(&val);
+
+    test_send_command(fd, 3, "DECRBY", "by_key", "-9223372036854775808");
+    ASSERT_TRUE(test_read_response(fd, &val) > 0);
+    ASSERT_EQ_INT(val.type, RESP_ERROR);
+    resp_value_free(&val);
+
+    close(fd);
+    return 0;
+}
+
+static int test_int_incr_bounds(void) {
+    int fd = test_connect();
+    ASSERT_TRUE(fd >= 0);
+
+    resp_value_t val;
+    test_send_command(fd, 3, "SET", "min_key", "-9223372036854775807");
+    ASSERT_TRUE(test_read_response(fd, &val) > 0);
+    resp_value_free(&val);
+
+    test_send_command(fd, 2, "DECR", "min_key");
+    ASSERT_TRUE(test_read_response(fd, &val) > 0);
+    ASSERT_EQ_INT(val.type, RESP_INTEGER);
+    ASSERT_TRUE(val.integer == INT64_MIN);
+
+    /* one past either end is refused and leaves the value */
+    test_send_command(fd, 2, "DECR", "min_key");
+    ASSERT_TRUE(test_read_response(fd, &val) > 0);
+    ASSERT_EQ_INT(val.type, RESP_ERROR);
+    resp_value_free(&val);
+
+    test_send_command(fd, 2, "GET", "min_key");
+    ASSERT_TRUE(test_read_response(fd, &val) > 0);
+    ASSERT_EQ_STR(val.str.data, "-9223372036854775808");
+    resp_value_free(&val);
+
+    test_send_command(fd, 3, "SET", "max_key", "9223372036854775808");
+    ASSERT_TRUE(test_read_response(fd, &val) > 0);
+    resp_value_free(&val);
+    test_send_command(fd, 2, "INCR", "max_key");
+    ASSERT_TRUE(test_read_response(fd, &val) > 0);
+    ASSERT_EQ_INT(val.type, RESP_ERROR);
+    resp_value_free(&val);
+
+    close(fd);
+    return 0;
+}
+
+static int test_int_pipeline(void) {
+    int fd = test_connect();
+    ASSERT_TRUE(fd >= 0);
+
+    /* Send 3 commands at once */
+    char buf[512];
+    int off = 0;
+    /* PING */
+    off += snprintf(buf + off, sizeof(buf) - (size_t)off,
+                    "*1\r\n$4\r\nPING\r\n");
+    /* SET pipeline_k v */
+    off += snprintf(buf + off, sizeof(buf) - (size_t)off,
+                    "*3\r\n$3\r\nSET\r\n$10\r\npipeline_k\r\n$1\r\nv\r\n");
+    /* GET pipeline_k */
+    off += snprintf(buf + off, sizeof(buf) - (size_t)off,
+                    "*2\r\n$3\r\nGET\r\n$10\r\npipeline_k\r\n");
+    test_send(fd, buf, (size_t)off);
+
+    /* Read 3 responses */
+    resp_value_t val;
+
+    ASSERT_TRUE(test_read_response(fd, &val) > 0);
+    ASSERT_EQ_INT(val.type, RESP_SIMPLE_STRING);
+    ASSERT_EQ_STR(val.str.data, "PONG");
+    resp_value_free(&val);
+
+    ASSERT_TRUE(test_read_response(fd, &val) > 0);
+    ASSERT_EQ_INT(val.type, RESP_SIMPLE_STRING);
+    ASSERT_EQ_STR(val.str.data, "OK");
+    resp_value_free(&val);
+
+    ASSERT_TRUE(test_read_response(fd, &val) > 0);
+    ASSERT_EQ_INT(val.type, RESP_BULK_STRING);
+    ASSERT_EQ_STR(val.str.data, "v");
+    resp_value_free(&val);
+
+    close(fd);
+    return 0;
+}
+
+static int test_int_concurrent(void) {
+    int fd1 = test_connect();
+    int fd2 = test_connect();
+    int fd3 = test_connect();
+    ASSERT_TRUE(fd1 >= 0);
+    ASSERT_TRUE(fd2 >= 0);
+    ASSERT_TRUE(fd3 >= 0);
+
+    resp_value_t val;
+
+    /* Each client sets its own key */
+    test_send_command(fd1, 3, "SET", "cc1", "v1");
+    test_send_command(fd2, 3, "SET", "cc2", "v2");
+    test_send_command(fd3, 3, "SET", "cc3", "v3");
+
+    ASSERT_TRUE(test_read_response(fd1, &val) > 0);
+    resp_value_free(&val);
+    ASSERT_TRUE(test_read_response(fd2, &val) > 0);
+    resp_value_free(&val);
+    ASSERT_TRUE(test_read_response(fd3, &val) > 0);
+    resp_value_free(&val);
+
+    /* Each client gets its own key */
+    test_send_command(fd1, 2, "GET", "cc1");
+    test_send_command(fd2, 2, "GET", "cc2");
+    test_send_command(fd3, 2, "GET", "cc3");
+
+    ASSERT_TRUE(test_read_response(fd1, &val) > 0);
+    ASSERT_EQ_STR(val.str.data, "v1");
+    resp_value_free(&val);
+
+    ASSERT_TRUE(test_read_response(fd2, &val) > 0);
+    ASSERT_EQ_STR(val.str.data, "v2");
+    resp_value_free(&val);
+
+    ASSERT_TRUE(test_read_response(fd3, &val) > 0);
+    ASSERT_EQ_STR(val.str.data, "v3");
+    resp_value_free(&val);
+
+    close(fd1);
+    close(fd2);
+    close(fd3);
+    return 0;
+}
+
+static int test_int_unknown_cmd(void) {
+    int fd = test_connect();
+    ASSERT_TRUE(fd >= 0);
+
+    test_send_command(fd, 1, "FOOBAR");
+    resp_value_t val;
+    ASSERT_TRUE(test_read_response(fd, &val) > 0);
+    ASSERT_EQ_INT(val.type, RESP_ERROR);
+    resp_value_free(&val);
+
+    close(fd);
+    return 0;
+}
+
+static int test_int_wrong_argc(void) {
+    int fd = test_connect();
+    ASSERT_TRUE(fd >= 0);
+
+    /* GET with no args */
+    test_send_command(fd, 1, "GET");
+    resp_value_t val;
+    ASSERT_TRUE(test_read_response(fd, &val) > 0);
+    ASSERT_EQ_INT(val.type, RESP_ERROR);
+    resp_value_free(&val);
+
+    close(fd);
+    return 0;
+}
+
+static int test_int_lowercase_cmd(void) {
+    int fd = test_connect();
+    ASSERT_TRUE(fd >= 0);
+
+    resp_value_t val;
+    test_send_command(fd, 3, "set", "lc_key", "v");
+    ASSERT_TRUE(test_read_response(fd, &val) > 0);
+    ASSERT_EQ_INT(val.type, RESP_SIMPLE_STRING);
+    resp_value_free(&val);
+
+    test_send_command(fd, 2, "GeT", "lc_key");
+    ASSERT_TRUE(test_read_response(fd, &val) > 0);
+    ASSERT_EQ_INT(val.type, RESP_BULK_STRING);
+    ASSERT_EQ_STR(val.str.data, "v");
+    resp_value_free(&val);
+
+    close(fd);
+    return 0;
+}
+
+static int test_int_memory_stats(void) {
+    int fd = test_connect();
+    ASSERT_TRUE(fd >= 0);
+
+    resp_value_t val;
+    test_send_command(fd, 3, "SET", "mem_key", "a value long enough to need a block");
+    ASSERT_TRUE(test_read_response(fd, &val) > 0);
+    resp_value_free(&val);
+
+    test_send_command(fd, 2, "MEMORY", "stats");
+    ASSERT_TRUE(test_read_response(fd, &val) > 0);
+    ASSERT_EQ_INT(val.type, RESP_ARRAY);
+    ASSERT_EQ_INT(val.array.count, 20);
+    ASSERT_EQ_STR(val.array.elements[2].str.data, "slab.requested");
+    ASSERT_TRUE(val.array.elements[3].integer > 0);
+    resp_value_free(&val);
+
+    test_send_command(fd, 2, "MEMORY", "SLABS");
+    ASSERT_TRUE(test_read_response(fd, &val) > 0);
+    ASSERT_EQ_INT(val.type, RESP_ARRAY);
+    ASSERT_TRUE(val.array.count > 0);
+    ASSERT_EQ_INT(val.array.elements[0].array.count, 4);
+    resp_value_free(&val);
+
+    test_send_command(fd, 2, "MEMORY", "bogus");
+    ASSERT_TRUE(test_read_response(fd, &val) > 0);
+    ASSERT_EQ_INT(val.type, RESP_ERROR);
+    resp_value_free(&val);
+
+    close(fd);
+    return 0;
+}
+
+/* INFO, SLOWLOG and LATENCY on a server that logs every command. */
+static int test_int_info_slowlog(void) {
+    int saved_port = test_port;
+    int port = saved_port + 8;
+    pid_t pid = spawn_server2(port, "--slowlog-log-slower-than", "0",
+                              "--slowlog-max-len", "3");
+    test_port = port;
+    int fd = test_connect();
+    ASSERT_TRUE(fd >= 0);
+    resp_value_t val;
+
+    test_send_command(fd, 3, "SET", "info:k", "v");
+    ASSERT_TRUE(test_read_response(fd, &val) > 0);
+    resp_value_free(&val);
+    test_send_command(fd, 2, "GET", "info:k");
+    ASSERT_TRUE(test_read_response(fd, &val) > 0);
+    resp_value_free(&val);
+
+    test_send_command(fd, 1, "INFO");
+    ASSERT_TRUE(test_read_response(fd, &val) > 0);
+    ASSERT_EQ_INT(val.type, RESP_BULK_STRING);
+    ASSERT_TRUE(strncmp(val.str.data, "# Server\r\n", 10) == 0);
+    ASSERT_NOT_NULL(strstr(val.str.data, "\r\nconnected_clients:1\r\n"));
+    ASSERT_NOT_NULL(strstr(val.str.data, "\r\ntotal_commands_processed:2\r\n"));
+    ASSERT_NOT_NULL(strstr(val.str.data, "\r\nrole:master\r\n"));
+    ASSERT_NOT_NULL(strstr(val.str.data, "\r\ndb0:keys=1\r\n"));
+    ASSERT_NULL(strstr(val.str.data, "cmdstat_"));
+    resp_value_free(&val);
+
+    test_send_command(fd, 2, "INFO", "commandstats");
+    ASSERT_TRUE(test_read_response(fd, &val) > 0);
+    ASSERT_TRUE(strncmp(val.str.data, "# Commandstats\r\n", 16) == 0);
+    ASSERT_NOT_NULL(strstr(val.str.data, "\r\ncmdstat_set:calls=1,"));
+    ASSERT_NOT_NULL(strstr(val.str.data, "\r\ncmdstat_get:calls=1,"));
+    ASSERT_NULL(strstr(val.str.data, "# Server"));
+    resp_value_free(&val);
+
+    /* newest first; the ring holds three */
+    test_send_command(fd, 2, "SLOWLOG", "GET");
+    ASSERT_TRUE(test_read_response(fd, &val) > 0);
+    ASSERT_EQ_INT(val.type, RESP_ARRAY);
+    ASSERT_EQ_INT(val.array.count, 3);
+    resp_value_t *args = &val.array.elements[0].array.elements[3];
+    ASSERT_EQ_STR(args->array.elements[0].str.data, "INFO");
+    ASSERT_EQ_STR(args->array.elements[1].str.data, "commandstats");
+    args = &val.array.elements[2].array.elements[3];
+    ASSERT_EQ_STR(args->array.elements[0].str.data, "GET");
+    resp_value_free(&val);
+
+    test_send_command(fd, 2, "SLOWLOG", "RESET");
+    ASSERT_TRUE(test_read_response(fd, &val) > 0);
+    ASSERT_EQ_INT(val.type, RESP_SIMPLE_STRING);
+    resp_value_free(&val);
+    test_send_command(fd, 2, "SLOWLOG", "LEN");
+    ASSERT_TRUE(test_read_response(fd, &val) > 0);
+    /* the RESET itself */
+    ASSERT_EQ_INT(val.integer, 1);
+    resp_value_free(&val);
+
+    test_send_command(fd, 3, "LATENCY", "HISTOGRAM", "set");
+    ASSERT_TRUE(test_read_response(fd, &val) > 0);
+    ASSERT_EQ_INT(val.type, RESP_ARRAY);
+    ASSERT_EQ_INT(val.array.count, 2);
+    ASSERT_EQ_STR(val.array.elements[0].str.data, "set");
+    ASSERT_EQ_INT(val.array.elements[1].array.elements[1].integer, 1);
+    resp_value_free(&val);
+
+    test_send_command(fd, 2, "SLOWLOG", "bogus");
+    ASSERT_TRUE(test_read_response(fd, &val) > 0);
+    ASSERT_EQ_INT(val.type, RESP_ERROR);
+    resp_value_free(&val);
+
+    close(fd);
+    ASSERT_TRUE(stop_server(pid));
+    test_port = saved_port;
+    return 0;
+}
+
+/* Writing well past --maxmemory evicts instead of growing: used memory
+   stays at the limit, and keys read after the others were written are
+   the ones that survive. */
+static int test_int_maxmemory(void) {
+    int saved_port = test_port;
+    int port = saved_port + 9;
+    pid_t pid = spawn_server2(port, "--maxmemory", "2000000",
+                              "--maxmemory-policy", "allkeys-lru");
+    test_port = port;
+    int fd = test_connect();
+    ASSERT_TRUE(fd >= 0);
+    resp_value_t val;
+
+    char value[1001];
+    memset(value, 'x', sizeof(value) - 1);
+    value[sizeof(value) - 1] = '\0';
+    char key[32];
+    for (int i = 0; i < 2200; i++) {
+        if (i == 1500) {
+            /* a clock tick later, read back the first 100 */
+            usleep(1100000);
+            for (int j = 0; j < 100; j++) {
+                snprintf(key, sizeof(key), "mm:%d", j);
+                test_send_command(fd, 2, "GET", key);
+                ASSERT_TRUE(test_read_response(fd, &val) > 0);
+                ASSERT_EQ_INT(val.type, RESP_BULK_STRING);
+                resp_value_free(&val);
+            }
+        }
+        snprintf(key, sizeof(key), "mm:%d", i);
+        test_send_command(fd, 3, "SET", key, value);
+        ASSERT_TRUE(test_read_response(fd, &val) > 0);
+        ASSERT_EQ_INT(val.type, RESP_SIMPLE_STRING);
+        resp_value_free(&val);
+    }
+
+    int read_kept = 0, idle_kept = 0;
+    for (int j = 0; j < 1500; j++) {
+        snprintf(key, sizeof(key), "mm:%d", j);
+        test_send_command(fd, 2, "EXISTS", key);
+        ASSERT_TRUE(test_read_response(fd, &val) > 0);
+        if (j < 100) {
+            read_kept += (int)val.integer;
+        } else {
+            idle_kept += (int)val.integer;
+        }
+        resp_value_free(&val);
+    }
+    /* sampling is approximate: a few read keys may still go */
+    ASSERT_TRUE(read_kept >= 85);
+    ASSERT_TRUE(idle_kept < 1000);
+
+    test_send_command(fd, 1, "INFO");
+    ASSERT_TRUE(test_read_response(fd, &val) > 0);
+    ASSERT_NOT_NULL(strstr(val.str.data, "\r\nmaxmemory:2000000\r\n"));
+    ASSERT_NOT_NULL(strstr(val.str.data,
+                           "\r\nmaxmemory_policy:allkeys-lru\r\n"));
+    /* eviction runs before a write, so the last one may go past */
+    const char *used = strstr(val.str.data, "\r\nused_memory:");
+    ASSERT_NOT_NULL(used);
+    ASSERT_TRUE(strtoll(used + 14, NULL, 10) <= 2000000 + 64 * 1024);
+    const char *evicted = strstr(val.str.data, "\r\nevicted_keys:");
+    ASSERT_NOT_NULL(evicted);
+    ASSERT_TRUE(strtoll(evicted + 15, NULL, 10) > 200);
+    resp_value_free(&val);
+
+    close(fd);
+    ASSERT_TRUE(stop_server(pid));
+    test_port = saved_port;
+    return 0;
+}
+
+#define UNLINK_TEST_BIG 200000
+
+/* --shards 2: UNLINK counts like DEL across shards, and FLUSHALL and
+   FLUSHDB empty every shard, ASYNC or not. */
+static int test_int_unlink_flushall(void) {
+    int saved_port = test_port;
+    int port = saved_port + 10;
+    pid_t pid = spawn_server(port, "--shards", "2");
+    test_port = port;
+    int fd = test_connect();
+    ASSERT_TRUE(fd >= 0);
+    resp_value_t val;
+
+    /* big enough that its free is an munmap */
+    static char big[UNLINK_TEST_BIG + 64];
+    int off = snprintf(big, sizeof(big), "*3\r\n$3\r\nSET\r\n$6\r\nul:big\r\n"
+                       "$%d\r\n", UNLINK_TEST_BIG);
+    memset(big + off, 'b', UNLINK_TEST_BIG);
+    memcpy(big + off + UNLINK_TEST_BIG, "\r\n", 2);
+    test_send(fd, big, (size_t)off + UNLINK_TEST_BIG + 2);
+    ASSERT_TRUE(test_read_response(fd, &val) > 0);
+    ASSERT_EQ_INT(val.type, RESP_SIMPLE_STRING);
+    resp_value_free(&val);
+    test_send_command(fd, 3, "SET", "ul:a", "1");
+    ASSERT_TRUE(test_read_response(fd, &val) > 0);
+    resp_value_free(&val);
+    test_send_command(fd, 4, "UNLINK", "ul:big", "ul:a", "ul:none");
+    ASSERT_TRUE(test_read_response(fd, &val) > 0);
+    ASSERT_EQ_INT(val.type, RESP_INTEGER);
+    ASSERT_EQ_INT(val.integer, 2);
+    test_send_command(fd, 2, "GET", "ul:big");
+    ASSERT_TRUE(test_read_response(fd, &val) > 0);
+    ASSERT_EQ_INT(val.type, RESP_NULL_BULK_STRING);
+
+    const char *flushes[][2] = {{"FLUSHALL", "ASYNC"}, {"FLUSHDB", NULL},
+                                {"FLUSHALL", "SYNC"}, {"FLUSHDB", "ASYNC"}};
+    for (int m = 0; m < 4; m++) {
+        send_numbered(fd, "MSET", "ul:", 200, true);
+        ASSERT_TRUE(test_read_response(fd, &val) > 0);
+        resp_value_free(&val);
+        test_send_command(fd, flushes[m][1] ? 2 : 1, flushes[m][0],
+                          flushes[m][1]);
+        ASSERT_TRUE(test_read_response(fd, &val) > 0);
+        ASSERT_EQ_INT(val.type, RESP_SIMPLE_STRING);
+        ASSERT_EQ_STR(val.str.data, "OK");
+        resp_value_free(&val);
+        test_send_command(fd, 2, "KEYS", "*");
+        ASSERT_TRUE(test_read_response(fd, &val) > 0);
+        ASSERT_EQ_INT(val.array.count, 0);
+        resp_value_free(&val);
+    }
+
+    /* the store works at once after an async flush */
+    test_send_command(fd, 3, "SET", "ul:after", "x");
+    ASSERT_TRUE(test_read_response(fd, &val) > 0);
+    resp_value_free(&val);
+    test_send_command(fd, 2, "GET", "ul:after");
+    ASSERT_TRUE(test_read_response(fd, &val) > 0);
+    ASSERT_EQ_STR(val.str.data, "x");
+    resp_value_free(&val);
+
+    test_send_command(fd, 2, "FLUSHALL", "LATER");
+    ASSERT_TRUE(test_read_response(fd, &val) > 0);
+    ASSERT_EQ_INT(val.type, RESP_ERROR);
+    ASSERT_EQ_STR(val.str.data, "ERR syntax error");
+    resp_value_free(&val);
+    test_send_command(fd, 2, "EXISTS", "ul:after");
+    ASSERT_TRUE(test_read_response(fd, &val) > 0);
+    ASSERT_EQ_INT(val.integer, 1);
+
+    test_send_command(fd, 2, "INFO", "memory");
+    ASSERT_TRUE(test_read_response(fd, &val) > 0);
+    ASSERT_NOT_NULL(strstr(val.str.data, "\r\nlazyfree_pending_objects:"));
+    resp_value_free(&val);
+
+    close(fd);
+    ASSERT_TRUE(stop_server(pid));
+    test_port = saved_port;
+    return 0;
+}
+
+#define LIMIT_TEST_BIG 60000     /* under the query limit below */
+#define LIMIT_TEST_GETS 500     /* 30 MB of replies, past the soft limit */
+
+static int test_int_client_limits(void) {
+    int saved_port = test_port;
+    int port = saved_port + 11;
+    pid_t pid = spawn_server2(port, "--client-query-buffer-limit", "100000",
+                              "50000", NULL);
+    test_port = port;
+    int fd = test_connect();
+    int other = test_connect();
+    ASSERT_TRUE(fd >= 0 && other >= 0);
+    resp_value_t val;
+
+    test_send_command(other, 2, "CLIENT", "LIST");
+    ASSERT_TRUE(test_read_response(other, &val) > 0);
+    ASSERT_EQ_INT(val.type, RESP_BULK_STRING);
+    ASSERT_NOT_NULL(strstr(val.str.data, "id="));
+    ASSERT_NOT_NULL(strstr(val.str.data, "addr=127.0.0.1:"));
+    ASSERT_NOT_NULL(strstr(val.str.data, "qbuf="));
+    ASSERT_NOT_NULL(strstr(val.str.data, "omem="));
+    resp_value_free(&val);
+    test_send_command(other, 2, "CLIENT", "KILL");
+    ASSERT_TRUE(test_read_response(other, &val) > 0);
+    ASSERT_EQ_INT(val.type, RESP_ERROR);
+    resp_value_free(&val);
+
+    static char big[LIMIT_TEST_BIG + 64];
+    int off = snprintf(big, sizeof(big), "*3\r\n$3\r\nSET\r\n$3\r\nbig\r\n"
+                       "$%d\r\n", LIMIT_TEST_BIG);
+    memset(big + off, 'x', LIMIT_TEST_BIG);
+    memcpy(big + off + LIMIT_TEST_BIG, "\r\n", 2);
+    test_send(fd, big, (size_t)off + LIMIT_TEST_BIG + 2);
+    ASSERT_TRUE(test_read_response(fd, &val) > 0);
+    ASSERT_EQ_INT(val.type, RESP_SIMPLE_STRING);
+    resp_value_free(&val);
+
+    /* a client that does not read is paused, not buffered without end */
+    char get[32];
+    int glen = snprintf(get, sizeof(get), "*2\r\n$3\r\nGET\r\n$3\r\nbig\r\n");
+    for (int i = 0; i < LIMIT_TEST_GETS; i++) {
+        test_send(fd, get, (size_t)glen);
+    }
+    usleep(200000);
+    test_send_command(other, 2, "CLIENT", "LIST");
+    ASSERT_TRUE(test_read_response(other, &val) > 0);
+    ASSERT_NOT_NULL(strstr(val.str.data, "flags=p"));
+    resp_value_free(&val);
+
+    /* and gets every reply once it does */
+    static char reply[LIMIT_TEST_BIG + 64];
+    size_t want = 8 + LIMIT_TEST_BIG + 2;     /* "$60000\r\n" ... "\r\n" */
+    for (int i = 0; i < LIMIT_TEST_GETS; i++) {
+        ASSERT_TRUE(recv_all(fd, reply, want) == want);
+        ASSERT_TRUE(memcmp(reply, "$60000\r\n", 8) == 0);
+        ASSERT_TRUE(reply[8] == 'x' && reply[7 + LIMIT_TEST_BIG] == 'x');
+    }
+    test_send_command(fd, 1, "PING");
+    ASSERT_TRUE(test_read_response(fd, &val) > 0);
+    ASSERT_EQ_INT(val.type, RESP_SIMPLE_STRING);
+    resp_value_free(&val);
+
+    /* a request that grows past the hard limit closes the connection */
+    off = snprintf(big, sizeof(big), "*3\r\n$3\r\nSET\r\n$1\r\nk\r\n"
+                   "$1000000\r\n");
+    memset(big + off, 'x', LIMIT_TEST_BIG);
+    test_send(fd, big, (size_t)off + LIMIT_TEST_BIG);
+    /* nothing more is sent once it is past: the close would be a SIGPIPE */
+    test_send(fd, big + off, LIMIT_TEST_BIG * 3 / 4);
+    char byte;
+    ASSERT_TRUE(read(fd, &byte, 1) <= 0);
+    close(fd);
+
+    test_send_command(other, 2, "INFO", "stats");
+    ASSERT_TRUE(test_read_response(other, &val) > 0);
+    ASSERT_NOT_NULL(strstr(val.str.data,
+                           "\r\nclient_query_buffer_limit_disconnections:1"));
+    resp_value_free(&val);
+
+    close(other);
+    ASSERT_TRUE(stop_server(pid));
+    test_port = saved_port;
+    return 0;
+}
+
+/* The server binds its Unix socket just after its TCP listener, so
+   give it a moment. */
+static int unix_connect(const char *path) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", path);
+    for (int attempt = 0; attempt < 50; attempt++) {
+        int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0) {
+            return -1;
+        }
+        if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0) {
+            test_reset_buf(fd);
+            return fd;
+        }
+        close(fd);
+        usleep(10000);
+    }
+    return -1;
+}
+
+static int test_int_unix_socket(void) {
+    int saved_port = test_port;
+    int port = saved_port + 12;
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/mini-redis-int-%d.sock", (int)getpid());
+    /* a stale socket from an earlier run is replaced */
+    int stale = socket(AF_UNIX, SOCK_STREAM, 0);
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", path);
+    ASSERT_EQ_INT(bind(stale, (struct sockaddr *)&addr, sizeof(addr)), 0);
+    close(stale);
+
+    pid_t pid = spawn_server2(port, "--unixsocket", path, "--shards", "2");
+    test_port = port;
+    int ufd = unix_connect(path);
+    int tfd = test_connect();
+    ASSERT_TRUE(ufd >= 0 && tfd >= 0);
+    resp_value_t val;
+
+    /* keys on both shards, written over one socket and read over the
+       other */
+    send_numbered(ufd, "MSET", "us:", 50, true);
+    ASSERT_TRUE(test_read_response(ufd, &val) > 0);
+    ASSERT_EQ_INT(val.type, RESP_SIMPLE_STRING);
+    resp_value_free(&val);
+    send_numbered(tfd, "MGET", "us:", 50, false);
+    ASSERT_TRUE(test_read_response(tfd, &val) > 0);
+    ASSERT_EQ_INT(val.type, RESP_ARRAY);
+    ASSERT_EQ_INT(val.array.count, 50);
+    ASSERT_EQ_STR(val.array.elements[49].str.data, "v49");
+    resp_value_free(&val);
+
+    test_send_command(tfd, 2, "CLIENT", "LIST");
+    ASSERT_TRUE(test_read_response(tfd, &val) > 0);
+    char want[96];
+    snprintf(want, sizeof(want), "addr=%s:0 fd=", path);
+    ASSERT_NOT_NULL(strstr(val.str.data, want));
+    ASSERT_NOT_NULL(strstr(val.str.data, "flags=U "));
+    ASSERT_NOT_NULL(strstr(val.str.data, "addr=127.0.0.1:"));
+    resp_value_free(&val);
+
+    close(ufd);
+    close(tfd);
+    ASSERT_TRUE(stop_server(pid));
+    test_port = saved_port;
+    /* removed on shutdown */
+    struct stat st;
+    ASSERT_TRUE(stat(path, &st) < 0 && errno == ENOENT);
+    return 0;
+}
+
+#define RESUME_TEST_VALUE 1000
+#define RESUME_TEST_GETS 300    /* 300 KB of replies: paused, then resumed */
+#define RESUME_TEST_ROUNDS 4
+
+/* Whether the file at path contains needle (files without NULs). */
+static bool file_contains(const char *path, const char *needle) {
+    static char buf[1 << 20];
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        return false;
+    }
+    size_t n = fread(buf, 1, sizeof(buf) - 1, f);
+    fclose(f);
+    buf[n] = '\0';
+    return strstr(buf, needle) != NULL;
+}
+
+/* A paused client's held-back writes reach the AOF before their replies
+   do, even when they run and reply within one finish_client(). */
+static int test_int_aof_resumed_writes(void) {
+    int saved_port = test_port;
+    int port = saved_port + 13;
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/mini-redis-int-%d-resume.aof",
+             (int)getpid());
+    unlink(path);
+    const char *opts[] = {"--appendonly", "yes", "--appendfilename", path,
+                          "--appendfsync", "always",
+                          "--client-output-buffer-limit", "0", "100000",
+                          NULL};
+    pid_t pid = spawn_server_opts(port, opts);
+    test_port = port;
+    int fd = test_connect();
+    ASSERT_TRUE(fd >= 0);
+    resp_value_t val;
+
+    static char value[RESUME_TEST_VALUE + 1];
+    memset(value, 'v', RESUME_TEST_VALUE);
+    test_send_command(fd, 3, "SET", "ar:big", value);
+    ASSERT_TRUE(test_read_response(fd, &val) > 0);
+    resp_value_free(&val);
+
+    /* each round's SET is held back behind its GETs, past the limit */
+    static char pipeline[RESUME_TEST_ROUNDS * (RESUME_TEST_GETS + 1) * 40];
+    size_t len = 0;
+    for (int r = 0; r < RESUME_TEST_ROUNDS; r++) {
+        for (int i = 0; i < RESUME_TEST_GETS; i++) {
+            len += (size_t)snprintf(pipeline + len, sizeof(pipeline) - len,
+                                    "*2\r\n$3\r\nGET\r\n$6\r\nar:big\r\n");
+        }
+        len += (size_t)snprintf(pipeline + len, sizeof(pipeline) - len,
+                                "*3\r\n$3\r\nSET\r\n$5\r\nar:w%d\r\n"
+                                "$1\r\nx\r\n", r);
+    }
+    test_send(fd, pipeline, len);
+
+    static char reply[RESUME_TEST_VALUE + 16];
+    size_t want = 7 + RESUME_TEST_VALUE + 2;     /* "$1000\r\n" ... "\r\n" */
+    for (int r = 0; r < RESUME_TEST_ROUNDS; r++) {
+        for (int i = 0; i < RESUME_TEST_GETS; i++) {
+            ASSERT_TRUE(recv_all(fd, reply, want) == want);
+            ASSERT_TRUE(memcmp(reply, "$1000\r\n", 7) == 0);
+        }
+        ASSERT_TRUE(recv_all(fd, reply, 5) == 5);
+        ASSERT_TRUE(memcmp(reply, "+OK\r\n", 5) == 0);
+        /* acknowledged, so already in the file */
+        char key[16];
+        snprintf(key, sizeof(key), "ar:w%d", r);
+        ASSERT_TRUE(file_contains(path, key));
+    }
+
+    close(fd);
+    ASSERT_TRUE(stop_server(pid));
+    unlink(path);
+    test_port = saved_port;
+    return 0;
+}
+
+/* "keys" from MEMORY STATS, -1 on error */
+static int64_t stats_key_count(int fd) {
+    resp_value_t val;
+    test_send_command(fd, 2, "MEMORY", "STATS");
+    if (test_read_response(fd, &val) <= 0) {
+        return -1;
+    }
+    int64_t keys = -1;
+    if (val.type == RESP_ARRAY && val.array.count == 20) {
+        keys = val.array.elements[17].integer;
+    }
+    resp_value_free(&val);
+    return keys;
+}
+
+static int test_int_active_expire(void) {
+    int fd = test_connect();
+    ASSERT_TRUE(fd >= 0);
+
+    int64_t before = stats_key_count(fd);
+    ASSERT_TRUE(before >= 0);
+
+    resp_value_t val;
+    const char *keys[] = { "active:1", "active:2", "active:3" };
+    for (int i = 0; i < 3; i++) {
+        test_send_command(fd, 5, "SET", keys[i], "val", "EX", "1");
+        ASSERT_TRUE(test_read_response(fd, &val) > 0);
+        resp_value_free(&val);
+    }
+    ASSERT_EQ_INT(stats_key_count(fd), before + 3);
+
+    /* never read again: the server must drop them on its own */
+    usleep(1300000);
+    ASSERT_EQ_INT(stats_key_count(fd), before);
 
     close(fd);
     return 0;
@@ -653,18 +2060,39 @@ test_case_t integration_tests[] = {
     {"test_int_exists",         test_int_exists},
     {"test_int_expire_ttl",     test_int_expire_ttl},
     {"test_int_set_ex",         test_int_set_ex},
+    {"test_int_set_ex_invalid", test_int_set_ex_invalid},
+    {"test_int_active_expire",  test_int_active_expire},
     {"test_int_ttl_no_expiry",  test_int_ttl_no_expiry},
     {"test_int_ttl_no_key",     test_int_ttl_no_key},
     {"test_int_keys_pattern",   test_int_keys_pattern},
+    {"test_int_scan",           test_int_scan},
+    {"test_int_mset_mget",      test_int_mset_mget},
+    {"test_int_msetnx",         test_int_msetnx},
     {"test_int_type",           test_int_type},
     {"test_int_incr_new",       test_int_incr_new},
     {"test_int_incr_existing",  test_int_incr_existing},
     {"test_int_incr_non_integer", test_int_incr_non_integer},
     {"test_int_decr",           test_int_decr},
+    {"test_int_incrby_decrby",  test_int_incrby_decrby},
+    {"test_int_incr_bounds",    test_int_incr_bounds},
     {"test_int_pipeline",       test_int_pipeline},
     {"test_int_concurrent",     test_int_concurrent},
+    {"test_int_io_threads",     test_int_io_threads},
+    {"test_int_shards",         test_int_shards},
+    {"test_int_maxclients",     test_int_maxclients},
+    {"test_int_save_restart",   test_int_save_restart},
+    {"test_int_aof_restart",    test_int_aof_restart},
+    {"test_int_replication",    test_int_replication},
     {"test_int_unknown_cmd",    test_int_unknown_cmd},
     {"test_int_wrong_argc",     test_int_wrong_argc},
+    {"test_int_memory_stats",   test_int_memory_stats},
+    {"test_int_info_slowlog",   test_int_info_slowlog},
+    {"test_int_maxmemory",      test_int_maxmemory},
+    {"test_int_unlink_flushall", test_int_unlink_flushall},
+    {"test_int_client_limits",   test_int_client_limits},
+    {"test_int_unix_socket",     test_int_unix_socket},
+    {"test_int_aof_resumed_writes", test_int_aof_resumed_writes},
+    {"test_int_lowercase_cmd",  test_int_lowercase_cmd},
 };
 int integration_test_count = sizeof(integration_tests) / sizeof(integration_tests[0]);
 
@@ -0,0 +1,72 @@
+#include "test.h"
+#include "io_threads.h"
+#include <pthread.h>
+
+#define JOBS 200
+
+typedef struct {
+    int runs;
+    pthread_t thread;
+} count_job_t;
+
+static void count_job(void *arg) {
+    count_job_t *job = arg;
+    job->runs++;
+    job->thread = pthread_self();
+}
+
+/* Run `rounds` batches of varying size over fresh jobs and check that
+   each job ran once, on thread i % nthreads, with job 0 on the caller. */
+static int check_batches(int nthreads, int rounds) {
+    io_threads_t *io = io_threads_create(nthreads);
+    ASSERT_EQ_INT(io_threads_count(io), nthreads);
+    count_job_t jobs[JOBS];
+    void *ptrs[JOBS];
+
+    for (int r = 0; r < rounds; r++) {
+        size_t n = (size_t)(r * 37) % (JOBS + 1);
+        for (size_t i = 0; i < n; i++) {
+            jobs[i].runs = 0;
+            ptrs[i] = &jobs[i];
+        }
+        io_threads_run(io, count_job, ptrs, n);
+        for (size_t i = 0; i < n; i++) {
+            ASSERT_EQ_INT(jobs[i].runs, 1);
+            size_t first = i % (size_t)nthreads;
+            ASSERT_TRUE(pthread_equal(jobs[i].thread, jobs[first].thread));
+        }
+        if (n > 0) {
+            ASSERT_TRUE(pthread_equal(jobs[0].thread, pthread_self()));
+        }
+        if (n > (size_t)nthreads && nthreads > 1) {
+            ASSERT_FALSE(pthread_equal(jobs[1].thread, pthread_self()));
+        }
+    }
+    io_threads_destroy(io);
+    return 0;
+}
+
+static int test_io_threads_every_job_once(void) {
+    return check_batches(4, 300);
+}
+
+static int test_io_threads_inline(void) {
+    return check_batches(1, 20);
+}
+
+static int test_io_threads_clamped(void) {
+    io_threads_t *io = io_threads_create(0);
+    ASSERT_EQ_INT(io_threads_count(io), 1);
+    io_threads_destroy(io);
+    io = io_threads_create(IO_THREADS_MAX + 1);
+    ASSERT_EQ_INT(io_threads_count(io), IO_THREADS_MAX);
+    io_threads_destroy(io);
+    return 0;
+}
+
+test_case_t io_thread_tests[] = {
+    {"test_io_threads_every_job_once", test_io_threads_every_job_once},
+    {"test_io_threads_inline",         test_io_threads_inline},
+    {"test_io_threads_clamped",        test_io_threads_clamped},
+};
+int io_thread_test_count = sizeof(io_thread_tests) / sizeof(io_thread_tests[0]);
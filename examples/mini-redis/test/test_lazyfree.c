@@ -0,0 +1,166 @@
+#include "test.h"
+#include "hashtable.h"
+#include "lazyfree.h"
+#include "slab.h"
+#include "util.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define BIG_VALUE (64 * 1024)
+
+static rstr_t key_n(char *buf, size_t size, const char *prefix, int i) {
+    rstr_t k = {buf, (size_t)snprintf(buf, size, "%s%d", prefix, i)};
+    return k;
+}
+
+/* Every encoding: inline, block, a big shared value, integers, TTLs. */
+static void fill(hashtable_t *ht, const char *prefix, int n, char *big) {
+    char value[200];
+    memset(value, 'v', sizeof(value));
+    for (int i = 0; i < n; i++) {
+        char buf[32];
+        rstr_t key = key_n(buf, sizeof(buf), prefix, i);
+        bool inserted;
+        switch (i % 4) {
+        case 0:
+            ht_set(ht, key, (rstr_t){value, 8});
+            break;
+        case 1:
+            ht_set(ht, key, (rstr_t){value, sizeof(value)});
+            break;
+        case 2:
+            ht_find_or_insert_int(ht, key, i, &inserted);
+            break;
+        default:
+            ht_set(ht, key, (rstr_t){big, i % 40 == 3 ? BIG_VALUE : 40});
+            break;
+        }
+        if (i % 5 == 0) {
+            ht_set_expire(ht, key, current_time_ms() + 60000);
+        }
+    }
+}
+
+static int test_lazyfree_thread(void) {
+    lazyfree_start();
+    size_t before = lazyfree_freed();
+    for (int i = 0; i < 1000; i++) {
+        lazyfree_free(malloc(i % 2 ? 64 : 1 << 20));
+    }
+    lazyfree_stop();
+    ASSERT_EQ_INT(lazyfree_pending(), 0);
+    ASSERT_EQ_INT(lazyfree_freed() - before, 1000);
+
+    /* stopped: freed inline */
+    lazyfree_free(malloc(64));
+    ASSERT_EQ_INT(lazyfree_freed() - before, 1000);
+    return 0;
+}
+
+/* The big value leaves this thread's books at once. */
+static int test_lazyfree_unlink(void) {
+    lazyfree_start();
+    char *big = malloc(BIG_VALUE);
+    ASSERT_NOT_NULL(big);
+    memset(big, 'b', BIG_VALUE);
+    hashtable_t *ht = ht_create();
+    size_t base = slab_used_bytes();
+    rstr_t key = {"big", 3};
+    ht_set(ht, key, (rstr_t){big, BIG_VALUE});
+    ht_set(ht, (rstr_t){"small", 5}, (rstr_t){"v", 1});
+    ASSERT_TRUE(slab_used_bytes() > base + BIG_VALUE);
+
+    ASSERT_TRUE(ht_unlink(ht, key));
+    ASSERT_FALSE(ht_unlink(ht, key));
+    ASSERT_FALSE(ht_exists(ht, key));
+    ASSERT_TRUE(slab_used_bytes() < base + 1024);
+    ASSERT_TRUE(ht_unlink(ht, (rstr_t){"small", 5}));
+    ASSERT_EQ_INT(ht_count(ht), 0);
+
+    ht_destroy(ht);
+    free(big);
+    lazyfree_stop();
+    return 0;
+}
+
+/* The table is empty and usable at once; the old entries go a slice at
+   a time, including a second flush before the first is done. */
+static int test_lazyfree_clear_async(void) {
+    lazyfree_start();
+    char *big = malloc(BIG_VALUE);
+    ASSERT_NOT_NULL(big);
+    memset(big, 'b', BIG_VALUE);
+    hashtable_t *ht = ht_create();
+    size_t base = slab_used_bytes();
+
+    fill(ht, "a:", 5000, big);
+    ASSERT_EQ_INT(ht_count(ht), 5000);
+    ht_clear_async(ht);
+    ASSERT_EQ_INT(ht_count(ht), 0);
+    ASSERT_TRUE(ht_lazyfree_pending(ht));
+    ASSERT_TRUE(ht_memory_draining(ht) > 0);
+    char buf[32];
+    ASSERT_NULL(ht_find(ht, key_n(buf, sizeof(buf), "a:", 1)));
+    ASSERT_NULL(ht_next_expiring(ht));
+
+    ASSERT_TRUE(ht_lazyfree_step(ht, 100));
+    fill(ht, "b:", 3000, big);
+    ht_clear_async(ht);
+    fill(ht, "c:", 300, big);
+    while (ht_lazyfree_step(ht, 100)) {
+    }
+    ASSERT_EQ_INT(ht_memory_draining(ht), 0);
+    ASSERT_EQ_INT(ht_count(ht), 300);
+    rstr_t v;
+    ASSERT_TRUE(ht_get(ht, key_n(buf, sizeof(buf), "c:", 1), &v));
+    ASSERT_EQ_INT(v.len, 200);
+
+    ht_clear(ht);
+    ASSERT_TRUE(slab_used_bytes() <= base);
+    ht_destroy(ht);
+    free(big);
+    lazyfree_stop();
+    return 0;
+}
+
+static void *abandon_main(void *arg) {
+    char *big = arg;
+    hashtable_t *ht = ht_create();
+    fill(ht, "a:", 4000, big);
+    ht_clear_async(ht);
+    fill(ht, "b:", 4000, big);
+    ht_abandon(ht);
+    slab_release_thread();
+    slab_stats_t st;
+    slab_get_stats(&st);
+    return (void *)(uintptr_t)(st.pages == 0 && st.allocated == 0 &&
+                               st.large_count == 0);
+}
+
+/* A thread that drops its slab frees only the store's malloc memory
+   (a leak here shows up under ASAN or valgrind). */
+static int test_lazyfree_abandon(void) {
+    lazyfree_start();
+    char *big = malloc(BIG_VALUE);
+    ASSERT_NOT_NULL(big);
+    memset(big, 'b', BIG_VALUE);
+    pthread_t t;
+    ASSERT_EQ_INT(pthread_create(&t, NULL, abandon_main, big), 0);
+    void *ok;
+    pthread_join(t, &ok);
+    ASSERT_TRUE(ok != NULL);
+    free(big);
+    lazyfree_stop();
+    ASSERT_EQ_INT(lazyfree_pending(), 0);
+    return 0;
+}
+
+test_case_t lazyfree_tests[] = {
+    {"test_lazyfree_thread",      test_lazyfree_thread},
+    {"test_lazyfree_unlink",      test_lazyfree_unlink},
+    {"test_lazyfree_clear_async", test_lazyfree_clear_async},
+    {"test_lazyfree_abandon",     test_lazyfree_abandon},
+};
+int lazyfree_test_count = sizeof(lazyfree_tests) / sizeof(lazyfree_tests[0]);
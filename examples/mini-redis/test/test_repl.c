@@ -0,0 +1,161 @@
+#include "test.h"
+#include "client.h"
+#include "commands.h"
+#include "hashtable.h"
+#include "repl.h"
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static rstr_t view(const char *s) {
+    rstr_t r = {(char *)s, strlen(s)};
+    return r;
+}
+
+/* Run a command the way the server does and return its reply. */
+static char *run(client_t *c, hashtable_t *ht, int argc, ...) {
+    resp_value_t argv[8];
+    va_list ap;
+    va_start(ap, argc);
+    for (int i = 0; i < argc; i++) {
+        argv[i].type = RESP_BULK_STRING;
+        argv[i].str = view(va_arg(ap, const char *));
+    }
+    va_end(ap);
+    resp_value_t cmd;
+    cmd.type = RESP_ARRAY;
+    cmd.array.elements = argv;
+    cmd.array.count = argc;
+    dispatch_command(c, ht, &cmd);
+    size_t len;
+    char *out = client_take_output(c, &len);
+    out = realloc(out, len + 1);
+    out[len] = '\0';
+    return out;
+}
+
+static bool starts_with(const char *s, const char *prefix) {
+    return strncmp(s, prefix, strlen(prefix)) == 0;
+}
+
+/* A replica attached at the start sees every write, encoded as RESP,
+   even when one iteration records more than the backlog holds; a later
+   one resuming inside the backlog gets exactly the tail. */
+static int test_repl_stream(void) {
+    repl_init(NULL, 0, REPL_MIN_BACKLOG);
+    hashtable_t *ht = ht_create();
+    client_t writer, r1, r2;
+    client_init(&writer);
+    client_init(&r1);
+    client_init(&r2);
+    rstr_t id = {(char *)repl_id(), REPL_ID_LEN};
+
+    ASSERT_FALSE(repl_feeding());
+    repl_attach(&r1, ht, id, view("0"));
+    ASSERT_TRUE(repl_feeding());
+    ASSERT_EQ_INT(r1.replica, 0);
+    size_t len;
+    char *out = client_take_output(&r1, &len);
+    ASSERT_TRUE(len == 11 && memcmp(out, "+CONTINUE\r\n", 11) == 0);
+    free(out);
+
+    /* about five backlogs' worth before the end of the iteration */
+    size_t cap = 128 * 1024, n = 0;
+    char *expected = malloc(cap);
+    char value[1000];
+    memset(value, 'v', sizeof(value) - 1);
+    value[sizeof(value) - 1] = '\0';
+    for (int i = 0; i < 80; i++) {
+        char key[16];
+        snprintf(key, sizeof(key), "key:%d", i);
+        free(run(&writer, ht, 3, "SET", key, value));
+        n += (size_t)snprintf(expected + n, cap - n,
+                              "*3\r\n$3\r\nSET\r\n$%zu\r\n%s\r\n$%zu\r\n%s\r\n",
+                              strlen(key), key, strlen(value), value);
+    }
+    free(run(&writer, ht, 2, "GET", "key:1"));
+    free(run(&writer, ht, 2, "DEL", "key:1"));
+    n += (size_t)snprintf(expected + n, cap - n,
+                          "*2\r\n$3\r\nDEL\r\n$5\r\nkey:1\r\n");
+    repl_flush();
+    ASSERT_EQ_INT(repl_offset(), (int64_t)n);
+    out = client_take_output(&r1, &len);
+    ASSERT_EQ_INT(len, n);
+    ASSERT_TRUE(memcmp(out, expected, n) == 0);
+    free(out);
+    ASSERT_FALSE(repl_replica_lagging(0));
+
+    char from[24];
+    snprintf(from, sizeof(from), "%zu", n - 100);
+    repl_attach(&r2, ht, id, view(from));
+    out = client_take_output(&r2, &len);
+    ASSERT_EQ_INT(len, 11 + 100);
+    ASSERT_TRUE(memcmp(out + 11, expected + n - 100, 100) == 0);
+    free(out);
+
+    /* both follow from here on */
+    free(run(&writer, ht, 3, "SET", "k", "1"));
+    repl_flush();
+    ASSERT_EQ_INT(r1.write_len, r2.write_len);
+    ASSERT_EQ_INT(repl_replica_count(), 2);
+    repl_detach(&r1);
+    ASSERT_EQ_INT(repl_replica_count(), 1);
+    ASSERT_TRUE(repl_replica(0) == &r2);
+    ASSERT_EQ_INT(r2.replica, 0);
+    repl_detach(&r2);
+
+    free(expected);
+    client_close(&writer);
+    client_close(&r1);
+    client_close(&r2);
+    ht_destroy(ht);
+    return 0;
+}
+
+/* On a replica only the link to the primary writes. */
+static int test_repl_readonly_replica(void) {
+    hashtable_t *ht = ht_create();
+    client_t c;
+    client_init(&c);
+
+    ASSERT_EQ_INT(repl_set_primary("127.0.0.1", 1), 0);
+    ASSERT_TRUE(repl_is_replica());
+    /* following a primary, nothing is recorded for replicas of our own */
+    ASSERT_FALSE(repl_feeding());
+    char *reply = run(&c, ht, 3, "SET", "k", "v");
+    ASSERT_TRUE(starts_with(reply, "-READONLY"));
+    free(reply);
+    ASSERT_FALSE(ht_exists(ht, view("k")));
+    reply = run(&c, ht, 2, "GET", "k");
+    ASSERT_EQ_STR(reply, "$-1\r\n");
+    free(reply);
+    reply = run(&c, ht, 1, "ROLE");
+    ASSERT_TRUE(starts_with(reply, "*5\r\n$5\r\nslave\r\n"));
+    free(reply);
+    reply = run(&c, ht, 3, "PSYNC", "?", "-1");
+    ASSERT_TRUE(starts_with(reply, "-ERR chained"));
+    free(reply);
+
+    char old_id[REPL_ID_LEN + 1];
+    memcpy(old_id, repl_id(), sizeof(old_id));
+    reply = run(&c, ht, 3, "REPLICAOF", "no", "one");
+    ASSERT_EQ_STR(reply, "+OK\r\n");
+    free(reply);
+    ASSERT_FALSE(repl_is_replica());
+    /* a new history starts */
+    ASSERT_TRUE(strcmp(old_id, repl_id()) != 0);
+    reply = run(&c, ht, 3, "SET", "k", "v");
+    ASSERT_EQ_STR(reply, "+OK\r\n");
+    free(reply);
+
+    client_close(&c);
+    ht_destroy(ht);
+    return 0;
+}
+
+test_case_t repl_tests[] = {
+    {"test_repl_stream",           test_repl_stream},
+    {"test_repl_readonly_replica", test_repl_readonly_replica},
+};
+int repl_test_count = sizeof(repl_tests) / sizeof(repl_tests[0]);
@@ -1,8 +1,11 @@
 #include "test.h"
 #include "resp.h"
 #include "client.h"
+#include "util.h"
 #include <stdlib.h>
 #include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
 
 static int test_parse_simple_string(void) {
     resp_value_t val;
@@ -165,6 +168,415 @@ static int test_parse_bulk_binary_data(void) {
     return 0;
 }
 
+static int test_parse_long_simple_string(void) {
+    /* stray '\r' bytes on both sides of SIMD block boundaries */
+    char input[1024];
+    input[0] = '+';
+    for (int i = 1; i < 1000; i++) {
+        input[i] = (i % 15 == 0 || i % 31 == 0) ? '\r' : 'a';
+    }
+    memcpy(input + 1000, "\r\n", 2);
+
+    resp_value_t val;
+    int r = resp_parse(input, 1002, &val);
+    ASSERT_EQ_INT(r, 1002);
+    ASSERT_EQ_INT(val.type, RESP_SIMPLE_STRING);
+    ASSERT_EQ_INT(val.str.len, 999);
+    resp_value_free(&val);
+
+    /* same line without the final '\n' is incomplete, not an error */
+    ASSERT_EQ_INT(resp_parse(input, 1001, &val), 0);
+    return 0;
+}
+
+static int test_parse_integer_bounds(void) {
+    resp_value_t val;
+    const char *max = ":9223372036854775807\r\n";
+    ASSERT_TRUE(resp_parse(max, strlen(max), &val) > 0);
+    ASSERT_TRUE(val.integer == INT64_MAX);
+
+    const char *min = ":-9223372036854775808\r\n";
+    ASSERT_TRUE(resp_parse(min, strlen(min), &val) > 0);
+    ASSERT_TRUE(val.integer == INT64_MIN);
+
+    const char *over = ":9223372036854775808\r\n";
+    ASSERT_EQ_INT(resp_parse(over, strlen(over), &val), -1);
+    const char *under = ":-9223372036854775809\r\n";
+    ASSERT_EQ_INT(resp_parse(under, strlen(under), &val), -1);
+    const char *plus = ":+5\r\n";
+    ASSERT_EQ_INT(resp_parse(plus, strlen(plus), &val), -1);
+    const char *minus = ":-\r\n";
+    ASSERT_EQ_INT(resp_parse(minus, strlen(minus), &val), -1);
+    return 0;
+}
+
+static int test_parse_hostile_lengths(void) {
+    resp_value_t val;
+    const char *overflow = "$99999999999999999999999\r\n";
+    ASSERT_EQ_INT(resp_parse(overflow, strlen(overflow), &val), -1);
+
+    const char *too_big = "$536870913\r\n";
+    ASSERT_EQ_INT(resp_parse(too_big, strlen(too_big), &val), -1);
+
+    const char *neg = "$-2\r\n";
+    ASSERT_EQ_INT(resp_parse(neg, strlen(neg), &val), -1);
+
+    const char *count = "*1048577\r\n";
+    ASSERT_EQ_INT(resp_parse(count, strlen(count), &val), -1);
+
+    const char *garbage = "*1x\r\n";
+    ASSERT_EQ_INT(resp_parse(garbage, strlen(garbage), &val), -1);
+    return 0;
+}
+
+static int test_parse_header_without_crlf(void) {
+    resp_value_t val;
+    /* a length header that cannot end within the limit is rejected
+       instead of being buffered forever */
+    const char *endless = "$111111111111111111111111111111";
+    ASSERT_EQ_INT(resp_parse(endless, strlen(endless), &val), -1);
+
+    const char *partial = "$1111";
+    ASSERT_EQ_INT(resp_parse(partial, strlen(partial), &val), 0);
+
+    char line[RESP_MAX_INLINE_LEN + 8];
+    line[0] = '+';
+    memset(line + 1, 'a', sizeof(line) - 1);
+    ASSERT_EQ_INT(resp_parse(line, sizeof(line), &val), -1);
+    return 0;
+}
+
+static int test_parse_large_bulk_skips_payload(void) {
+    size_t n = 1 << 20;
+    char *input = malloc(n + 32);
+    int h = snprintf(input, 32, "$%zu\r\n", n);
+    /* payload full of CRLFs: only the declared length may be used */
+    for (size_t i = 0; i < n; i++) {
+        input[h + i] = (i % 2) ? '\n' : '\r';
+    }
+    memcpy(input + h + n, "\r\n", 2);
+
+    resp_value_t val;
+    int r = resp_parse(input, (size_t)h + n + 2, &val);
+    ASSERT_EQ_INT(r, h + (int)n + 2);
+    ASSERT_EQ_INT(val.str.len, n);
+    resp_value_free(&val);
+
+    ASSERT_EQ_INT(resp_parse(input, (size_t)h + n + 1, &val), 0);
+
+    input[h + n] = 'X';
+    ASSERT_EQ_INT(resp_parse(input, (size_t)h + n + 2, &val), -1);
+    free(input);
+    return 0;
+}
+
+/* Append bytes to a client's read buffer the way the server does. */
+static void feed(client_t *c, const char *data, size_t len) {
+    if (c->read_len + len > c->read_cap) {
+        c->read_cap = c->read_len + len;
+        c->read_buf = realloc(c->read_buf, c->read_cap);
+    }
+    memcpy(c->read_buf + c->read_len, data, len);
+    c->read_len += len;
+}
+
+static void feed_str(client_t *c, const char *data) {
+    feed(c, data, strlen(data));
+}
+
+static int test_parse_deep_nesting(void) {
+    resp_value_t val;
+    size_t depth = 200000;
+    char *buf = malloc(depth * 4);
+    ASSERT_NOT_NULL(buf);
+    for (size_t i = 0; i < depth; i++) {
+        memcpy(buf + i * 4, "*1\r\n", 4);
+    }
+    ASSERT_EQ_INT(resp_parse(buf, depth * 4, &val), -1);
+
+    /* a command element gets the same cap */
+    client_t c;
+    client_init(&c);
+    feed(&c, buf, depth * 4);
+    ASSERT_EQ_INT(resp_parse_client(&c, &val), -1);
+    client_close(&c);
+
+    /* nesting up to the limit still parses */
+    char ok[RESP_MAX_NESTING * 4 + 8];
+    for (int i = 0; i < RESP_MAX_NESTING; i++) {
+        memcpy(ok + i * 4, "*1\r\n", 4);
+    }
+    memcpy(ok + RESP_MAX_NESTING * 4, ":1\r\n", 4);
+    size_t ok_len = RESP_MAX_NESTING * 4 + 4;
+    ASSERT_EQ_INT(resp_parse(ok, ok_len, &val), (int)ok_len);
+    resp_value_free(&val);
+
+    free(buf);
+    return 0;
+}
+
+/* Parsed arguments are views into the read buffer, not C strings. */
+static bool arg_is(resp_value_t *cmd, int i, const char *expected) {
+    rstr_t s = cmd->array.elements[i].str;
+    return s.len == strlen(expected) && memcmp(s.data, expected, s.len) == 0;
+}
+
+static int test_parse_client_byte_by_byte(void) {
+    client_t c;
+    client_init(&c);
+    const char *input = "*3\r\n$3\r\nSET\r\n$3\r\nkey\r\n$5\r\nvalue\r\n";
+    size_t n = strlen(input);
+    resp_value_t val;
+
+    for (size_t i = 0; i + 1 < n; i++) {
+        feed(&c, input + i, 1);
+        ASSERT_EQ_INT(resp_parse_client(&c, &val), 0);
+    }
+    feed(&c, input + n - 1, 1);
+    ASSERT_EQ_INT(resp_parse_client(&c, &val), 1);
+    ASSERT_EQ_INT(c.read_pos, n);
+    ASSERT_EQ_INT(val.type, RESP_ARRAY);
+    ASSERT_EQ_INT(val.array.count, 3);
+    ASSERT_TRUE(arg_is(&val, 0, "SET"));
+    ASSERT_TRUE(arg_is(&val, 2, "value"));
+    resp_command_release(&c, &val);
+    client_close(&c);
+    return 0;
+}
+
+static int test_parse_client_resumes_bulk(void) {
+    client_t c;
+    client_init(&c);
+    resp_value_t val;
+
+    feed_str(&c, "*2\r\n$3\r\nGET\r\n$10\r\nabc");
+    ASSERT_EQ_INT(resp_parse_client(&c, &val), 0);
+    /* header and first element are consumed; only the payload is pending */
+    ASSERT_EQ_INT(c.req_argi, 1);
+    ASSERT_EQ_INT(c.req_bulk_len, 10);
+    size_t pos = c.read_pos;
+
+    feed_str(&c, "defg");
+    ASSERT_EQ_INT(resp_parse_client(&c, &val), 0);
+    ASSERT_EQ_INT(c.read_pos, pos);
+
+    feed_str(&c, "hij\r\n");
+    ASSERT_EQ_INT(resp_parse_client(&c, &val), 1);
+    ASSERT_EQ_INT(val.array.count, 2);
+    ASSERT_TRUE(arg_is(&val, 1, "abcdefghij"));
+    resp_command_release(&c, &val);
+    client_close(&c);
+    return 0;
+}
+
+static int test_parse_client_pipeline(void) {
+    client_t c;
+    client_init(&c);
+    resp_value_t val;
+
+    const char *cmd = "*1\r\n$4\r\nPING\r\n";
+    for (int i = 0; i < 100; i++) {
+        feed_str(&c, cmd);
+    }
+    for (int i = 0; i < 100; i++) {
+        ASSERT_EQ_INT(resp_parse_client(&c, &val), 1);
+        ASSERT_TRUE(arg_is(&val, 0, "PING"));
+        resp_command_release(&c, &val);
+    }
+    ASSERT_EQ_INT(resp_parse_client(&c, &val), 0);
+    ASSERT_EQ_INT(c.read_pos, c.read_len);
+    client_close(&c);
+    return 0;
+}
+
+static int test_parse_client_bad_terminator(void) {
+    client_t c;
+    client_init(&c);
+    resp_value_t val;
+
+    feed_str(&c, "*1\r\n$3\r\nfooXX");
+    ASSERT_EQ_INT(resp_parse_client(&c, &val), -1);
+    ASSERT_EQ_INT(c.req_argc, -1);
+    client_close(&c);
+    return 0;
+}
+
+static int test_parse_client_close_mid_command(void) {
+    client_t c;
+    client_init(&c);
+    resp_value_t val;
+
+    /* partially parsed elements are released by client_close() */
+    feed_str(&c, "*3\r\n$3\r\nSET\r\n$1\r\nk\r\n");
+    ASSERT_EQ_INT(resp_parse_client(&c, &val), 0);
+    ASSERT_EQ_INT(c.req_argi, 2);
+    client_close(&c);
+    ASSERT_NULL(c.req_args);
+    return 0;
+}
+
+static int test_parse_client_args_are_views(void) {
+    client_t c;
+    client_init(&c);
+    resp_value_t val;
+
+    feed_str(&c, "*2\r\n$3\r\nGET\r\n$3\r\nkey\r\n");
+    ASSERT_EQ_INT(resp_parse_client(&c, &val), 1);
+    ASSERT_TRUE(val.array.elements == c.req_args);
+    ASSERT_TRUE(val.array.elements[1].str.data == c.read_buf + 17);
+    resp_command_release(&c, &val);
+
+    /* the argv array is reused for the next command */
+    resp_value_t *argv = c.req_args;
+    feed_str(&c, "*1\r\n$4\r\nPING\r\n");
+    ASSERT_EQ_INT(resp_parse_client(&c, &val), 1);
+    ASSERT_TRUE(val.array.elements == argv);
+    ASSERT_TRUE(arg_is(&val, 0, "PING"));
+    resp_command_release(&c, &val);
+    client_close(&c);
+    return 0;
+}
+
+static int test_parse_client_compact_keeps_partial(void) {
+    client_t c;
+    client_init(&c);
+    resp_value_t val;
+
+    feed_str(&c, "*1\r\n$4\r\nPING\r\n*2\r\n$3\r\nGET\r\n$3\r\nk");
+    ASSERT_EQ_INT(resp_parse_client(&c, &val), 1);
+    resp_command_release(&c, &val);
+    ASSERT_EQ_INT(resp_parse_client(&c, &val), 0);
+
+    /* compaction must keep the already-parsed GET argument */
+    client_compact_read_buf(&c);
+    ASSERT_EQ_INT(c.req_start, 0);
+    ASSERT_TRUE(c.read_buf[0] == '*');
+
+    feed_str(&c, "ey\r\n");
+    ASSERT_EQ_INT(resp_parse_client(&c, &val), 1);
+    ASSERT_TRUE(arg_is(&val, 0, "GET"));
+    ASSERT_TRUE(arg_is(&val, 1, "key"));
+    resp_command_release(&c, &val);
+
+    client_compact_read_buf(&c);
+    ASSERT_EQ_INT(c.read_len, 0);
+    client_close(&c);
+    return 0;
+}
+
+static int test_parse_client_hostile_count(void) {
+    client_t c;
+    client_init(&c);
+    resp_value_t val;
+
+    feed_str(&c, "*2000000000\r\n$3\r\nGET\r\n");
+    ASSERT_EQ_INT(resp_parse_client(&c, &val), -1);
+    ASSERT_NULL(c.req_args);
+
+    client_close(&c);
+    client_init(&c);
+    feed_str(&c, "*1\r\n$99999999999\r\n");
+    ASSERT_EQ_INT(resp_parse_client(&c, &val), -1);
+    client_close(&c);
+    return 0;
+}
+
+/* Concatenate a client's queued output into buf (NUL-terminated). */
+static size_t queued_output(client_t *c, char *buf, size_t cap) {
+    size_t n = 0;
+    size_t off = c->reply_off;
+    for (reply_chunk_t *ch = c->reply_head; ch; ch = ch->next) {
+        const char *data = ch->cap ? ch->data : ch->ref.data;
+        size_t len = ch->len - off;
+        if (n + len >= cap) {
+            len = cap - n - 1;
+        }
+        memcpy(buf + n, data + off, len);
+        n += len;
+        off = 0;
+    }
+    buf[n] = '\0';
+    return n;
+}
+
+static int test_write_integers(void) {
+    client_t c;
+    client_init(&c);
+    char out[256];
+
+    int64_t vals[] = {0, 1, -1, -2, 9, 10, 99, 100, 12345, -987654321,
+                      INT64_MAX, INT64_MIN};
+    for (size_t i = 0; i < sizeof(vals) / sizeof(vals[0]); i++) {
+        resp_write_integer(&c, vals[i]);
+    }
+    queued_output(&c, out, sizeof(out));
+    ASSERT_EQ_STR(out, ":0\r\n:1\r\n:-1\r\n:-2\r\n:9\r\n:10\r\n:99\r\n"
+                       ":100\r\n:12345\r\n:-987654321\r\n"
+                       ":9223372036854775807\r\n:-9223372036854775808\r\n");
+    ASSERT_EQ_INT(c.write_len, strlen(out));
+    client_close(&c);
+    return 0;
+}
+
+static int test_write_shared_and_headers(void) {
+    client_t c;
+    client_init(&c);
+    char out[256];
+
+    resp_write_shared(&c, RESP_SHARED_OK);
+    resp_write_shared(&c, RESP_SHARED_PONG);
+    resp_write_null_bulk_string(&c);
+    resp_write_array_header(&c, 0);
+    resp_write_array_header(&c, 1234);
+    resp_write_bulk_string(&c, "hello", 5);
+    resp_write_bulk_string(&c, "", 0);
+    resp_write_simple_string(&c, "string");
+    resp_write_error(&c, "ERR x");
+    queued_output(&c, out, sizeof(out));
+    ASSERT_EQ_STR(out, "+OK\r\n+PONG\r\n$-1\r\n*0\r\n*1234\r\n"
+                       "$5\r\nhello\r\n$0\r\n\r\n+string\r\n-ERR x\r\n");
+    ASSERT_TRUE(c.reply_head == c.reply_tail);
+    client_close(&c);
+    return 0;
+}
+
+static int test_write_bulk_header_boundaries(void) {
+    client_t c;
+    char out[256];
+    char data[128];
+    memset(data, 'z', sizeof(data));
+
+    /* lengths around the end of the pre-encoded header table */
+    size_t lens[] = {31, 32, 99, 100};
+    for (size_t i = 0; i < sizeof(lens) / sizeof(lens[0]); i++) {
+        client_init(&c);
+        resp_write_bulk_string(&c, data, lens[i]);
+        size_t n = queued_output(&c, out, sizeof(out));
+        char header[16];
+        int h = snprintf(header, sizeof(header), "$%zu\r\n", lens[i]);
+        ASSERT_EQ_INT(n, (size_t)h + lens[i] + 2);
+        ASSERT_TRUE(memcmp(out, header, (size_t)h) == 0);
+        client_close(&c);
+    }
+    return 0;
+}
+
+static int test_u64_digits(void) {
+    ASSERT_EQ_INT(u64_digits(0), 1);
+    ASSERT_EQ_INT(u64_digits(9), 1);
+    ASSERT_EQ_INT(u64_digits(10), 2);
+    ASSERT_EQ_INT(u64_digits(999999999), 9);
+    ASSERT_EQ_INT(u64_digits(1000000000), 10);
+    ASSERT_EQ_INT(u64_digits(UINT64_MAX), 20);
+
+    char buf[24];
+    size_t n = u64_to_str(buf, UINT64_MAX);
+    buf[n] = '\0';
+    ASSERT_EQ_STR(buf, "18446744073709551615");
+    ASSERT_EQ_INT(i64_strlen(INT64_MIN), 20);
+    return 0;
+}
+
 test_case_t resp_tests[] = {
     {"test_parse_simple_string",     test_parse_simple_string},
     {"test_parse_error",             test_parse_error},
@@ -181,5 +593,23 @@ test_case_t resp_tests[] = {
     {"test_parse_incomplete_array",  test_parse_incomplete_array},
     {"test_parse_malformed_prefix",  test_parse_malformed_prefix},
     {"test_parse_bulk_binary_data",  test_parse_bulk_binary_data},
+    {"test_parse_long_simple_string", test_parse_long_simple_string},
+    {"test_parse_integer_bounds",    test_parse_integer_bounds},
+    {"test_parse_hostile_lengths",   test_parse_hostile_lengths},
+    {"test_parse_deep_nesting",      test_parse_deep_nesting},
+    {"test_parse_header_without_crlf", test_parse_header_without_crlf},
+    {"test_parse_large_bulk_skips_payload", test_parse_large_bulk_skips_payload},
+    {"test_parse_client_byte_by_byte", test_parse_client_byte_by_byte},
+    {"test_parse_client_resumes_bulk", test_parse_client_resumes_bulk},
+    {"test_parse_client_pipeline",   test_parse_client_pipeline},
+    {"test_parse_client_bad_terminator", test_parse_client_bad_terminator},
+    {"test_parse_client_close_mid_command", test_parse_client_close_mid_command},
+    {"test_parse_client_args_are_views", test_parse_client_args_are_views},
+    {"test_parse_client_compact_keeps_partial", test_parse_client_compact_keeps_partial},
+    {"test_parse_client_hostile_count", test_parse_client_hostile_count},
+    {"test_write_integers",          test_write_integers},
+    {"test_write_shared_and_headers", test_write_shared_and_headers},
+    {"test_write_bulk_header_boundaries", test_write_bulk_header_boundaries},
+    {"test_u64_digits",              test_u64_digits},
 };
 int resp_test_count = sizeof(resp_tests) / sizeof(resp_tests[0]);
@@ -8,6 +8,30 @@ extern test_case_t glob_tests[];
 extern int glob_test_count;
 extern test_case_t ttl_tests[];
 extern int ttl_test_count;
+extern test_case_t event_tests[];
+extern int event_test_count;
+extern test_case_t client_tests[];
+extern int client_test_count;
+extern test_case_t command_tests[];
+extern int command_test_count;
+extern test_case_t alloc_tests[];
+extern int alloc_test_count;
+extern test_case_t io_thread_tests[];
+extern int io_thread_test_count;
+extern test_case_t shard_tests[];
+extern int shard_test_count;
+extern test_case_t snapshot_tests[];
+extern int snapshot_test_count;
+extern test_case_t aof_tests[];
+extern int aof_test_count;
+extern test_case_t repl_tests[];
+extern int repl_test_count;
+extern test_case_t stats_tests[];
+extern int stats_test_count;
+extern test_case_t evict_tests[];
+extern int evict_test_count;
+extern test_case_t lazyfree_tests[];
+extern int lazyfree_test_count;
 extern int run_integration_tests(void);
 
 int main(void) {
@@ -22,6 +46,30 @@ int main(void) {
                                    glob_tests, glob_test_count);
     total_failed += run_test_suite("TTL/Expiration Tests",
                                    ttl_tests, ttl_test_count);
+    total_failed += run_test_suite("Event Loop Tests",
+                                   event_tests, event_test_count);
+    total_failed += run_test_suite("Client Output Tests",
+                                   client_tests, client_test_count);
+    total_failed += run_test_suite("Command Lookup Tests",
+                                   command_tests, command_test_count);
+    total_failed += run_test_suite("Allocator Tests",
+                                   alloc_tests, alloc_test_count);
+    total_failed += run_test_suite("I/O Thread Tests",
+                                   io_thread_tests, io_thread_test_count);
+    total_failed += run_test_suite("Shard Tests",
+                                   shard_tests, shard_test_count);
+    total_failed += run_test_suite("Snapshot Tests",
+                                   snapshot_tests, snapshot_test_count);
+    total_failed += run_test_suite("AOF Tests",
+                                   aof_tests, aof_test_count);
+    total_failed += run_test_suite("Replication Tests",
+                                   repl_tests, repl_test_count);
+    total_failed += run_test_suite("Stats Tests",
+                                   stats_tests, stats_test_count);
+    total_failed += run_test_suite("Eviction Tests",
+                                   evict_tests, evict_test_count);
+    total_failed += run_test_suite("Lazy Free Tests",
+                                   lazyfree_tests, lazyfree_test_count);
     total_failed += run_integration_tests();
 
     printf("\n");
@@ -0,0 +1,303 @@
+#include "test.h"
+#include "shard.h"
+#include "commands.h"
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+/* Two shards driven by hand on one thread: route from shard 0, let
+   shard 1 execute, then merge on shard 0. */
+typedef struct {
+    shard_group_t *group;
+    hashtable_t *stores[2];
+    client_table_t clients;
+    client_t *c;            /* slot 0 */
+    char *out;
+    size_t out_len;
+} rig_t;
+
+static void rig_init(rig_t *r) {
+    r->group = shard_group_create(2);
+    for (int i = 0; i < 2; i++) {
+        r->stores[i] = ht_create();
+        shard_attach(shard_get(r->group, i), r->stores[i]);
+    }
+    client_table_init(&r->clients);
+    r->c = client_table_acquire(&r->clients);
+    r->out = NULL;
+}
+
+static void rig_free(rig_t *r) {
+    free(r->out);
+    client_table_free(&r->clients);
+    shard_group_destroy(r->group);
+    ht_destroy(r->stores[0]);
+    ht_destroy(r->stores[1]);
+}
+
+static resp_value_t make_cmd(resp_value_t *args, int argc, va_list ap) {
+    for (int i = 0; i < argc; i++) {
+        const char *s = va_arg(ap, const char *);
+        args[i].type = RESP_BULK_STRING;
+        args[i].str.data = (char *)s;
+        args[i].str.len = strlen(s);
+    }
+    resp_value_t cmd;
+    cmd.type = RESP_ARRAY;
+    cmd.array.elements = args;
+    cmd.array.count = argc;
+    return cmd;
+}
+
+/* Route one command of a pipeline for the client on shard 0. */
+static shard_route_t rig_route(rig_t *r, int argc, ...) {
+    resp_value_t args[16];
+    va_list ap;
+    va_start(ap, argc);
+    resp_value_t cmd = make_cmd(args, argc, ap);
+    va_end(ap);
+    client_t *c = r->c;
+    shard_route_t route = shard_route(shard_get(r->group, 0), c, 0, &cmd);
+    if (route == SHARD_LOCAL) {
+        dispatch_command(c, r->stores[0], &cmd);
+    }
+    arena_reset(&c->req_arena);
+    return route;
+}
+
+/* Send the pipeline, let shard 1 execute its part, merge on shard 0 and
+   keep the client's output in r->out. */
+static void rig_finish(rig_t *r) {
+    client_t *c = r->c;
+    shard_t *s0 = shard_get(r->group, 0);
+    shard_flush(s0, c, 0);
+    if (shard_client_waiting(s0, 0)) {
+        int resumed[1];
+        shard_poll(shard_get(r->group, 1), &r->clients, resumed);
+        if (shard_poll(s0, &r->clients, resumed) != 1 || resumed[0] != 0) {
+            fprintf(stderr, "    client was not resumed\n");
+        }
+    }
+    free(r->out);
+    r->out = client_take_output(c, &r->out_len);
+}
+
+/* Run a command to completion and keep its reply in r->out. Returns
+   whether it was routed. */
+static bool rig_run(rig_t *r, int argc, ...) {
+    resp_value_t args[16];
+    va_list ap;
+    va_start(ap, argc);
+    resp_value_t cmd = make_cmd(args, argc, ap);
+    va_end(ap);
+    client_t *c = r->c;
+    shard_route_t route = shard_route(shard_get(r->group, 0), c, 0, &cmd);
+    if (route == SHARD_LOCAL) {
+        dispatch_command(c, r->stores[0], &cmd);
+    }
+    arena_reset(&c->req_arena);
+    rig_finish(r);
+    return route != SHARD_LOCAL;
+}
+
+static bool out_is(const rig_t *r, const char *want) {
+    if (r->out_len != strlen(want) || memcmp(r->out, want, r->out_len) != 0) {
+        fprintf(stderr, "    got \"%.*s\"\n", (int)r->out_len, r->out);
+        return false;
+    }
+    return true;
+}
+
+/* A key owned by shard `t` of r's group, written into buf. */
+static const char *key_on(const rig_t *r, int t, const char *prefix,
+                          char *buf, size_t cap) {
+    for (int i = 0;; i++) {
+        snprintf(buf, cap, "%s%d", prefix, i);
+        rstr_t k = {buf, strlen(buf)};
+        if (shard_of(r->group, k) == t) {
+            return buf;
+        }
+    }
+}
+
+static int test_shard_of_spread(void) {
+    shard_group_t *g = shard_group_create(4);
+    int counts[4] = {0};
+    for (int i = 0; i < 4000; i++) {
+        char key[32];
+        rstr_t k = {key, (size_t)snprintf(key, sizeof(key), "key:%d", i)};
+        int t = shard_of(g, k);
+        ASSERT_TRUE(t >= 0 && t < 4);
+        ASSERT_EQ_INT(shard_of(g, k), t);
+        counts[t]++;
+    }
+    for (int t = 0; t < 4; t++) {
+        ASSERT_TRUE(counts[t] > 800 && counts[t] < 1200);
+    }
+    shard_group_destroy(g);
+    return 0;
+}
+
+static int test_shard_single_key(void) {
+    rig_t r;
+    rig_init(&r);
+    char local[32], remote[32];
+    key_on(&r, 0, "l", local, sizeof(local));
+    key_on(&r, 1, "r", remote, sizeof(remote));
+
+    ASSERT_FALSE(rig_run(&r, 3, "SET", local, "1"));
+    ASSERT_TRUE(rig_run(&r, 3, "SET", remote, "2"));
+    ASSERT_TRUE(out_is(&r, "+OK\r\n"));
+    rstr_t k = {remote, strlen(remote)};
+    ASSERT_NOT_NULL(ht_find(r.stores[1], k));
+    ASSERT_NULL(ht_find(r.stores[0], k));
+
+    ASSERT_TRUE(rig_run(&r, 2, "INCR", remote));
+    ASSERT_TRUE(out_is(&r, ":3\r\n"));
+    /* errors come back as they are */
+    ASSERT_TRUE(rig_run(&r, 3, "INCRBY", remote, "x"));
+    ASSERT_TRUE(out_is(&r, "-ERR value is not an integer or out of range\r\n"));
+    /* invalid commands are left to dispatch_command() */
+    ASSERT_FALSE(rig_run(&r, 1, "GET"));
+    ASSERT_FALSE(rig_run(&r, 2, "NOPE", remote));
+
+    rig_free(&r);
+    return 0;
+}
+
+static int test_shard_multi_key_merge(void) {
+    rig_t r;
+    rig_init(&r);
+    char a[32], b[32], c[32], d[32];
+    key_on(&r, 0, "a", a, sizeof(a));
+    key_on(&r, 1, "b", b, sizeof(b));
+    key_on(&r, 0, "c", c, sizeof(c));
+    key_on(&r, 1, "d", d, sizeof(d));
+
+    ASSERT_TRUE(rig_run(&r, 7, "MSET", a, "1", b, "2", c, "3"));
+    ASSERT_TRUE(out_is(&r, "+OK\r\n"));
+    /* values return in key order, whichever shard holds them */
+    ASSERT_TRUE(rig_run(&r, 5, "MGET", b, a, d, c));
+    ASSERT_TRUE(out_is(&r, "*4\r\n$1\r\n2\r\n$1\r\n1\r\n$-1\r\n$1\r\n3\r\n"));
+    ASSERT_TRUE(rig_run(&r, 5, "EXISTS", a, b, d, b));
+    ASSERT_TRUE(out_is(&r, ":3\r\n"));
+    ASSERT_TRUE(rig_run(&r, 2, "KEYS", "*"));
+    resp_value_t v;
+    ASSERT_EQ_INT(resp_parse(r.out, r.out_len, &v), (int64_t)r.out_len);
+    ASSERT_EQ_INT(v.array.count, 3);
+    resp_value_free(&v);
+
+    /* all-or-nothing across shards is refused */
+    ASSERT_TRUE(rig_run(&r, 5, "MSETNX", a, "9", b, "9"));
+    ASSERT_TRUE(out_is(&r, "-CROSSSLOT Keys in request don't hash to the "
+                       "same shard\r\n"));
+    ASSERT_FALSE(rig_run(&r, 5, "MSETNX", a, "9", c, "9"));
+
+    ASSERT_TRUE(rig_run(&r, 4, "DEL", a, b, d));
+    ASSERT_TRUE(out_is(&r, ":2\r\n"));
+    ASSERT_FALSE(rig_run(&r, 3, "DEL", a, c));
+
+    rig_free(&r);
+    return 0;
+}
+
+static int test_shard_scan_cursor(void) {
+    rig_t r;
+    rig_init(&r);
+    for (int i = 0; i < 100; i++) {
+        char key[32], val[8] = "v";
+        snprintf(key, sizeof(key), "s%d", i);
+        rig_run(&r, 3, "SET", key, val);
+    }
+
+    /* the cursor walks shard 0, then shard 1, and ends at 0 */
+    int seen = 0, calls = 0;
+    char cursor[32] = "0";
+    do {
+        ASSERT_TRUE(rig_run(&r, 4, "SCAN", cursor, "COUNT", "7"));
+        resp_value_t v;
+        ASSERT_TRUE(resp_parse(r.out, r.out_len, &v) > 0);
+        ASSERT_EQ_INT(v.array.count, 2);
+        snprintf(cursor, sizeof(cursor), "%.*s",
+                 (int)v.array.elements[0].str.len,
+                 v.array.elements[0].str.data);
+        seen += v.array.elements[1].array.count;
+        resp_value_free(&v);
+        calls++;
+    } while (strcmp(cursor, "0") != 0 && calls < 1000);
+    ASSERT_EQ_INT(seen, 100);
+
+    ASSERT_TRUE(rig_run(&r, 2, "SCAN", "12x"));
+    ASSERT_TRUE(out_is(&r, "-ERR invalid cursor\r\n"));
+    rig_free(&r);
+    return 0;
+}
+
+static int test_shard_pipeline_batch(void) {
+    rig_t r;
+    rig_init(&r);
+    char local[32], remote[32], other[32];
+    key_on(&r, 0, "l", local, sizeof(local));
+    key_on(&r, 1, "r", remote, sizeof(remote));
+    key_on(&r, 1, "o", other, sizeof(other));
+
+    /* a local command runs where it is until a remote one opens a batch;
+       after that everything joins the batch to keep replies in order */
+    ASSERT_EQ_INT(rig_route(&r, 3, "SET", local, "1"), SHARD_LOCAL);
+    ASSERT_EQ_INT(rig_route(&r, 3, "SET", remote, "2"), SHARD_TAKEN);
+    ASSERT_EQ_INT(rig_route(&r, 2, "INCR", local), SHARD_TAKEN);
+    ASSERT_EQ_INT(rig_route(&r, 1, "PING"), SHARD_TAKEN);
+    ASSERT_EQ_INT(rig_route(&r, 2, "GET", remote), SHARD_TAKEN);
+    ASSERT_EQ_INT(rig_route(&r, 3, "DEL", remote, other), SHARD_TAKEN);
+    ASSERT_EQ_INT(rig_route(&r, 1, "GET"), SHARD_TAKEN);
+    /* spanning shards: wait for the batch */
+    ASSERT_EQ_INT(rig_route(&r, 3, "EXISTS", local, remote), SHARD_DEFER);
+    ASSERT_FALSE(shard_client_waiting(shard_get(r.group, 0), 0));
+    rig_finish(&r);
+    ASSERT_TRUE(out_is(&r, "+OK\r\n+OK\r\n:2\r\n+PONG\r\n$1\r\n2\r\n:1\r\n"
+                       "-ERR wrong number of arguments for 'GET' command\r\n"));
+
+    /* the batch is gone: the deferred command now runs on its own */
+    ASSERT_TRUE(rig_run(&r, 3, "EXISTS", local, remote));
+    ASSERT_TRUE(out_is(&r, ":1\r\n"));
+    rig_free(&r);
+    return 0;
+}
+
+static int test_shard_closed_client(void) {
+    rig_t r;
+    rig_init(&r);
+    char remote[32];
+    key_on(&r, 1, "r", remote, sizeof(remote));
+
+    shard_t *s0 = shard_get(r.group, 0);
+    ASSERT_EQ_INT(rig_route(&r, 2, "GET", remote), SHARD_TAKEN);
+    shard_flush(s0, r.c, 0);
+    ASSERT_TRUE(shard_client_waiting(s0, 0));
+    shard_client_closed(s0, 0);
+    ASSERT_FALSE(shard_client_waiting(s0, 0));
+
+    /* the late reply is dropped, not delivered to the slot */
+    int resumed[1];
+    ASSERT_EQ_INT(shard_poll(shard_get(r.group, 1), &r.clients, resumed), 0);
+    ASSERT_EQ_INT(shard_poll(s0, &r.clients, resumed), 0);
+    ASSERT_EQ_INT(r.c->write_len, 0);
+
+    /* so is a batch closed before it was sent */
+    ASSERT_EQ_INT(rig_route(&r, 2, "GET", remote), SHARD_TAKEN);
+    shard_client_closed(s0, 0);
+    shard_flush(s0, r.c, 0);
+    ASSERT_FALSE(shard_client_waiting(s0, 0));
+    rig_free(&r);
+    return 0;
+}
+
+test_case_t shard_tests[] = {
+    {"test_shard_of_spread",       test_shard_of_spread},
+    {"test_shard_single_key",      test_shard_single_key},
+    {"test_shard_multi_key_merge", test_shard_multi_key_merge},
+    {"test_shard_scan_cursor",     test_shard_scan_cursor},
+    {"test_shard_pipeline_batch",  test_shard_pipeline_batch},
+    {"test_shard_closed_client",   test_shard_closed_client},
+};
+int shard_test_count = sizeof(shard_tests) / sizeof(shard_tests[0]);
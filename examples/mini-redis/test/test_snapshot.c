@@ -0,0 +1,264 @@
+#include "test.h"
+#include "hashtable.h"
+#include "snapshot.h"
+#include "util.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+static char snap_path[64];
+
+static const char *test_path(void) {
+    snprintf(snap_path, sizeof(snap_path), "/tmp/mini-redis-snap-%d.mrdb",
+             (int)getpid());
+    return snap_path;
+}
+
+static rstr_t view(const char *s) {
+    rstr_t r = {(char *)s, strlen(s)};
+    return r;
+}
+
+static void set_numbered(hashtable_t *ht, int from, int to) {
+    char key[32], val[32];
+    for (int i = from; i < to; i++) {
+        rstr_t k = {key, (size_t)snprintf(key, sizeof(key), "key:%d", i)};
+        rstr_t v = {val, (size_t)snprintf(val, sizeof(val), "value-%d", i)};
+        ht_set(ht, k, v);
+    }
+}
+
+static int test_snapshot_round_trip(void) {
+    const char *path = test_path();
+    hashtable_t *ht = ht_create();
+    bool inserted;
+
+    ht_set(ht, view("short"), view("v"));
+    ht_set(ht, view("heap"), view("a value too long to sit in the slot"));
+    size_t big_len = RSTR_SHARED_MIN + 100;
+    char *big = malloc(big_len);
+    ASSERT_NOT_NULL(big);
+    for (size_t i = 0; i < big_len; i++) {
+        big[i] = (char)('a' + i % 26);
+    }
+    rstr_t bigv = {big, big_len};
+    ht_set(ht, view("big"), bigv);
+    rstr_t binary = {"b\0\r\n", 4};
+    ht_set(ht, binary, binary);
+    ht_find_or_insert_int(ht, view("counter"), INT64_MIN, &inserted);
+    ht_entry_t *e = ht_find_or_insert_int(ht, view("a:long:counter:key:name"),
+                                          12345, &inserted);
+    int64_t ttl_at = current_time_ms() + 60000;
+    ht_entry_set_expire(ht, e, ttl_at);
+    ht_set(ht, view("ttl"), view("x"));
+    ht_set_expire(ht, view("ttl"), ttl_at);
+
+    ASSERT_EQ_INT(snapshot_write(ht, path), 0);
+    ht_destroy(ht);
+
+    ht = ht_create();
+    snapshot_load_stats_t st;
+    ASSERT_EQ_INT(snapshot_load(ht, path, NULL, NULL, 1, &st), 0);
+    ASSERT_EQ_INT(st.loaded, 7);
+    ASSERT_EQ_INT(st.expired, 0);
+    ASSERT_EQ_INT(ht_count(ht), 7);
+
+    rstr_t got;
+    ASSERT_TRUE(ht_get(ht, view("short"), &got));
+    ASSERT_EQ_RSTR(got, view("v"));
+    ASSERT_TRUE(ht_get(ht, view("heap"), &got));
+    ASSERT_EQ_RSTR(got, view("a value too long to sit in the slot"));
+    ASSERT_TRUE(ht_get(ht, view("big"), &got));
+    ASSERT_EQ_RSTR(got, bigv);
+    ASSERT_TRUE(ht_get(ht, binary, &got));
+    ASSERT_EQ_RSTR(got, binary);
+    ASSERT_EQ_INT(ht_get_expire(ht, view("short")), -1);
+    ASSERT_EQ_INT(ht_get_expire(ht, view("ttl")), ttl_at);
+
+    /* integers come back integer-encoded, with their TTL */
+    int64_t n;
+    ASSERT_TRUE(ht_entry_int(ht_find(ht, view("counter")), &n));
+    ASSERT_TRUE(n == INT64_MIN);
+    e = ht_find(ht, view("a:long:counter:key:name"));
+    ASSERT_TRUE(ht_entry_int(e, &n));
+    ASSERT_EQ_INT(n, 12345);
+    ASSERT_EQ_INT(ht_entry_expire(e), ttl_at);
+
+    free(big);
+    ht_destroy(ht);
+    unlink(path);
+    return 0;
+}
+
+static int test_snapshot_sized_load(void) {
+    const char *path = test_path();
+    hashtable_t *ht = ht_create();
+    /* several checksum blocks' worth */
+    set_numbered(ht, 0, 10000);
+    ASSERT_EQ_INT(snapshot_write(ht, path), 0);
+    ht_destroy(ht);
+
+    struct stat sb;
+    ASSERT_EQ_INT(stat(path, &sb), 0);
+    ASSERT_TRUE(sb.st_size > 2 * SNAPSHOT_BLOCK);
+
+    /* the smallest table that holds every key, reached in one step */
+    ht = ht_create();
+    snapshot_load_stats_t st;
+    ASSERT_EQ_INT(snapshot_load(ht, path, NULL, NULL, 1, &st), 0);
+    ASSERT_EQ_INT(st.loaded, 10000);
+    ASSERT_FALSE(ht_is_rehashing(ht));
+    ASSERT_EQ_INT(ht_capacity(ht), 16384);
+
+    rstr_t got;
+    ASSERT_TRUE(ht_get(ht, view("key:4321"), &got));
+    ASSERT_EQ_RSTR(got, view("value-4321"));
+
+    ht_destroy(ht);
+    unlink(path);
+    return 0;
+}
+
+/* Data that ends exactly on a checksum block boundary: one value size
+   in the range lands there, and every one must load. */
+static int test_snapshot_block_boundary(void) {
+    const char *path = test_path();
+    static char value[SNAPSHOT_BLOCK];
+    memset(value, 'v', sizeof(value));
+    bool on_boundary = false;
+    for (size_t len = SNAPSHOT_BLOCK - 64; len < SNAPSHOT_BLOCK; len++) {
+        hashtable_t *ht = ht_create();
+        ht_set(ht, view("k"), (rstr_t){value, len});
+        ASSERT_EQ_INT(snapshot_write(ht, path), 0);
+        ht_destroy(ht);
+        struct stat sb;
+        ASSERT_EQ_INT(stat(path, &sb), 0);
+        on_boundary |= sb.st_size - 8 == SNAPSHOT_BLOCK;
+
+        ht = ht_create();
+        snapshot_load_stats_t st;
+        ASSERT_EQ_INT(snapshot_load(ht, path, NULL, NULL, 1, &st), 0);
+        rstr_t got;
+        ASSERT_TRUE(ht_get(ht, view("k"), &got));
+        ASSERT_EQ_INT(got.len, len);
+        ht_destroy(ht);
+    }
+    ASSERT_TRUE(on_boundary);
+    unlink(path);
+    return 0;
+}
+
+static int test_snapshot_drops_expired(void) {
+    const char *path = test_path();
+    hashtable_t *ht = ht_create();
+    set_numbered(ht, 0, 10);
+    ht_set_expire(ht, view("key:3"), current_time_ms() + 20);
+    ht_set_expire(ht, view("key:4"), current_time_ms() + 60000);
+    ASSERT_EQ_INT(snapshot_write(ht, path), 0);
+    ht_destroy(ht);
+
+    usleep(40000);
+    ht = ht_create();
+    snapshot_load_stats_t st;
+    ASSERT_EQ_INT(snapshot_load(ht, path, NULL, NULL, 1, &st), 0);
+    ASSERT_EQ_INT(st.loaded, 9);
+    ASSERT_EQ_INT(st.expired, 1);
+    ASSERT_FALSE(ht_exists(ht, view("key:3")));
+    ASSERT_TRUE(ht_get_expire(ht, view("key:4")) > current_time_ms());
+
+    ht_destroy(ht);
+    unlink(path);
+    return 0;
+}
+
+static bool keep_even(void *ctx, rstr_t key) {
+    int *kept = ctx;
+    bool keep = (key.data[key.len - 1] - '0') % 2 == 0;
+    *kept += keep;
+    return keep;
+}
+
+static int test_snapshot_keep_filter(void) {
+    const char *path = test_path();
+    hashtable_t *ht = ht_create();
+    set_numbered(ht, 0, 100);
+    ASSERT_EQ_INT(snapshot_write(ht, path), 0);
+    ht_destroy(ht);
+
+    ht = ht_create();
+    int kept = 0;
+    snapshot_load_stats_t st;
+    ASSERT_EQ_INT(snapshot_load(ht, path, keep_even, &kept, 2, &st), 0);
+    ASSERT_EQ_INT(kept, 50);
+    ASSERT_EQ_INT(st.loaded, 50);
+    ASSERT_EQ_INT(st.skipped, 50);
+    ASSERT_TRUE(ht_exists(ht, view("key:42")));
+    ASSERT_FALSE(ht_exists(ht, view("key:43")));
+
+    ht_destroy(ht);
+    unlink(path);
+    return 0;
+}
+
+/* Overwrite the byte of the file at off. */
+static void poke(const char *path, off_t off, char byte) {
+    int fd = open(path, O_WRONLY);
+    if (pwrite(fd, &byte, 1, off) != 1) {
+        perror("write");
+    }
+    close(fd);
+}
+
+static int test_snapshot_rejects_bad_files(void) {
+    const char *path = test_path();
+    snapshot_load_stats_t st;
+    hashtable_t *ht = ht_create();
+
+    unlink(path);
+    ASSERT_EQ_INT(snapshot_load(ht, path, NULL, NULL, 1, &st), -1);
+    ASSERT_EQ_INT(errno, ENOENT);
+
+    set_numbered(ht, 0, 100);
+    ASSERT_EQ_INT(snapshot_write(ht, path), 0);
+    struct stat sb;
+    ASSERT_EQ_INT(stat(path, &sb), 0);
+
+    /* a flipped value byte fails the checksum */
+    poke(path, sb.st_size / 2, '#');
+    ASSERT_EQ_INT(snapshot_load(ht, path, NULL, NULL, 1, &st), -2);
+
+    ASSERT_EQ_INT(snapshot_write(ht, path), 0);
+    poke(path, 0, 'X');
+    ASSERT_EQ_INT(snapshot_load(ht, path, NULL, NULL, 1, &st), -2);
+
+    ASSERT_EQ_INT(snapshot_write(ht, path), 0);
+    ASSERT_EQ_INT(truncate(path, sb.st_size - 1), 0);
+    ASSERT_EQ_INT(snapshot_load(ht, path, NULL, NULL, 1, &st), -2);
+    ASSERT_EQ_INT(truncate(path, 0), 0);
+    ASSERT_EQ_INT(snapshot_load(ht, path, NULL, NULL, 1, &st), -2);
+
+    /* the temporary file never outlives a save */
+    char tmp[96];
+    snprintf(tmp, sizeof(tmp), "%s.tmp-%d", path, (int)getpid());
+    ASSERT_TRUE(access(tmp, F_OK) < 0);
+    ASSERT_EQ_INT(snapshot_write(ht, "/nonexistent-dir/dump.mrdb"), -1);
+
+    ht_destroy(ht);
+    unlink(path);
+    return 0;
+}
+
+test_case_t snapshot_tests[] = {
+    {"test_snapshot_round_trip",        test_snapshot_round_trip},
+    {"test_snapshot_sized_load",        test_snapshot_sized_load},
+    {"test_snapshot_block_boundary",    test_snapshot_block_boundary},
+    {"test_snapshot_drops_expired",     test_snapshot_drops_expired},
+    {"test_snapshot_keep_filter",       test_snapshot_keep_filter},
+    {"test_snapshot_rejects_bad_files", test_snapshot_rejects_bad_files},
+};
+int snapshot_test_count = sizeof(snapshot_tests) / sizeof(snapshot_tests[0]);
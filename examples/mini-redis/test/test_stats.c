@@ -0,0 +1,149 @@
+#include "test.h"
+#include "client.h"
+#include "commands.h"
+#include "resp.h"
+#include "stats.h"
+#include <stdlib.h>
+#include <string.h>
+
+static resp_value_t arg(const char *s) {
+    resp_value_t v;
+    v.type = RESP_BULK_STRING;
+    v.str.data = (char *)s;
+    v.str.len = strlen(s);
+    return v;
+}
+
+/* What c was sent, parsed. */
+static int take_reply(client_t *c, resp_value_t *out) {
+    size_t len;
+    char *data = client_take_output(c, &len);
+    int r = resp_parse(data, len, out);
+    free(data);
+    return r == (int)len ? 0 : -1;
+}
+
+/* Every tick count lands in a bucket whose bound is at or above it and
+   within a quarter of it; buckets never go backwards. */
+static int test_stats_hist_buckets(void) {
+    int last = 0;
+    for (uint64_t t = 0; t < (1ULL << 40); t = t < 64 ? t + 1 : t + t / 7) {
+        int b = stats_hist_bucket(t);
+        ASSERT_TRUE(b >= last);
+        ASSERT_TRUE(b < STATS_HIST_BUCKETS);
+        uint64_t max = stats_hist_bucket_max(b);
+        ASSERT_TRUE(max >= t);
+        ASSERT_TRUE(max - t <= t / 4);
+        last = b;
+    }
+    ASSERT_EQ_INT(stats_hist_bucket(UINT64_MAX), STATS_HIST_BUCKETS - 1);
+    return 0;
+}
+
+static int test_stats_record_command(void) {
+    const cmd_stats_t *st = stats_command(CMD_ECHO);
+    uint64_t calls = st->calls, processed = stats_commands_processed();
+    resp_value_t argv[2] = {arg("ECHO"), arg("x")};
+    /* 99 fast calls and one a million times slower */
+    for (int i = 0; i < 99; i++) {
+        stats_record_command(CMD_ECHO, 100, argv, 2);
+    }
+    stats_record_command(CMD_ECHO, 100000000, argv, 2);
+    ASSERT_EQ_INT(st->calls, calls + 100);
+    ASSERT_EQ_INT(stats_commands_processed(), processed + 100);
+
+    if (calls == 0) {
+        double fast = stats_ticks_to_us(100);
+        double p50 = stats_percentile_us(st, 0.5);
+        ASSERT_TRUE(p50 >= fast && p50 <= fast * 1.25);
+        ASSERT_TRUE(stats_percentile_us(st, 0.999) >=
+                    stats_ticks_to_us(100000000));
+    }
+
+    info_buf_t b = {NULL, 0, 0};
+    info_section(&b, "Commandstats");
+    stats_info_commandstats(&b);
+    ASSERT_TRUE(strncmp(b.data, "# Commandstats\r\n", 16) == 0);
+    ASSERT_NOT_NULL(strstr(b.data, "\r\ncmdstat_echo:calls="));
+    free(b.data);
+    return 0;
+}
+
+/* Long arguments and long commands are cut; the ring keeps the newest. */
+static int test_stats_slowlog(void) {
+    stats_slowlog_config(0, 2);
+    client_t c;
+    client_init(&c);
+
+    char big[300];
+    memset(big, 'b', sizeof(big) - 1);
+    big[sizeof(big) - 1] = '\0';
+    resp_value_t argv[40];
+    argv[0] = arg("MSET");
+    for (int i = 1; i < 40; i++) {
+        argv[i] = arg(i == 1 ? big : "v");
+    }
+    stats_record_command(CMD_MSET, 1, argv, 40);
+    resp_value_t get[2] = {arg("GET"), arg("k")};
+    stats_record_command(CMD_GET, 1, get, 2);
+    stats_record_command(CMD_GET, 1, get, 2);
+    ASSERT_EQ_INT(stats_slowlog_len(), 2);
+
+    stats_slowlog_reset();
+    stats_record_command(CMD_MSET, 1, argv, 40);
+    stats_write_slowlog(&c, -1);
+    resp_value_t v;
+    ASSERT_EQ_INT(take_reply(&c, &v), 0);
+    ASSERT_EQ_INT(v.array.count, 1);
+    resp_value_t *e = &v.array.elements[0];
+    ASSERT_EQ_INT(e->array.count, 4);
+    resp_value_t *args = &e->array.elements[3];
+    ASSERT_EQ_INT(args->array.count, SLOWLOG_MAX_ARGS);
+    ASSERT_EQ_STR(args->array.elements[0].str.data, "MSET");
+    ASSERT_TRUE(strncmp(args->array.elements[1].str.data, big,
+                        SLOWLOG_MAX_ARG_LEN) == 0);
+    ASSERT_EQ_STR(args->array.elements[1].str.data + SLOWLOG_MAX_ARG_LEN,
+                  "... (171 more bytes)");
+    ASSERT_EQ_STR(args->array.elements[SLOWLOG_MAX_ARGS - 1].str.data,
+                  "... (9 more arguments)");
+    resp_value_free(&v);
+
+    client_close(&c);
+    stats_slowlog_config(SLOWLOG_DEFAULT_SLOWER_THAN, SLOWLOG_DEFAULT_MAX_LEN);
+    return 0;
+}
+
+static int test_stats_latency_histogram(void) {
+    resp_value_t argv[1] = {arg("LASTSAVE")};
+    uint64_t calls = stats_command(CMD_LASTSAVE)->calls;
+    stats_record_command(CMD_LASTSAVE, 10, argv, 1);
+    stats_record_command(CMD_LASTSAVE, 10, argv, 1);
+
+    client_t c;
+    client_init(&c);
+    resp_value_t names[2] = {arg("lastsave"), arg("nosuchcommand")};
+    stats_write_latency_histogram(&c, names, 2);
+    resp_value_t v;
+    ASSERT_EQ_INT(take_reply(&c, &v), 0);
+    ASSERT_EQ_INT(v.array.count, 2);
+    ASSERT_EQ_STR(v.array.elements[0].str.data, "lastsave");
+    resp_value_t *h = &v.array.elements[1];
+    ASSERT_EQ_INT(h->array.count, 4);
+    ASSERT_EQ_INT(h->array.elements[1].integer, calls + 2);
+    /* cumulative: the last bucket counts every call */
+    resp_value_t *buckets = &h->array.elements[3];
+    ASSERT_TRUE(buckets->array.count >= 2);
+    ASSERT_EQ_INT(buckets->array.elements[buckets->array.count - 1].integer,
+                  calls + 2);
+    resp_value_free(&v);
+    client_close(&c);
+    return 0;
+}
+
+test_case_t stats_tests[] = {
+    {"test_stats_hist_buckets",      test_stats_hist_buckets},
+    {"test_stats_record_command",    test_stats_record_command},
+    {"test_stats_slowlog",           test_stats_slowlog},
+    {"test_stats_latency_histogram", test_stats_latency_histogram},
+};
+int stats_test_count = sizeof(stats_tests) / sizeof(stats_tests[0]);
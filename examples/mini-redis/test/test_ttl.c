@@ -1,6 +1,7 @@
 #include "test.h"
 #include "hashtable.h"
 #include "util.h"
+#include <stdio.h>
 #include <unistd.h>
 
 static int test_ttl_set_and_check(void) {
@@ -29,7 +30,7 @@ static int test_ttl_not_expired_yet(void) {
     ht_set(ht, key, val);
     ht_set_expire(ht, key, current_time_ms() + 10000);
 
-    ASSERT_NOT_NULL(ht_get(ht, key));
+    ASSERT_TRUE(ht_get(ht, key, NULL));
 
     rstr_free(&key);
     rstr_free(&val);
@@ -46,7 +47,7 @@ static int test_ttl_expired(void) {
     ht_set_expire(ht, key, current_time_ms() + 1);
     usleep(10000); /* 10ms, well past 1ms expiry */
 
-    ASSERT_NULL(ht_get(ht, key));
+    ASSERT_FALSE(ht_get(ht, key, NULL));
 
     rstr_free(&key);
     rstr_free(&val);
@@ -63,7 +64,7 @@ static int test_ttl_delete_removes_expiry(void) {
     ht_set_expire(ht, key, current_time_ms() + 10000);
     ht_delete(ht, key);
 
-    ASSERT_NULL(ht_get(ht, key));
+    ASSERT_FALSE(ht_get(ht, key, NULL));
     ASSERT_FALSE(ht_exists(ht, key));
 
     rstr_free(&key);
@@ -104,7 +105,7 @@ static int test_ttl_expire_makes_tombstone(void) {
     usleep(10000);
 
     /* Access triggers lazy expiration */
-    ASSERT_NULL(ht_get(ht, key));
+    ASSERT_FALSE(ht_get(ht, key, NULL));
     ASSERT_EQ_INT(ht_count(ht), 0);
 
     rstr_free(&key);
@@ -113,6 +114,101 @@ static int test_ttl_expire_makes_tombstone(void) {
     return 0;
 }
 
+static int test_ttl_active_expire(void) {
+    hashtable_t *ht = ht_create();
+    int64_t now = current_time_ms();
+    char buf[16];
+
+    /* enough keys to be mid-rehash, so both tables get expired */
+    for (int i = 0; i < 115; i++) {
+        int n = snprintf(buf, sizeof(buf), "key:%d", i);
+        rstr_t key = { buf, (size_t)n };
+        ht_set(ht, key, key);
+        ht_set_expire(ht, key, i % 2 ? now - 1 : now + 100000);
+    }
+    ASSERT_TRUE(ht_is_rehashing(ht));
+    ASSERT_EQ_INT(ht_next_expire(ht), now - 1);
+
+    /* nothing reads the keys: only the cycle can remove them */
+    ASSERT_EQ_INT(ht_expire_cycle(ht, 1000000), 57);
+    ASSERT_EQ_INT(ht_count(ht), 58);
+    ASSERT_EQ_INT(ht_next_expire(ht), now + 100000);
+    ASSERT_EQ_INT(ht_expire_cycle(ht, 1000000), 0);
+
+    rstr_t k0 = { "key:0", 5 };
+    rstr_t k1 = { "key:1", 5 };
+    ASSERT_TRUE(ht_get(ht, k0, NULL));
+    ASSERT_FALSE(ht_get(ht, k1, NULL));
+
+    ht_destroy(ht);
+    return 0;
+}
+
+static int test_ttl_expire_index_stale(void) {
+    hashtable_t *ht = ht_create();
+    rstr_t a = rstr_create("a", 1);
+    rstr_t b = rstr_create("b", 1);
+    rstr_t c = rstr_create("c", 1);
+    /* hold the clock so the keys stay live while their TTLs change */
+    int64_t now = clock_refresh();
+
+    /* a: TTL cleared by overwrite; b: TTL moved later; c: deleted */
+    ht_set(ht, a, a);
+    ht_set_expire(ht, a, now + 1);
+    ht_set(ht, a, b);
+    ht_set(ht, b, b);
+    ht_set_expire(ht, b, now + 1);
+    ht_set_expire(ht, b, now + 100000);
+    ht_set(ht, c, c);
+    ht_set_expire(ht, c, now + 1);
+    ht_delete(ht, c);
+
+    usleep(10000);
+    clock_refresh();
+    ASSERT_TRUE(ht_next_expire(ht) <= clock_ms());
+    ASSERT_EQ_INT(ht_expire_cycle(ht, 1000000), 0);
+    ASSERT_EQ_INT(ht_count(ht), 2);
+    ASSERT_EQ_INT(ht_get_expire(ht, a), -1);
+    ASSERT_EQ_INT(ht_next_expire(ht), now + 100000);
+
+    /* refreshing one TTL over and over keeps the index bounded */
+    for (int i = 0; i < 10000; i++) {
+        ht_set_expire(ht, b, now + 100000 + i);
+    }
+    ASSERT_TRUE(ht->expiry_len < 1000);
+
+    clock_uncache();
+    rstr_free(&a);
+    rstr_free(&b);
+    rstr_free(&c);
+    ht_destroy(ht);
+    return 0;
+}
+
+static int test_ttl_cached_clock(void) {
+    hashtable_t *ht = ht_create();
+    rstr_t key = rstr_create("k", 1);
+
+    int64_t now = clock_refresh();
+    ht_set(ht, key, key);
+    ht_set_expire(ht, key, now + 1);
+    usleep(10000);
+
+    /* the loop's clock has not moved, so neither has the key */
+    ASSERT_EQ_INT(clock_ms(), now);
+    ASSERT_TRUE(ht_get(ht, key, NULL));
+    ASSERT_EQ_INT(ht_expire_cycle(ht, 1000000), 0);
+
+    clock_refresh();
+    ASSERT_EQ_INT(ht_expire_cycle(ht, 1000000), 1);
+    ASSERT_EQ_INT(ht_count(ht), 0);
+
+    clock_uncache();
+    rstr_free(&key);
+    ht_destroy(ht);
+    return 0;
+}
+
 static int test_ttl_no_expiry_by_default(void) {
     hashtable_t *ht = ht_create();
     rstr_t key = rstr_create("k", 1);
@@ -135,5 +231,8 @@ test_case_t ttl_tests[] = {
     {"test_ttl_overwrite_resets",    test_ttl_overwrite_resets},
     {"test_ttl_expire_makes_tombstone", test_ttl_expire_makes_tombstone},
     {"test_ttl_no_expiry_by_default", test_ttl_no_expiry_by_default},
+    {"test_ttl_active_expire",       test_ttl_active_expire},
+    {"test_ttl_expire_index_stale",  test_ttl_expire_index_stale},
+    {"test_ttl_cached_clock",        test_ttl_cached_clock},
 };
 int ttl_test_count = sizeof(ttl_tests) / sizeof(ttl_tests[0]);